@@ -34,6 +34,9 @@ Alertracker::Alertracker(GlobalRegistry *in_globalreg) {
 	globalreg = in_globalreg;
 	next_alert_id = 0;
 
+	pthread_mutex_init(&alert_mutex, NULL);
+	main_thread = pthread_self();
+
 	if (globalreg->kismet_config == NULL) {
 		fprintf(stderr, "FATAL OOPS:  Alertracker called with null config\n");
 		exit(1);
@@ -61,6 +64,10 @@ Alertracker::Alertracker(GlobalRegistry *in_globalreg) {
 		num_backlog = scantmp;
 	}
 
+	// Alerts raised by the dissector threads are sent from the main loop
+	if (globalreg->reactor != NULL)
+		globalreg->reactor->AddWakeupHandler(this);
+
 	// Register the alert component
 	_PCM(PACK_COMP_ALERT) =
 		globalreg->packetchain->RegisterPacketComponent("alert");
@@ -80,9 +87,17 @@ Alertracker::Alertracker(GlobalRegistry *in_globalreg) {
 }
 
 Alertracker::~Alertracker() {
+	if (globalreg->reactor != NULL)
+		globalreg->reactor->RemoveWakeupHandler(this);
+
 	for (map<int, alert_rec *>::iterator x = alert_ref_map.begin();
 		 x != alert_ref_map.end(); ++x)
 		delete x->second;
+
+	for (unsigned int x = 0; x < send_queue.size(); x++)
+		delete send_queue[x];
+
+	pthread_mutex_destroy(&alert_mutex);
 }
 
 int Alertracker::RegisterAlert(const char *in_header, alert_time_unit in_unit, 
@@ -90,6 +105,8 @@ int Alertracker::RegisterAlert(const char *in_header, alert_time_unit in_unit,
 							   int in_burst, int in_phy) {
 	char err[1024];
 
+	local_locker lock(&alert_mutex);
+
 	// Bail if this header is registered
 	if (alert_name_map.find(in_header) != alert_name_map.end()) {
 		snprintf(err, 1024, "RegisterAlert() header already registered '%s'",
@@ -125,6 +142,8 @@ int Alertracker::RegisterAlert(const char *in_header, alert_time_unit in_unit,
 }
 
 	int Alertracker::FetchAlertRef(string in_header) {
+		local_locker lock(&alert_mutex);
+
 		if (alert_name_map.find(in_header) != alert_name_map.end())
 			return alert_name_map[in_header];
 
@@ -162,6 +181,8 @@ int Alertracker::CheckTimes(alert_rec *arec) {
 }
 
 int Alertracker::PotentialAlert(int in_ref) {
+	local_locker lock(&alert_mutex);
+
 	map<int, alert_rec *>::iterator aritr = alert_ref_map.find(in_ref);
 
 	if (aritr == alert_ref_map.end())
@@ -175,15 +196,27 @@ int Alertracker::PotentialAlert(int in_ref) {
 int Alertracker::RaiseAlert(int in_ref, kis_packet *in_pack,
 							mac_addr bssid, mac_addr source, mac_addr dest, 
 							mac_addr other, string in_channel, string in_text) {
+	// Off the main thread the alert is queued and sent by the main loop, 
+	// which also keeps the backlog
+	bool queue = globalreg->reactor != NULL &&
+		!pthread_equal(pthread_self(), main_thread);
+	bool wake = false;
+
+	pthread_mutex_lock(&alert_mutex);
+
 	map<int, alert_rec *>::iterator aritr = alert_ref_map.find(in_ref);
 
-	if (aritr == alert_ref_map.end())
+	if (aritr == alert_ref_map.end()) {
+		pthread_mutex_unlock(&alert_mutex);
 		return -1;
+	}
 
 	alert_rec *arec = aritr->second;
 
-	if (CheckTimes(arec) != 1)
+	if (CheckTimes(arec) != 1) {
+		pthread_mutex_unlock(&alert_mutex);
 		return 0;
+	}
 
 	kis_alert_info *info = new kis_alert_info;
 
@@ -205,10 +238,17 @@ int Alertracker::RaiseAlert(int in_ref, kis_packet *in_pack,
 	arec->total_sent++;
 	arec->time_last = time(0);
 
-	alert_backlog.push_back(info);
-	if ((int) alert_backlog.size() > num_backlog) {
-		delete alert_backlog[0];
-		alert_backlog.erase(alert_backlog.begin());
+	if (queue) {
+		send_queue.push_back(info);
+
+		// Anything already queued has a wakeup pending
+		wake = (send_queue.size() == 1);
+	} else {
+		alert_backlog.push_back(info);
+		if ((int) alert_backlog.size() > num_backlog) {
+			delete alert_backlog[0];
+			alert_backlog.erase(alert_backlog.begin());
+		}
 	}
 
 	// Try to get the existing alert info
@@ -222,18 +262,58 @@ int Alertracker::RaiseAlert(int in_ref, kis_packet *in_pack,
 			in_pack->insert(_PCM(PACK_COMP_ALERT), acomp);
 		}
 
-		// Attach it to the packet
-		acomp->alert_vec.push_back(info);
+		// Attach it to the packet; a queued alert may be out of the backlog
+		// before the packet is logged, so the packet gets its own copy
+		if (queue) {
+			kis_alert_info *pinfo = new kis_alert_info(*info);
+			acomp->alert_vec.push_back(pinfo);
+			acomp->owned_vec.push_back(pinfo);
+		} else {
+			acomp->alert_vec.push_back(info);
+		}
+	}
+
+	pthread_mutex_unlock(&alert_mutex);
+
+	if (queue) {
+		if (wake)
+			globalreg->reactor->Wakeup();
+	} else {
+		SendAlert(info);
 	}
 
+	return 1;
+}
+
+void Alertracker::SendAlert(kis_alert_info *info) {
 	// Send it to the network as an alert
 	globalreg->kisnetserver->SendToAll(_NPM(PROTO_REF_ALERT), (void *) info);
 
 	// Send the text info
 	globalreg->messagebus->InjectMessage((info->header + " " + info->text), 
 										 MSGFLAG_ALERT);
+}
 
-	return 1;
+void Alertracker::ReactorEvent(int in_fd __attribute__((unused)),
+							   unsigned int in_events __attribute__((unused))) {
+	vector<kis_alert_info *> queued;
+
+	{
+		local_locker lock(&alert_mutex);
+		queued.swap(send_queue);
+	}
+
+	for (unsigned int x = 0; x < queued.size(); x++) {
+		SendAlert(queued[x]);
+
+		local_locker lock(&alert_mutex);
+
+		alert_backlog.push_back(queued[x]);
+		if ((int) alert_backlog.size() > num_backlog) {
+			delete alert_backlog[0];
+			alert_backlog.erase(alert_backlog.begin());
+		}
+	}
 }
 
 void Alertracker::BlitBacklogged(int in_fd) {
@@ -29,11 +29,14 @@
 #include <algorithm>
 #include <string>
 
+#include <pthread.h>
+
 #include "globalregistry.h"
 #include "messagebus.h"
 #include "packetchain.h"
 #include "timetracker.h"
 #include "kis_netframe.h"
+#include "kis_reactor.h"
 
 class kis_alert_info : public packet_component {
 public:
@@ -66,7 +69,16 @@ public:
 		self_destruct = 1;
 	}
 
+	~kis_alert_component() {
+		for (unsigned int x = 0; x < owned_vec.size(); x++)
+			delete owned_vec[x];
+	}
+
 	vector<kis_alert_info *> alert_vec;
+
+	// Alerts raised off the main thread are attached as copies, since the
+	// backlog may discard the original before the packet is logged
+	vector<kis_alert_info *> owned_vec;
 };
 
 static const int alert_time_unit_conv[] = {
@@ -77,7 +89,10 @@ enum alert_time_unit {
     sat_second, sat_minute, sat_hour, sat_day
 };
 
-class Alertracker {
+// Alerts may be raised by packet handlers running on the dissector threads;
+// the alert records and backlog are locked, and alerts raised off the main
+// thread are sent to clients and the messagebus by the main loop
+class Alertracker : public ReactorEventHandler {
 public:
     // A registered alert type
     struct alert_rec {
@@ -153,6 +168,9 @@ public:
 
 	const vector<kis_alert_info *> *FetchBacklog();
 
+	// Send alerts raised by other threads
+	virtual void ReactorEvent(int in_fd, unsigned int in_events);
+
 protected:
     // Check and age times
     int CheckTimes(alert_rec *arec);
@@ -160,8 +178,19 @@ protected:
 	// Parse a foo/bar rate/unit option
 	int ParseRateUnit(string in_ru, alert_time_unit *ret_unit, int *ret_rate);
 
+	// Send an alert to the network clients and the messagebus
+	void SendAlert(kis_alert_info *info);
+
     GlobalRegistry *globalreg;
 
+	// Protects the alert records, backlog, and send queue
+	pthread_mutex_t alert_mutex;
+
+	pthread_t main_thread;
+
+	// Alerts raised off the main thread, waiting to be sent
+	vector<kis_alert_info *> send_queue;
+
     int next_alert_id;
 
     map<string, int> alert_name_map;
@@ -0,0 +1,136 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+// Capture protocol checksum benchmark
+//
+// Times Adler32Checksum and Crc32cChecksum over frame-sized buffers and
+// prints the best throughput of each.  Crc32cChecksum uses whichever
+// implementation this CPU gets; the output says which.  Build with
+// 'make benchmarks'.
+//
+// bench_checksum [frame size] [megabytes]
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench_util.h"
+#include "util.h"
+
+typedef struct {
+    uint32_t (*sumfn)(const char *, size_t);
+    const char *buf;
+    size_t frame_sz;
+    size_t nframes;
+    uint32_t check;
+} bench_sum_run;
+
+// One pass over every frame; the sum of the checksums goes to check so none
+// of the work can be thrown away
+static double bench_sum_pass(void *auxdata) {
+    bench_sum_run *run = (bench_sum_run *) auxdata;
+    uint32_t sum = 0;
+
+    double start = bench_now();
+
+    // Slide through the buffer so every frame starts somewhere new
+    for (size_t f = 0; f < run->nframes; f++)
+        sum += (*run->sumfn)(run->buf + (f & 63), run->frame_sz);
+
+    double elapsed = bench_now() - start;
+
+    run->check = sum;
+
+    return elapsed;
+}
+
+// Best MB/s
+static double bench_sum(uint32_t (*sumfn)(const char *, size_t),
+        const char *buf, size_t frame_sz, size_t nframes, uint32_t *check) {
+    bench_sum_run run;
+
+    run.sumfn = sumfn;
+    run.buf = buf;
+    run.frame_sz = frame_sz;
+    run.nframes = nframes;
+
+    double best = bench_best(bench_sum_pass, &run);
+
+    *check = run.check;
+
+    return (nframes * frame_sz) / 1048576.0 / best;
+}
+
+static uint32_t bench_adler32(const char *buf, size_t len) {
+    return Adler32Checksum(buf, (int) len);
+}
+
+static uint32_t bench_crc32c(const char *buf, size_t len) {
+    return Crc32cChecksum(buf, len);
+}
+
+int main(int argc, char *argv[]) {
+    size_t frame_sz = 8192;
+    size_t total_mb = 1024;
+
+    if (argc > 1)
+        frame_sz = strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+        total_mb = strtoul(argv[2], NULL, 10);
+
+    if (frame_sz == 0 || total_mb == 0) {
+        fprintf(stderr, "usage: %s [frame size] [megabytes]\n", argv[0]);
+        return 1;
+    }
+
+    // The standard CRC32C check value
+    if (Crc32cChecksum("123456789", 9) != 0xE3069283) {
+        fprintf(stderr, "Crc32cChecksum gave %08x for the check string, "
+                "expected e3069283\n", Crc32cChecksum("123456789", 9));
+        return 1;
+    }
+
+    char *buf = new char[frame_sz + 64];
+    uint64_t seed = 1;
+
+    for (size_t x = 0; x < frame_sz + 64; x++)
+        buf[x] = (char) (bench_rand(&seed) >> 40);
+
+    size_t nframes = total_mb * 1048576 / frame_sz;
+
+    if (nframes == 0)
+        nframes = 1;
+
+    uint32_t adler_check, crc_check;
+
+    double adler = bench_sum(bench_adler32, buf, frame_sz, nframes, &adler_check);
+    double crc = bench_sum(bench_crc32c, buf, frame_sz, nframes, &crc_check);
+
+    printf("%lu frames of %lu bytes, best of %u\n",
+            (unsigned long) nframes, (unsigned long) frame_sz, BENCH_RUNS);
+    printf("  Adler32Checksum           %8.1f MB/s  (check %08x)\n",
+            adler, adler_check);
+    printf("  Crc32cChecksum (%s) %8.1f MB/s  (check %08x)  %.1fx\n",
+            Crc32cHardware() ? "hardware" : "table   ", crc, crc_check,
+            crc / adler);
+
+    delete[] buf;
+
+    return 0;
+}
@@ -0,0 +1,246 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+// Devicetracker packet path benchmark
+//
+// Runs synthetic packets through Devicetracker::UpdateCommonDevice the way a
+// phy handler does, and through the device counters alone, and prints the
+// best cost per packet.  Build with 'make benchmarks'; run it from two
+// checkouts to compare a change.
+//
+// bench_devicetracker [devices] [packets]
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench_util.h"
+#include "globalregistry.h"
+#include "messagebus.h"
+#include "configfile.h"
+#include "timetracker.h"
+#include "entrytracker.h"
+#include "packetchain.h"
+#include "packet.h"
+#include "devicetracker.h"
+#include "phyhandler.h"
+
+class Bench_Phy_Handler : public Kis_Phy_Handler {
+public:
+    Bench_Phy_Handler(GlobalRegistry *in_globalreg) :
+        Kis_Phy_Handler(in_globalreg) {
+        phyname = "BENCH";
+    }
+
+    Bench_Phy_Handler(GlobalRegistry *in_globalreg, Devicetracker *in_tracker,
+            int in_phyid) : Kis_Phy_Handler(in_globalreg, in_tracker, in_phyid) {
+        phyname = "BENCH";
+    }
+
+    virtual Kis_Phy_Handler *CreatePhyHandler(GlobalRegistry *in_globalreg,
+            Devicetracker *in_tracker, int in_phyid) {
+        return new Bench_Phy_Handler(in_globalreg, in_tracker, in_phyid);
+    }
+
+    virtual void ExportLogRecord(kis_tracked_device_base *in_device,
+            string in_logtype, FILE *in_logfile, int in_lineindent) { }
+};
+
+// A small pool of packets of each type the common tracker distinguishes
+static void bench_build_packets(GlobalRegistry *globalreg,
+        vector<kis_packet *> *packets) {
+    int pack_comp_common =
+        globalreg->packetchain->RegisterPacketComponent("COMMON");
+    int pack_comp_radiodata =
+        globalreg->packetchain->RegisterPacketComponent("RADIODATA");
+
+    uint64_t seed = 1;
+
+    for (unsigned int p = 0; p < 64; p++) {
+        kis_packet *pack = new kis_packet(globalreg);
+
+        pack->ts = globalreg->timestamp;
+
+        kis_common_info *common = new kis_common_info;
+
+        switch (p % 3) {
+            case 0:
+                common->type = packet_basic_data;
+                common->datasize = bench_rand(&seed) % 1500;
+                break;
+            case 1:
+                common->type = packet_basic_mgmt;
+                break;
+            default:
+                common->type = packet_basic_phy;
+                common->error = 1;
+                break;
+        }
+
+        kis_layer1_packinfo *l1 = new kis_layer1_packinfo;
+
+        l1->freq_khz = 2412000 + 25000 * (bench_rand(&seed) % 3);
+        l1->signal_type = kis_l1_signal_type_dbm;
+        l1->signal_dbm = -30 - (int) (bench_rand(&seed) % 60);
+        l1->noise_dbm = -95;
+
+        pack->insert(pack_comp_common, common);
+        pack->insert(pack_comp_radiodata, l1);
+
+        packets->push_back(pack);
+    }
+}
+
+typedef struct {
+    GlobalRegistry *globalreg;
+    int phyid;
+    vector<kis_packet *> *packets;
+    vector<kis_tracked_device_base *> *devices;
+    unsigned int npackets;
+    unsigned int flags;
+} bench_dt_run;
+
+// npackets through UpdateCommonDevice
+static double bench_ucd(void *auxdata) {
+    bench_dt_run *run = (bench_dt_run *) auxdata;
+    unsigned int ndevs = run->devices->size();
+    uint64_t seed = 1;
+
+    double start = bench_now();
+
+    for (unsigned int p = 0; p < run->npackets; p++) {
+        uint64_t rnd = bench_rand(&seed);
+        uint32_t devnum = (uint32_t) (rnd % ndevs);
+
+        mac_addr mac((uint8_t *) &devnum, 4);
+
+        run->globalreg->devicetracker->UpdateCommonDevice(mac, run->phyid,
+                (*run->packets)[(rnd >> 24) % run->packets->size()], run->flags);
+    }
+
+    return bench_now() - start;
+}
+
+// The per-packet counter updates on the device record alone, without the
+// device list
+static double bench_counters(void *auxdata) {
+    bench_dt_run *run = (bench_dt_run *) auxdata;
+    uint64_t seed = 1;
+    time_t ts = 1500000000;
+
+    double start = bench_now();
+
+    for (unsigned int p = 0; p < run->npackets; p++) {
+        uint64_t rnd = bench_rand(&seed);
+        kis_tracked_device_base *device = 
+            (*run->devices)[rnd % run->devices->size()];
+
+        if ((p & 0xFFFF) == 0)
+            ts++;
+
+        device->set_last_time(ts);
+        device->inc_packets();
+
+        switch ((rnd >> 24) % 3) {
+            case 0:
+                device->inc_data_packets();
+                device->inc_datasize((rnd >> 32) % 1500);
+                break;
+            case 1:
+                device->inc_llc_packets();
+                break;
+            default:
+                device->inc_error_packets();
+                break;
+        }
+
+        device->set_frequency(2412000 + 25000 * ((rnd >> 40) % 3));
+        device->bump_generation();
+    }
+
+    return bench_now() - start;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int ndevs = 1000;
+    unsigned int npackets = 5000000;
+
+    exec_name = argv[0];
+
+    if (argc > 1)
+        ndevs = strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+        npackets = strtoul(argv[2], NULL, 10);
+
+    if (ndevs == 0 || npackets == 0) {
+        fprintf(stderr, "usage: %s [devices] [packets]\n", argv[0]);
+        return 1;
+    }
+
+    GlobalRegistry *globalreg = new GlobalRegistry;
+
+    globalreg->messagebus = new MessageBus;
+    globalreg->kismet_config = new ConfigFile(globalreg);
+    globalreg->timetracker = new Timetracker(globalreg);
+    globalreg->entrytracker = new EntryTracker(globalreg);
+    globalreg->packetchain = new Packetchain(globalreg);
+    globalreg->devicetracker = new Devicetracker(globalreg);
+
+    Bench_Phy_Handler *weakphy = new Bench_Phy_Handler(globalreg);
+    int phyid = globalreg->devicetracker->RegisterPhyHandler(weakphy);
+    delete weakphy;
+
+    vector<kis_packet *> packets;
+    bench_build_packets(globalreg, &packets);
+
+    // Create every device up front so the timed runs are all updates
+    vector<kis_tracked_device_base *> devices;
+    for (unsigned int d = 0; d < ndevs; d++) {
+        mac_addr mac((uint8_t *) &d, 4);
+        devices.push_back(globalreg->devicetracker->UpdateCommonDevice(mac,
+                    phyid, packets[d % packets.size()], UCD_UPDATE_PACKETS));
+    }
+
+    bench_dt_run run;
+
+    run.globalreg = globalreg;
+    run.phyid = phyid;
+    run.packets = &packets;
+    run.devices = &devices;
+    run.npackets = npackets;
+    run.flags = 0;
+
+    printf("%u devices, %u packets, best of %u\n", ndevs, npackets, BENCH_RUNS);
+
+    printf("  device counters only:                %7.1f ns/packet\n",
+            bench_best(bench_counters, &run) * 1000000000.0 / npackets);
+
+    run.flags = UCD_UPDATE_PACKETS;
+    printf("  UpdateCommonDevice, packets:         %7.1f ns/packet\n",
+            bench_best(bench_ucd, &run) * 1000000000.0 / npackets);
+
+    run.flags = UCD_UPDATE_PACKETS | UCD_UPDATE_FREQUENCIES;
+    printf("  UpdateCommonDevice, packets+freq:    %7.1f ns/packet\n",
+            bench_best(bench_ucd, &run) * 1000000000.0 / npackets);
+
+    for (unsigned int p = 0; p < packets.size(); p++)
+        delete packets[p];
+
+    return 0;
+}
@@ -0,0 +1,212 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+// Tracked map container benchmark
+//
+// Compares kis_flat_map with std::map, keyed the way tracked maps are (field
+// ids), at the sizes tracked maps have.  Each size spreads about the same
+// number of entries over as many maps as it takes, like a device list, and
+// times building the maps, looking up keys in random maps, and iterating
+// every map.  Prints the best ns per operation for each container.
+// Build with 'make benchmarks'.
+//
+// bench_flat_map [entries]
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#include "bench_util.h"
+#include "kis_flat_map.h"
+
+typedef struct {
+    double build;
+    double find;
+    double iterate;
+    uint64_t check;
+} bench_map_result;
+
+// Field ids are handed out in registration order and a component's fields
+// are usually registered together, so keys are clustered but not dense
+static void bench_keys(unsigned int in_size, vector<int> *keys) {
+    uint64_t seed = in_size;
+    int k = 100;
+
+    keys->clear();
+
+    for (unsigned int x = 0; x < in_size; x++) {
+        k += 1 + (bench_rand(&seed) % 4);
+        keys->push_back(k);
+    }
+
+    // Insert out of order, as components add fields
+    for (unsigned int x = in_size; x > 1; x--)
+        std::swap((*keys)[x - 1], (*keys)[bench_rand(&seed) % x]);
+}
+
+template<class M>
+struct bench_map_run {
+    vector<int> keys;
+    vector<M *> maps;
+    unsigned int size;
+    unsigned int nmaps;
+    unsigned int nops;
+    uint64_t check;
+};
+
+template<class M>
+static void bench_map_free(bench_map_run<M> *run) {
+    for (unsigned int m = 0; m < run->maps.size(); m++)
+        delete run->maps[m];
+
+    run->maps.clear();
+}
+
+// Throws away the last run's maps untimed, then builds them again
+template<class M>
+static double bench_map_build(void *auxdata) {
+    bench_map_run<M> *run = (bench_map_run<M> *) auxdata;
+
+    bench_map_free(run);
+
+    double start = bench_now();
+
+    for (unsigned int m = 0; m < run->nmaps; m++) {
+        M *map = new M;
+
+        for (unsigned int k = 0; k < run->size; k++)
+            (*map)[run->keys[k]] = (void *) (uintptr_t) (m + k);
+
+        run->maps.push_back(map);
+    }
+
+    return bench_now() - start;
+}
+
+template<class M>
+static double bench_map_find(void *auxdata) {
+    bench_map_run<M> *run = (bench_map_run<M> *) auxdata;
+    uint64_t seed = 1;
+    uint64_t check = 0;
+
+    double start = bench_now();
+
+    for (unsigned int o = 0; o < run->nops; o++) {
+        uint64_t rnd = bench_rand(&seed);
+        M *map = run->maps[rnd % run->nmaps];
+        typename M::iterator i = map->find(run->keys[(rnd >> 24) % run->size]);
+
+        if (i != map->end())
+            check += (uintptr_t) i->second;
+    }
+
+    double elapsed = bench_now() - start;
+
+    run->check += check;
+
+    return elapsed;
+}
+
+template<class M>
+static double bench_map_iterate(void *auxdata) {
+    bench_map_run<M> *run = (bench_map_run<M> *) auxdata;
+    uint64_t check = 0;
+
+    double start = bench_now();
+
+    for (unsigned int m = 0; m < run->nmaps; m++) {
+        for (typename M::iterator i = run->maps[m]->begin();
+                i != run->maps[m]->end(); ++i)
+            check += i->first;
+    }
+
+    double elapsed = bench_now() - start;
+
+    run->check += check;
+
+    return elapsed;
+}
+
+template<class M>
+static bench_map_result bench_map(unsigned int in_size, unsigned int in_entries) {
+    bench_map_result res;
+    bench_map_run<M> run;
+
+    bench_keys(in_size, &run.keys);
+
+    run.size = in_size;
+    run.nmaps = in_entries / in_size;
+
+    if (run.nmaps == 0)
+        run.nmaps = 1;
+
+    run.nops = run.nmaps * in_size;
+    run.check = 0;
+
+    res.build = bench_best(bench_map_build<M>, &run) * 1000000000.0 / run.nops;
+    res.find = bench_best(bench_map_find<M>, &run) * 1000000000.0 / run.nops;
+    res.iterate = 
+        bench_best(bench_map_iterate<M>, &run) * 1000000000.0 / run.nops;
+    res.check = run.check;
+
+    bench_map_free(&run);
+
+    return res;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int entries = 2000000;
+    unsigned int sizes[] = { 4, 8, 16, 32, 64, 256, 1024 };
+
+    if (argc > 1)
+        entries = strtoul(argv[1], NULL, 10);
+
+    if (entries == 0) {
+        fprintf(stderr, "usage: %s [entries]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%u entries per size, ns per operation, best of %u\n", entries,
+            BENCH_RUNS);
+    printf("%6s  %-12s %8s %8s %8s\n", "size", "container", "insert", "find",
+            "iterate");
+
+    for (unsigned int s = 0; s < sizeof(sizes) / sizeof(unsigned int); s++) {
+        bench_map_result tree =
+            bench_map<std::map<int, void *> >(sizes[s], entries);
+        bench_map_result flat =
+            bench_map<kis_flat_map<int, void *> >(sizes[s], entries);
+
+        printf("%6u  %-12s %8.1f %8.1f %8.1f\n", sizes[s], "std::map",
+                tree.build, tree.find, tree.iterate);
+        printf("%6s  %-12s %8.1f %8.1f %8.1f\n", "", "kis_flat_map",
+                flat.build, flat.find, flat.iterate);
+
+        if (tree.check != flat.check) {
+            fprintf(stderr, "kis_flat_map and std::map disagree at size %u\n",
+                    sizes[s]);
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,239 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+// JSON serializer benchmark
+//
+// Builds a device list shaped like the webui summary (29 fields per device,
+// with a nested signal map, and strings which need escaping) and times
+// JsonAdapter::Pack over it, into a stream which discards its input and
+// into a std::stringstream.  Prints the best time and throughput.
+// Build with 'make benchmarks'; run it from two checkouts to compare a
+// change.
+//
+// bench_json [devices]
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <streambuf>
+
+#include "bench_util.h"
+#include "globalregistry.h"
+#include "messagebus.h"
+#include "entrytracker.h"
+#include "trackedelement.h"
+#include "json_adapter.h"
+
+// Counts what it's given and throws it away, so only the serializer is timed
+class bench_null_streambuf : public std::streambuf {
+public:
+    bench_null_streambuf() { count = 0; }
+
+    size_t count;
+
+protected:
+    virtual std::streamsize xsputn(const char *s, std::streamsize n) {
+        count += n;
+        return n;
+    }
+
+    virtual int overflow(int c) {
+        count++;
+        return c;
+    }
+};
+
+typedef struct {
+    const char *name;
+    TrackerType type;
+} bench_json_field;
+
+static const bench_json_field bench_fields[] = {
+    { "kismet.device.base.key", TrackerUInt64 },
+    { "kismet.device.base.macaddr", TrackerMac },
+    { "kismet.device.base.phyname", TrackerString },
+    { "kismet.device.base.name", TrackerString },
+    { "kismet.device.base.commonname", TrackerString },
+    { "kismet.device.base.type", TrackerUInt64 },
+    { "kismet.device.base.crypt", TrackerUInt64 },
+    { "kismet.device.base.first_time", TrackerUInt64 },
+    { "kismet.device.base.last_time", TrackerUInt64 },
+    { "kismet.device.base.packets.total", TrackerUInt64 },
+    { "kismet.device.base.packets.rx", TrackerUInt64 },
+    { "kismet.device.base.packets.tx", TrackerUInt64 },
+    { "kismet.device.base.packets.llc", TrackerUInt64 },
+    { "kismet.device.base.packets.error", TrackerUInt64 },
+    { "kismet.device.base.packets.data", TrackerUInt64 },
+    { "kismet.device.base.packets.crypt", TrackerUInt64 },
+    { "kismet.device.base.packets.filtered", TrackerUInt64 },
+    { "kismet.device.base.datasize", TrackerUInt64 },
+    { "kismet.device.base.channel", TrackerString },
+    { "kismet.device.base.frequency", TrackerDouble },
+    { "kismet.device.base.manuf", TrackerString },
+    { "kismet.device.base.num_alerts", TrackerUInt32 },
+    { "kismet.common.location.lat", TrackerDouble },
+    { "kismet.common.location.lon", TrackerDouble },
+    { "kismet.common.location.alt", TrackerDouble },
+    // Nested in the signal map
+    { "kismet.common.signal.last_signal_dbm", TrackerInt32 },
+    { "kismet.common.signal.min_signal_dbm", TrackerInt32 },
+    { "kismet.common.signal.max_signal_dbm", TrackerInt32 },
+};
+
+#define BENCH_NUM_FIELDS (sizeof(bench_fields) / sizeof(bench_json_field))
+
+static TrackerElement *bench_build_devices(EntryTracker *entrytracker,
+        unsigned int ndevs) {
+    int ids[BENCH_NUM_FIELDS];
+
+    for (unsigned int i = 0; i < BENCH_NUM_FIELDS; i++)
+        ids[i] = entrytracker->RegisterField(bench_fields[i].name,
+                bench_fields[i].type, "benchmark field");
+
+    int dev_id =
+        entrytracker->RegisterField("kismet.device.base", TrackerMap,
+                "benchmark device");
+    int sig_id =
+        entrytracker->RegisterField("kismet.device.base.signal", TrackerMap,
+                "benchmark signal");
+    int list_id =
+        entrytracker->RegisterField("kismet.device.list", TrackerVector,
+                "benchmark device list");
+
+    TrackerElement *list = new TrackerElement(TrackerVector, list_id);
+
+    for (unsigned int d = 0; d < ndevs; d++) {
+        TrackerElement *dev = new TrackerElement(TrackerMap, dev_id);
+        TrackerElement *sig = new TrackerElement(TrackerMap, sig_id);
+
+        for (unsigned int i = 0; i < BENCH_NUM_FIELDS; i++) {
+            TrackerElement *f = new TrackerElement(bench_fields[i].type, ids[i]);
+
+            switch (bench_fields[i].type) {
+                case TrackerUInt64:
+                    f->set((uint64_t) (d * 7919ULL + i * 1000003ULL));
+                    break;
+                case TrackerUInt32:
+                    f->set((uint32_t) (d % 13));
+                    break;
+                case TrackerInt32:
+                    f->set((int32_t) -(int32_t) (30 + (d + i) % 60));
+                    break;
+                case TrackerDouble:
+                    f->set((double) (d * 0.000137 + i * 1.25 - 17.5));
+                    break;
+                case TrackerString: {
+                    char s[64];
+                    snprintf(s, 64, "Device \"%u\" net\\%u", d, i);
+                    f->set(string(s));
+                    break;
+                }
+                case TrackerMac:
+                    f->set(mac_addr((uint8_t *) &d, 4));
+                    break;
+                default:
+                    break;
+            }
+
+            if (strncmp(bench_fields[i].name, "kismet.common.signal.", 21) == 0)
+                sig->add_map(f);
+            else
+                dev->add_map(f);
+        }
+
+        dev->add_map(sig);
+        list->add_vector(dev);
+    }
+
+    return list;
+}
+
+typedef struct {
+    GlobalRegistry *globalreg;
+    TrackerElement *list;
+    size_t len;
+} bench_json_run;
+
+// Pack into a stream which only counts, and remember how much it was given
+static double bench_pack_null(void *auxdata) {
+    bench_json_run *run = (bench_json_run *) auxdata;
+    bench_null_streambuf nullbuf;
+    std::ostream nullstream(&nullbuf);
+
+    double start = bench_now();
+    JsonAdapter::Pack(run->globalreg, nullstream, run->list);
+    double elapsed = bench_now() - start;
+
+    run->len = nullbuf.count;
+
+    return elapsed;
+}
+
+static double bench_pack_ss(void *auxdata) {
+    bench_json_run *run = (bench_json_run *) auxdata;
+    std::stringstream ss;
+
+    double start = bench_now();
+    JsonAdapter::Pack(run->globalreg, ss, run->list);
+    return bench_now() - start;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int ndevs = 100000;
+
+    exec_name = argv[0];
+
+    if (argc > 1)
+        ndevs = strtoul(argv[1], NULL, 10);
+
+    if (ndevs == 0) {
+        fprintf(stderr, "usage: %s [devices]\n", argv[0]);
+        return 1;
+    }
+
+    GlobalRegistry *globalreg = new GlobalRegistry;
+
+    globalreg->messagebus = new MessageBus;
+    globalreg->entrytracker = new EntryTracker(globalreg);
+
+    TrackerElement *list = bench_build_devices(globalreg->entrytracker, ndevs);
+    list->link();
+
+    bench_json_run run;
+
+    run.globalreg = globalreg;
+    run.list = list;
+    run.len = 0;
+
+    double best_null = bench_best(bench_pack_null, &run);
+    double best_ss = bench_best(bench_pack_ss, &run);
+
+    double mb = run.len / 1048576.0;
+
+    printf("%u devices, %.1f MB of JSON, best of %u\n", ndevs, mb,
+            BENCH_RUNS);
+    printf("  discarding stream:  %.3fs  %7.1f MB/s\n", best_null, mb / best_null);
+    printf("  std::stringstream:  %.3fs  %7.1f MB/s\n", best_ss, mb / best_ss);
+
+    list->unlink();
+
+    return 0;
+}
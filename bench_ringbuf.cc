@@ -0,0 +1,228 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+// Ringbuffer throughput benchmark
+//
+// One producer thread and one consumer thread move a stream of sequenced
+// words through a RingbufV2 and a RingbufSPSC, first with write/read copies
+// and then in place with reserve/commit and peek_span/consume, and print the
+// best throughput.  The consumer checks the sequence so a broken ring
+// fails loudly instead of looking fast.  Build with 'make benchmarks'.
+//
+// bench_ringbuf [megabytes] [ring size] [chunk size]
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "bench_util.h"
+#include "ringbuf2.h"
+#include "ringbuf_spsc.h"
+
+typedef struct {
+    RingbufV2 *ring;
+    bool in_place;
+    size_t total_words;
+    size_t chunk_words;
+    bool failed;
+} bench_ring_run;
+
+static void *bench_producer(void *arg) {
+    bench_ring_run *run = (bench_ring_run *) arg;
+    uint64_t *chunk = new uint64_t[run->chunk_words];
+    uint64_t seq = 0;
+
+    while (seq < run->total_words) {
+        size_t want = run->chunk_words;
+
+        if (run->total_words - seq < want)
+            want = run->total_words - seq;
+
+        if (run->in_place) {
+            void *span;
+            size_t got = run->ring->reserve(&span, want * sizeof(uint64_t));
+
+            got /= sizeof(uint64_t);
+
+            if (got == 0) {
+                sched_yield();
+                continue;
+            }
+
+            uint64_t *words = (uint64_t *) span;
+            for (size_t w = 0; w < got; w++)
+                words[w] = seq++;
+
+            run->ring->commit(got * sizeof(uint64_t));
+        } else {
+            if (run->ring->available() < want * sizeof(uint64_t)) {
+                sched_yield();
+                continue;
+            }
+
+            for (size_t w = 0; w < want; w++)
+                chunk[w] = seq++;
+
+            run->ring->write(chunk, want * sizeof(uint64_t));
+        }
+    }
+
+    delete[] chunk;
+
+    return NULL;
+}
+
+static void *bench_consumer(void *arg) {
+    bench_ring_run *run = (bench_ring_run *) arg;
+    uint64_t *chunk = new uint64_t[run->chunk_words];
+    uint64_t seq = 0;
+
+    while (seq < run->total_words) {
+        size_t got;
+
+        if (run->in_place) {
+            void *span;
+            got = run->ring->peek_span(&span, run->chunk_words * sizeof(uint64_t));
+            got /= sizeof(uint64_t);
+
+            uint64_t *words = (uint64_t *) span;
+            for (size_t w = 0; w < got; w++) {
+                if (words[w] != seq++)
+                    run->failed = true;
+            }
+
+            if (got != 0)
+                run->ring->consume(got * sizeof(uint64_t));
+        } else {
+            got = run->ring->read(chunk, run->chunk_words * sizeof(uint64_t));
+            got /= sizeof(uint64_t);
+
+            for (size_t w = 0; w < got; w++) {
+                if (chunk[w] != seq++)
+                    run->failed = true;
+            }
+        }
+
+        if (got == 0)
+            sched_yield();
+    }
+
+    delete[] chunk;
+
+    return NULL;
+}
+
+// One producer and one consumer over the whole stream; negative if the
+// stream came out wrong
+static double bench_ring_pass(void *auxdata) {
+    bench_ring_run *run = (bench_ring_run *) auxdata;
+    pthread_t prod, cons;
+
+    run->ring->clear();
+    run->failed = false;
+
+    double start = bench_now();
+
+    pthread_create(&cons, NULL, bench_consumer, run);
+    pthread_create(&prod, NULL, bench_producer, run);
+
+    pthread_join(prod, NULL);
+    pthread_join(cons, NULL);
+
+    double elapsed = bench_now() - start;
+
+    if (run->failed)
+        return -1;
+
+    return elapsed;
+}
+
+// Best MB/s, or a negative value if the stream came out wrong
+static double bench_ring(RingbufV2 *ring, bool in_place, size_t total_words,
+        size_t chunk_words) {
+    bench_ring_run run;
+
+    run.ring = ring;
+    run.in_place = in_place;
+    run.total_words = total_words;
+    run.chunk_words = chunk_words;
+
+    double best = bench_best(bench_ring_pass, &run);
+
+    if (best < 0)
+        return best;
+
+    return (total_words * sizeof(uint64_t)) / 1048576.0 / best;
+}
+
+static void bench_report(const char *name, double mbsec) {
+    if (mbsec < 0)
+        printf("  %-34s FAILED, stream out of sequence\n", name);
+    else
+        printf("  %-34s %8.1f MB/s\n", name, mbsec);
+}
+
+int main(int argc, char *argv[]) {
+    size_t total_mb = 256;
+    size_t ring_sz = 128 * 1024;
+    size_t chunk_sz = 4096;
+
+    if (argc > 1)
+        total_mb = strtoul(argv[1], NULL, 10);
+    if (argc > 2)
+        ring_sz = strtoul(argv[2], NULL, 10);
+    if (argc > 3)
+        chunk_sz = strtoul(argv[3], NULL, 10);
+
+    // Whole words only, so a span never splits one
+    if (total_mb == 0 || chunk_sz < sizeof(uint64_t) || ring_sz < chunk_sz ||
+            (ring_sz % sizeof(uint64_t)) != 0) {
+        fprintf(stderr, "usage: %s [megabytes] [ring size] [chunk size]\n",
+                argv[0]);
+        return 1;
+    }
+
+    size_t total_words = total_mb * 1048576 / sizeof(uint64_t);
+    size_t chunk_words = chunk_sz / sizeof(uint64_t);
+
+    RingbufV2 *locked = new RingbufV2(ring_sz);
+    RingbufSPSC *spsc = new RingbufSPSC(ring_sz);
+
+    printf("%lu MB through a %lu byte ring in %lu byte chunks, best of %u\n",
+            (unsigned long) total_mb, (unsigned long) ring_sz,
+            (unsigned long) chunk_sz, BENCH_RUNS);
+
+    bench_report("RingbufV2 write/read",
+            bench_ring(locked, false, total_words, chunk_words));
+    bench_report("RingbufV2 reserve/peek_span",
+            bench_ring(locked, true, total_words, chunk_words));
+    bench_report("RingbufSPSC write/read",
+            bench_ring(spsc, false, total_words, chunk_words));
+    bench_report(spsc->mirrored() ? "RingbufSPSC reserve/peek_span" :
+            "RingbufSPSC reserve/peek_span (unmirrored)",
+            bench_ring(spsc, true, total_words, chunk_words));
+
+    delete locked;
+    delete spsc;
+
+    return 0;
+}
@@ -0,0 +1,54 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "bench_util.h"
+
+// Normally provided by kismet_server
+char *exec_name;
+
+double bench_now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+uint64_t bench_rand(uint64_t *seed) {
+    *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return *seed >> 16;
+}
+
+double bench_best(bench_run_cb in_cb, void *in_aux) {
+    double best = 0;
+
+    for (unsigned int r = 0; r < BENCH_RUNS; r++) {
+        double elapsed = (*in_cb)(in_aux);
+
+        if (elapsed < 0)
+            return elapsed;
+
+        if (r == 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
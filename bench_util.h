@@ -0,0 +1,52 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __BENCH_UTIL_H__
+#define __BENCH_UTIL_H__
+
+#include "config.h"
+
+#include <stdint.h>
+
+// Shared plumbing for the standalone benchmarks built by 'make benchmarks'
+
+// Normally provided by kismet_server; declared the same way as getopt.h
+// declares it
+extern "C" {
+    extern char *exec_name;
+}
+
+// Every benchmark reports the best of this many runs
+#define BENCH_RUNS      3
+
+// Wall clock time in seconds
+double bench_now();
+
+// Cheap deterministic generator, so every run sees the same input
+uint64_t bench_rand(uint64_t *seed);
+
+// One run of a benchmark.  The run does its own setup, times only the work
+// being measured with bench_now(), and returns the elapsed seconds, or a
+// negative value if the run failed.
+typedef double (*bench_run_cb)(void *auxdata);
+
+// Run a benchmark BENCH_RUNS times and return the fastest time in seconds,
+// or a negative value if any run failed
+double bench_best(bench_run_cb in_cb, void *in_aux);
+
+#endif
@@ -237,6 +237,19 @@ bool Datasourcetracker::remove_datasource(uuid in_uuid) {
     return false;
 }
 
+void Datasourcetracker::close_datasources() {
+    local_locker lock(&dst_lock);
+
+    TrackerElementVector dsv(datasource_vec);
+
+    for (TrackerElementVector::iterator i = dsv.begin(); i != dsv.end(); ++i) {
+        KisDataSource *kds = (KisDataSource *) *i;
+
+        kds->cancel_error_handler();
+        kds->close_source();
+    }
+}
+
 int Datasourcetracker::register_datasource_builder(string in_type,
         string in_description, KisDataSource *in_builder) {
     local_locker lock(&dst_lock);
@@ -178,6 +178,9 @@ public:
     // Remove a data source
     bool remove_datasource(uuid in_uud);
 
+    // Close every data source, for shutdown
+    void close_datasources();
+
     // HTTP api
     virtual bool Httpd_VerifyPath(const char *path, const char *method);
 
@@ -27,6 +27,7 @@
 #include <string>
 #include <sstream>
 #include <pthread.h>
+#include <sys/time.h>
 
 #include "globalregistry.h"
 #include "util.h"
@@ -51,9 +52,17 @@ int Devicetracker_packethook_commontracker(CHAINCALL_PARMS) {
 	return ((Devicetracker *) auxdata)->CommonTracker(in_pack);
 }
 
+static uint64_t devicetracker_usec() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    return ((uint64_t) tv.tv_sec * 1000000) + tv.tv_usec;
+}
+
 Devicetracker::Devicetracker(GlobalRegistry *in_globalreg) :
     Kis_Net_Httpd_Stream_Handler(in_globalreg) {
     pthread_mutex_init(&devicelist_mutex, NULL);
+    pthread_mutex_init(&sortview_mutex, NULL);
 
 	globalreg = in_globalreg;
 
@@ -84,6 +93,29 @@ Devicetracker::Devicetracker(GlobalRegistry *in_globalreg) :
     device_update_timestamp_id =
         globalreg->entrytracker->RegisterField("kismet.devicelist.timestamp",
                 TrackerInt64, "device list timestamp");
+    device_update_seqno_id =
+        globalreg->entrytracker->RegisterField("kismet.devicelist.sequence",
+                TrackerUInt64, "device list change sequence");
+
+    dt_draw_id =
+        globalreg->entrytracker->RegisterField("kismet.datatables.draw",
+                TrackerUInt64, "datatables request draw counter");
+    dt_records_total_id =
+        globalreg->entrytracker->RegisterField("kismet.datatables.records_total",
+                TrackerUInt64, "datatables total number of records");
+    dt_records_filtered_id =
+        globalreg->entrytracker->RegisterField("kismet.datatables.records_filtered",
+                TrackerUInt64, "datatables number of records matching search");
+
+    // Has to be set before any rrds are made
+    unsigned int rrd_resolution =
+        globalreg->kismet_config->FetchOptUInt("tracker_rrd_resolution", 1);
+
+    if (!kis_tracked_rrd<uint64_t, TrackerUInt64>::set_default_resolution(rrd_resolution)) {
+        _MSG("Invalid tracker_rrd_resolution " + UIntToString(rrd_resolution) + 
+                ", it must be a number of seconds which evenly divides a "
+                "minute.  Using 1 second.", MSGFLAG_ERROR);
+    }
 
     packets_rrd = new kis_tracked_rrd<uint64_t, TrackerUInt64>(globalreg, 0);
     packets_rrd->link();
@@ -172,11 +204,38 @@ Devicetracker::Devicetracker(GlobalRegistry *in_globalreg) :
 		max_devices_timer = -1;
 	}
 
+    sortview_maxage =
+        globalreg->kismet_config->FetchOptInt("tracker_sort_maxage", 2);
+
+    unsigned int cache_mb =
+        globalreg->kismet_config->FetchOptUInt("tracker_cache_size", 32);
+    int cache_maxage =
+        globalreg->kismet_config->FetchOptInt("tracker_cache_maxage", 5);
+
+    if (cache_mb > 0 && cache_maxage > 0) {
+        serialize_cache = 
+            new SerializeCache((size_t) cache_mb * 1024 * 1024, cache_maxage);
+    } else {
+        serialize_cache = NULL;
+    }
+
+    change_seqno = 0;
+
     full_refresh_time = globalreg->timestamp.tv_sec;
+    full_refresh_seqno = 0;
+
+    devicelist_generation = 0;
+    current_snapshot = NULL;
+
+    memset(&lock_stats, 0, sizeof(devicelist_lock_stats));
 }
 
 Devicetracker::~Devicetracker() {
-    // globalreg->httpd_server->RemoveHandler(this);
+    // Stop serving, and wait for any streamed device lists, before tearing
+    // down what they read
+    if (httpd != NULL) {
+        httpd->RemoveHandler(this);
+    }
 
 	globalreg->packetchain->RemoveHandler(&Devicetracker_packethook_commontracker,
 										  CHAINPOS_TRACKER);
@@ -198,13 +257,32 @@ Devicetracker::~Devicetracker() {
             delete p->second;
         }
 
+        if (current_snapshot != NULL) {
+            ReleaseDeviceSnapshot(current_snapshot);
+            current_snapshot = NULL;
+        }
+
         for (unsigned int d = 0; d < tracked_vec.size(); d++) {
+            RemoveDeviceIndex(tracked_vec[d]);
             tracked_vec[d]->unlink();
         }
+        tracked_vec.clear();
 
         packets_rrd->unlink();
     }
 
+    {
+        local_locker lock(&sortview_mutex);
+
+        for (unsigned int v = 0; v < sorted_views.size(); v++)
+            FreeSortedView(sorted_views[v]);
+        sorted_views.clear();
+    }
+
+    if (serialize_cache != NULL)
+        delete serialize_cache;
+
+    pthread_mutex_destroy(&sortview_mutex);
     pthread_mutex_destroy(&devicelist_mutex);
 }
 
@@ -351,18 +429,125 @@ int Devicetracker::RegisterPhyHandler(Kis_Phy_Handler *in_weak_handler) {
 }
 
 void Devicetracker::UpdateFullRefresh() {
+    local_locker lock(&devicelist_mutex);
+
+    UpdateFullRefresh_nl();
+}
+
+void Devicetracker::UpdateFullRefresh_nl() {
     full_refresh_time = globalreg->timestamp.tv_sec;
+    // Bump the sequence so anyone who has seen the current sequence still
+    // learns about the removal
+    full_refresh_seqno = ++change_seqno;
 }
 
-kis_tracked_device_base *Devicetracker::FetchDevice(uint64_t in_key) {
+void Devicetracker::MarkDeviceChanged(kis_tracked_device_base *device) {
+    uint64_t wait_start = devicetracker_usec();
+
     local_locker lock(&devicelist_mutex);
 
-	device_itr i = tracked_map.find(in_key);
+    RecordWriterWait_nl(wait_start);
 
-	if (i != tracked_map.end())
-		return i->second;
+    MarkDeviceChanged_nl(device);
+}
+
+void Devicetracker::MarkDeviceChanged_nl(kis_tracked_device_base *device) {
+    device->set_change(++change_seqno, globalreg->timestamp.tv_sec);
+
+    change_journal.splice(change_journal.end(), change_journal, 
+            device->change_itr);
+}
+
+uint64_t Devicetracker::FetchChangeSeqno() {
+    local_locker lock(&devicelist_mutex);
+
+    return change_seqno;
+}
+
+devicelist_snapshot *Devicetracker::AcquireDeviceSnapshot() {
+    local_locker lock(&devicelist_mutex);
+
+    uint64_t hold_start = devicetracker_usec();
+
+    if (current_snapshot == NULL || 
+            current_snapshot->generation != devicelist_generation) {
+        devicelist_snapshot *snapshot = new devicelist_snapshot();
+
+        snapshot->generation = devicelist_generation;
+        snapshot->devices = tracked_vec;
+
+        for (unsigned int x = 0; x < snapshot->devices.size(); x++)
+            snapshot->devices[x]->link();
+
+        // Our reference as the current snapshot
+        snapshot->refcount = 1;
+
+        if (current_snapshot != NULL)
+            ReleaseDeviceSnapshot(current_snapshot);
+
+        current_snapshot = snapshot;
+
+        lock_stats.snapshots++;
+    }
+
+    __sync_add_and_fetch(&(current_snapshot->refcount), 1);
+
+    RecordReaderHold_nl(hold_start);
+
+    return current_snapshot;
+}
+
+void Devicetracker::ReleaseDeviceSnapshot(devicelist_snapshot *snapshot) {
+    if (__sync_sub_and_fetch(&(snapshot->refcount), 1) != 0)
+        return;
+
+    // Anything removed from the tracker since the snapshot was taken is
+    // freed here
+    for (unsigned int x = 0; x < snapshot->devices.size(); x++)
+        snapshot->devices[x]->unlink();
+
+    delete(snapshot);
+}
+
+uint64_t kis_tracked_device_base::generation_counter = 0;
+
+void Devicetracker::FetchLockStats(devicelist_lock_stats *stats) {
+    local_locker lock(&devicelist_mutex);
+
+    *stats = lock_stats;
+}
+
+void Devicetracker::FetchSerializeCacheStats(SerializeCache::cache_stats *stats) {
+    if (serialize_cache == NULL) {
+        memset(stats, 0, sizeof(SerializeCache::cache_stats));
+        return;
+    }
+
+    serialize_cache->FetchStats(stats);
+}
+
+void Devicetracker::RecordReaderHold_nl(uint64_t in_start_usec) {
+    uint64_t held = devicetracker_usec() - in_start_usec;
+
+    lock_stats.reader_hold_usec += held;
+
+    if (held > lock_stats.reader_hold_max_usec)
+        lock_stats.reader_hold_max_usec = held;
+}
+
+void Devicetracker::RecordWriterWait_nl(uint64_t in_start_usec) {
+    uint64_t waited = devicetracker_usec() - in_start_usec;
+
+    lock_stats.writer_wait_usec += waited;
+
+    if (waited > lock_stats.writer_wait_max_usec)
+        lock_stats.writer_wait_max_usec = waited;
+}
+
+kis_tracked_device_base *Devicetracker::FetchDevice(uint64_t in_key) {
+    local_locker lock(&devicelist_mutex);
 
-	return NULL;
+	return tracked_map.find(in_key);
 }
 
 kis_tracked_device_base *Devicetracker::FetchDevice(mac_addr in_device,
@@ -370,6 +555,93 @@ kis_tracked_device_base *Devicetracker::FetchDevice(mac_addr in_device,
 	return FetchDevice(DevicetrackerKey::MakeKey(in_device, in_phy));
 }
 
+void Devicetracker::FetchDevicesByMac(mac_addr in_mac,
+        vector<kis_tracked_device_base *> *ret_vec) {
+    local_locker lock(&devicelist_mutex);
+
+    FetchDevicesByMac_nl(in_mac, ret_vec);
+}
+
+void Devicetracker::FetchDevicesByMac_nl(mac_addr in_mac,
+        vector<kis_tracked_device_base *> *ret_vec) {
+    // Masked macs can match any number of devices, so they have to look at
+    // everything
+    if (in_mac.longmask != (uint64_t) -1) {
+        for (unsigned int x = 0; x < tracked_vec.size(); x++) {
+            if (tracked_vec[x]->get_macaddr() == in_mac)
+                ret_vec->push_back(tracked_vec[x]);
+        }
+
+        return;
+    }
+
+    vector<kis_tracked_device_base *> *macvec = 
+        tracked_mac_multimap.find(in_mac.longmac);
+
+    if (macvec == NULL)
+        return;
+
+    ret_vec->insert(ret_vec->end(), macvec->begin(), macvec->end());
+}
+
+void Devicetracker::AddDeviceIndex(kis_tracked_device_base *device) {
+    tracked_map.insert(device->get_key(), device);
+
+    devicelist_generation++;
+
+    device->set_change(++change_seqno, globalreg->timestamp.tv_sec);
+    device->change_itr = change_journal.insert(change_journal.end(), device);
+
+    uint64_t mackey = device->get_macaddr().longmac;
+
+    vector<kis_tracked_device_base *> *macvec = 
+        tracked_mac_multimap.find(mackey);
+
+    if (macvec == NULL) {
+        macvec = new vector<kis_tracked_device_base *>();
+        tracked_mac_multimap.insert(mackey, macvec);
+    }
+
+    macvec->push_back(device);
+}
+
+void Devicetracker::RemoveDeviceIndex(kis_tracked_device_base *device) {
+    if (!tracked_map.erase(device->get_key()))
+        return;
+
+    devicelist_generation++;
+
+    // Drop our hold on the current snapshot so that removed devices are
+    // freed as soon as the readers using it are done, instead of waiting
+    // for the next reader to come along
+    if (current_snapshot != NULL) {
+        ReleaseDeviceSnapshot(current_snapshot);
+        current_snapshot = NULL;
+    }
+
+    change_journal.erase(device->change_itr);
+
+    uint64_t mackey = device->get_macaddr().longmac;
+
+    vector<kis_tracked_device_base *> *macvec = 
+        tracked_mac_multimap.find(mackey);
+
+    if (macvec == NULL)
+        return;
+
+    for (unsigned int x = 0; x < macvec->size(); x++) {
+        if ((*macvec)[x] == device) {
+            macvec->erase(macvec->begin() + x);
+            break;
+        }
+    }
+
+    if (macvec->size() == 0) {
+        tracked_mac_multimap.erase(mackey);
+        delete macvec;
+    }
+}
+
 int Devicetracker::CommonTracker(kis_packet *in_pack) {
 	kis_common_info *pack_common =
 		(kis_common_info *) in_pack->fetch(pack_comp_common);
@@ -488,30 +760,48 @@ kis_tracked_device_base *Devicetracker::UpdateCommonDevice(mac_addr in_mac,
 
     key = DevicetrackerKey::MakeKey(in_mac, in_phy);
 
-	if ((device = FetchDevice(key)) == NULL) {
-        device = new kis_tracked_device_base(globalreg, device_base_id);
+    bool new_device = false;
 
-        // Always hold a linkage to the device for ourselves
-        device->link();
+    {
+        // Find or create the device and mark it changed in one pass over
+        // the lock; this is the packet path's only hold on the device list
+        uint64_t wait_start = devicetracker_usec();
 
-        device->set_key(key);
-        device->set_macaddr(in_mac);
-        device->set_phyname(phy->FetchPhyName());
+        local_locker lock(&devicelist_mutex);
 
-        {
-            local_locker lock(&devicelist_mutex);
-            tracked_map[device->get_key()] = device;
+        RecordWriterWait_nl(wait_start);
+
+        if ((device = tracked_map.find(key)) == NULL) {
+            device = new kis_tracked_device_base(globalreg, device_base_id);
+
+            // Always hold a linkage to the device for ourselves
+            device->link();
+
+            device->set_key(key);
+            device->set_macaddr(in_mac);
+            device->set_phyname(phy->FetchPhyName());
+
+            AddDeviceIndex(device);
             tracked_vec.push_back(device);
+
+            new_device = true;
         }
 
+        device->set_last_time(in_pack->ts.tv_sec);
+
+        MarkDeviceChanged_nl(device);
+    }
+
+    // Webserver threads read the device under its lock
+    tracker_component_locker dev_locker(device);
+
+    if (new_device) {
         device->set_first_time(in_pack->ts.tv_sec);
 
         if (globalreg->manufdb != NULL)
             device->set_manuf(globalreg->manufdb->LookupOUI(device->get_macaddr()));
     }
 
-    device->set_last_time(in_pack->ts.tv_sec);
-
     if (in_flags & UCD_UPDATE_PACKETS) {
         device->inc_packets();
 
@@ -568,6 +858,8 @@ kis_tracked_device_base *Devicetracker::UpdateCommonDevice(mac_addr in_mac,
         device->inc_seenby_count(pack_capsrc->ref_source, in_pack->ts.tv_sec, f);
 	}
 
+    device->bump_generation();
+
     return device;
 }
 
@@ -581,7 +873,7 @@ int Devicetracker::PopulateCommon(kis_tracked_device_base *device, kis_packet *i
 	kis_ref_capsource *pack_capsrc =
 		(kis_ref_capsource *) in_pack->fetch(pack_comp_capsrc);
 
-    tracker_component_locker((tracker_component *) device);
+    tracker_component_locker dev_locker(device);
 
 	// If we can't figure it out at all (no common layer) just bail
 	if (pack_common == NULL)
@@ -1577,6 +1869,9 @@ bool Devicetracker::Httpd_VerifyPath(const char *path, const char *method) {
     if (strcmp(path, "/devices/all_devices.msgpack") == 0)
         return true;
 
+    if (strcmp(path, "/devices/all_devices_compact.msgpack") == 0)
+        return true;
+
     if (strcmp(path, "/devices/all_devices.json") == 0)
         return true;
 
@@ -1589,6 +1884,9 @@ bool Devicetracker::Httpd_VerifyPath(const char *path, const char *method) {
     if (strcmp(path, "/phy/all_phys.msgpack") == 0)
         return true;
 
+    if (strcmp(path, "/phy/all_phys_compact.msgpack") == 0)
+        return true;
+
     if (strcmp(path, "/phy/all_phys.json") == 0)
         return true;
 
@@ -1618,22 +1916,23 @@ bool Devicetracker::Httpd_VerifyPath(const char *path, const char *method) {
 				return false;
 
 			if (tokenurl[4] == "device.msgpack")
+                ;
+			else if (tokenurl[4] == "device_compact.msgpack")
                 ;
 			else if (tokenurl[4] == "device.json")
                 ;
 			else
 				return false;
 
-            map<uint64_t, kis_tracked_device_base *>::iterator tmi =
-                tracked_map.find(key);
-            if (tmi != tracked_map.end()) {
+            kis_tracked_device_base *dev = tracked_map.find(key);
+            if (dev != NULL) {
                 // Try to find the exact field
                 if (tokenurl.size() > 5) {
                     vector<string>::const_iterator first = tokenurl.begin() + 5;
                     vector<string>::const_iterator last = tokenurl.end();
                     vector<string> fpath(first, last);
 
-                    if (tmi->second->get_child_path(fpath) == NULL) {
+                    if (dev->get_child_path(fpath) == NULL) {
                         return false;
                     }
                 }
@@ -1646,9 +1945,9 @@ bool Devicetracker::Httpd_VerifyPath(const char *path, const char *method) {
             if (tokenurl.size() < 5)
                 return false;
 
-            local_locker lock(&devicelist_mutex);
-
 			if (tokenurl[4] == "devices.msgpack")
+                ;
+			else if (tokenurl[4] == "devices_compact.msgpack")
                 ;
 			else if (tokenurl[4] == "devices.json")
                 ;
@@ -1662,22 +1961,18 @@ bool Devicetracker::Httpd_VerifyPath(const char *path, const char *method) {
             }
 
             // Try to find the actual mac
-            vector<kis_tracked_device_base *>::iterator vi;
-            for (vi = tracked_vec.begin(); vi != tracked_vec.end(); ++vi) {
-                if ((*vi)->get_macaddr() == mac) {
-                    return true;
-                }
-            }
+            vector<kis_tracked_device_base *> macdevs;
+            FetchDevicesByMac(mac, &macdevs);
 
-            return false;
-        } else if (tokenurl[2] == "last-time") {
+            return macdevs.size() != 0;
+        } else if (tokenurl[2] == "last-time" || tokenurl[2] == "last-seq") {
             if (tokenurl.size() < 5) {
                 return false;
             }
 
-            // Is the timestamp an int?
-            long lastts;
-            if (sscanf(tokenurl[3].c_str(), "%ld", &lastts) != 1) {
+            // Is the timestamp or sequence an int?
+            unsigned long since;
+            if (sscanf(tokenurl[3].c_str(), "%lu", &since) != 1) {
                 return false;
             }
 
@@ -1686,6 +1981,8 @@ bool Devicetracker::Httpd_VerifyPath(const char *path, const char *method) {
                 return true;
             if (tokenurl[4] == "devices.msgpack")
                 return true;
+            if (tokenurl[4] == "devices_compact.msgpack")
+                return true;
 
             return false;
         }
@@ -1726,8 +2023,143 @@ void Devicetracker::httpd_all_phys(TrackerElementSerializer *serializer,
     delete(wrapper);
 }
 
+void Devicetracker::httpd_parse_fields(string in_fields,
+        vector<vector<int> > *ret_fields) {
+    vector<string> paths = StrTokenize(in_fields, ",");
+
+    for (unsigned int p = 0; p < paths.size(); p++) {
+        vector<string> elems = StrTokenize(paths[p], "/");
+        vector<int> ids;
+        bool valid = true;
+
+        for (unsigned int e = 0; e < elems.size(); e++) {
+            // Skip empty path elements
+            if (elems[e].length() == 0)
+                continue;
+
+            int id = globalreg->entrytracker->GetFieldId(elems[e]);
+
+            if (id < 0) {
+                valid = false;
+                break;
+            }
+
+            ids.push_back(id);
+        }
+
+        if (valid && ids.size() > 0)
+            ret_fields->push_back(ids);
+    }
+}
+
+TrackerElement *Devicetracker::httpd_project_fields(
+        tracker_component *in_component, 
+        const vector<vector<int> > &in_fields) {
+    TrackerElement *projection = new TrackerElement(TrackerMap);
+
+    // Maps we made to hold the path down to a field, as opposed to fields
+    // of the device; a whole field replaces any we made under it
+    vector<TrackerElement *> built;
+
+    for (unsigned int x = 0; x < in_fields.size(); x++) {
+        const vector<int> &path = in_fields[x];
+
+        TrackerElement *sub = in_component->get_child_path(path);
+
+        if (sub == NULL)
+            continue;
+
+        TrackerElement *level = projection;
+        unsigned int e;
+
+        for (e = 0; e + 1 < path.size(); e++) {
+            TrackerElement *next = level->get_map_value(path[e]);
+
+            if (next == NULL) {
+                next = new TrackerElement(TrackerMap, path[e]);
+                level->add_map(next);
+                built.push_back(next);
+            } else if (std::find(built.begin(), built.end(), next) == 
+                    built.end()) {
+                // Already sending the whole parent
+                break;
+            }
+
+            level = next;
+        }
+
+        if (e + 1 < path.size())
+            continue;
+
+        TrackerElement *existing = level->get_map_value(path[e]);
+
+        if (existing != NULL) {
+            vector<TrackerElement *>::iterator bi =
+                std::find(built.begin(), built.end(), existing);
+
+            // Asked for the same field twice
+            if (bi == built.end())
+                continue;
+
+            built.erase(bi);
+        }
+
+        level->add_map(sub);
+    }
+
+    return projection;
+}
+
+uint64_t Devicetracker::httpd_cache_view(const vector<vector<int> > *in_fields,
+        uint64_t in_default_view) {
+    if (in_fields == NULL)
+        return in_default_view;
+
+    // FNV-1a over the field paths, kept clear of the fixed views
+    uint64_t h = 14695981039346656037ULL;
+
+    for (unsigned int p = 0; p < in_fields->size(); p++) {
+        for (unsigned int e = 0; e < (*in_fields)[p].size(); e++) {
+            h ^= (uint64_t) (*in_fields)[p][e];
+            h *= 1099511628211ULL;
+        }
+
+        // Path separator
+        h ^= (uint64_t) -1;
+        h *= 1099511628211ULL;
+    }
+
+    return h | (1ULL << 63);
+}
+
+TrackerElement *Devicetracker::httpd_device_record(SerializeCacheTags *in_tags,
+        kis_tracked_device_base *in_device, 
+        const vector<vector<int> > *in_fields, bool in_summary,
+        uint64_t in_view) {
+    // The tracker changes devices under their lock, so a projection can't
+    // be walked without it
+    tracker_component_locker dev_locker(in_device);
+
+    TrackerElement *rec;
+
+    if (in_fields != NULL)
+        rec = httpd_project_fields(in_device, *in_fields);
+    else if (in_summary)
+        rec = in_device->get_tracked_summary();
+    else
+        rec = in_device;
+
+    // Take the generation before anything is encoded, so a change which
+    // lands while we serialize is seen by the next request
+    in_tags->Tag(rec, in_device->get_key(), in_device->get_generation(),
+            in_view, in_device);
+
+    return rec;
+}
+
 void Devicetracker::httpd_device_summary(TrackerElementSerializer *serializer,
-        TrackerElementVector *subvec, string in_wrapper_key) {
+        TrackerElementVector *subvec, string in_wrapper_key,
+        const vector<vector<int> > *in_fields) {
 
     TrackerElement *devvec =
         globalreg->entrytracker->GetTrackedInstance(device_summary_base_id);
@@ -1743,14 +2175,30 @@ void Devicetracker::httpd_device_summary(TrackerElementSerializer *serializer,
         wrapper = devvec;
     }
 
+    // Copy unchanged devices out of the serialization cache
+    uint64_t cache_view = httpd_cache_view(in_fields, cache_view_summary);
+
+    // Always tagged, so each device is locked while it's serialized, even
+    // with no cache
+    SerializeCacheTags *tags = 
+        new SerializeCacheTags(serialize_cache, globalreg->timestamp.tv_sec);
+    serializer->SetCacheTags(tags);
+
     if (subvec == NULL) {
-        local_locker lock(&devicelist_mutex);
+        devicelist_snapshot *snapshot = AcquireDeviceSnapshot();
 
-        for (unsigned int x = 0; x < tracked_vec.size(); x++) {
-            devvec->add_vector(tracked_vec[x]->get_tracked_summary());
+        for (unsigned int x = 0; x < snapshot->devices.size(); x++) {
+            devvec->add_vector(httpd_device_record(tags, 
+                        snapshot->devices[x], in_fields, true, cache_view));
         }
 
         serializer->serialize(wrapper);
+
+        // Let go of the summaries before the snapshot lets go of the devices
+        delete(wrapper);
+        wrapper = NULL;
+
+        ReleaseDeviceSnapshot(snapshot);
     } else {
         /* we do NOT want to lock here actually, we're processing a subvec of
          * stuff not the master device list
@@ -1759,26 +2207,350 @@ void Devicetracker::httpd_device_summary(TrackerElementSerializer *serializer,
          */
         for (TrackerElementVector::const_iterator x = subvec->begin();
                 x != subvec->end(); ++x) {
-            devvec->add_vector(((kis_tracked_device_base *) *x)->get_tracked_summary());
+            kis_tracked_device_base *dev = (kis_tracked_device_base *) *x;
+
+            devvec->add_vector(httpd_device_record(tags, dev, in_fields, 
+                        true, cache_view));
         }
 
         serializer->serialize(wrapper);
     }
 
+    serializer->SetCacheTags(NULL);
+    delete(tags);
+
+    if (wrapper != NULL)
+        delete(wrapper);
+}
+
+// Copy the sortable value of an element into a sort key
+static void devicetracker_fill_sort_key(TrackerElement *e,
+        devicelist_sort_key *key) {
+    if (e == NULL)
+        return;
+
+    switch (e->get_type()) {
+        case TrackerString:
+            key->str = GetTrackerValue<string>(e);
+            break;
+        case TrackerInt8:
+            key->numeric = GetTrackerValue<int8_t>(e);
+            break;
+        case TrackerUInt8:
+            key->numeric = GetTrackerValue<uint8_t>(e);
+            break;
+        case TrackerInt16:
+            key->numeric = GetTrackerValue<int16_t>(e);
+            break;
+        case TrackerUInt16:
+            key->numeric = GetTrackerValue<uint16_t>(e);
+            break;
+        case TrackerInt32:
+            key->numeric = GetTrackerValue<int32_t>(e);
+            break;
+        case TrackerUInt32:
+            key->numeric = GetTrackerValue<uint32_t>(e);
+            break;
+        case TrackerInt64:
+            key->numeric = GetTrackerValue<int64_t>(e);
+            break;
+        case TrackerUInt64:
+            key->numeric = GetTrackerValue<uint64_t>(e);
+            break;
+        case TrackerFloat:
+            key->numeric = GetTrackerValue<float>(e);
+            break;
+        case TrackerDouble:
+            key->numeric = GetTrackerValue<double>(e);
+            break;
+        case TrackerMac:
+            key->str = GetTrackerValue<mac_addr>(e).Mac2String();
+            break;
+        default:
+            break;
+    }
+}
+
+static bool devicetracker_sort_key_asc(const devicelist_sort_key &a,
+        const devicelist_sort_key &b) {
+    if (a.numeric != b.numeric)
+        return a.numeric < b.numeric;
+
+    return a.str < b.str;
+}
+
+static bool devicetracker_sort_key_desc(const devicelist_sort_key &a,
+        const devicelist_sort_key &b) {
+    return devicetracker_sort_key_asc(b, a);
+}
+
+// Case-insensitive match of a search term against the text fields of a
+// device; in_search must already be lowercase
+static bool devicetracker_search_device(kis_tracked_device_base *dev,
+        const string &in_search) {
+    if (StrLower(dev->get_devicename()).find(in_search) != string::npos)
+        return true;
+    if (StrLower(dev->get_username()).find(in_search) != string::npos)
+        return true;
+    if (StrLower(dev->get_macaddr().Mac2String()).find(in_search) != string::npos)
+        return true;
+    if (StrLower(dev->get_manuf()).find(in_search) != string::npos)
+        return true;
+    if (StrLower(dev->get_phyname()).find(in_search) != string::npos)
+        return true;
+    if (StrLower(dev->get_type_string()).find(in_search) != string::npos)
+        return true;
+    if (StrLower(dev->get_crypt_string()).find(in_search) != string::npos)
+        return true;
+    if (StrLower(dev->get_channel()).find(in_search) != string::npos)
+        return true;
+
+    return false;
+}
+
+void Devicetracker::FreeSortedView(devicelist_sorted_view *view) {
+    if (view->snapshot != NULL)
+        ReleaseDeviceSnapshot(view->snapshot);
+
+    delete(view);
+}
+
+devicelist_sorted_view *Devicetracker::FetchSortedView_nl(string in_sort_field,
+        bool in_sort_desc, string in_search) {
+    uint64_t cur_seqno;
+
+    {
+        local_locker lock(&devicelist_mutex);
+        cur_seqno = change_seqno;
+    }
+
+    time_t now = globalreg->timestamp.tv_sec;
+
+    for (unsigned int v = 0; v < sorted_views.size(); v++) {
+        devicelist_sorted_view *view = sorted_views[v];
+
+        if (view->sort_field != in_sort_field || 
+                view->sort_desc != in_sort_desc || 
+                view->search != in_search)
+            continue;
+
+        // Nothing has changed, or it's recent enough to re-use
+        if (view->build_seqno == cur_seqno || 
+                now - view->build_time < sortview_maxage)
+            return view;
+
+        FreeSortedView(view);
+        sorted_views.erase(sorted_views.begin() + v);
+        break;
+    }
+
+    devicelist_sorted_view *view = new devicelist_sorted_view();
+
+    view->sort_field = in_sort_field;
+    view->sort_desc = in_sort_desc;
+    view->search = in_search;
+    view->build_seqno = cur_seqno;
+    view->build_time = now;
+    view->snapshot = AcquireDeviceSnapshot();
+
+    // Resolve the sort field, given the way the json serializer names it:
+    // path elements separated by '.', with the '.' in each field name
+    // turned into '_'
+    vector<int> sort_path;
+    vector<string> sort_tok = StrTokenize(in_sort_field, ".");
+    for (unsigned int x = 0; x < sort_tok.size(); x++) {
+        int id = globalreg->entrytracker->GetFieldIdJson(sort_tok[x]);
+
+        if (id < 0) {
+            sort_path.clear();
+            break;
+        }
+
+        sort_path.push_back(id);
+    }
+
+    vector<devicelist_sort_key> keys;
+    keys.reserve(view->snapshot->devices.size());
+
+    for (unsigned int x = 0; x < view->snapshot->devices.size(); x++) {
+        kis_tracked_device_base *dev = view->snapshot->devices[x];
+
+        tracker_component_locker dev_locker(dev);
+
+        if (in_search.length() != 0 && !devicetracker_search_device(dev, in_search))
+            continue;
+
+        devicelist_sort_key key;
+        key.device = dev;
+
+        // Sort keys come from the summary, which is what the client is
+        // looking at
+        if (sort_path.size() != 0) {
+            TrackerElement *summary = dev->get_tracked_summary();
+            TrackerElement *sub = summary;
+
+            for (unsigned int p = 0; p < sort_path.size() && sub != NULL; p++) {
+                if (sub->get_type() != TrackerMap) {
+                    sub = NULL;
+                    break;
+                }
+
+                sub = sub->get_map_value(sort_path[p]);
+            }
+
+            devicetracker_fill_sort_key(sub, &key);
+        }
+
+        keys.push_back(key);
+    }
+
+    // Unknown sort fields leave the list in tracker order
+    if (sort_path.size() != 0) {
+        if (in_sort_desc)
+            std::stable_sort(keys.begin(), keys.end(), 
+                    devicetracker_sort_key_desc);
+        else
+            std::stable_sort(keys.begin(), keys.end(), 
+                    devicetracker_sort_key_asc);
+    }
+
+    view->devices.reserve(keys.size());
+    for (unsigned int x = 0; x < keys.size(); x++)
+        view->devices.push_back(keys[x].device);
+
+    // Keep a handful of views around; the ui generally only has one or two
+    // sorts active at once
+    if (sorted_views.size() >= 4) {
+        FreeSortedView(sorted_views[0]);
+        sorted_views.erase(sorted_views.begin());
+    }
+
+    sorted_views.push_back(view);
+
+    return view;
+}
+
+void Devicetracker::httpd_device_summary_page(TrackerElementSerializer *serializer,
+        const std::map<string, string> &args,
+        const vector<vector<int> > *in_fields) {
+    std::map<string, string>::const_iterator ai;
+
+    unsigned long draw = 0;
+    unsigned long start = 0;
+    long length = -1;
+    string sort_field;
+    bool sort_desc = false;
+    string search;
+
+    if ((ai = args.find("draw")) != args.end())
+        sscanf(ai->second.c_str(), "%lu", &draw);
+
+    if ((ai = args.find("start")) != args.end())
+        sscanf(ai->second.c_str(), "%lu", &start);
+
+    if ((ai = args.find("length")) != args.end())
+        sscanf(ai->second.c_str(), "%ld", &length);
+
+    if ((ai = args.find("search[value]")) != args.end())
+        search = StrLower(ai->second);
+
+    // Only the first sort column is supported; find the data field of the
+    // column it refers to
+    if ((ai = args.find("order[0][column]")) != args.end()) {
+        std::map<string, string>::const_iterator ci =
+            args.find("columns[" + ai->second + "][data]");
+
+        if (ci != args.end())
+            sort_field = ci->second;
+
+        if ((ai = args.find("order[0][dir]")) != args.end())
+            sort_desc = (ai->second == "desc");
+    }
+
+    TrackerElement *wrapper = new TrackerElement(TrackerMap);
+
+    TrackerElement *draw_e =
+        globalreg->entrytracker->GetTrackedInstance(dt_draw_id);
+    draw_e->set((uint64_t) draw);
+    draw_e->set_local_name("draw");
+    wrapper->add_map(draw_e);
+
+    TrackerElement *total_e =
+        globalreg->entrytracker->GetTrackedInstance(dt_records_total_id);
+    total_e->set_local_name("recordsTotal");
+    wrapper->add_map(total_e);
+
+    TrackerElement *filtered_e =
+        globalreg->entrytracker->GetTrackedInstance(dt_records_filtered_id);
+    filtered_e->set_local_name("recordsFiltered");
+    wrapper->add_map(filtered_e);
+
+    TrackerElement *devvec =
+        globalreg->entrytracker->GetTrackedInstance(device_summary_base_id);
+    devvec->set_local_name("aaData");
+    wrapper->add_map(devvec);
+
+    uint64_t cache_view = httpd_cache_view(in_fields, cache_view_summary);
+
+    // Always tagged, so each device is locked while it's serialized, even
+    // with no cache
+    SerializeCacheTags *tags = 
+        new SerializeCacheTags(serialize_cache, globalreg->timestamp.tv_sec);
+    serializer->SetCacheTags(tags);
+
+    // Our own hold on the devices in the view, which another request can
+    // free before we're done serializing
+    devicelist_snapshot *snapshot = NULL;
+
+    {
+        local_locker lock(&sortview_mutex);
+
+        devicelist_sorted_view *view =
+            FetchSortedView_nl(sort_field, sort_desc, search);
+
+        snapshot = view->snapshot;
+        __sync_add_and_fetch(&(snapshot->refcount), 1);
+
+        total_e->set((uint64_t) view->snapshot->devices.size());
+        filtered_e->set((uint64_t) view->devices.size());
+
+        unsigned long end = view->devices.size();
+        if (length >= 0 && start + length < end)
+            end = start + length;
+
+        for (unsigned long x = start; x < end; x++) {
+            devvec->add_vector(httpd_device_record(tags, view->devices[x],
+                        in_fields, true, cache_view));
+        }
+    }
+
+    serializer->serialize(wrapper);
+
+    serializer->SetCacheTags(NULL);
+    delete(tags);
+
     delete(wrapper);
+
+    ReleaseDeviceSnapshot(snapshot);
 }
 
 void Devicetracker::httpd_xml_device_summary(std::stringstream &stream) {
-    local_locker lock(&devicelist_mutex);
+    devicelist_snapshot *snapshot = AcquireDeviceSnapshot();
 
     TrackerElement *devvec =
         globalreg->entrytracker->GetTrackedInstance(device_summary_base_id);
 
-    for (unsigned int x = 0; x < tracked_vec.size(); x++) {
-        devvec->add_vector(tracked_vec[x]->get_tracked_summary());
+    // XML is never cached, the tags only lock each device
+    SerializeCacheTags *tags = 
+        new SerializeCacheTags(NULL, globalreg->timestamp.tv_sec);
+
+    for (unsigned int x = 0; x < snapshot->devices.size(); x++) {
+        devvec->add_vector(httpd_device_record(tags, snapshot->devices[x],
+                    NULL, true, cache_view_summary));
     }
 
     XmlserializeAdapter *xml = new XmlserializeAdapter(globalreg);
+    xml->SetLockTags(tags);
 
     xml->RegisterField("kismet.device.list", "SummaryDevices");
     xml->RegisterFieldNamespace("kismet.device.list",
@@ -1836,8 +2608,11 @@ void Devicetracker::httpd_xml_device_summary(std::stringstream &stream) {
     xml->XmlSerialize(devvec, stream);
 
     delete(xml);
+    delete(tags);
     delete(devvec);
 
+    ReleaseDeviceSnapshot(snapshot);
+
 }
 
 void Devicetracker::Httpd_CreateStreamResponse(
@@ -1850,39 +2625,22 @@ void Devicetracker::Httpd_CreateStreamResponse(
         return;
     }
 
-    if (strcmp(path, "/devices/all_devices.msgpack") == 0) {
-        TrackerElementSerializer *serializer =
-            new MsgpackAdapter::Serializer(globalreg, stream);
-        httpd_device_summary(serializer);
-        delete(serializer);
-        return;
-    }
-
-    if (strcmp(path, "/devices/all_devices.json") == 0) {
-        TrackerElementSerializer *serializer =
-            new JsonAdapter::Serializer(globalreg, stream);
-        httpd_device_summary(serializer);
-        delete(serializer);
+    if (strcmp(path, "/devices/all_devices.xml") == 0) {
+        httpd_xml_device_summary(stream);
         return;
     }
 
-    // Datatable wrapper
-    if (strcmp(path, "/devices/all_devices_dt.json") == 0) {
+    if (strcmp(path, "/phy/all_phys.msgpack") == 0) {
         TrackerElementSerializer *serializer =
-            new JsonAdapter::Serializer(globalreg, stream);
-        httpd_device_summary(serializer, NULL, "aaData");
+            new MsgpackAdapter::Serializer(globalreg, stream);
+        httpd_all_phys(serializer);
         delete(serializer);
         return;
     }
 
-    if (strcmp(path, "/devices/all_devices.xml") == 0) {
-        httpd_xml_device_summary(stream);
-        return;
-    }
-
-    if (strcmp(path, "/phy/all_phys.msgpack") == 0) {
+    if (strcmp(path, "/phy/all_phys_compact.msgpack") == 0) {
         TrackerElementSerializer *serializer =
-            new MsgpackAdapter::Serializer(globalreg, stream);
+            new MsgpackAdapter::CompactSerializer(globalreg, stream);
         httpd_all_phys(serializer);
         delete(serializer);
         return;
@@ -1917,11 +2675,10 @@ void Devicetracker::Httpd_CreateStreamResponse(
                 return;
             }
 
-            local_locker lock(&devicelist_mutex);
-
             uint64_t key = 0;
 
             bool use_msgpack = false;
+            bool use_compact = false;
             bool use_json = false;
 
 			if (sscanf(tokenurl[3].c_str(), "%lu", &key) != 1) {
@@ -1930,64 +2687,96 @@ void Devicetracker::Httpd_CreateStreamResponse(
 
 			if (tokenurl[4] == "device.msgpack")
 				use_msgpack = true;
+			else if (tokenurl[4] == "device_compact.msgpack")
+				use_compact = true;
 			else if (tokenurl[4] == "device.json")
 				use_json = true;
 			else 
 				return;
 
-            map<uint64_t, kis_tracked_device_base *>::iterator tmi =
-                tracked_map.find(key);
-            if (tmi != tracked_map.end()) {
-                // Try to find the exact field
-                if (tokenurl.size() > 5) {
-                    vector<string>::const_iterator first = tokenurl.begin() + 5;
-                    vector<string>::const_iterator last = tokenurl.end();
-                    vector<string> fpath(first, last);
+            kis_tracked_device_base *dev = NULL;
 
-                    TrackerElement *sub = tmi->second->get_child_path(fpath);
-
-                    if (sub == NULL) {
-                        return;
-                    } else {
-                        TrackerElementSerializer *serializer = NULL;
-                        if (use_msgpack) {
-                            serializer =
-                                new MsgpackAdapter::Serializer(globalreg, stream);
-                        } else if (use_json) {
-                            serializer =
-                                new JsonAdapter::Serializer(globalreg, stream);
-                        }
-                        serializer->serialize(sub);
-                        delete(serializer);
-                        return;
-                    }
-                }
+            {
+                // Only hold the list long enough to take a link to the
+                // device; it can't be freed out from under us after that
+                local_locker lock(&devicelist_mutex);
+                uint64_t hold_start = devicetracker_usec();
+
+                dev = tracked_map.find(key);
+
+                if (dev != NULL)
+                    dev->link();
+
+                RecordReaderHold_nl(hold_start);
+            }
+
+            if (dev == NULL)
+                return;
+
+            // Hold the device while we pick it apart and serialize it
+            dev->mutex_lock();
+
+            // Default to the whole device, or try to find the exact field
+            TrackerElement *sub = dev;
+
+            if (tokenurl.size() > 5) {
+                vector<string>::const_iterator first = tokenurl.begin() + 5;
+                vector<string>::const_iterator last = tokenurl.end();
+                vector<string> fpath(first, last);
+
+                sub = dev->get_child_path(fpath);
+            }
+
+            // Project the requested fields out of the whole device
+            const char *fields = 
+                MHD_lookup_connection_value(connection, 
+                        MHD_GET_ARGUMENT_KIND, "fields");
+
+            if (sub == dev && fields != NULL) {
+                vector<vector<int> > fieldpaths;
+                httpd_parse_fields(fields, &fieldpaths);
+
+                if (fieldpaths.size() > 0)
+                    sub = httpd_project_fields(dev, fieldpaths);
+            }
+
+            if (sub != NULL) {
+                sub->link();
 
                 TrackerElementSerializer *serializer = NULL;
                 if (use_msgpack) {
                     serializer =
                         new MsgpackAdapter::Serializer(globalreg, stream);
+                } else if (use_compact) {
+                    serializer =
+                        new MsgpackAdapter::CompactSerializer(globalreg, stream);
                 } else if (use_json) {
                     serializer =
                         new JsonAdapter::Serializer(globalreg, stream);
                 }
-                serializer->serialize(tmi->second);
+                serializer->serialize(sub);
                 delete(serializer);
-                return;
-            } else {
-                return;
+
+                sub->unlink();
             }
+
+            dev->mutex_unlock();
+
+            dev->unlink();
+
+            return;
         } else if (tokenurl[2] == "by-mac") {
             if (tokenurl.size() < 5)
                 return;
 
-            local_locker lock(&devicelist_mutex);
-
             bool use_msgpack = false;
+            bool use_compact = false;
             bool use_json = false;
 
 			if (tokenurl[4] == "devices.msgpack")
 				use_msgpack = true;
+			else if (tokenurl[4] == "devices_compact.msgpack")
+				use_compact = true;
 			else if (tokenurl[4] == "devices.json")
 				use_json = true;
             else
@@ -1999,107 +2788,294 @@ void Devicetracker::Httpd_CreateStreamResponse(
                 return;
             }
 
+            vector<vector<int> > fieldpaths;
+
+            const char *fields = 
+                MHD_lookup_connection_value(connection, 
+                        MHD_GET_ARGUMENT_KIND, "fields");
+
+            if (fields != NULL)
+                httpd_parse_fields(fields, &fieldpaths);
+
             TrackerElement *devvec =
                 globalreg->entrytracker->GetTrackedInstance(device_list_base_id);
 
-            vector<kis_tracked_device_base *>::iterator vi;
-            for (vi = tracked_vec.begin(); vi != tracked_vec.end(); ++vi) {
-                if ((*vi)->get_macaddr() == mac) {
-                    devvec->add_vector((*vi));
-                }
+            uint64_t cache_view = 
+                httpd_cache_view(fieldpaths.size() > 0 ? &fieldpaths : NULL,
+                        cache_view_device);
+
+            SerializeCacheTags *tags = new SerializeCacheTags(serialize_cache,
+                    globalreg->timestamp.tv_sec);
+
+            vector<kis_tracked_device_base *> macdevs;
+
+            {
+                // Link the devices so we only need to hold the list while we
+                // collect them; they're locked one at a time after
+                local_locker lock(&devicelist_mutex);
+                uint64_t hold_start = devicetracker_usec();
+
+                FetchDevicesByMac_nl(mac, &macdevs);
+
+                for (unsigned int x = 0; x < macdevs.size(); x++)
+                    macdevs[x]->link();
+
+                RecordReaderHold_nl(hold_start);
             }
 
+            for (unsigned int x = 0; x < macdevs.size(); x++)
+                devvec->add_vector(httpd_device_record(tags, macdevs[x],
+                            fieldpaths.size() > 0 ? &fieldpaths : NULL, 
+                            false, cache_view));
+
             TrackerElementSerializer *serializer = NULL;
             if (use_msgpack) {
                 serializer =
                     new MsgpackAdapter::Serializer(globalreg, stream);
+            } else if (use_compact) {
+                serializer =
+                    new MsgpackAdapter::CompactSerializer(globalreg, stream);
             } else if (use_json) {
                 serializer =
                     new JsonAdapter::Serializer(globalreg, stream);
             }
 
             if (serializer != NULL) {
+                serializer->SetCacheTags(tags);
                 serializer->serialize(devvec);
                 delete(serializer);
             }
 
+            delete(tags);
+
             delete(devvec);
 
+            for (unsigned int x = 0; x < macdevs.size(); x++)
+                macdevs[x]->unlink();
+
             return;
-        } else if (tokenurl[2] == "last-time") {
-            if (tokenurl.size() < 5)
-                return;
+        }
 
-            // Is the timestamp an int?
-            long lastts;
-            if (sscanf(tokenurl[3].c_str(), "%ld", &lastts) != 1)
-                return;
+    }
+}
 
-            local_locker lock(&devicelist_mutex);
+bool Devicetracker::Httpd_UseChunkedStream(const char *path, 
+        const char *method) {
+    if (strcmp(method, "GET") != 0)
+        return false;
 
-            TrackerElement *wrapper = new TrackerElement(TrackerMap);
+    if (strcmp(path, "/devices/all_devices.msgpack") == 0 ||
+            strcmp(path, "/devices/all_devices_compact.msgpack") == 0 ||
+            strcmp(path, "/devices/all_devices.json") == 0 ||
+            strcmp(path, "/devices/all_devices_dt.json") == 0)
+        return true;
 
-            TrackerElement *refresh =
-                globalreg->entrytracker->GetTrackedInstance(device_update_required_id);
+    vector<string> tokenurl = StrTokenize(path, "/");
 
-            // If we've changed the list more recently, we have to do a refresh
-            if (lastts < full_refresh_time) {
-                refresh->set((uint8_t) 1);
-            } else {
-                refresh->set((uint8_t) 0);
-            }
+    if (tokenurl.size() < 5)
+        return false;
 
-            wrapper->add_map(refresh);
+    if (tokenurl[1] == "devices" && 
+            (tokenurl[2] == "last-time" || tokenurl[2] == "last-seq"))
+        return true;
 
-            TrackerElement *updatets =
-                globalreg->entrytracker->GetTrackedInstance(device_update_timestamp_id);
-            updatets->set((int64_t) globalreg->timestamp.tv_sec);
+    return false;
+}
 
-            wrapper->add_map(updatets);
+void Devicetracker::Httpd_CreateChunkedResponse(
+        Kis_Net_Httpd *httpd __attribute__((unused)),
+        const char *path, const char *method, 
+        const std::map<string, string> &args, std::ostream &stream) {
 
-            TrackerElement *devvec =
-                globalreg->entrytracker->GetTrackedInstance(device_list_base_id);
+    if (strcmp(method, "GET") != 0) {
+        return;
+    }
 
-            wrapper->add_map(devvec);
+    // Optional list of fields to send instead of the full record; if none
+    // of them are known we send the normal record instead of empty ones
+    vector<vector<int> > fieldpaths;
+    vector<vector<int> > *fields = NULL;
 
-            vector<kis_tracked_device_base *>::iterator vi;
-            for (vi = tracked_vec.begin(); vi != tracked_vec.end(); ++vi) {
-                if ((*vi)->get_last_time() > lastts)
-                    devvec->add_vector((*vi));
-            }
+    std::map<string, string>::const_iterator fi = args.find("fields");
+    if (fi != args.end()) {
+        httpd_parse_fields(fi->second, &fieldpaths);
 
-            TrackerElementSerializer *serializer = NULL;
-            // Are we asking for a summary we understand?
-            if (tokenurl[4] == "devices.json")
-                serializer =
-                    new JsonAdapter::Serializer(globalreg, stream);
-            if (tokenurl[4] == "devices.msgpack")
-                serializer =
-                    new MsgpackAdapter::Serializer(globalreg, stream);
+        if (fieldpaths.size() > 0)
+            fields = &fieldpaths;
+    }
 
-            if (serializer != NULL) {
-                serializer->serialize(wrapper);
-                delete(serializer);
-            }
+    if (strcmp(path, "/devices/all_devices.msgpack") == 0) {
+        TrackerElementSerializer *serializer =
+            new MsgpackAdapter::Serializer(globalreg, stream);
+        httpd_device_summary(serializer, NULL, "", fields);
+        delete(serializer);
+        return;
+    }
 
-            delete(wrapper);
+    // Field-id keyed compact dialect; see /system/tracked_fields.msgpack
+    if (strcmp(path, "/devices/all_devices_compact.msgpack") == 0) {
+        TrackerElementSerializer *serializer =
+            new MsgpackAdapter::CompactSerializer(globalreg, stream);
+        httpd_device_summary(serializer, NULL, "", fields);
+        delete(serializer);
+        return;
+    }
+
+    if (strcmp(path, "/devices/all_devices.json") == 0) {
+        TrackerElementSerializer *serializer =
+            new JsonAdapter::Serializer(globalreg, stream);
+        httpd_device_summary(serializer, NULL, "", fields);
+        delete(serializer);
+        return;
+    }
+
+    // Datatable wrapper; datatables doing server-side processing sends a
+    // draw counter and gets back a single page
+    if (strcmp(path, "/devices/all_devices_dt.json") == 0) {
+        TrackerElementSerializer *serializer =
+            new JsonAdapter::Serializer(globalreg, stream);
+
+        if (args.find("draw") != args.end())
+            httpd_device_summary_page(serializer, args, fields);
+        else
+            httpd_device_summary(serializer, NULL, "aaData", fields);
 
+        delete(serializer);
+        return;
+    }
+
+    vector<string> tokenurl = StrTokenize(path, "/");
+
+    if (tokenurl.size() < 5)
+        return;
+
+    if (tokenurl[1] != "devices")
+        return;
+
+    if (tokenurl[2] == "last-time" || tokenurl[2] == "last-seq") {
+        // Is the timestamp or sequence an int?
+        unsigned long since;
+        if (sscanf(tokenurl[3].c_str(), "%lu", &since) != 1)
             return;
+
+        TrackerElementSerializer *serializer = NULL;
+        // Are we asking for a summary we understand?
+        if (tokenurl[4] == "devices.json")
+            serializer =
+                new JsonAdapter::Serializer(globalreg, stream);
+        if (tokenurl[4] == "devices.msgpack")
+            serializer =
+                new MsgpackAdapter::Serializer(globalreg, stream);
+        if (tokenurl[4] == "devices_compact.msgpack")
+            serializer =
+                new MsgpackAdapter::CompactSerializer(globalreg, stream);
+
+        if (serializer != NULL) {
+            httpd_device_delta(serializer, tokenurl[2] == "last-seq", since,
+                    fields);
+            delete(serializer);
+        }
+
+        return;
+    }
+}
+
+void Devicetracker::httpd_device_delta(TrackerElementSerializer *serializer,
+        bool in_use_seqno, uint64_t in_since, 
+        const vector<vector<int> > *in_fields) {
+    TrackerElement *wrapper = new TrackerElement(TrackerMap);
+
+    // Changed devices are usually fetched by every client polling the list,
+    // so they're still worth caching
+    uint64_t cache_view = httpd_cache_view(in_fields, cache_view_device);
+
+    SerializeCacheTags *tags = new SerializeCacheTags(serialize_cache, 
+            globalreg->timestamp.tv_sec);
+
+    // Collect and link the changed devices under the list lock; each device
+    // is locked on its own after we let go, since the tracker takes the list
+    // lock while holding a device
+    vector<kis_tracked_device_base *> changed;
+
+    pthread_mutex_lock(&devicelist_mutex);
+    uint64_t hold_start = devicetracker_usec();
+
+    TrackerElement *refresh =
+        globalreg->entrytracker->GetTrackedInstance(device_update_required_id);
+
+    // If we've changed the list more recently, we have to do a refresh
+    if ((in_use_seqno && in_since < full_refresh_seqno) ||
+            (!in_use_seqno && (time_t) in_since < full_refresh_time)) {
+        refresh->set((uint8_t) 1);
+    } else {
+        refresh->set((uint8_t) 0);
+    }
+
+    wrapper->add_map(refresh);
+
+    TrackerElement *updatets =
+        globalreg->entrytracker->GetTrackedInstance(device_update_timestamp_id);
+    updatets->set((int64_t) globalreg->timestamp.tv_sec);
+
+    wrapper->add_map(updatets);
+
+    TrackerElement *updateseq =
+        globalreg->entrytracker->GetTrackedInstance(device_update_seqno_id);
+    updateseq->set((uint64_t) change_seqno);
+
+    wrapper->add_map(updateseq);
+
+    TrackerElement *devvec =
+        globalreg->entrytracker->GetTrackedInstance(device_list_base_id);
+
+    wrapper->add_map(devvec);
+
+    // Walk back from the most recent change until we hit something the
+    // client has already seen
+    list<kis_tracked_device_base *>::reverse_iterator ri;
+    for (ri = change_journal.rbegin(); ri != change_journal.rend(); ++ri) {
+        if (in_use_seqno) {
+            if ((*ri)->get_change_seqno() <= in_since)
+                break;
+        } else {
+            if ((*ri)->get_change_time() <= (time_t) in_since)
+                break;
         }
 
+        (*ri)->link();
+        changed.push_back(*ri);
     }
+
+    RecordReaderHold_nl(hold_start);
+    pthread_mutex_unlock(&devicelist_mutex);
+
+    for (unsigned int x = 0; x < changed.size(); x++)
+        devvec->add_vector(httpd_device_record(tags, changed[x], in_fields,
+                    false, cache_view));
+
+    serializer->SetCacheTags(tags);
+    serializer->serialize(wrapper);
+    serializer->SetCacheTags(NULL);
+
+    delete(tags);
+    delete(wrapper);
+
+    for (unsigned int x = 0; x < changed.size(); x++)
+        changed[x]->unlink();
 }
 
 void Devicetracker::MatchOnDevices(DevicetrackerFilterWorker *worker) {
-    local_locker lock(&devicelist_mutex);
+    devicelist_snapshot *snapshot = AcquireDeviceSnapshot();
 
-    map<uint64_t, kis_tracked_device_base *>::iterator tmi;
+    for (unsigned int x = 0; x < snapshot->devices.size(); x++) {
+        tracker_component_locker dev_locker(snapshot->devices[x]);
 
-    for (tmi = tracked_map.begin(); tmi != tracked_map.end(); ++tmi) {
-        worker->MatchDevice(this, tmi->second);
+        worker->MatchDevice(this, snapshot->devices[x]);
     }
 
     worker->Finalize(this);
+
+    ReleaseDeviceSnapshot(snapshot);
 }
 
 // Simple std::sort comparison function to order by the least frequently
@@ -2122,23 +3098,20 @@ int Devicetracker::timetracker_event(int eventid) {
             if (globalreg->timestamp.tv_sec - (*i)->get_last_time() >
                     device_idle_expiration) {
                 target_devs.push_back(*i);
-                tracked_vec.erase(i);
+                i = tracked_vec.erase(i);
             } else {
                 ++i;
             }
         }
 
         if (target_devs.size() > 0)
-            UpdateFullRefresh();
+            UpdateFullRefresh_nl();
 
         // Remove them from the global index, and then unlink to let the
         // tracked element GC clean them up
         for (vector<kis_tracked_device_base *>::iterator i =
                 target_devs.begin(); i != target_devs.end(); ++i) {
-            device_itr mi = tracked_map.find((*i)->get_key());
-
-            if (mi != tracked_map.end())
-                tracked_map.erase(mi);
+            RemoveDeviceIndex(*i);
 
             fprintf(stderr, "debug - forgetting device %s age %lu expiration %d\n", (*i)->get_macaddr().Mac2String().c_str(), globalreg->timestamp.tv_sec - (*i)->get_last_time(), device_idle_expiration);
 
@@ -2157,7 +3130,7 @@ int Devicetracker::timetracker_event(int eventid) {
 			return 1;
 
         // Do an update since we're trimming something
-        UpdateFullRefresh();
+        UpdateFullRefresh_nl();
 
 		// Now things start getting expensive.  Start by sorting the
 		// vector of devices - we don't use it for anything else in a sorted
@@ -2169,14 +3142,11 @@ int Devicetracker::timetracker_event(int eventid) {
 
 		// Figure out how many we don't care about, and remove them from the map
 		for (unsigned int d = 0; d < drop; d++) {
-			device_itr mi = tracked_map.find(tracked_vec[d]->get_key());
-
-			if (mi != tracked_map.end())
-				tracked_map.erase(mi);
+			RemoveDeviceIndex(tracked_vec[d]);
 
 			// Pre-emptively unlink because we're about to go through and clear
 			// them out of the vec in bulk
-			mi->second->unlink();
+			tracked_vec[d]->unlink();
 		}
 
 		// Clear them out of the vector
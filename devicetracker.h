@@ -50,6 +50,8 @@
 #include "trackercomponent_legacy.h"
 #include "timetracker.h"
 #include "kis_net_microhttpd.h"
+#include "kis_hashmap.h"
+#include "serialize_cache.h"
 
 // How big the main vector of components is, if we ever get more than this
 // many tracked components we'll need to expand this but since it ties to
@@ -133,7 +135,12 @@ class Devicetracker;
 #define KIS_DEVICE_BASICCRYPT_DECRYPTED	(1 << 5)
 
 // Base of all device tracking under the new trackerentry system
-class kis_tracked_device_base : public tracker_component {
+//
+// Phys attach their own records as sub-components instead of deriving from
+// the base, so it's final; calls to the proxied accessors on the packet path
+// go directly to them (and the typed counters inline to a plain add) instead
+// of through the vtable.
+class kis_tracked_device_base final : public tracker_component {
 public:
     kis_tracked_device_base(GlobalRegistry *in_globalreg, int in_id) :
         tracker_component(in_globalreg, in_id) {
@@ -147,6 +154,11 @@ public:
         // We own it, so link it once
         summary_map->link();
 
+        change_seqno = 0;
+        change_time = 0;
+
+        generation = next_generation();
+
         register_fields();
         reserve_fields(NULL);
     }
@@ -163,6 +175,11 @@ public:
         // We own it, so link it once
         summary_map->link();
 
+        change_seqno = 0;
+        change_time = 0;
+
+        generation = next_generation();
+
         register_fields();
         reserve_fields(e);
     }
@@ -279,6 +296,33 @@ public:
         }
     }
 
+    // Change journal state, maintained by the devicetracker and not exported.
+    // The sequence number is the devicetracker change sequence at the last
+    // time this device was altered.
+    uint64_t get_change_seqno() { return change_seqno; }
+    time_t get_change_time() { return change_time; }
+
+    void set_change(uint64_t in_seqno, time_t in_time) {
+        change_seqno = in_seqno;
+        change_time = in_time;
+    }
+
+    // Position in the devicetracker change journal
+    list<kis_tracked_device_base *>::iterator change_itr;
+
+    // Modification generation, for the serialization cache.  Whatever
+    // changes the device bumps it once it's done; UpdateCommonDevice and the
+    // phy trackers do this for every packet.  Generations come from one
+    // counter shared by all devices, so a device which is removed and seen
+    // again never re-uses a generation.
+    uint64_t get_generation() {
+        return __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+    }
+
+    void bump_generation() {
+        __atomic_store_n(&generation, next_generation(), __ATOMIC_RELEASE);
+    }
+
     kis_tracked_seenby_data *get_seenby_map() {
         return (kis_tracked_seenby_data *) seenby_map;
     }
@@ -323,7 +367,7 @@ protected:
         
         key_id =
             RegisterField("kismet.device.base.key", TrackerUInt64,
-                    "unique integer key", (void **) &key);
+                    "unique integer key", &key);
 
         macaddr_id =
             RegisterField("kismet.device.base.macaddr", TrackerMac,
@@ -347,7 +391,7 @@ protected:
 
         basic_type_set_id =
             RegisterField("kismet.device.base.basic_type_set", TrackerUInt64,
-                    "bitset of basic type", (void **) &basic_type_set);
+                    "bitset of basic type", &basic_type_set);
 
         crypt_string_id =
             RegisterField("kismet.device.base.crypt", TrackerString,
@@ -355,43 +399,43 @@ protected:
 
         basic_crypt_set_id =
             RegisterField("kismet.device.base.basic_crypt_set", TrackerUInt64,
-                    "bitset of basic encryption", (void **) &basic_crypt_set);
+                    "bitset of basic encryption", &basic_crypt_set);
 
         first_time_id =
             RegisterField("kismet.device.base.first_time", TrackerUInt64,
-                    "first time seen time_t", (void **) &first_time);
+                    "first time seen time_t", &first_time);
         last_time_id =
             RegisterField("kismet.device.base.last_time", TrackerUInt64,
-                    "last time seen time_t", (void **) &last_time);
+                    "last time seen time_t", &last_time);
 
         packets_id =
             RegisterField("kismet.device.base.packets.total", TrackerUInt64,
-                    "total packets seen of all types", (void **) &packets);
+                    "total packets seen of all types", &packets);
         rx_packets_id =
             RegisterField("kismet.device.base.packets.rx", TrackerUInt64,
-                        "observed packets sent to device", (void **) &rx_packets);
+                        "observed packets sent to device", &rx_packets);
         tx_packets_id =
             RegisterField("kismet.device.base.packets.tx", TrackerUInt64,
-                        "observed packets from device", (void **) &tx_packets);
+                        "observed packets from device", &tx_packets);
         llc_packets_id =
             RegisterField("kismet.device.base.packets.llc", TrackerUInt64,
-                        "observed protocol control packets", (void **) &llc_packets);
+                        "observed protocol control packets", &llc_packets);
         error_packets_id =
             RegisterField("kismet.device.base.packets.error", TrackerUInt64,
-                        "corrupt/error packets", (void **) &error_packets);
+                        "corrupt/error packets", &error_packets);
         data_packets_id =
             RegisterField("kismet.device.base.packets.data", TrackerUInt64,
-                        "data packets", (void **) &data_packets);
+                        "data packets", &data_packets);
         crypt_packets_id =
             RegisterField("kismet.device.base.packets.crypt", TrackerUInt64,
-                        "data packets using encryption", (void **) &crypt_packets);
+                        "data packets using encryption", &crypt_packets);
         filter_packets_id =
             RegisterField("kismet.device.base.packets.filtered", TrackerUInt64,
-                        "packets dropped by filter", (void **) &filter_packets);
+                        "packets dropped by filter", &filter_packets);
 
         datasize_id =
             RegisterField("kismet.device.base.datasize", TrackerUInt64,
-                        "transmitted data in bytes", (void **) &datasize);
+                        "transmitted data in bytes", &datasize);
 
         kis_tracked_rrd<uint64_t, TrackerUInt64> *packets_rrd_builder =
             new kis_tracked_rrd<uint64_t, TrackerUInt64>(globalreg, 0);
@@ -423,7 +467,7 @@ protected:
                         "channel (phy specific)", (void **) &channel);
         frequency_id =
             RegisterField("kismet.device.base.frequency", TrackerDouble,
-                        "frequency", (void **) &frequency);
+                        "frequency", &frequency);
 
         manuf_id =
             RegisterField("kismet.device.base.manuf", TrackerString,
@@ -431,7 +475,7 @@ protected:
 
         alert_id =
             RegisterField("kismet.device.base.num_alerts", TrackerUInt32,
-                        "number of alerts on this device", (void **) &alert);
+                        "number of alerts on this device", &alert);
 
         kis_tracked_tag *tag_builder = new kis_tracked_tag(globalreg, 0);
         tag_id =
@@ -515,7 +559,7 @@ protected:
     }
 
     // Unique key
-    TrackerElement *key;
+    TrackedScalar<uint64_t, TrackerUInt64> key;
     int key_id;
 
     // Mac address (probably the key, but could be different)
@@ -542,7 +586,7 @@ protected:
     int type_string_id;
 
     // Basic phy-neutral type for sorting and classification
-    TrackerElement *basic_type_set;
+    TrackedScalar<uint64_t, TrackerUInt64> basic_type_set;
     int basic_type_set_id;
 
     // Printable crypt string, which is set by the phy and is the best printable
@@ -552,31 +596,31 @@ protected:
     int crypt_string_id;
 
     // Bitset of basic phy-neutral crypt options
-    TrackerElement *basic_crypt_set;
+    TrackedScalar<uint64_t, TrackerUInt64> basic_crypt_set;
     int basic_crypt_set_id;
 
     // First and last seen
-    TrackerElement *first_time, *last_time;
+    TrackedScalar<uint64_t, TrackerUInt64> first_time, last_time;
     int first_time_id, last_time_id;
 
     // Packet counts
-    TrackerElement *packets, *tx_packets, *rx_packets,
-                   // link-level packets
-                   *llc_packets,
-                   // known-bad packets
-                   *error_packets,
-                   // data packets
-                   *data_packets,
-                   // Encrypted data packets (double-counted with data)
-                   *crypt_packets,
-                   // Excluded / filtered packets
-                   *filter_packets;
+    TrackedScalar<uint64_t, TrackerUInt64> packets, tx_packets, rx_packets,
+        // link-level packets
+        llc_packets,
+        // known-bad packets
+        error_packets,
+        // data packets
+        data_packets,
+        // Encrypted data packets (double-counted with data)
+        crypt_packets,
+        // Excluded / filtered packets
+        filter_packets;
     int packets_id, tx_packets_id, rx_packets_id,
         llc_packets_id, error_packets_id, data_packets_id,
         crypt_packets_id, filter_packets_id;
 
     // Data seen in bytes
-    TrackerElement *datasize;
+    TrackedScalar<uint64_t, TrackerUInt64> datasize;
     int datasize_id;
 
     // Packets and data RRDs
@@ -587,7 +631,8 @@ protected:
     kis_tracked_rrd<uint64_t, TrackerUInt64> *data_rrd;
 
 	// Channel and frequency as per PHY type
-    TrackerElement *channel, *frequency;
+    TrackerElement *channel;
+    TrackedScalar<double, TrackerDouble> frequency;
     int channel_id, frequency_id;
 
     // Signal data
@@ -604,7 +649,7 @@ protected:
     int manuf_id;
 
     // Alerts triggered on this device
-    TrackerElement *alert;
+    TrackedScalar<uint32_t, TrackerUInt32> alert;
     int alert_id;
 
     // Device tag
@@ -628,6 +673,18 @@ protected:
 
     // Non-exported local value for seenby content
     int seenby_val_id;
+
+    // Change journal
+    uint64_t change_seqno;
+    time_t change_time;
+
+    uint64_t generation;
+
+    static uint64_t generation_counter;
+
+    static uint64_t next_generation() {
+        return __atomic_add_fetch(&generation_counter, 1, __ATOMIC_RELAXED);
+    }
 };
 
 // Packinfo references
@@ -641,6 +698,79 @@ public:
     kis_tracked_device_base *devref;
 };
 
+// Snapshot of the device list.  Readers (REST serializers, filter workers)
+// take a snapshot while briefly holding devicelist_mutex and then walk it
+// without any lock, so a slow client never stalls the packet path.  Every
+// device in a snapshot is linked, so a device removed from the tracker is
+// only freed once the last snapshot holding it is released.
+//
+// Snapshots are shared between readers until the device list changes;
+// get one from Devicetracker::AcquireDeviceSnapshot and give it back with
+// ReleaseDeviceSnapshot.
+class devicelist_snapshot {
+public:
+    devicelist_snapshot() {
+        generation = 0;
+        refcount = 0;
+    }
+
+    vector<kis_tracked_device_base *> devices;
+
+    // Device list generation this snapshot was taken at
+    uint64_t generation;
+
+protected:
+    friend class Devicetracker;
+
+    int refcount;
+};
+
+// Sort key pulled out of a device for server-side sorting.  Keys are copied
+// out of the devices before sorting so a device changing while we sort can't
+// break the ordering.  Numeric fields sort by value, everything else by its
+// string form.
+class devicelist_sort_key {
+public:
+    devicelist_sort_key() {
+        numeric = 0;
+        device = NULL;
+    }
+
+    double numeric;
+    string str;
+
+    kis_tracked_device_base *device;
+};
+
+// A filtered and sorted view of a device list snapshot, used to serve pages
+// of the device list without sorting the entire list for every request.
+// Views are cached by the devicetracker and shared by page requests with the
+// same sort and search until they get too old.
+class devicelist_sorted_view {
+public:
+    devicelist_sorted_view() {
+        snapshot = NULL;
+        sort_desc = false;
+        build_seqno = 0;
+        build_time = 0;
+    }
+
+    // Snapshot keeping the devices in the view alive
+    devicelist_snapshot *snapshot;
+
+    // Sort field (as requested) and search string this view was built for
+    string sort_field;
+    bool sort_desc;
+    string search;
+
+    // Change sequence and time the view was built at
+    uint64_t build_seqno;
+    time_t build_time;
+
+    // Matching devices, in sorted order
+    vector<kis_tracked_device_base *> devices;
+};
+
 // Filter-handler class.  Subclassed by a filter supplicant to be passed to the
 // device filter functions.
 class DevicetrackerFilterWorker {
@@ -685,6 +815,37 @@ public:
     // components due to timeouts / max device cleanup
     void UpdateFullRefresh();
 
+    // Take a snapshot of the current device list; see devicelist_snapshot
+    devicelist_snapshot *AcquireDeviceSnapshot();
+    void ReleaseDeviceSnapshot(devicelist_snapshot *snapshot);
+
+    // Contention on the device list between the readers (snapshots, REST
+    // lookups) and the packet path
+    typedef struct {
+        // Snapshots built; shared snapshots aren't counted
+        uint64_t snapshots;
+        // Time readers held the device list lock, in usec
+        uint64_t reader_hold_usec;
+        uint64_t reader_hold_max_usec;
+        // Time the packet path waited for the device list lock, in usec
+        uint64_t writer_wait_usec;
+        uint64_t writer_wait_max_usec;
+    } devicelist_lock_stats;
+
+    void FetchLockStats(devicelist_lock_stats *stats);
+
+    // Serialization cache for device records; stats are zero when the
+    // cache is turned off
+    void FetchSerializeCacheStats(SerializeCache::cache_stats *stats);
+
+    // Flag that a device has changed; moves it to the head of the change 
+    // journal used for incremental device list updates.  UpdateCommonDevice
+    // does this automatically.
+    void MarkDeviceChanged(kis_tracked_device_base *device);
+
+    // Current change sequence
+    uint64_t FetchChangeSeqno();
+
 #if 0
 	int SetDeviceTag(mac_addr in_device, string in_data);
 	int ClearDeviceTag(mac_addr in_device);
@@ -695,13 +856,15 @@ public:
 	kis_tracked_device_base *FetchDevice(uint64_t in_key);
 	kis_tracked_device_base *FetchDevice(mac_addr in_device, unsigned int in_phy);
 
-    // Perform a device filter.  Pass a subclassed filter instance.  It is not
-    // thread safe to retain a vector/copy of devices, so all work should be
-    // done inside the worker
-    void MatchOnDevices(DevicetrackerFilterWorker *worker);
+    // Find all devices with a given mac, across all phys.  Masked macs
+    // fall back to a full search of the device list.
+    void FetchDevicesByMac(mac_addr in_mac, vector<kis_tracked_device_base *> *ret_vec);
 
-	typedef map<uint64_t, kis_tracked_device_base *>::iterator device_itr;
-	typedef map<uint64_t, kis_tracked_device_base *>::const_iterator const_device_itr;
+    // Perform a device filter.  Pass a subclassed filter instance.  The worker
+    // runs over a snapshot of the device list without the list locked; it
+    // is not safe to retain the devices after Finalize, so all work should
+    // be done inside the worker
+    void MatchOnDevices(DevicetrackerFilterWorker *worker);
 
 	static void Usage(char *argv);
 
@@ -752,6 +915,14 @@ public:
             const char *url, const char *method, const char *upload_data,
             size_t *upload_data_size, std::stringstream &stream);
 
+    // The full device list and delta endpoints can be huge; stream them to
+    // the client as they're serialized
+    virtual bool Httpd_UseChunkedStream(const char *path, const char *method);
+
+    virtual void Httpd_CreateChunkedResponse(Kis_Net_Httpd *httpd,
+            const char *url, const char *method, 
+            const std::map<string, string> &args, std::ostream &stream);
+
     // Generate a list of all phys, serialized appropriately.  If specified,
     // wrap it in a dictionary and name it with the key in in_wrapper, which
     // is required for some js libs like datatables.
@@ -761,9 +932,31 @@ public:
     // Generate a device summary, serialized.  Optionally provide an existing
     // vector to generate a summary of devices matching a given criteria via
     // a worker.  Also optionally, wrap the results in a dictionary named via
-    // the in_wrapper key, which is required for some js libs like datatables
+    // the in_wrapper key, which is required for some js libs like datatables.
+    // If a list of field paths is given, only those fields of each device are
+    // sent instead of the summary.
     void httpd_device_summary(TrackerElementSerializer *serializer,
-            TrackerElementVector *subvec = NULL, string in_wrapper_key = "");
+            TrackerElementVector *subvec = NULL, string in_wrapper_key = "",
+            const vector<vector<int> > *in_fields = NULL);
+
+    // Generate a single page of the device summary for the DataTables
+    // server-side processing protocol: sorted on any summary field, filtered
+    // by a search string, and limited to the start and length requested.
+    void httpd_device_summary_page(TrackerElementSerializer *serializer,
+            const std::map<string, string> &args,
+            const vector<vector<int> > *in_fields = NULL);
+
+    // Parse a 'fields' request argument - a comma separated list of field
+    // paths, with path elements separated by '/' - into field ids.  Unknown
+    // fields are skipped.
+    void httpd_parse_fields(string in_fields, vector<vector<int> > *ret_fields);
+
+    // Build a map holding only the requested fields of a device.  Fields
+    // keep their place in the device, under maps holding only the path down
+    // to them, so fields with the same name under different parents don't
+    // collide.
+    TrackerElement *httpd_project_fields(tracker_component *in_component,
+            const vector<vector<int> > &in_fields);
 
     // TODO merge this into a normal serializer call
     void httpd_xml_device_summary(std::stringstream &stream);
@@ -808,8 +1001,79 @@ protected:
     unsigned int max_num_devices;
     int max_devices_timer;
 
-    // Timestamp for the last time we removed a device
+    // Timestamp and change sequence for the last time we removed a device
     time_t full_refresh_time;
+    uint64_t full_refresh_seqno;
+
+    // Change journal: every device, ordered by the last time it changed,
+    // most recent at the end.  A delta request walks back from the end until
+    // it reaches devices older than it asked for, so it only ever touches
+    // devices which changed.
+    list<kis_tracked_device_base *> change_journal;
+    uint64_t change_seqno;
+
+    // MarkDeviceChanged without locking
+    void MarkDeviceChanged_nl(kis_tracked_device_base *device);
+
+    // UpdateFullRefresh without locking
+    void UpdateFullRefresh_nl();
+
+    // Device list generation, bumped whenever a device is added or removed.
+    // The current snapshot is re-used until the generation moves on.
+    uint64_t devicelist_generation;
+    devicelist_snapshot *current_snapshot;
+
+    // Lock contention stats; devicelist_mutex must be held to record
+    devicelist_lock_stats lock_stats;
+    void RecordReaderHold_nl(uint64_t in_start_usec);
+    void RecordWriterWait_nl(uint64_t in_start_usec);
+
+    // Sorted views of the device list for paged requests, most recently
+    // built at the end
+    pthread_mutex_t sortview_mutex;
+    vector<devicelist_sorted_view *> sorted_views;
+
+    // How long, in seconds, a sorted view is re-used after devices change
+    int sortview_maxage;
+
+    // Encoded device records, or NULL if caching is turned off
+    SerializeCache *serialize_cache;
+
+    // Views of a device which are cached separately; projections get a view
+    // from the fields they project
+    enum {
+        cache_view_device = 0,
+        cache_view_summary = 1
+    };
+
+    // Cache view for a set of projected fields, or for the whole record
+    // or summary when there aren't any
+    uint64_t httpd_cache_view(const vector<vector<int> > *in_fields,
+            uint64_t in_default_view);
+
+    // Build the record for a device in a list being serialized - its
+    // projected fields, its summary, or the whole device - under the device
+    // lock, and tag it so it's serialized under the lock as well.  The device
+    // must stay linked until the record is serialized.
+    TrackerElement *httpd_device_record(SerializeCacheTags *in_tags,
+            kis_tracked_device_base *in_device, 
+            const vector<vector<int> > *in_fields, bool in_summary,
+            uint64_t in_view);
+
+    // Find a matching sorted view, or build a new one.  sortview_mutex must
+    // be held, and the view is only valid while it is.
+    devicelist_sorted_view *FetchSortedView_nl(string in_sort_field,
+            bool in_sort_desc, string in_search);
+    void FreeSortedView(devicelist_sorted_view *view);
+
+    int dt_draw_id, dt_records_total_id, dt_records_filtered_id;
+
+    // Serialize the devices changed since a timestamp or sequence number
+    void httpd_device_delta(TrackerElementSerializer *serializer,
+            bool in_use_seqno, uint64_t in_since,
+            const vector<vector<int> > *in_fields = NULL);
+
+    int device_update_seqno_id;
 
 	// Common device component
 	int devcomp_ref_common;
@@ -818,10 +1082,22 @@ protected:
 	int pack_comp_device, pack_comp_common, pack_comp_basicdata,
 		pack_comp_radiodata, pack_comp_gps, pack_comp_capsrc;
 
-	// Tracked devices
-	map<uint64_t, kis_tracked_device_base *> tracked_map;
+	// Tracked devices, indexed by device key
+	kis_hashmap<kis_tracked_device_base *> tracked_map;
 	// Vector of tracked devices so we can iterate them quickly
 	vector<kis_tracked_device_base *> tracked_vec;
+    // Devices indexed by mac, one entry per phy the mac was seen on
+    kis_hashmap<vector<kis_tracked_device_base *> *> tracked_mac_multimap;
+
+    // Add and remove devices from the indexes; devicelist_mutex must be held.
+    // Removal does not touch tracked_vec.
+    void AddDeviceIndex(kis_tracked_device_base *device);
+    void RemoveDeviceIndex(kis_tracked_device_base *device);
+
+    // FetchDevicesByMac without locking, for callers already holding
+    // devicelist_mutex
+    void FetchDevicesByMac_nl(mac_addr in_mac, 
+            vector<kis_tracked_device_base *> *ret_vec);
 
 	// Filtering
 	FilterCore *track_filter;
@@ -790,12 +790,22 @@ protected:
     TrackerElement *value, *dirty;
 };
 
-// Currently borked
+// Round-robin record of a value over the past minute, hour, and day.
+//
+// The minute is kept in slots of 'resolution' seconds, the hour and day as
+// the average per second over each minute and hour.  Samples are summed into
+// plain arrays; the hour and day are only updated when a sample lands in a
+// new minute or hour, and the tracked vectors are only built and filled in
+// when the record is serialized.
+//
+// The resolution is picked up from the default when the rrd is created, and
+// has to divide a minute evenly.
 template <class IC, int ET>
 class kis_tracked_rrd : public tracker_component {
 public:
     kis_tracked_rrd(GlobalRegistry *in_globalreg, int in_id) :
         tracker_component(in_globalreg, in_id) {
+        init_data();
         register_fields();
         reserve_fields(NULL);
     }
@@ -803,273 +813,179 @@ public:
     kis_tracked_rrd(GlobalRegistry *in_globalreg, int in_id, TrackerElement *e) :
         tracker_component(in_globalreg, in_id) {
 
+        init_data();
         register_fields();
         reserve_fields(e);
     }
 
+    virtual ~kis_tracked_rrd() {
+        delete[] minute_data;
+        pthread_mutex_destroy(&rrd_mutex);
+    }
+
     virtual TrackerElement *clone_type() {
         return new kis_tracked_rrd<IC, ET>(globalreg, get_id());
     }
 
-    __Proxy(last_time, uint64_t, time_t, time_t, last_time);
+    // Seconds per slot of the minute record for rrds created from now on;
+    // returns false if the resolution doesn't divide a minute
+    static bool set_default_resolution(unsigned int in_res) {
+        if (in_res == 0 || in_res > 60 || 60 % in_res != 0)
+            return false;
 
-    void add_sample(IC in_s, time_t in_time) {
-        int sec_bucket = in_time % 60;
-        int min_bucket = (in_time / 60) % 60;
-        int hour_bucket = (in_time / 3600) % 24;
+        default_resolution = in_res;
+        return true;
+    }
+
+    static unsigned int get_default_resolution() {
+        return default_resolution;
+    }
+
+    time_t get_last_time() const {
+        return sample_time;
+    }
 
-        time_t ltime = get_last_time();
+    unsigned int get_resolution() const {
+        return rrd_resolution;
+    }
 
-        // The second slot for the last time
-        int last_sec_bucket = ltime % 60;
-        // The minute of the hour the last known data would go in
-        int last_min_bucket = (ltime / 60) % 60;
-        // The hour of the day the last known data would go in
-        int last_hour_bucket = (ltime / 3600) % 24;
+    void add_sample(IC in_s, time_t in_time) {
+        local_locker lock(&rrd_mutex);
 
-        if (in_time < ltime) {
+        if (in_time < sample_time) {
             // printf("debug - rrd - timewarp to the past?  discard\n");
             return;
         }
-        
-        TrackerElement *e;
-
-        // If we haven't seen data in a day, we reset everything because
-        // none of it is valid.  This is the simplest case.
-        if (in_time - ltime > (60 * 60 * 24)) {
-            // printf("debug - rrd - beed a day since last value\n");
-            // Directly fill in this second, clear rest of the minute
-            for (int x = 0; x < 60; x++) {
-                e = minute_vec->get_vector_value(x);
-
-                if (x == sec_bucket)
-                    e->set((IC) in_s);
-                else
-                    e->set((IC) 0);
-            }
 
-            // We know we haven't seen it in the last hour, so we can just put
-            // the average of one sample in the last minute into the hour record
-            for (int x = 0; x < 60; x++) {
-                e = hour_vec->get_vector_value(x);
-
-                if (x == min_bucket)
-                    e->set((IC) in_s / 60);
-                else
-                    e->set((IC) 0);
-            }
+        if (in_time / rrd_resolution != sample_time / rrd_resolution)
+            roll_forward(in_time);
 
-            // We know we haven't seen it in the last day, so we can put the
-            // average of seeing it once directly into the day
-            for (int x = 0; x < 24; x++) {
-                e = day_vec->get_vector_value(x);
+        minute_data[(in_time / rrd_resolution) % minute_slots] += in_s;
+        minute_total += in_s;
+        hour_total += in_s;
 
-                if (x == hour_bucket)
-                    e->set((IC) in_s / (60) / (60));
-                else
-                    e->set((IC) 0);
-            }
-            set_last_time(in_time);
-
-            return;
-        } else if (in_time - ltime > (60*60)) {
-            // printf("debug - rrd - been an hour since last value\n");
-            // If we haven't seen data in an hour but we're still w/in the day:
-            //   - Average the seconds we know about & set the minute record
-            //   - Clear seconds data & set our current value
-            //   - Average the minutes we know about & set the hour record
-            //
-           
-            IC sec_avg = 0, min_avg = 0;
-
-            // Clear the past minutes worth of second data and build the average,
-            // set the new second entry for the otherwise empty minute
-            for (int x = 0; x < 60; x++) {
-                e = minute_vec->get_vector_value(x);
-
-                sec_avg += GetTrackerValue<IC>(e);
-
-                if (x == sec_bucket)
-                    e->set((IC) in_s);
-                else
-                    e->set((IC) 0);
-            }
+        sample_time = in_time;
+    }
 
-            // Compute the average from the minute we knew about
-            sec_avg /= 60;
+    // RRDs are serialized by the webserver threads while samples are added,
+    // so this and add_sample hold rrd_mutex
+    virtual void pre_serialize() {
+        tracker_component::pre_serialize();
 
-            for (int x = 0; x < 60; x++) {
-                e = minute_vec->get_vector_value(x);
+        local_locker lock(&rrd_mutex);
 
-                // Get the average of the minute value we had
-                min_avg += GetTrackerValue<IC>(e);
+        // Age out anything which has expired since the last sample
+        time_t now = globalreg->timestamp.tv_sec;
 
-                // Put the old minute data in place, put the new value in,
-                // or zero out
-                if (x == last_min_bucket) {
-                    e->set((IC) sec_avg);
-                } else if (x == min_bucket)
-                    e->set((IC) in_s / 60);
-                else
-                    e->set((IC) 0);
-            }
+        if (now > sample_time) {
+            roll_forward(now);
+            sample_time = now;
+        }
 
-            // Set the last hour aggregation
-            min_avg /= 60;
+        last_time->set((uint64_t) sample_time);
+        resolution->set((uint32_t) rrd_resolution);
 
-            // Fill the hours between the last time we saw data and now with
-            // zeroes; fastforward time
-            for (int h = 0; h < hours_different(last_hour_bucket + 1, hour_bucket); h++) {
-                e = hour_vec->get_vector_value((last_hour_bucket + 1 + h) % 24);
-                e->set((IC) 0);
-            }
+        fill_vec(minute_vec, second_entry_id, minute_data, minute_slots, -1, 0);
 
-        } else if (in_time - ltime > 60) {
-            // - Calculate the average seconds
-            // - Wipe the seconds
-            // - Set the new second value
-            // - Update minutes
-            // - Update hours
-            // printf("debug - rrd - been over a minute since last value\n");
+        // The minute and hour we're in the middle of haven't been rolled up 
+        // yet, so fill them in from what we have so far
+        fill_vec(hour_vec, minute_entry_id, hour_data, 60, 
+                (sample_time / 60) % 60, minute_total / 60);
+        fill_vec(day_vec, hour_entry_id, day_data, 24,
+                (sample_time / 3600) % 24, hour_total / 3600);
+    }
 
-            IC sec_avg = 0, min_avg = 0;
+protected:
+    void init_data() {
+        pthread_mutex_init(&rrd_mutex, NULL);
 
-            for (int s = 0; s < 60; s++) {
-                e = minute_vec->get_vector_value(s);
-                sec_avg += GetTrackerValue<IC>(e);
+        rrd_resolution = default_resolution;
+        minute_slots = 60 / rrd_resolution;
 
-                if (s == sec_bucket)
-                    e->set((IC) in_s);
-                else 
-                    e->set((IC) 0);
-            }
+        minute_data = new IC[minute_slots];
 
-            sec_avg /= 60;
-
-            for (int m = 0; 
-                    m < minutes_different(last_min_bucket + 1, min_bucket); m++) {
-                e = hour_vec->get_vector_value((last_min_bucket + 1 + m) % 60);
-                e->set((IC) 0);
-            }
+        clear_data();
+    }
 
-            e = hour_vec->get_vector_value(min_bucket);
-            e->set((IC) sec_avg);
+    void clear_data() {
+        sample_time = 0;
 
-            // Average the minutes into an hour
-            for (unsigned int m = 0; m < 60; m++) {
-                e = hour_vec->get_vector_value(m);
-                min_avg += GetTrackerValue<IC>(e);
-            }
+        for (unsigned int x = 0; x < minute_slots; x++)
+            minute_data[x] = 0;
+        for (unsigned int x = 0; x < 60; x++)
+            hour_data[x] = 0;
+        for (unsigned int x = 0; x < 24; x++)
+            day_data[x] = 0;
 
-            min_avg /= 60;
+        minute_total = 0;
+        hour_total = 0;
+    }
 
-            // Set the hour
-            e = day_vec->get_vector_value(hour_bucket);
-            e->set(min_avg);
+    // Move the record forward to a later time with no data in between,
+    // rolling the minute and hour we leave into the hour and day records.
+    // Slots which have been skipped are zeroed; it never has to walk more than
+    // one full lap of a record.
+    void roll_forward(time_t in_time) {
+        time_t last_slot = sample_time / rrd_resolution;
+        time_t slot = in_time / rrd_resolution;
 
-        } else {
-            // printf("debug - rrd - w/in the last minute %d seconds\n", in_time - last_time);
-            // If in_time == last_time then we're updating an existing record, so
-            // add that in.
-            // Otherwise, fast-forward seconds with zero data, average the seconds,
-            // and propagate the averages up
-            if (in_time == ltime) {
-                e = minute_vec->get_vector_value(sec_bucket);
-                (*e) += in_s;
-
-                // printf("setting second %d to %d\n",  sec_bucket, GetTrackerValue<IC>(e));
-            } else {
-                // printf("seconds different: %d zeroing from %d to %d... ", minutes_different(last_sec_bucket, sec_bucket), last_sec_bucket, sec_bucket);
-                for (int s = 0; 
-                        s < minutes_different(last_sec_bucket + 1, sec_bucket); s++) {
-                    e = minute_vec->get_vector_value((last_sec_bucket + 1 + s) % 60);
-                    e->set((IC) 0);
-                    // printf("%d ", s);
-                }
-                // printf("\n");
+        for (time_t s = 1; s <= slot - last_slot && s <= (time_t) minute_slots; s++)
+            minute_data[(last_slot + s) % minute_slots] = 0;
 
-                e = minute_vec->get_vector_value(sec_bucket);
-                e->set((IC) in_s);
-            }
+        time_t last_min = sample_time / 60;
+        time_t min = in_time / 60;
 
-#if 0
-            printf("last minute: ");
-            for (int s = 0; s < 60; s++) {
-                e = minute_vec->get_vector_value(s);
-                printf("%u ", GetTrackerValue<IC>(e));
-            }
-            printf("\n");
-#endif
-               
-            // Update all the averages
-            IC sec_avg = 0, min_avg = 0;
-
-            // Average the seconds into a minute
-            for (unsigned int s = 0; s < 60; s++) {
-                e = minute_vec->get_vector_value(s);
-                sec_avg += GetTrackerValue<IC>(e);
-            }
+        if (min == last_min)
+            return;
 
-            sec_avg /= 60;
+        hour_data[last_min % 60] = minute_total / 60;
+        minute_total = 0;
 
-            // Set the minute
-            e = hour_vec->get_vector_value(min_bucket);
-            e->set(sec_avg);
+        for (time_t m = 1; m <= min - last_min && m <= 60; m++)
+            hour_data[(last_min + m) % 60] = 0;
 
-            // Average the minutes into an hour
-            for (unsigned int m = 0; m < 60; m++) {
-                e = hour_vec->get_vector_value(m);
-                min_avg += GetTrackerValue<IC>(e);
-            }
+        time_t last_hour = sample_time / 3600;
+        time_t hour = in_time / 3600;
 
-            min_avg /= 60;
-
-            // Set the hour
-            e = day_vec->get_vector_value(hour_bucket);
-            e->set(min_avg);
-        }
+        if (hour == last_hour)
+            return;
 
+        day_data[last_hour % 24] = hour_total / 3600;
+        hour_total = 0;
 
-        set_last_time(in_time);
+        for (time_t h = 1; h <= hour - last_hour && h <= 24; h++)
+            day_data[(last_hour + h) % 24] = 0;
     }
 
-    virtual void pre_serialize() {
-        tracker_component::pre_serialize();
+    // Copy a record into its tracked vector, building the vector the first
+    // time; slot in_cur is replaced with in_cur_val if it isn't negative.
+    // Once built the vector is never resized, since another thread may be
+    // serializing it.
+    void fill_vec(TrackerElement *in_vec, int in_entry_id, const IC *in_data,
+            unsigned int in_len, int in_cur, IC in_cur_val) {
+        if (in_vec->size_vector() == 0) {
+            for (unsigned int x = 0; x < in_len; x++)
+                in_vec->add_vector(new TrackerElement((TrackerType) ET, in_entry_id));
+        }
 
-        // printf("debug - rrd - preserialize\n");
-        // Update the averages
-        add_sample(0, globalreg->timestamp.tv_sec);
-    }
+        for (unsigned int x = 0; x < in_len; x++) {
+            TrackerElement *e = in_vec->get_vector_value(x);
 
-protected:
-    inline int minutes_different(int m1, int m2) const {
-        if (m1 == m2) {
-            return 0;
-        } else if (m1 < m2) {
-            return m2 - m1;
-        } else {
-            return 60 - m1 + m2;
+            if ((int) x == in_cur)
+                e->set((IC) in_cur_val);
+            else
+                e->set((IC) in_data[x]);
         }
     }
 
-    inline int hours_different(int h1, int h2) const {
-        if (h1 == h2) {
-            return 0;
-        } else if (h1 < h2) {
-            return h2 - h1;
-        } else {
-            return 24 - h1 + h2;
-        }
-    }
+    // Pick up the values of an existing record, as long as it was kept at
+    // the same resolution
+    void load_vec(TrackerElement *in_vec, IC *ret_data, unsigned int in_len) {
+        if (in_vec->size_vector() != in_len)
+            return;
 
-    inline int days_different(int d1, int d2) const {
-        if (d1 == d2) {
-            return 0;
-        } else if (d1 < d2) {
-            return d2 - d1;
-        } else {
-            return 7 - d1 + d2;
-        }
+        for (unsigned int x = 0; x < in_len; x++)
+            ret_data[x] = GetTrackerValue<IC>(in_vec->get_vector_value(x));
     }
 
     virtual void register_fields() {
@@ -1078,6 +994,9 @@ protected:
         last_time_id =
             RegisterField("kismet.common.rrd.last_time", TrackerUInt64,
                     "last time udpated", (void **) &last_time);
+        resolution_id =
+            RegisterField("kismet.common.rrd.resolution", TrackerUInt32,
+                    "seconds per minute_vec value", (void **) &resolution);
 
         minute_vec_id = 
             RegisterField("kismet.common.rrd.minute_vec", TrackerVector,
@@ -1104,38 +1023,56 @@ protected:
     virtual void reserve_fields(TrackerElement *e) {
         tracker_component::reserve_fields(e);
 
-        set_last_time(0);
+        // The vectors themselves aren't built until we're serialized
+        if (e != NULL && 
+                GetTrackerValue<uint32_t>(resolution) == rrd_resolution) {
+            sample_time = GetTrackerValue<uint64_t>(last_time);
 
-        // Build slots for all the times
-        int x;
-        if ((x = minute_vec->get_vector()->size()) != 60) {
-            for ( ; x < 60; x++) {
-                TrackerElement *me =
-                    new TrackerElement((TrackerType) ET, second_entry_id);
-                minute_vec->add_vector(me);
-            }
-        }
+            load_vec(minute_vec, minute_data, minute_slots);
+            load_vec(hour_vec, hour_data, 60);
+            load_vec(day_vec, day_data, 24);
 
-        if ((x = hour_vec->get_vector()->size()) != 60) {
-            for ( ; x < 60; x++) {
-                TrackerElement *he =
-                    new TrackerElement((TrackerType) ET, minute_entry_id);
-                hour_vec->add_vector(he);
-            }
+            // The current minute and hour are only partial in the vectors,
+            // pick back up from what they had so far
+            minute_total = hour_data[(sample_time / 60) % 60] * 60;
+            hour_total = day_data[(sample_time / 3600) % 24] * 3600;
         }
 
-        if ((x = day_vec->get_vector()->size()) != 24) {
-            for ( ; x < 24; x++) {
-                TrackerElement *he =
-                    new TrackerElement((TrackerType) ET, hour_entry_id);
-                day_vec->add_vector(he);
-            }
-        }
+        // Vectors kept at another resolution are rebuilt on the first
+        // serialization, before anything else can see them
+        if (minute_vec->size_vector() != minute_slots)
+            minute_vec->clear_vector();
+        if (hour_vec->size_vector() != 60)
+            hour_vec->clear_vector();
+        if (day_vec->size_vector() != 24)
+            day_vec->clear_vector();
     }
 
+    static unsigned int default_resolution;
+
+    pthread_mutex_t rrd_mutex;
+
+    unsigned int rrd_resolution;
+    unsigned int minute_slots;
+
+    time_t sample_time;
+
+    // Sum per slot over the past minute
+    IC *minute_data;
+    // Average per second over each of the past 60 minutes and 24 hours
+    IC hour_data[60];
+    IC day_data[24];
+
+    // Running sums for the minute and hour we're in
+    IC minute_total;
+    IC hour_total;
+
     int last_time_id;
     TrackerElement *last_time;
 
+    int resolution_id;
+    TrackerElement *resolution;
+
     int minute_vec_id;
     TrackerElement *minute_vec;
 
@@ -1150,5 +1087,8 @@ protected:
     int hour_entry_id;
 };
 
+template <class IC, int ET>
+unsigned int kis_tracked_rrd<IC, ET>::default_resolution = 1;
+
 #endif
 
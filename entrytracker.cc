@@ -18,10 +18,13 @@
 
 #include <string>
 #include <sstream>
+#include <algorithm>
+#include <msgpack.hpp>
 
 #include "util.h"
 
 #include "entrytracker.h"
+#include "json_adapter.h"
 
 EntryTracker::EntryTracker(GlobalRegistry *in_globalreg) :
     Kis_Net_Httpd_Stream_Handler(in_globalreg) {
@@ -30,6 +33,11 @@ EntryTracker::EntryTracker(GlobalRegistry *in_globalreg) :
     globalreg->InsertGlobal("ENTRY_TRACKER", this);
 
     next_field_num = 1;
+
+    pthread_mutex_init(&entry_mutex, NULL);
+
+    for (unsigned int x = 0; x < field_pages; x++)
+        field_page_table[x] = NULL;
 }
 
 EntryTracker::~EntryTracker() {
@@ -45,11 +53,74 @@ EntryTracker::~EntryTracker() {
 
     field_name_map.clear();
     field_id_map.clear();
+    field_json_map.clear();
+
+    for (unsigned int x = 0; x < field_pages; x++) {
+        if (field_page_table[x] != NULL)
+            delete[] field_page_table[x];
+    }
+
+    pthread_mutex_destroy(&entry_mutex);
+}
+
+void EntryTracker::IndexField(reserved_field *in_field) {
+    field_name_map[StrLower(in_field->field_name)] = in_field;
+    field_id_map[in_field->field_id] = in_field;
+
+    // JSON is special, and considers '.' to be a path separator, so keys
+    // get '_' instead
+    string json_name = in_field->field_name;
+    std::replace(json_name.begin(), json_name.end(), '.', '_');
+
+    in_field->json_key = "\"" + JsonAdapter::SanitizeString(json_name) + "\": ";
+
+    field_json_map.insert(std::make_pair(StrLower(json_name), 
+                in_field->field_id));
+
+    unsigned int page = in_field->field_id / field_page_sz;
+
+    if (page >= field_pages)
+        return;
+
+    reserved_field **ptable = field_page_table[page];
+
+    if (ptable == NULL) {
+        ptable = new reserved_field *[field_page_sz];
+
+        for (unsigned int x = 0; x < field_page_sz; x++)
+            ptable[x] = NULL;
+
+        __atomic_store_n(&(field_page_table[page]), ptable, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&(ptable[in_field->field_id % field_page_sz]), in_field, 
+            __ATOMIC_RELEASE);
+}
+
+const string *EntryTracker::GetFieldJsonKey(int in_id) {
+    if (in_id < 0 || (unsigned int) in_id / field_page_sz >= field_pages)
+        return NULL;
+
+    reserved_field **ptable = 
+        __atomic_load_n(&(field_page_table[in_id / field_page_sz]), __ATOMIC_ACQUIRE);
+
+    if (ptable == NULL)
+        return NULL;
+
+    reserved_field *field = 
+        __atomic_load_n(&(ptable[in_id % field_page_sz]), __ATOMIC_ACQUIRE);
+
+    if (field == NULL)
+        return NULL;
+
+    return &(field->json_key);
 }
 
 int EntryTracker::RegisterField(string in_name, TrackerType in_type, string in_desc) {
     string mod_name = StrLower(in_name);
 
+    local_locker lock(&entry_mutex);
+
     map<string, reserved_field *>::iterator iter = field_name_map.find(mod_name);
 
     if (iter != field_name_map.end()) {
@@ -81,8 +152,7 @@ int EntryTracker::RegisterField(string in_name, TrackerType in_type, string in_d
 
     definition->field_description = in_desc;
 
-    field_name_map[mod_name] = definition;
-    field_id_map[definition->field_id] = definition;
+    IndexField(definition);
 
     return definition->field_id;
 }
@@ -90,43 +160,62 @@ int EntryTracker::RegisterField(string in_name, TrackerType in_type, string in_d
 int EntryTracker::RegisterField(string in_name, TrackerElement *in_builder, 
         string in_desc) {
     string mod_name = StrLower(in_name);
+    TrackerElement *builder = NULL;
 
-    map<string, reserved_field *>::iterator iter = field_name_map.find(mod_name);
+    // Cloning a component registers its own fields, so the builder is
+    // cloned outside the lock and we look again after
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1)
+            builder = in_builder->clone_type();
 
-    if (iter != field_name_map.end()) {
-        if (iter->second->builder == NULL) {
-            fprintf(stderr, "debug - %s:%s %u tried to register field %s with builder "
-                    "but already registered with type %s.\n", __FILE__, 
-                    __func__, __LINE__,
-                    mod_name.c_str(), 
-                    TrackerElement::type_to_string(iter->second->track_type).c_str());
-            return -1;
+        local_locker lock(&entry_mutex);
+
+        map<string, reserved_field *>::iterator iter = field_name_map.find(mod_name);
+
+        if (iter != field_name_map.end()) {
+            if (builder != NULL)
+                delete(builder);
+
+            if (iter->second->builder == NULL) {
+                fprintf(stderr, "debug - %s:%s %u tried to register field %s with builder "
+                        "but already registered with type %s.\n", __FILE__, 
+                        __func__, __LINE__,
+                        mod_name.c_str(), 
+                        TrackerElement::type_to_string(iter->second->track_type).c_str());
+                return -1;
+            }
+
+            return iter->second->field_id;
         }
 
-        return iter->second->field_id;
-    }
+        if (pass == 0)
+            continue;
 
-    reserved_field *definition = new reserved_field();
+        reserved_field *definition = new reserved_field();
 
-    definition->field_id = next_field_num++;
-    definition->field_name = in_name;
+        definition->field_id = next_field_num++;
+        definition->field_name = in_name;
 
-    definition->builder = in_builder->clone_type();
+        definition->builder = builder;
 
-    definition->field_description = in_desc;
+        definition->field_description = in_desc;
 
-    field_name_map[mod_name] = definition;
-    field_id_map[definition->field_id] = definition;
+        // Set the builders ID now that we know it
+        definition->builder->set_id(definition->field_id);
 
-    // Set the builders ID now that we know it
-    definition->builder->set_id(definition->field_id);
+        IndexField(definition);
 
-    return definition->field_id;
+        return definition->field_id;
+    }
+
+    return -1;
 }
 
 int EntryTracker::GetFieldId(string in_name) {
     string mod_name = StrLower(in_name);
 
+    local_locker lock(&entry_mutex);
+
     map<string, reserved_field *>::iterator itr = field_name_map.find(mod_name);
 
     if (itr == field_name_map.end()) {
@@ -136,7 +225,22 @@ int EntryTracker::GetFieldId(string in_name) {
     return itr->second->field_id;
 }
 
+int EntryTracker::GetFieldIdJson(string in_name) {
+    string mod_name = StrLower(in_name);
+
+    local_locker lock(&entry_mutex);
+
+    map<string, int>::iterator itr = field_json_map.find(mod_name);
+
+    if (itr == field_json_map.end())
+        return -1;
+
+    return itr->second;
+}
+
 string EntryTracker::GetFieldName(int in_id) {
+    local_locker lock(&entry_mutex);
+
     map<int, reserved_field *>::iterator itr = field_id_map.find(in_id);
 
     if (itr == field_id_map.end()) {
@@ -177,16 +281,22 @@ TrackerElement *EntryTracker::RegisterAndGetField(string in_name,
 
 
 TrackerElement *EntryTracker::GetTrackedInstance(int in_id) {
-    map<int, reserved_field *>::iterator itr = field_id_map.find(in_id);
-
-    if (itr == field_id_map.end()) {
-        return NULL;
-    }
-
     reserved_field *definition;
     TrackerElement *ret;
 
-    definition = itr->second;
+    {
+        // Definitions are never freed, and cloning may register fields, so
+        // only hold the lock for the lookup
+        local_locker lock(&entry_mutex);
+
+        map<int, reserved_field *>::iterator itr = field_id_map.find(in_id);
+
+        if (itr == field_id_map.end()) {
+            return NULL;
+        }
+
+        definition = itr->second;
+    }
 
     if (definition->builder == NULL)
         ret = new TrackerElement(definition->track_type, definition->field_id);
@@ -200,17 +310,21 @@ TrackerElement *EntryTracker::GetTrackedInstance(int in_id) {
 TrackerElement *EntryTracker::GetTrackedInstance(string in_name) {
     string mod_name = StrLower(in_name);
 
-    map<string, reserved_field *>::iterator itr = field_name_map.find(mod_name);
-
     reserved_field *definition;
     TrackerElement *ret;
 
-    // We don't know this
-    if (itr == field_name_map.end()) {
-        return NULL;
-    }
+    {
+        local_locker lock(&entry_mutex);
+
+        map<string, reserved_field *>::iterator itr = field_name_map.find(mod_name);
 
-    definition = itr->second;
+        // We don't know this
+        if (itr == field_name_map.end()) {
+            return NULL;
+        }
+
+        definition = itr->second;
+    }
 
     if (definition->builder == NULL)
         ret = new TrackerElement(definition->track_type, definition->field_id);
@@ -227,6 +341,9 @@ bool EntryTracker::Httpd_VerifyPath(const char *path, const char *method) {
     if (strcmp(path, "/system/tracked_fields.html") == 0)
         return true;
 
+    if (strcmp(path, "/system/tracked_fields.msgpack") == 0)
+        return true;
+
     return false;
 }
 
@@ -242,6 +359,8 @@ void EntryTracker::Httpd_CreateStreamResponse(
         return;
     }
 
+    local_locker lock(&entry_mutex);
+
     if (strcmp(path, "/system/tracked_fields.html") == 0) {
         stream << "<html><head><title>Kismet Server - Tracked Fields</title></head>";
         stream << "<body>";
@@ -274,5 +393,30 @@ void EntryTracker::Httpd_CreateStreamResponse(
         return;
     }
 
+    // Field dictionary for the compact msgpack dialect; a map of field id
+    // to [name, type, description].  Ids are stable for the life of the
+    // server, so clients only need this once.
+    if (strcmp(path, "/system/tracked_fields.msgpack") == 0) {
+        msgpack::packer<std::ostream> o(&stream);
+
+        o.pack_map(field_id_map.size());
+
+        for (map<int, reserved_field *>::iterator i = field_id_map.begin();
+                i != field_id_map.end(); ++i) {
+            o.pack(i->first);
+            o.pack_array(3);
+            o.pack(i->second->field_name);
+
+            if (i->second->builder == NULL)
+                o.pack((int) i->second->track_type);
+            else
+                o.pack((int) i->second->builder->get_type());
+
+            o.pack(i->second->field_description);
+        }
+
+        return;
+    }
+
 }
 
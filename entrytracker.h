@@ -26,6 +26,7 @@
 
 #include <string>
 #include <map>
+#include <pthread.h>
 
 #include "globalregistry.h"
 #include "trackedelement.h"
@@ -64,6 +65,15 @@ public:
     int GetFieldId(string in_name);
     string GetFieldName(int in_id);
 
+    // Find a field by the name the JSON serializer gives it, with '.'
+    // replaced by '_'
+    int GetFieldIdJson(string in_name);
+
+    // Get the JSON object key for a field, already escaped and quoted and
+    // followed by the ':' separator.  Safe to call from any thread without
+    // locking.  Returns NULL for unregistered fields.
+    const string *GetFieldJsonKey(int in_id);
+
     // Get a field instance
     // Return: NULL if unknown
     TrackerElement *GetTrackedInstance(string in_name);
@@ -95,11 +105,31 @@ protected:
 
         // Might as well track this for auto-doc
         string field_description;
+
+        // Precomputed JSON object key
+        string json_key;
     };
 
+    // Protects the maps; fields are registered from whichever thread builds
+    // the first instance of a component, and looked up by the webserver
+    pthread_mutex_t entry_mutex;
+
     map<string, reserved_field *> field_name_map;
     map<int, reserved_field *> field_id_map;
 
+    // Lowercased JSON names of the fields; the first field registered under
+    // a name wins if two only differ by '.' and '_'
+    map<string, int> field_json_map;
+
+    // Fields indexed by id for the serializers, in fixed pages which are 
+    // never moved once published, so readers don't need the maps or a lock
+    static const unsigned int field_page_sz = 256;
+    static const unsigned int field_pages = 256;
+    reserved_field **field_page_table[field_pages];
+
+    // Add a new field to the maps and indexes; entry_mutex must be held
+    void IndexField(reserved_field *in_field);
+
 };
 
 #endif
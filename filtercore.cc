@@ -40,6 +40,12 @@ FilterCore::FilterCore(GlobalRegistry *in_globalreg) {
 	pcre_invert = -1;
 	pcre_hit = 0;
 #endif
+
+	pthread_rwlock_init(&filter_rwlock, NULL);
+}
+
+FilterCore::~FilterCore() {
+	pthread_rwlock_destroy(&filter_rwlock);
 }
 
 #define _filter_stacker_none	0
@@ -500,6 +506,8 @@ int FilterCore::AddFilterLine(string filter_str) {
 	}
 
 	// Join all the maps back up with the real filters
+	pthread_rwlock_wrlock(&filter_rwlock);
+
 	negate = local_inverts[_filter_type_bssid];
 	if (negate != -1) {
 		macvec = local_maps[_filter_type_bssid];
@@ -547,6 +555,8 @@ int FilterCore::AddFilterLine(string filter_str) {
 	}
 #endif
 
+	pthread_rwlock_unlock(&filter_rwlock);
+
 	return 1;
 	
 #if 0
@@ -707,30 +717,37 @@ int FilterCore::AddFilterLine(string filter_str) {
 int FilterCore::RunFilter(mac_addr bssidmac, mac_addr sourcemac,
 						  mac_addr destmac) {
 	int hit = 0;
+
+	pthread_rwlock_rdlock(&filter_rwlock);
+
 	// Clumsy artifact of how iters are defined for macmap currently, must
 	// be defined as an assign
 	macmap<int>::iterator fitr = bssid_map.find(bssidmac);
 	
+	// Several dissector threads can hold the read lock at once, so the hit
+	// counts are bumped atomically
 	if ((fitr != bssid_map.end() && bssid_invert == 1) ||
 		(fitr == bssid_map.end() && bssid_invert == 0)) {
-		bssid_hit++;
+		__sync_add_and_fetch(&bssid_hit, 1);
 		hit = 1;
 	}
 
 	fitr = source_map.find(sourcemac);
 	if ((fitr != source_map.end() && source_invert == 1) ||
 		(fitr == source_map.end() && source_invert == 0)) {
-		source_hit++;
+		__sync_add_and_fetch(&source_hit, 1);
 		hit = 1;
 	}
 
 	fitr = dest_map.find(destmac);
 	if ((fitr != dest_map.end() && dest_invert == 1) ||
 		(fitr == dest_map.end() && dest_invert == 0)) {
-		dest_hit++;
+		__sync_add_and_fetch(&dest_hit, 1);
 		hit = 1;
 	}
 
+	pthread_rwlock_unlock(&filter_rwlock);
+
 	return hit;
 }
 
@@ -749,12 +766,18 @@ int FilterCore::RunPcreFilter(string in_text) {
 	int ovector[128];
 	int rc;
 
+	pthread_rwlock_rdlock(&filter_rwlock);
+
 	for (unsigned int x = 0; x < pcre_vec.size(); x++) {
 		rc = pcre_exec(pcre_vec[x]->re, pcre_vec[x]->study, in_text.c_str(),
 					   in_text.length(), 0, 0, ovector, 128);
-		if ((rc >= 0 && pcre_invert == 0) || (rc < 0 && pcre_invert == 1))
+		if ((rc >= 0 && pcre_invert == 0) || (rc < 0 && pcre_invert == 1)) {
+			pthread_rwlock_unlock(&filter_rwlock);
 			return 1;
+		}
 	}
+
+	pthread_rwlock_unlock(&filter_rwlock);
 #endif
 	return 0;
 }
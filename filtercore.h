@@ -28,6 +28,7 @@
 
 #include <stdio.h>
 #include <time.h>
+#include <pthread.h>
 #include <list>
 #include <map>
 #include <vector>
@@ -57,13 +58,14 @@ public:
 
 	FilterCore();
 	FilterCore(GlobalRegistry *in_globalreg);
+	~FilterCore();
 
 	// Add a filter line to a block
 	int AddFilterLine(string filter_str);
 
 	// Run a set of addresses through the filter.  We extract this to the
 	// generic layer here so that we're not necessarily tied to the
-	// packinfo_80211
+	// packinfo_80211.  Safe to call from the dissector threads.
 	int RunFilter(mac_addr bssidmac, mac_addr sourcemac,
 				  mac_addr destmac);
 	// Run the PCRE filters against the incoming text.  This isn't an ifdef since
@@ -80,6 +82,10 @@ public:
 protected:
 	GlobalRegistry *globalreg;
 
+	// Filters run on the dissector threads while new lines can be added from
+	// the main thread, so adding a line takes this for writing
+	pthread_rwlock_t filter_rwlock;
+
 	macmap<int> bssid_map;
 	macmap<int> source_map;
 	macmap<int> dest_map;
@@ -29,6 +29,8 @@ GlobalRegistry::GlobalRegistry() {
 	fatal_condition = 0;
 	spindown = 0;
 
+	packet_clock = 0;
+
 	kismet_instance = KISMET_INSTANCE_SERVER;
 
 	winch = false;
@@ -48,6 +50,7 @@ GlobalRegistry::GlobalRegistry() {
 	packetchain = NULL;
 	alertracker = NULL;
 	timetracker = NULL;
+	reactor = NULL;
 	kisnetserver = NULL;
 	kisdroneserver = NULL;
 	kismet_config = NULL;
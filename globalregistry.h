@@ -38,6 +38,7 @@ class Devicetracker;
 class Packetchain;
 class Alertracker;
 class Timetracker;
+class KisReactor;
 class KisNetFramework;
 class KisDroneFramework;
 class ConfigFile;
@@ -201,6 +202,7 @@ public:
     Packetchain *packetchain;
     Alertracker *alertracker;
     Timetracker *timetracker;
+    KisReactor *reactor;
     KisNetFramework *kisnetserver;
     KisDroneFramework *kisdroneserver;
     ConfigFile *kismet_config;
@@ -238,7 +240,12 @@ public:
 	
     time_t start_time;
     string servername;
+
+	// Current server time, updated from the wall clock each pass through 
+	// the main loop.  When packet_clock is set (during an offline replay) it
+	// follows the packet timestamps instead and the main loop leaves it alone
 	struct timeval timestamp;
+	int packet_clock;
 
 	string homepath;
 
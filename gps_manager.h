@@ -30,7 +30,7 @@
 class Kis_Gps;
 
 // Packet info attached to each packet, if there isn't already GPS info present
-class kis_gps_packinfo : public packet_component {
+class kis_gps_packinfo : public packet_component, public kis_pooled<kis_gps_packinfo> {
 public:
 	kis_gps_packinfo() {
 		self_destruct = 1;
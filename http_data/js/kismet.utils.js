@@ -328,6 +328,16 @@ exports.RRD_HOUR = 3600;
 
 // exports.RRD_DAY = 86400
 
+// Seconds per bin of the minute array of a RRD record; servers may keep the
+// minute at a coarser resolution than one second
+exports.RrdMinuteResolution = function(rrd) {
+    if ('kismet_common_rrd_resolution' in rrd && 
+            rrd['kismet_common_rrd_resolution'] > 0)
+        return rrd['kismet_common_rrd_resolution'];
+
+    return exports.RRD_SECOND;
+}
+
 exports.RecalcRrdData = function(start, now, type, data, opt) {
     var rrd_len = data.length;
 
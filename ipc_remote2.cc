@@ -37,6 +37,9 @@ IPCRemoteV2::IPCRemoteV2(GlobalRegistry *in_globalreg,
     ipchandler = in_rbhandler;
     pipeclient = NULL;
 
+    shm_ring_sz = 0;
+    shmclient = NULL;
+
     remotehandler = (IPCRemoteV2Tracker *) globalreg->FetchGlobal("IPCHANDLER");
 
     if (remotehandler == NULL) {
@@ -53,11 +56,19 @@ IPCRemoteV2::~IPCRemoteV2() {
         local_locker lock(&ipc_locker);
         if (pipeclient != NULL)
             delete(pipeclient);
+
+        if (shmclient != NULL)
+            delete(shmclient);
     }
 
     pthread_mutex_destroy(&ipc_locker);
 }
 
+void IPCRemoteV2::set_shm_ring(size_t in_sz) {
+    local_locker lock(&ipc_locker);
+    shm_ring_sz = in_sz;
+}
+
 void IPCRemoteV2::add_path(string in_path) {
     local_locker lock(&ipc_locker);
     path_vec.push_back(in_path);
@@ -89,6 +100,11 @@ void IPCRemoteV2::close_ipc() {
         delete(pipeclient);
         pipeclient = NULL;
     }
+
+    if (shmclient != NULL) {
+        delete(shmclient);
+        shmclient = NULL;
+    }
 }
 
 int IPCRemoteV2::launch_kis_binary(string cmd, vector<string> args) {
@@ -112,6 +128,11 @@ int IPCRemoteV2::launch_kis_explicit_binary(string cmdpath, vector<string> args)
         pipeclient = NULL;
     }
 
+    if (shmclient != NULL) {
+        delete(shmclient);
+        shmclient = NULL;
+    }
+
     if (stat(cmdpath.c_str(), &buf) < 0) {
         _MSG("IPC could not find binary '" + cmdpath + "'", MSGFLAG_ERROR);
         return -1;
@@ -146,29 +167,68 @@ int IPCRemoteV2::launch_kis_explicit_binary(string cmdpath, vector<string> args)
         return -1;
     }
 
+    // Offer a shared memory ring if we can make one; if not, the helper
+    // just gets the pipes
+    RingbufShm *shmring = NULL;
+
+    if (shm_ring_sz != 0) {
+        shmring = new RingbufShm(shm_ring_sz);
+
+        if (!shmring->valid()) {
+            _MSG("IPC could not create a shared memory ring for '" + cmdpath + 
+                    "', using pipes only", MSGFLAG_INFO);
+            delete(shmring);
+            shmring = NULL;
+        }
+    }
+
     if ((child_pid = fork()) < 0) {
         _MSG("IPC could not fork()", MSGFLAG_ERROR);
+        if (shmring != NULL)
+            delete(shmring);
+        close(inpipepair[0]);
+        close(inpipepair[1]);
+        close(outpipepair[0]);
+        close(outpipepair[1]);
         pthread_mutex_unlock(&ipc_locker);
+        return -1;
     } else if (child_pid == 0) {
         // We're the child process
+        unsigned int argpos = 0;
         
-        // argv[0], "--in-fd" "--out-fd" ... NULL
-        cmdarg = new char*[args.size() + 4];
-        cmdarg[0] = strdup(cmdpath.c_str());
+        // argv[0], "--in-fd" "--out-fd" [ "--shm-ring-fd" "--shm-doorbell-fd" ] 
+        // ... NULL
+        cmdarg = new char*[args.size() + 6];
+        cmdarg[argpos++] = strdup(cmdpath.c_str());
 
         // FD we read from is the read end of the in pair
         arg << "--in-fd=" << inpipepair[1];
-        cmdarg[1] = strdup(arg.str().c_str());
+        cmdarg[argpos++] = strdup(arg.str().c_str());
         arg.str("");
 
         // FD we write to is the write end of the out pair
         arg << "--out-fd=" << outpipepair[0];
-        cmdarg[2] = strdup(arg.str().c_str());
+        cmdarg[argpos++] = strdup(arg.str().c_str());
+        arg.str("");
+
+        if (shmring != NULL) {
+            // Let the ring survive the exec
+            fcntl(shmring->get_ring_fd(), F_SETFD, 0);
+            fcntl(shmring->get_doorbell_fd(), F_SETFD, 0);
+
+            arg << "--shm-ring-fd=" << shmring->get_ring_fd();
+            cmdarg[argpos++] = strdup(arg.str().c_str());
+            arg.str("");
+
+            arg << "--shm-doorbell-fd=" << shmring->get_doorbell_fd();
+            cmdarg[argpos++] = strdup(arg.str().c_str());
+            arg.str("");
+        }
 
         for (unsigned int x = 0; x < args.size(); x++)
-            cmdarg[x+3] = strdup(args[x].c_str());
+            cmdarg[argpos++] = strdup(args[x].c_str());
 
-        cmdarg[args.size() + 3] = NULL;
+        cmdarg[argpos] = NULL;
 
         // Close the remote side of the pipes
         close(inpipepair[0]);
@@ -191,6 +251,13 @@ int IPCRemoteV2::launch_kis_explicit_binary(string cmdpath, vector<string> args)
     // pair.  Confused?
     pipeclient->OpenPipes(outpipepair[0], inpipepair[1]);
 
+    // The handler reads from the ring from now on; pipe data is fed into it
+    // until the helper attaches, and the doorbell wakes us up after
+    if (shmring != NULL) {
+        ipchandler->SetReadBuffer(shmring);
+        shmclient = new ShmRingClient(globalreg, ipchandler, shmring);
+    }
+
     binary_path = cmdpath;
     binary_args = args;
 
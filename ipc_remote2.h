@@ -28,6 +28,7 @@
 #include "globalregistry.h"
 #include "ringbuf_handler.h"
 #include "pipeclient.h"
+#include "ringbuf_shm.h"
 #include "timetracker.h"
 
 /* IPC remote v2
@@ -59,11 +60,19 @@ public:
     // Close down IPC (but don't issue a kill)
     void close_ipc();
 
+    // Offer a shared memory ring of in_sz bytes to kismet compatible binaries
+    // we launch; 0 disables it.  Must be set before launching.
+    void set_shm_ring(size_t in_sz);
+
     // Launch a binary with specified arguments.
     //
     // When launching kismet compatible binaries, IPCRemote will make a 
     // pipe and pass it to the binary via --in-fd= and --out-fd= arguments.
     //
+    // If a shared memory ring is enabled and the platform supports it, the
+    // ring replaces the read buffer of the handler and is passed via
+    // --shm-ring-fd= and --shm-doorbell-fd=; see kis_shm_ring.h.
+    //
     // When launching standard binaries, IPCRemote will map stdin and stdout
     // to the binary.
     //
@@ -98,6 +107,9 @@ protected:
     PipeClient *pipeclient;
     IPCRemoteV2Tracker *remotehandler;
 
+    size_t shm_ring_sz;
+    ShmRingClient *shmclient;
+
     bool tracker_free;
 
     vector<string> path_vec;
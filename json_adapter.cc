@@ -19,12 +19,16 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 #include <time.h>
 #include <list>
 #include <map>
 #include <vector>
 #include <algorithm>
 #include <string>
+#include <cmath>
+#include <stdexcept>
 
 #include "globalregistry.h"
 #include "trackedelement.h"
@@ -34,28 +38,299 @@
 #include "devicetracker_component.h"
 #include "json_adapter.h"
 
-void JsonAdapter::Pack(GlobalRegistry *globalreg, std::stringstream &stream, 
+void JsonAdapter::Pack(GlobalRegistry *globalreg, std::ostream &stream, 
         tracker_component *c) {
     Pack(globalreg, stream, (TrackerElement *) c);
 }
 
+void JsonAdapter::Pack(GlobalRegistry *globalreg, std::ostream &stream,
+    TrackerElement *e, SerializeCacheTags *tags) {
+    Writer writer(globalreg, stream);
+    writer.SetCacheTags(tags);
+    writer.Pack(e);
+}
+
 string JsonAdapter::SanitizeString(string in) {
-    return MultiReplaceAll(in, "\\", "\\\\");
+    string out;
+    char hex[8];
+
+    out.reserve(in.length());
+
+    for (unsigned int x = 0; x < in.length(); x++) {
+        unsigned char c = (unsigned char) in[x];
+
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char) c;
+        } else if (c < 0x20) {
+            snprintf(hex, 8, "\\u%04x", c);
+            out += hex;
+        } else {
+            out += (char) c;
+        }
+    }
+
+    return out;
 }
 
+JsonAdapter::Writer::Writer(GlobalRegistry *in_globalreg, std::ostream &in_stream) :
+    globalreg(in_globalreg), stream(in_stream) {
+    cache_tags = NULL;
+    hold_flush = false;
 
-void JsonAdapter::Pack(GlobalRegistry *globalreg, std::stringstream &stream,
-    TrackerElement *e) {
+    len = 0;
+    cap = flush_sz + 4096;
+    buf = (char *) malloc(cap);
 
-    e->pre_serialize();
+    if (buf == NULL)
+        throw std::runtime_error("Unable to allocate JSON buffer");
+}
+
+JsonAdapter::Writer::~Writer() {
+    Flush();
+    free(buf);
+}
+
+void JsonAdapter::Writer::Flush() {
+    if (len == 0)
+        return;
+
+    stream.write(buf, len);
+    len = 0;
+}
+
+void JsonAdapter::Writer::Grow(size_t in_sz) {
+    size_t ncap = cap * 2;
+
+    if (ncap < in_sz)
+        ncap = in_sz;
+
+    char *nbuf = (char *) realloc(buf, ncap);
+
+    if (nbuf == NULL)
+        throw std::runtime_error("Unable to grow JSON buffer");
+
+    buf = nbuf;
+    cap = ncap;
+}
+
+// Pairs of decimal digits, so integers format two digits per division
+static const char json_digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+void JsonAdapter::Writer::AppendUInt(uint64_t in_v) {
+    if (in_v < 10) {
+        Append((char) ('0' + in_v));
+        return;
+    }
+
+    char tmp[20];
+    unsigned int pos = 20;
+
+    while (in_v >= 100) {
+        unsigned int d = (in_v % 100) * 2;
+        in_v /= 100;
+        tmp[--pos] = json_digit_pairs[d + 1];
+        tmp[--pos] = json_digit_pairs[d];
+    }
+
+    if (in_v >= 10) {
+        unsigned int d = in_v * 2;
+        tmp[--pos] = json_digit_pairs[d + 1];
+        tmp[--pos] = json_digit_pairs[d];
+    } else {
+        tmp[--pos] = '0' + in_v;
+    }
+
+    Append(tmp + pos, 20 - pos);
+}
+
+void JsonAdapter::Writer::AppendInt(int64_t in_v) {
+    if (in_v < 0) {
+        Append('-');
+        // Negate as unsigned so INT64_MIN survives
+        AppendUInt(~((uint64_t) in_v) + 1);
+        return;
+    }
+
+    AppendUInt((uint64_t) in_v);
+}
+
+void JsonAdapter::Writer::AppendDouble(double in_v) {
+    // Same output as iostream 'fixed' at the default precision of 6.  Values
+    // too big to split into integer parts, and nan/inf, go the slow way.
+    if (!(in_v > -1e15 && in_v < 1e15)) {
+        char tmp[384];
+        int r = snprintf(tmp, sizeof(tmp), "%f", in_v);
+
+        if (r > 0)
+            Append(tmp, kismin((size_t) r, sizeof(tmp) - 1));
+
+        return;
+    }
+
+    if (std::signbit(in_v)) {
+        Append('-');
+        in_v = -in_v;
+    }
+
+    double ipart = floor(in_v);
+    uint64_t whole = (uint64_t) ipart;
+    // The fractional part is exact; only the scale rounds
+    uint64_t frac = (uint64_t) nearbyint((in_v - ipart) * 1000000);
+
+    if (frac >= 1000000) {
+        whole++;
+        frac -= 1000000;
+    }
+
+    AppendUInt(whole);
+
+    Reserve(7);
+    buf[len] = '.';
+    for (int x = 6; x >= 1; x--) {
+        buf[len + x] = '0' + (frac % 10);
+        frac /= 10;
+    }
+    len += 7;
+}
+
+void JsonAdapter::Writer::AppendMac(const mac_addr& in_mac, bool in_mask) {
+    static const char hexdigits[] = "0123456789ABCDEF";
 
-    // XXX no, they don't, this only happens when we're a map of some sort,
-    // vectors etc get normal treatment.  Delete this after confirmation.
-    /*
-    // All fields get "name": [value]
-    stream << "\"" << globalreg->entrytracker->GetFieldName(e->get_id()) <<
-        "\":";
-    */
+    Reserve(35);
+
+    for (unsigned int m = 0; m < (in_mask ? 2 : 1); m++) {
+        uint64_t v = m == 0 ? in_mac.longmac : in_mac.longmask;
+
+        if (m != 0)
+            buf[len++] = '/';
+
+        for (int x = MAC_LEN_MAX - 1; x >= 0; x--) {
+            uint8_t b = (v >> (x * 8)) & 0xFF;
+
+            buf[len++] = hexdigits[b >> 4];
+            buf[len++] = hexdigits[b & 0x0F];
+
+            if (x != 0)
+                buf[len++] = ':';
+        }
+    }
+}
+
+void JsonAdapter::Writer::AppendString(const string& in_str) {
+    const char *s = in_str.data();
+    size_t sz = in_str.length();
+    size_t run = 0;
+
+    Reserve(sz + 2);
+    buf[len++] = '"';
+
+    // Copy runs of plain characters in one go, and escape the rest
+    for (size_t x = 0; x < sz; x++) {
+        unsigned char c = (unsigned char) s[x];
+
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+
+        Append(s + run, x - run);
+        run = x + 1;
+
+        if (c == '"' || c == '\\') {
+            Append('\\');
+            Append((char) c);
+        } else {
+            static const char hexdigits[] = "0123456789abcdef";
+            char esc[6] = { '\\', 'u', '0', '0', 
+                hexdigits[c >> 4], hexdigits[c & 0x0F] };
+            Append(esc, 6);
+        }
+    }
+
+    Append(s + run, sz - run);
+    Append('"');
+}
+
+void JsonAdapter::Writer::AppendKey(TrackerElement *e, int in_id) {
+    const string *lname = e->get_local_name_ptr();
+
+    if (lname != NULL && lname->length() != 0) {
+        string tname = *lname;
+        std::replace(tname.begin(), tname.end(), '.', '_');
+        AppendString(tname);
+        Append(": ", 2);
+        return;
+    }
+
+    const string *key = globalreg->entrytracker->GetFieldJsonKey(in_id);
+
+    if (key != NULL) {
+        Append(key->data(), key->length());
+        return;
+    }
+
+    string tname = globalreg->entrytracker->GetFieldName(in_id);
+    std::replace(tname.begin(), tname.end(), '.', '_');
+    AppendString(tname);
+    Append(": ", 2);
+}
+
+bool JsonAdapter::Writer::PackCached(TrackerElement *e) {
+    const SerializeCacheTags::cache_tag *tag = cache_tags->Match(e);
+
+    if (tag == NULL)
+        return false;
+
+    SerializeCache *cache = cache_tags->cache;
+
+    if (cache != NULL && cache->Fetch(tag->object, tag->generation, tag->view,
+                SerializeCache::format_json, cache_tags->now, 
+                &(cache_tags->scratch))) {
+        Append(cache_tags->scratch.data(), cache_tags->scratch.length());
+        return true;
+    }
+
+    // Build the record in the buffer as usual and keep a copy of it; records
+    // don't nest, so nothing under this one is looked up in the cache
+    SerializeCacheTags *saved_tags = cache_tags;
+    size_t start = len;
+
+    if (tag->lock != NULL)
+        tag->lock->mutex_lock();
+
+    cache_tags = NULL;
+    hold_flush = true;
+
+    Pack(e);
+
+    hold_flush = false;
+    cache_tags = saved_tags;
+
+    if (tag->lock != NULL)
+        tag->lock->mutex_unlock();
+
+    if (cache != NULL)
+        cache->Store(tag->object, tag->generation, tag->view, 
+                SerializeCache::format_json, cache_tags->now,
+                buf + start, len - start);
+
+    return true;
+}
+
+void JsonAdapter::Writer::Pack(TrackerElement *e) {
+    if (cache_tags != NULL && PackCached(e))
+        return;
+
+    e->pre_serialize();
 
     TrackerElement::tracked_vector *tvec;
     TrackerElement::vector_iterator vec_iter;
@@ -72,139 +347,133 @@ void JsonAdapter::Pack(GlobalRegistry *globalreg, std::stringstream &stream,
     TrackerElement::tracked_double_map *tdoublemap;
     TrackerElement::double_map_iterator double_map_iter;
 
-    mac_addr mac;
-    uuid euuid;
-
-    string tname;
-
     switch (e->get_type()) {
         case TrackerString:
-            stream << "\"" << SanitizeString(GetTrackerValue<string>(e)) << "\"";
+            AppendString(GetTrackerValue<string>(e));
             break;
         case TrackerInt8:
-            stream << (int) GetTrackerValue<int8_t>(e);
+            AppendInt(GetTrackerValue<int8_t>(e));
             break;
         case TrackerUInt8:
-            stream << (unsigned int) GetTrackerValue<uint8_t>(e);
+            AppendUInt(GetTrackerValue<uint8_t>(e));
             break;
         case TrackerInt16:
-            stream << (int) GetTrackerValue<int16_t>(e);
+            AppendInt(GetTrackerValue<int16_t>(e));
             break;
         case TrackerUInt16:
-            stream << (unsigned int) GetTrackerValue<uint16_t>(e);
+            AppendUInt(GetTrackerValue<uint16_t>(e));
             break;
         case TrackerInt32:
-            stream << GetTrackerValue<int32_t>(e);
+            AppendInt(GetTrackerValue<int32_t>(e));
             break;
         case TrackerUInt32:
-            stream << GetTrackerValue<uint32_t>(e);
+            AppendUInt(GetTrackerValue<uint32_t>(e));
             break;
         case TrackerInt64:
-            stream << GetTrackerValue<int64_t>(e);
+            AppendInt(GetTrackerValue<int64_t>(e));
             break;
         case TrackerUInt64:
-            stream << GetTrackerValue<uint64_t>(e);
+            AppendUInt(GetTrackerValue<uint64_t>(e));
             break;
         case TrackerFloat:
-            stream << fixed << GetTrackerValue<float>(e);
+            AppendDouble(GetTrackerValue<float>(e));
             break;
         case TrackerDouble:
-            stream << fixed << GetTrackerValue<double>(e);
+            AppendDouble(GetTrackerValue<double>(e));
             break;
         case TrackerMac:
-            mac = GetTrackerValue<mac_addr>(e);
             // Mac is quoted as a string value
-            stream << "\"" << mac.MacFull2String() << "\"";
+            Append('"');
+            AppendMac(GetTrackerValue<mac_addr>(e), true);
+            Append('"');
             break;
         case TrackerUuid:
-            euuid = GetTrackerValue<uuid>(e);
             // UUID is quoted as a string value
-            stream << "\"" << euuid.UUID2String() << "\"";
+            AppendString(GetTrackerValue<uuid>(e).UUID2String());
             break;
         case TrackerVector:
             tvec = e->get_vector();
-            stream << "[";
+            Append('[');
             for (vec_iter = tvec->begin(); vec_iter != tvec->end(); /* */ ) {
-                JsonAdapter::Pack(globalreg, stream, *vec_iter);
+                Pack(*vec_iter);
                 if (++vec_iter != tvec->end())
-                    stream << ",";
+                    Append(',');
+
+                // Stream long lists out as we go
+                if (len >= flush_sz && !hold_flush)
+                    Flush();
             }
-            stream << "]";
+            Append(']');
             break;
         case TrackerMap:
             tmap = e->get_map();
-            stream << "{";
+            Append('{');
             for (map_iter = tmap->begin(); map_iter != tmap->end(); /* */) {
-                if ((tname = map_iter->second->get_local_name()) == "")
-                    tname = globalreg->entrytracker->GetFieldName(map_iter->first);
-
-                // JSON is special, and considers '.' to be a path separator, so
-                // change all our '.' to '_'.
-                std::replace(tname.begin(), tname.end(), '.', '_');
-
-                tname = SanitizeString(tname);
-
-                stream << "\"" << 
-                    tname <<
-                    "\": ";
-                JsonAdapter::Pack(globalreg, stream, map_iter->second);
+                AppendKey(map_iter->second, map_iter->first);
+                Pack(map_iter->second);
                 if (++map_iter != tmap->end()) // Increment iter in loop
-                    stream << ",";
+                    Append(',');
             }
-            stream << "}";
+            Append('}');
             break;
         case TrackerIntMap:
             tmap = e->get_intmap();
-            stream << "{";
+            Append('{');
             for (map_iter = tmap->begin(); map_iter != tmap->end(); /* */) {
                 // Integer dictionary keys in json are still quoted as strings
-                stream << "\"" << map_iter->first << "\": ";
-                JsonAdapter::Pack(globalreg, stream, map_iter->second);
+                Append('"');
+                AppendInt(map_iter->first);
+                Append("\": ", 3);
+                Pack(map_iter->second);
                 if (++map_iter != tmap->end()) // Increment iter in loop
-                    stream << ",";
+                    Append(',');
             }
-            stream << "}";
+            Append('}');
             break;
         case TrackerMacMap:
             tmacmap = e->get_macmap();
-            stream << "{";
+            Append('{');
             for (mac_map_iter = tmacmap->begin(); 
                     mac_map_iter != tmacmap->end(); /* */) {
                 // Mac keys are strings and we push only the mac not the mask */
-                stream << "\"" << mac_map_iter->first.Mac2String() << "\": ";
-                JsonAdapter::Pack(globalreg, stream, mac_map_iter->second);
+                Append('"');
+                AppendMac(mac_map_iter->first, false);
+                Append("\": ", 3);
+                Pack(mac_map_iter->second);
                 if (++mac_map_iter != tmacmap->end())
-                    stream << ",";
+                    Append(',');
             }
-            stream << "}";
+            Append('}');
             break;
         case TrackerStringMap:
             tstringmap = e->get_stringmap();
-            stream << "{";
+            Append('{');
             for (string_map_iter = tstringmap->begin();
                     string_map_iter != tstringmap->end(); /* */) {
-                stream << "\"" << string_map_iter->first << "\": ";
-                JsonAdapter::Pack(globalreg, stream, string_map_iter->second);
+                AppendString(string_map_iter->first);
+                Append(": ", 2);
+                Pack(string_map_iter->second);
                 if (++string_map_iter != tstringmap->end())
-                    stream << ",";
+                    Append(',');
             }
-            stream << "}";
+            Append('}');
             break;
         case TrackerDoubleMap:
             tdoublemap = e->get_doublemap();
-            stream << "{";
+            Append('{');
             for (double_map_iter = tdoublemap->begin();
                     double_map_iter != tdoublemap->end(); /* */) {
                 // Double keys are handled as strings in json
-                stream << "\"" << double_map_iter->first << "\": ";
-                JsonAdapter::Pack(globalreg, stream, double_map_iter->second);
+                Append('"');
+                AppendDouble(double_map_iter->first);
+                Append("\": ", 3);
+                Pack(double_map_iter->second);
                 if (++double_map_iter != tdoublemap->end())
-                    stream << ",";
+                    Append(',');
             }
-            stream << "}";
+            Append('}');
             break;
         default:
             break;
-
     }
 }
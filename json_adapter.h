@@ -21,26 +21,101 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include "globalregistry.h"
 #include "trackedelement.h"
 #include "devicetracker_component.h"
+#include "serialize_cache.h"
 #include "json_adapter.h"
 
 namespace JsonAdapter {
 
-void Pack(GlobalRegistry *globalreg, std::stringstream &stream, TrackerElement *e);
+void Pack(GlobalRegistry *globalreg, std::ostream &stream, TrackerElement *e,
+        SerializeCacheTags *tags = NULL);
 
-void Pack(GlobalRegistry *globalreg, std::stringstream &stream, tracker_component *c);
+void Pack(GlobalRegistry *globalreg, std::ostream &stream, tracker_component *c);
 
+// Escape a string for inclusion in a JSON string value
 string SanitizeString(string in);
 
+// JSON writer
+//
+// Builds the JSON text in a contiguous buffer with hand-rolled number, MAC,
+// and string formatting, and hands it to the output stream in large blocks
+// instead of going through ostream formatting for every value.  Map keys come
+// pre-escaped and pre-quoted from the entry tracker.
+class Writer {
+public:
+    Writer(GlobalRegistry *in_globalreg, std::ostream &in_stream);
+    ~Writer();
+
+    void Pack(TrackerElement *e);
+
+    // Send everything buffered so far to the stream
+    void Flush();
+
+    // Copy tagged records from the serialization cache, and cache the ones
+    // which miss, locking the components they were built from
+    void SetCacheTags(SerializeCacheTags *in_tags) {
+        cache_tags = in_tags;
+    }
+
+protected:
+    // Hand the buffer to the stream once it gets this big, so large lists
+    // still stream out as they're written
+    static const size_t flush_sz = 65536;
+
+    void Grow(size_t in_sz);
+
+    inline void Reserve(size_t in_sz) {
+        if (len + in_sz > cap)
+            Grow(len + in_sz);
+    }
+
+    inline void Append(const char *in_data, size_t in_sz) {
+        Reserve(in_sz);
+        memcpy(buf + len, in_data, in_sz);
+        len += in_sz;
+    }
+
+    inline void Append(char in_c) {
+        Reserve(1);
+        buf[len++] = in_c;
+    }
+
+    void AppendUInt(uint64_t in_v);
+    void AppendInt(int64_t in_v);
+    void AppendDouble(double in_v);
+    void AppendMac(const mac_addr& in_mac, bool in_mask);
+    void AppendString(const string& in_str);
+    void AppendKey(TrackerElement *e, int in_id);
+
+    // Pack a tagged record through the cache; returns false if the element
+    // isn't tagged
+    bool PackCached(TrackerElement *e);
+
+    GlobalRegistry *globalreg;
+    std::ostream &stream;
+
+    char *buf;
+    size_t len;
+    size_t cap;
+
+    SerializeCacheTags *cache_tags;
+
+    // A record is being captured for the cache and has to stay in the
+    // buffer until it's complete
+    bool hold_flush;
+};
+
 class Serializer : public TrackerElementSerializer {
 public:
-    Serializer(GlobalRegistry *in_globalreg, std::stringstream &in_stream) : 
+    Serializer(GlobalRegistry *in_globalreg, std::ostream &in_stream) : 
         TrackerElementSerializer(in_globalreg, in_stream) { }
 
     virtual void serialize(TrackerElement *in_elem) {
-        Pack(globalreg, stream, in_elem);
+        Pack(globalreg, stream, in_elem, cache_tags);
     }
 };
 
@@ -22,11 +22,28 @@
 #include "simple_datasource_proto.h"
 #include "endian_magic.h"
 #include "configfile.h"
+#include "ringbuf_spsc.h"
 
 #ifdef HAVE_LIBPCRE
 #include <pcre.h>
 #endif
 
+#include <signal.h>
+
+// Capture thread entry point
+void *kisdatasource_capture_thread(void *arg) {
+    KisDataSource *source = (KisDataSource *) arg;
+
+    // Leave signal handling to the main thread
+    sigset_t sset;
+    sigfillset(&sset);
+    pthread_sigmask(SIG_BLOCK, &sset, NULL);
+
+    source->capture_thread();
+
+    return NULL;
+}
+
 KisDataSource::KisDataSource(GlobalRegistry *in_globalreg) :
     tracker_component(in_globalreg, 0) {
     globalreg = in_globalreg;
@@ -38,6 +55,14 @@ KisDataSource::KisDataSource(GlobalRegistry *in_globalreg) :
 
     pthread_mutex_init(&source_lock, NULL);
 
+    pthread_mutex_init(&capture_lock, NULL);
+    pthread_cond_init(&capture_cond, NULL);
+    capture_running = false;
+    capture_shutdown = false;
+    capture_pending = false;
+    capture_queue_wait =
+        globalreg->kismet_config->FetchOptUInt("datasource_queue_wait", 100);
+
     probe_callback = NULL;
     probe_aux = NULL;
 
@@ -54,6 +79,8 @@ KisDataSource::KisDataSource(GlobalRegistry *in_globalreg) :
 
     ipchandler = NULL;
     source_ipc = NULL;
+
+    ipc_crc32c = false;
 }
 
 KisDataSource::~KisDataSource() {
@@ -65,12 +92,17 @@ KisDataSource::~KisDataSource() {
     }
 
     pthread_mutex_destroy(&source_lock);
+
+    pthread_mutex_destroy(&capture_lock);
+    pthread_cond_destroy(&capture_cond);
 }
 
 void KisDataSource::close_source() {
     cancel_probe_source();
     cancel_open_source();
 
+    stop_capture_thread();
+
     if (source_ipc != NULL) {
         source_ipc->close_ipc();
         source_ipc->soft_kill();
@@ -144,86 +176,444 @@ void KisDataSource::register_fields() {
     num_reports_id =
         RegisterField("kismet.datasource.num_reports", TrackerUInt64,
                 "number of packtes/device reports", (void **) &num_reports);
+
+    source_threaded_id =
+        RegisterField("kismet.datasource.threaded", TrackerUInt8,
+                "source is decoded on its own capture thread (bool)",
+                (void **) &source_threaded);
+    source_affinity_id =
+        RegisterField("kismet.datasource.affinity", TrackerString,
+                "CPUs the capture thread is pinned to", 
+                (void **) &source_affinity);
+    queue_drops_id =
+        RegisterField("kismet.datasource.queue_drops", TrackerUInt64,
+                "packets dropped because the packet chain was full",
+                (void **) &queue_drops);
 }
 
-void KisDataSource::BufferAvailable(size_t in_amt) {
-    simple_cap_proto_t *frame_header;
-    uint8_t *buf;
-    uint32_t frame_sz;
-    uint32_t frame_checksum, calc_checksum;
+void KisDataSource::parse_capture_options(string in_definition) {
+    vector<opt_pair> opt_vec;
+    size_t cpos = in_definition.find(":");
+
+    if (cpos != string::npos)
+        StringToOpts(in_definition.substr(cpos + 1), ",", &opt_vec);
+
+    set_source_threaded(FetchOptBoolean("threaded", &opt_vec,
+                globalreg->kismet_config->FetchOptBoolean("datasource_threads", 0)));
+
+    capture_cpus.clear();
+
+    string affinity = FetchOpt("affinity", &opt_vec);
+    set_source_affinity(affinity);
 
-    if (in_amt < sizeof(simple_cap_proto_t)) {
+    if (affinity == "")
         return;
+
+    // cpu[,cpu-cpu...]
+    vector<string> cpu_vec = StrTokenize(affinity, ",");
+
+    for (unsigned int x = 0; x < cpu_vec.size(); x++) {
+        unsigned int first, last;
+
+        if (sscanf(cpu_vec[x].c_str(), "%u-%u", &first, &last) == 2) {
+            for (unsigned int c = first; c <= last; c++)
+                capture_cpus.push_back(c);
+        } else if (sscanf(cpu_vec[x].c_str(), "%u", &first) == 1) {
+            capture_cpus.push_back(first);
+        } else {
+            _MSG("Datasource '" + get_source_name() + "' could not parse CPU "
+                    "affinity '" + affinity + "', expected a list of CPUs "
+                    "such as affinity=\"0,2-3\"", MSGFLAG_ERROR);
+            capture_cpus.clear();
+            set_source_affinity("");
+            return;
+        }
     }
+}
+
+void KisDataSource::start_capture_thread() {
+    if (!get_source_threaded())
+        return;
+
+    // Deferred frames come back through the reactor
+    if (globalreg->reactor == NULL)
+        return;
+
+    local_locker lock(&capture_lock);
 
-    // Peek the buffer
-    buf = new uint8_t[in_amt];
-    ipchandler->PeekReadBufferData(buf, in_amt);
+    if (capture_running)
+        return;
 
-    frame_header = (simple_cap_proto_t *) buf;
+    capture_shutdown = false;
+    // There may already be data waiting
+    capture_pending = true;
+    deferred_frames.clear();
+    deferred_error = "";
 
-    if (kis_ntoh32(frame_header->signature) != KIS_CAP_SIMPLE_PROTO_SIG) {
-        // TODO kill connection or seek for valid
-        delete[] buf;
+    if (pthread_create(&capture_tid, NULL, kisdatasource_capture_thread, this) != 0) {
+        _MSG("Datasource '" + get_source_name() + "' failed to launch capture "
+                "thread, decoding in the main thread: " + 
+                string(strerror(errno)), MSGFLAG_ERROR);
         return;
     }
 
-    frame_sz = kis_ntoh32(frame_header->packet_sz);
+    capture_running = true;
+
+    globalreg->reactor->AddWakeupHandler(this);
 
-    if (frame_sz > in_amt) {
-        // Nothing we can do right now, not enough data to make up a
-        // complete packet.
-        delete[] buf;
+    if (capture_cpus.size() == 0)
         return;
+
+#ifdef SYS_LINUX
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+
+    for (unsigned int x = 0; x < capture_cpus.size(); x++) {
+        if (capture_cpus[x] < CPU_SETSIZE)
+            CPU_SET(capture_cpus[x], &cpuset);
+    }
+
+    int err;
+    if ((err = pthread_setaffinity_np(capture_tid, sizeof(cpu_set_t), &cpuset)) != 0) {
+        _MSG("Datasource '" + get_source_name() + "' could not set capture thread "
+                "CPU affinity to '" + get_source_affinity() + "': " +
+                string(strerror(err)), MSGFLAG_ERROR);
+    }
+#else
+    _MSG("Datasource '" + get_source_name() + "' requested CPU affinity, which "
+            "is not supported on this platform", MSGFLAG_ERROR);
+#endif
+}
+
+void KisDataSource::stop_capture_thread() {
+    {
+        local_locker lock(&capture_lock);
+
+        if (!capture_running)
+            return;
+
+        capture_shutdown = true;
+        pthread_cond_signal(&capture_cond);
+    }
+
+    pthread_join(capture_tid, NULL);
+
+    if (globalreg->reactor != NULL)
+        globalreg->reactor->RemoveWakeupHandler(this);
+
+    {
+        local_locker lock(&capture_lock);
+
+        capture_running = false;
+        deferred_frames.clear();
+        deferred_error = "";
+    }
+}
+
+void KisDataSource::capture_thread() {
+    pthread_mutex_lock(&capture_lock);
+
+    while (1) {
+        while (!capture_shutdown && !capture_pending)
+            pthread_cond_wait(&capture_cond, &capture_lock);
+
+        if (capture_shutdown)
+            break;
+
+        capture_pending = false;
+
+        pthread_mutex_unlock(&capture_lock);
+        drain_read_buffer(true);
+        pthread_mutex_lock(&capture_lock);
+    }
+
+    pthread_mutex_unlock(&capture_lock);
+}
+
+void KisDataSource::ReactorEvent(int in_fd __attribute__((unused)),
+        unsigned int in_events __attribute__((unused))) {
+    deque<vector<uint8_t> > frames;
+    string error;
+
+    {
+        local_locker lock(&capture_lock);
+        frames.swap(deferred_frames);
+        error.swap(deferred_error);
+    }
+
+    for (deque<vector<uint8_t> >::iterator i = frames.begin();
+            i != frames.end(); ++i) {
+        if (dispatch_frame(&((*i)[0]), i->size(), false) == 0) {
+            local_locker lock(&source_lock);
+            inc_ipc_errors(1);
+        }
     }
 
+    if (error.length() != 0)
+        BufferError(error);
+}
+
+void KisDataSource::inject_packet(kis_packet *in_pack) {
+    int ret;
+
+    // The capture thread waits for room in the chain rather than dropping
+    // straight away.  capture_running and capture_tid are set before the
+    // capture thread can get past capture_lock, and only change once it's
+    // gone.
+    if (capture_running && pthread_equal(pthread_self(), capture_tid))
+        ret = packetchain->QueuePacket(in_pack, capture_queue_wait);
+    else
+        ret = packetchain->ProcessPacket(in_pack);
+
+    if (ret == 0) {
+        local_locker lock(&source_lock);
+        inc_queue_drops(1);
+    }
+}
+
+void KisDataSource::BufferAvailable(size_t in_amt __attribute__((unused))) {
+    {
+        local_locker lock(&capture_lock);
+
+        if (capture_running) {
+            capture_pending = true;
+            pthread_cond_signal(&capture_cond);
+            return;
+        }
+    }
+
+    drain_read_buffer(false);
+}
+
+void KisDataSource::drain_read_buffer(bool in_capture_thread) {
+    simple_cap_proto_t frame_header;
+    uint8_t *frame;
+    size_t buf_used, contig_sz;
+    uint32_t frame_sz;
+
+    // Decode every complete frame in the buffer
+    while (1) {
+        if (in_capture_thread) {
+            local_locker lock(&capture_lock);
+
+            if (capture_shutdown)
+                return;
+        }
+
+        buf_used = ipchandler->GetReadBufferUsed();
+
+        if (buf_used < sizeof(simple_cap_proto_t))
+            return;
+
+        // The header may wrap, so peek a copy of it
+        ipchandler->PeekReadBufferData(&frame_header, sizeof(simple_cap_proto_t));
+
+        uint32_t signature = kis_ntoh32(frame_header.signature);
+
+        if (signature != KIS_CAP_SIMPLE_PROTO_SIG &&
+                signature != KIS_CAP_SIMPLE_PROTO_SIG_CRC32C) {
+            // TODO kill connection or seek for valid
+            local_locker lock(&source_lock);
+            inc_ipc_errors(1);
+            return;
+        }
+
+        frame_sz = kis_ntoh32(frame_header.packet_sz);
+
+        if (frame_sz < sizeof(simple_cap_proto_t)) {
+            local_locker lock(&source_lock);
+            inc_ipc_errors(1);
+            return;
+        }
+
+        if (frame_sz > ipchandler->GetReadBufferSize()) {
+            // This frame can never be completed, and nothing behind it can
+            // be read
+            stringstream ss;
+            ss << "Datasource '" << get_source_name() << "' got a " << 
+                frame_sz << " byte frame, larger than the " << 
+                ipchandler->GetReadBufferSize() << " byte IPC buffer";
+
+            {
+                local_locker lock(&source_lock);
+                inc_ipc_errors(1);
+            }
+
+            if (!in_capture_thread) {
+                BufferError(ss.str());
+                return;
+            }
+
+            bool wake = false;
+
+            {
+                local_locker lock(&capture_lock);
+
+                if (deferred_error.length() == 0) {
+                    deferred_error = ss.str();
+                    wake = true;
+                }
+            }
+
+            if (wake)
+                globalreg->reactor->Wakeup();
+
+            return;
+        }
+
+        if (frame_sz > buf_used) {
+            // Nothing we can do right now, not enough data to make up a
+            // complete packet.
+            return;
+        }
+
+        // Decode in place if the frame is contiguous in the ring, which it
+        // is unless it wraps around the end
+        contig_sz = ipchandler->ZeroCopyPeekReadBufferData((void **) &frame, 
+                frame_sz);
+
+        if (contig_sz < frame_sz) {
+            if (frame_scratch.size() < frame_sz)
+                frame_scratch.resize(frame_sz);
+
+            ipchandler->PeekReadBufferData(&(frame_scratch[0]), frame_sz);
+            frame = &(frame_scratch[0]);
+        }
+
+        int valid = 0;
+
+        if (check_frame(frame, frame_sz))
+            valid = dispatch_frame(frame, frame_sz, in_capture_thread);
+
+        if (valid < 0) {
+            // Copy it out for the main thread before it's consumed
+            {
+                local_locker lock(&capture_lock);
+                deferred_frames.push_back(vector<uint8_t>(frame, frame + frame_sz));
+            }
+
+            globalreg->reactor->Wakeup();
+        }
+
+        // Consume the packet in the ringbuf; the kv pairs borrowed from it are
+        // gone by now
+        ipchandler->ConsumeReadBufferData(frame_sz);
+
+        if (valid == 0) {
+            // TODO report invalid frame and disconnect
+            local_locker lock(&source_lock);
+            inc_ipc_errors(1);
+        }
+    }
+}
+
+bool KisDataSource::handle_frame(uint8_t *in_frame, size_t in_frame_sz) {
+    if (!check_frame(in_frame, in_frame_sz))
+        return false;
+
+    return dispatch_frame(in_frame, in_frame_sz, false) != 0;
+}
+
+bool KisDataSource::check_frame(uint8_t *in_frame, size_t in_frame_sz) {
+    simple_cap_proto_t *frame_header = (simple_cap_proto_t *) in_frame;
+    uint32_t frame_checksum, calc_checksum;
+
     // Get the checksum
     frame_checksum = kis_ntoh32(frame_header->checksum);
 
-    // Zero the checksum field in the packet
+    // Zero the checksum field in the packet; the frame is ours until we
+    // consume it, so this is safe to do in place
     frame_header->checksum = 0x00000000;
 
-    // Calc the checksum of the rest
-    calc_checksum = Adler32Checksum((const char *) buf, frame_sz);
+    // Calc the checksum of the rest, with whichever checksum the capture
+    // binary chose
+    bool crc32c = 
+        (kis_ntoh32(frame_header->signature) == KIS_CAP_SIMPLE_PROTO_SIG_CRC32C);
+
+    if (crc32c)
+        calc_checksum = Crc32cChecksum((const char *) in_frame, in_frame_sz);
+    else
+        calc_checksum = Adler32Checksum((const char *) in_frame, in_frame_sz);
 
     // Compare to the saved checksum
     if (calc_checksum != frame_checksum) {
-        // TODO report invalid checksum and disconnect
-        delete[] buf;
-        return;
+        return false;
+    }
+
+    // Answer in kind
+    if (crc32c) {
+        local_locker lock(&source_lock);
+        ipc_crc32c = true;
     }
 
-    // Consume the packet in the ringbuf 
-    ipchandler->GetReadBufferData(NULL, frame_sz);
+    return true;
+}
 
-    // Extract the kv pairs
+int KisDataSource::dispatch_frame(uint8_t *in_frame, size_t in_frame_sz,
+        bool in_capture_thread) {
+    simple_cap_proto_t *frame_header = (simple_cap_proto_t *) in_frame;
+
+    // Extract the kv pairs, borrowing their data from the frame
     KVmap kv_map;
+    bool valid = true;
+
+    size_t data_offt = 0;
+    size_t data_sz = in_frame_sz - sizeof(simple_cap_proto_t);
 
-    ssize_t data_offt = 0;
     for (unsigned int kvn = 0; kvn < kis_ntoh32(frame_header->num_kv_pairs); kvn++) {
+        if (data_offt + sizeof(simple_cap_proto_kv_h_t) > data_sz) {
+            valid = false;
+            break;
+        }
+
         simple_cap_proto_kv *pkv =
             (simple_cap_proto_kv *) &((frame_header->data)[data_offt]);
 
-        data_offt = 
+        data_offt += 
             sizeof(simple_cap_proto_kv_h_t) +
             kis_ntoh32(pkv->header.obj_sz);
 
+        if (data_offt > data_sz) {
+            valid = false;
+            break;
+        }
+
         KisDataSource_CapKeyedObject *kv =
             new KisDataSource_CapKeyedObject(pkv);
 
-        kv_map[StrLower(kv->key)] = kv;
+        KVmap::iterator ki = kv_map.find(kv->key);
+        if (ki != kv_map.end()) {
+            delete ki->second;
+            ki->second = kv;
+        } else {
+            kv_map.insert(KVpair(kv->key, kv));
+        }
     }
 
-    char ctype[17];
-    snprintf(ctype, 17, "%s", frame_header->type);
-    handle_packet(ctype, kv_map);
+    int ret = valid ? 1 : 0;
+
+    if (valid) {
+        char ctype[17];
+        snprintf(ctype, 17, "%s", frame_header->type);
+
+        if (in_capture_thread) {
+            string ltype = StrLower(ctype);
+
+            // Callbacks and messages belong to the main thread
+            if ((ltype != "data" && ltype != "packets") ||
+                    kv_map.find("message") != kv_map.end())
+                ret = -1;
+        }
+
+        if (ret > 0)
+            handle_packet(ctype, kv_map);
+    }
 
     for (KVmap::iterator i = kv_map.begin(); i != kv_map.end(); ++i) {
         delete i->second;
     }
 
-    delete[] buf;
-
+    return ret;
 }
 
 void KisDataSource::BufferError(string in_error) {
@@ -308,6 +698,8 @@ bool KisDataSource::write_ipc_packet(string in_type, KVmap *in_kvpairs) {
 
         // Add the total size
         kvpair_len += sizeof(simple_cap_proto_kv_h_t) + i->second->size;
+
+        proto_kvpairs.push_back(kvt);
     }
 
     // Make the container packet
@@ -315,8 +707,6 @@ bool KisDataSource::write_ipc_packet(string in_type, KVmap *in_kvpairs) {
 
     ret = (simple_cap_proto_t *) new char[pack_len];
 
-    ret->signature = kis_hton32(KIS_CAP_SIMPLE_PROTO_SIG);
-   
     // Prep the checksum with 0
     ret->checksum = 0;
 
@@ -337,23 +727,32 @@ bool KisDataSource::write_ipc_packet(string in_type, KVmap *in_kvpairs) {
         kvpair_offt += len;
 
         // Delete it as we go
-        delete(proto_kvpairs[i]);
+        delete[] (char *) proto_kvpairs[i];
     }
 
-    // Calculate the checksum with it pre-populated as 0x0
-    uint32_t calc_checksum;
-    calc_checksum = Adler32Checksum((const char *) ret, pack_len);
-
-    ret->checksum = kis_hton32(calc_checksum);
-
     size_t ret_sz;
 
     {
         // Lock & send to the IPC ringbuffer
         local_locker lock(&source_lock);
+
+        // Calculate the checksum with it pre-populated as 0x0, using CRC32C
+        // once the capture binary has shown it understands it
+        uint32_t calc_checksum;
+
+        if (ipc_crc32c) {
+            ret->signature = kis_hton32(KIS_CAP_SIMPLE_PROTO_SIG_CRC32C);
+            calc_checksum = Crc32cChecksum((const char *) ret, pack_len);
+        } else {
+            ret->signature = kis_hton32(KIS_CAP_SIMPLE_PROTO_SIG);
+            calc_checksum = Adler32Checksum((const char *) ret, pack_len);
+        }
+
+        ret->checksum = kis_hton32(calc_checksum);
+
         ret_sz = ipchandler->PutWriteBufferData(ret, pack_len, true);
 
-        delete ret;
+        delete[] (char *) ret;
     }
 
     if (ret_sz != pack_len)
@@ -378,6 +777,9 @@ void KisDataSource::cancel_error_handler() {
 
 bool KisDataSource::probe_source(string in_source, probe_handler in_cb,
         void *in_aux) {
+    // The capture thread takes the source lock, so stop it before we do
+    stop_capture_thread();
+
     local_locker lock(&source_lock);
 
     // Fail out an existing callback
@@ -402,6 +804,9 @@ bool KisDataSource::probe_source(string in_source, probe_handler in_cb,
 
 bool KisDataSource::open_source(string in_definition, open_handler in_cb, 
         void *in_aux) {
+    // The capture thread takes the source lock, so stop it before we do
+    stop_capture_thread();
+
     local_locker lock(&source_lock);
 
     // Fail out any existing callback
@@ -414,6 +819,7 @@ bool KisDataSource::open_source(string in_definition, open_handler in_cb,
     open_aux = in_aux;
 
     set_source_definition(in_definition);
+    parse_capture_options(in_definition);
 
     // Launch the IPC, fail immediately if we can't
     if (!spawn_ipc()) {
@@ -435,6 +841,45 @@ bool KisDataSource::open_source(string in_definition, open_handler in_cb,
 
     kvmap->insert(KVpair("DEFINITION", definition));
 
+    // Tell the capture binary how it may batch packets
+    stringstream stream;
+    msgpack::packer<std::stringstream> packer(&stream);
+
+    packer.pack_map(3);
+    packer.pack(string("latency_ms"));
+    packer.pack((unsigned int) 
+            globalreg->kismet_config->FetchOptUInt("datasource_batch_latency", 50));
+    packer.pack(string("max_packets"));
+    packer.pack((unsigned int)
+            globalreg->kismet_config->FetchOptUInt("datasource_batch_packets", 256));
+    // A batch has to fit in our read buffer with room to spare, whatever
+    // the packet count
+    packer.pack(string("max_bytes"));
+    packer.pack((unsigned int) (KIS_DATASOURCE_IPC_BUFFER / 2));
+
+    KisDataSource_CapKeyedObject *batch =
+        new KisDataSource_CapKeyedObject("BATCH", stream.str().data(),
+                stream.str().length());
+
+    kvmap->insert(KVpair("BATCH", batch));
+
+    // Offer CRC32C frames if we can check them in hardware; otherwise it's
+    // no faster than the original checksum
+    if (Crc32cHardware()) {
+        stringstream csum_stream;
+        msgpack::packer<std::stringstream> csum_packer(&csum_stream);
+
+        csum_packer.pack_array(2);
+        csum_packer.pack(string("crc32c"));
+        csum_packer.pack(string("adler32"));
+
+        KisDataSource_CapKeyedObject *checksum =
+            new KisDataSource_CapKeyedObject("CHECKSUM", csum_stream.str().data(),
+                    csum_stream.str().length());
+
+        kvmap->insert(KVpair("CHECKSUM", checksum));
+    }
+
     queue_ipc_command("OPENDEVICE", kvmap);
 
     return true;
@@ -517,7 +962,7 @@ void KisDataSource::set_channel_hop(vector<string> in_channel_list,
     queue_ipc_command("CONFIGURE", kvmap);
 }
 
-void KisDataSource::handle_packet(string in_type, KVmap in_kvmap) {
+void KisDataSource::handle_packet(string in_type, KVmap &in_kvmap) {
     string ltype = StrLower(in_type);
 
     if (ltype == "status")
@@ -532,9 +977,11 @@ void KisDataSource::handle_packet(string in_type, KVmap in_kvmap) {
         handle_packet_message(in_kvmap);
     else if (ltype == "data")
         handle_packet_data(in_kvmap);
+    else if (ltype == "packets")
+        handle_packet_packets(in_kvmap);
 }
 
-void KisDataSource::handle_packet_status(KVmap in_kvpairs) {
+void KisDataSource::handle_packet_status(KVmap &in_kvpairs) {
     KVmap::iterator i;
     
     if ((i = in_kvpairs.find("message")) != in_kvpairs.end()) {
@@ -546,7 +993,7 @@ void KisDataSource::handle_packet_status(KVmap in_kvpairs) {
 
 }
 
-void KisDataSource::handle_packet_probe_resp(KVmap in_kvpairs) {
+void KisDataSource::handle_packet_probe_resp(KVmap &in_kvpairs) {
     KVmap::iterator i;
 
     // Process any messages
@@ -578,7 +1025,7 @@ void KisDataSource::handle_packet_probe_resp(KVmap in_kvpairs) {
     source_ipc->close_ipc();
 }
 
-void KisDataSource::handle_packet_open_resp(KVmap in_kvpairs) {
+void KisDataSource::handle_packet_open_resp(KVmap &in_kvpairs) {
     KVmap::iterator i;
 
     // Process any messages
@@ -608,7 +1055,7 @@ void KisDataSource::handle_packet_open_resp(KVmap in_kvpairs) {
 
 }
 
-void KisDataSource::handle_packet_error(KVmap in_kvpairs) {
+void KisDataSource::handle_packet_error(KVmap &in_kvpairs) {
     KVmap::iterator i;
 
     // Process any messages
@@ -632,7 +1079,7 @@ void KisDataSource::handle_packet_error(KVmap in_kvpairs) {
 }
 
 
-void KisDataSource::handle_packet_message(KVmap in_kvpairs) {
+void KisDataSource::handle_packet_message(KVmap &in_kvpairs) {
     KVmap::iterator i;
 
     // Process any messages
@@ -641,7 +1088,7 @@ void KisDataSource::handle_packet_message(KVmap in_kvpairs) {
     }
 }
 
-void KisDataSource::handle_packet_data(KVmap in_kvpairs) {
+void KisDataSource::handle_packet_data(KVmap &in_kvpairs) {
     KVmap::iterator i;
 
     kis_packet *packet = NULL;
@@ -681,12 +1128,48 @@ void KisDataSource::handle_packet_data(KVmap in_kvpairs) {
     }
 
     // Update the last valid report time
-    inc_num_reports(1);
-    set_last_report_time(globalreg->timestamp.tv_sec);
+    {
+        local_locker lock(&source_lock);
+        inc_num_reports(1);
+        set_last_report_time(globalreg->timestamp.tv_sec);
+    }
     
     // Inject the packet into the packetchain if we have one
-    packetchain->ProcessPacket(packet);
+    inject_packet(packet);
+
+}
+
+void KisDataSource::handle_packet_packets(KVmap &in_kvpairs) {
+    KVmap::iterator i;
+
+    kis_gps_packinfo *gpsinfo = NULL;
+
+    // Process any messages
+    if ((i = in_kvpairs.find("message")) != in_kvpairs.end()) {
+        handle_kv_message(i->second);
+    }
+
+    // One GPS record covers the whole batch
+    if ((i = in_kvpairs.find("gps")) != in_kvpairs.end()) {
+        gpsinfo = handle_kv_gps(i->second);
+    }
+
+    unsigned int npackets = 0;
+
+    if ((i = in_kvpairs.find("packets")) != in_kvpairs.end()) {
+        npackets = handle_kv_packets(i->second, gpsinfo);
+    }
 
+    if (gpsinfo != NULL)
+        delete(gpsinfo);
+
+    if (npackets == 0)
+        return;
+
+    // Update the last valid report time
+    local_locker lock(&source_lock);
+    inc_num_reports(npackets);
+    set_last_report_time(globalreg->timestamp.tv_sec);
 }
 
 bool KisDataSource::handle_kv_success(KisDataSource_CapKeyedObject *in_obj) {
@@ -792,46 +1275,45 @@ bool KisDataSource::handle_kv_channels(KisDataSource_CapKeyedObject *in_obj) {
 kis_layer1_packinfo *KisDataSource::handle_kv_signal(KisDataSource_CapKeyedObject *in_obj) {
     kis_layer1_packinfo *siginfo = new kis_layer1_packinfo();
 
-    // Unpack the dictionary
-    MsgpackAdapter::MsgpackStrMap dict;
+    // Unpack the dictionary in place
     msgpack::unpacked result;
-    MsgpackAdapter::MsgpackStrMap::iterator obj_iter;
+    msgpack::object *obj;
 
     try {
-        msgpack::unpack(result, in_obj->object, in_obj->size);
+        msgpack::unpack(result, in_obj->object, in_obj->size,
+                MsgpackAdapter::UnpackReferenceRaw);
         msgpack::object deserialized = result.get();
-        dict = deserialized.as<MsgpackAdapter::MsgpackStrMap>();
 
-        if ((obj_iter = dict.find("signal_dbm")) != dict.end()) {
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "signal_dbm")) != NULL) {
             siginfo->signal_type = kis_l1_signal_type_dbm;
-            siginfo->signal_dbm = obj_iter->second.as<int32_t>();
+            siginfo->signal_dbm = obj->as<int32_t>();
         }
 
-        if ((obj_iter = dict.find("noise_dbm")) != dict.end()) {
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "noise_dbm")) != NULL) {
             siginfo->signal_type = kis_l1_signal_type_dbm;
-            siginfo->noise_dbm = obj_iter->second.as<int32_t>();
+            siginfo->noise_dbm = obj->as<int32_t>();
         }
 
-        if ((obj_iter = dict.find("signal_rssi")) != dict.end()) {
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "signal_rssi")) != NULL) {
             siginfo->signal_type = kis_l1_signal_type_rssi;
-            siginfo->signal_rssi = obj_iter->second.as<int32_t>();
+            siginfo->signal_rssi = obj->as<int32_t>();
         }
 
-        if ((obj_iter = dict.find("noise_rssi")) != dict.end()) {
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "noise_rssi")) != NULL) {
             siginfo->signal_type = kis_l1_signal_type_rssi;
-            siginfo->noise_rssi = obj_iter->second.as<int32_t>();
+            siginfo->noise_rssi = obj->as<int32_t>();
         }
 
-        if ((obj_iter = dict.find("freq_khz")) != dict.end()) {
-            siginfo->freq_khz = obj_iter->second.as<double>();
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "freq_khz")) != NULL) {
+            siginfo->freq_khz = obj->as<double>();
         }
 
-        if ((obj_iter = dict.find("channel")) != dict.end()) {
-            siginfo->channel = obj_iter->second.as<string>();
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "channel")) != NULL) {
+            siginfo->channel = obj->as<string>();
         }
 
-        if ((obj_iter = dict.find("datarate")) != dict.end()) {
-            siginfo->datarate = obj_iter->second.as<double>();
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "datarate")) != NULL) {
+            siginfo->datarate = obj->as<double>();
         }
 
     } catch (const std::exception& e) {
@@ -856,50 +1338,49 @@ kis_layer1_packinfo *KisDataSource::handle_kv_signal(KisDataSource_CapKeyedObjec
 kis_gps_packinfo *KisDataSource::handle_kv_gps(KisDataSource_CapKeyedObject *in_obj) {
     kis_gps_packinfo *gpsinfo = new kis_gps_packinfo();
 
-    // Unpack the dictionary
-    MsgpackAdapter::MsgpackStrMap dict;
+    // Unpack the dictionary in place
     msgpack::unpacked result;
-    MsgpackAdapter::MsgpackStrMap::iterator obj_iter;
+    msgpack::object *obj;
 
     try {
-        msgpack::unpack(result, in_obj->object, in_obj->size);
+        msgpack::unpack(result, in_obj->object, in_obj->size,
+                MsgpackAdapter::UnpackReferenceRaw);
         msgpack::object deserialized = result.get();
-        dict = deserialized.as<MsgpackAdapter::MsgpackStrMap>();
 
-        if ((obj_iter = dict.find("lat")) != dict.end()) {
-            gpsinfo->lat = obj_iter->second.as<double>();
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "lat")) != NULL) {
+            gpsinfo->lat = obj->as<double>();
         }
 
-        if ((obj_iter = dict.find("lon")) != dict.end()) {
-            gpsinfo->lon = obj_iter->second.as<double>();
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "lon")) != NULL) {
+            gpsinfo->lon = obj->as<double>();
         }
 
-        if ((obj_iter = dict.find("alt")) != dict.end()) {
-            gpsinfo->alt = obj_iter->second.as<double>();
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "alt")) != NULL) {
+            gpsinfo->alt = obj->as<double>();
         }
 
-        if ((obj_iter = dict.find("speed")) != dict.end()) {
-            gpsinfo->speed = obj_iter->second.as<double>();
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "speed")) != NULL) {
+            gpsinfo->speed = obj->as<double>();
         }
 
-        if ((obj_iter = dict.find("heading")) != dict.end()) {
-            gpsinfo->heading = obj_iter->second.as<double>();
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "heading")) != NULL) {
+            gpsinfo->heading = obj->as<double>();
         }
 
-        if ((obj_iter = dict.find("precision")) != dict.end()) {
-            gpsinfo->precision = obj_iter->second.as<double>();
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "precision")) != NULL) {
+            gpsinfo->precision = obj->as<double>();
         }
 
-        if ((obj_iter = dict.find("fix")) != dict.end()) {
-            gpsinfo->precision = obj_iter->second.as<int32_t>();
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "fix")) != NULL) {
+            gpsinfo->precision = obj->as<int32_t>();
         }
 
-        if ((obj_iter = dict.find("time")) != dict.end()) {
-            gpsinfo->time = (time_t) obj_iter->second.as<uint64_t>();
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "time")) != NULL) {
+            gpsinfo->time = (time_t) obj->as<uint64_t>();
         }
 
-        if ((obj_iter = dict.find("name")) != dict.end()) {
-            gpsinfo->gpsname = obj_iter->second.as<string>();
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "name")) != NULL) {
+            gpsinfo->gpsname = obj->as<string>();
         }
 
     } catch (const std::exception& e) {
@@ -924,54 +1405,57 @@ kis_packet *KisDataSource::handle_kv_packet(KisDataSource_CapKeyedObject *in_obj
     kis_packet *packet = packetchain->GeneratePacket();
     kis_datachunk *datachunk = new kis_datachunk();
 
-    // Unpack the dictionary
-    MsgpackAdapter::MsgpackStrMap dict;
+    // Unpack the dictionary in place; the packet data stays in the frame
+    // until we copy it into the datachunk
     msgpack::unpacked result;
-    MsgpackAdapter::MsgpackStrMap::iterator obj_iter;
+    msgpack::object *obj;
 
     try {
-        msgpack::unpack(result, in_obj->object, in_obj->size);
+        msgpack::unpack(result, in_obj->object, in_obj->size,
+                MsgpackAdapter::UnpackReferenceRaw);
         msgpack::object deserialized = result.get();
-        dict = deserialized.as<MsgpackAdapter::MsgpackStrMap>();
 
-        if ((obj_iter = dict.find("tv_sec")) != dict.end()) {
-            packet->ts.tv_sec = (time_t) obj_iter->second.as<uint64_t>();
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "tv_sec")) != NULL) {
+            packet->ts.tv_sec = (time_t) obj->as<uint64_t>();
         } else {
             throw std::runtime_error(string("tv_sec timestamp missing"));
         }
 
-        if ((obj_iter = dict.find("tv_usec")) != dict.end()) {
-            packet->ts.tv_usec = (time_t) obj_iter->second.as<uint64_t>();
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "tv_usec")) != NULL) {
+            packet->ts.tv_usec = (time_t) obj->as<uint64_t>();
         } else {
             throw std::runtime_error(string("tv_usec timestamp missing"));
         }
 
-        if ((obj_iter = dict.find("dlt")) != dict.end()) {
-            datachunk->dlt = obj_iter->second.as<uint64_t>();
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "dlt")) != NULL) {
+            datachunk->dlt = obj->as<uint64_t>();
         } else {
             throw std::runtime_error(string("DLT missing"));
         }
 
         // Record the size
         uint64_t size = 0;
-        if ((obj_iter = dict.find("size")) != dict.end()) {
-            size = obj_iter->second.as<uint64_t>();
+        if ((obj = MsgpackAdapter::FindStrKey(deserialized, "size")) != NULL) {
+            size = obj->as<uint64_t>();
         } else {
             throw std::runtime_error(string("size field missing or zero"));
         }
 
-        msgpack::object rawdata;
-        if ((obj_iter = dict.find("packet")) != dict.end()) {
-            rawdata = obj_iter->second;
-        } else {
+        msgpack::object *rawdata;
+        if ((rawdata = MsgpackAdapter::FindStrKey(deserialized, "packet")) == NULL) {
             throw std::runtime_error(string("packet data missing"));
         }
 
-        if (rawdata.via.bin.size != size) {
+        if (rawdata->type != msgpack::type::BIN) {
+            throw std::runtime_error(string("packet data not binary"));
+        }
+
+        if (rawdata->via.bin.size != size) {
             throw std::runtime_error(string("packet size did not match data size"));
         }
 
-        datachunk->copy_data((const uint8_t *) rawdata.via.bin.ptr, size);
+        // The only copy of the packet data
+        datachunk->copy_data((const uint8_t *) rawdata->via.bin.ptr, size);
 
     } catch (const std::exception& e) {
         // Something went wrong with msgpack unpacking
@@ -998,6 +1482,79 @@ kis_packet *KisDataSource::handle_kv_packet(KisDataSource_CapKeyedObject *in_obj
 
 }
 
+unsigned int KisDataSource::handle_kv_packets(KisDataSource_CapKeyedObject *in_obj,
+        kis_gps_packinfo *in_gps) {
+    simple_cap_proto_packet_h_t ph;
+    size_t offt = 0;
+    unsigned int npackets = 0;
+
+    while (offt < in_obj->size) {
+        if (offt + sizeof(simple_cap_proto_packet_h_t) > in_obj->size) {
+            local_locker lock(&source_lock);
+            inc_ipc_errors(1);
+            break;
+        }
+
+        // Records aren't aligned; copy the header out
+        memcpy(&ph, in_obj->object + offt, sizeof(simple_cap_proto_packet_h_t));
+
+        uint32_t caplen = kis_ntoh32(ph.caplen);
+        uint32_t flags = kis_ntoh32(ph.flags);
+
+        offt += sizeof(simple_cap_proto_packet_h_t);
+
+        if (offt + caplen > in_obj->size) {
+            local_locker lock(&source_lock);
+            inc_ipc_errors(1);
+            break;
+        }
+
+        kis_packet *packet = packetchain->GeneratePacket();
+
+        packet->ts.tv_sec = (time_t) kis_ntoh64(ph.tv_sec);
+        packet->ts.tv_usec = kis_ntoh32(ph.tv_usec);
+
+        kis_datachunk *datachunk = new kis_datachunk();
+        datachunk->dlt = kis_ntoh32(ph.dlt);
+        datachunk->copy_data((const uint8_t *) in_obj->object + offt, caplen);
+        packet->insert(pack_comp_linkframe, datachunk);
+
+        offt += caplen;
+
+        if (flags & (SIMPLE_CAP_PACKET_SIGNAL_DBM | SIMPLE_CAP_PACKET_SIGNAL_RSSI |
+                    SIMPLE_CAP_PACKET_FREQ)) {
+            kis_layer1_packinfo *siginfo = new kis_layer1_packinfo();
+
+            int16_t signal = (int16_t) kis_ntoh16((uint16_t) ph.signal);
+            int16_t noise = (int16_t) kis_ntoh16((uint16_t) ph.noise);
+
+            if (flags & SIMPLE_CAP_PACKET_SIGNAL_DBM) {
+                siginfo->signal_type = kis_l1_signal_type_dbm;
+                siginfo->signal_dbm = signal;
+                siginfo->noise_dbm = noise;
+            } else if (flags & SIMPLE_CAP_PACKET_SIGNAL_RSSI) {
+                siginfo->signal_type = kis_l1_signal_type_rssi;
+                siginfo->signal_rssi = signal;
+                siginfo->noise_rssi = noise;
+            }
+
+            if (flags & SIMPLE_CAP_PACKET_FREQ)
+                siginfo->freq_khz = kis_ntoh32(ph.freq_khz);
+
+            packet->insert(pack_comp_l1info, siginfo);
+        }
+
+        if (in_gps != NULL)
+            packet->insert(pack_comp_gps, new kis_gps_packinfo(in_gps));
+
+        inject_packet(packet);
+
+        npackets++;
+    }
+
+    return npackets;
+}
+
 bool KisDataSource::spawn_ipc() {
     stringstream ss;
 
@@ -1008,6 +1565,9 @@ bool KisDataSource::spawn_ipc() {
     set_source_running(false);
     set_child_pid(0);
 
+    // A new capture binary starts out on the original checksum
+    ipc_crc32c = false;
+
     if (get_source_ipc_bin() == "") {
         ss << "Datasource '" << get_source_name() << "' missing IPC binary, cannot "
             "launch binary";
@@ -1036,11 +1596,19 @@ bool KisDataSource::spawn_ipc() {
     }
 
     // Make a new handler and new ipc.  Give a generous buffer.
-    ipchandler = new RingbufferHandler((32 * 1024), (32 * 1024));
+    ipchandler = new RingbufferHandler(KIS_DATASOURCE_IPC_BUFFER, 
+            KIS_DATASOURCE_IPC_BUFFER);
+    // Only the pipe client fills the read buffer and only we drain it, so it
+    // doesn't need locking
+    ipchandler->SetReadBuffer(new RingbufSPSC(KIS_DATASOURCE_IPC_BUFFER));
     ipchandler->SetReadBufferInterface(this);
 
     source_ipc = new IPCRemoteV2(globalreg, ipchandler);
 
+    // Offer the helper a shared memory ring, if we're allowed to
+    source_ipc->set_shm_ring(1024 *
+            globalreg->kismet_config->FetchOptUInt("datasource_shm_ring", 1024));
+
     // Get allowed paths for binaries
     vector<string> bin_paths = globalreg->kismet_config->FetchOptVec("bin_paths");
 
@@ -1068,6 +1636,8 @@ bool KisDataSource::spawn_ipc() {
     set_source_running(true);
     set_child_pid(source_ipc->get_pid());
 
+    start_capture_thread();
+
     return true;
 }
 
@@ -1080,24 +1650,32 @@ KisDataSource_QueuedCommand::KisDataSource_QueuedCommand(string in_cmd,
 
 KisDataSource_CapKeyedObject::KisDataSource_CapKeyedObject(simple_cap_proto_kv *in_kp) {
     char ckey[17];
+    unsigned int x;
+
+    // Keys are matched case-insensitively
+    for (x = 0; x < 16 && in_kp->header.key[x] != 0; x++)
+        ckey[x] = tolower(in_kp->header.key[x]);
+    ckey[x] = 0;
 
-    snprintf(ckey, 17, "%s", in_kp->header.key);
     key = string(ckey);
 
     size = kis_ntoh32(in_kp->header.obj_sz);
-    object = new char[size];
-    memcpy(object, in_kp->object, size);
+    object = (char *) in_kp->object;
+    borrowed = true;
 }
 
 KisDataSource_CapKeyedObject::KisDataSource_CapKeyedObject(string in_key,
         const char *in_object, ssize_t in_len) {
 
     key = in_key.substr(0, 16);
+    size = in_len;
     object = new char[in_len];
     memcpy(object, in_object, in_len);
+    borrowed = false;
 }
 
 KisDataSource_CapKeyedObject::~KisDataSource_CapKeyedObject() {
-    delete[] object;
+    if (!borrowed)
+        delete[] object;
 }
 
@@ -21,9 +21,14 @@
 
 #include "config.h"
 
+#include <pthread.h>
+
+#include <deque>
+
 #include "globalregistry.h"
 #include "datasourcetracker.h"
 #include "ipc_remote2.h"
+#include "kis_reactor.h"
 #include "ringbuf_handler.h"
 #include "uuid.h"
 #include "gps_manager.h"
@@ -32,6 +37,11 @@
 #include "packetchain.h"
 #include "simple_datasource_proto.h"
 
+// Size of the IPC buffers to the capture binary.  Every frame from the
+// capture binary has to fit in the read buffer, so packet batches are capped
+// at half of it
+#define KIS_DATASOURCE_IPC_BUFFER   (32 * 1024)
+
 /*
  * Kismet Data Source
  *
@@ -58,6 +68,16 @@
  * Data sources derive from trackable elements so they can be easily 
  * inspected by client interfaces.
  *
+ * A source may be given its own capture thread (threaded=true in the source
+ * definition, or datasource_threads in the config), which decodes frames and
+ * queues the packets into the packetchain so a busy source doesn't hold up
+ * the main loop.  Only packet frames are handled on the capture thread;
+ * everything else is passed back to the main thread.  If the packetchain
+ * stays full the capture thread stops draining the IPC buffer, which backs
+ * up into the capture binary; packets which still can't be queued are
+ * counted as queue drops.  The thread can be pinned to CPUs with
+ * affinity=cpu[,cpu-cpu...] in the definition.
+ *
  */
 
 /* DST forward ref */
@@ -69,7 +89,8 @@ class KisDataSource_CapKeyedObject;
 /* Queued command when IPC is open proto */
 class KisDataSource_QueuedCommand;
 
-class KisDataSource : public RingbufferInterface, public tracker_component {
+class KisDataSource : public RingbufferInterface, public ReactorEventHandler,
+    public tracker_component {
 public:
     // Create a builder instance which only knows enough to be able to
     // build a complete version of itself
@@ -137,6 +158,12 @@ public:
 
     __Proxy(source_ipc_bin, string, string, string, source_ipc_bin);
 
+    __Proxy(source_threaded, uint8_t, bool, bool, source_threaded);
+    __Proxy(source_affinity, string, string, string, source_affinity);
+
+    __Proxy(queue_drops, uint64_t, uint64_t, uint64_t, queue_drops);
+    __ProxyIncDec(queue_drops, uint64_t, uint64_t, queue_drops);
+
     __Proxy(last_report_time, uint64_t, time_t, time_t, last_report_time);
     __Proxy(num_reports, uint64_t, uint64_t, uint64_t, num_reports);
     __ProxyIncDec(num_reports, uint64_t, uint64_t, num_reports);
@@ -151,6 +178,13 @@ public:
     virtual void BufferAvailable(size_t in_amt);
     virtual void BufferError(string in_error);
 
+    // Reactor wakeup, used to hand frames from the capture thread back to
+    // the main thread
+    virtual void ReactorEvent(int in_fd, unsigned int in_events);
+
+    // Capture thread main loop
+    void capture_thread();
+
     // KV pair map
     typedef map<string, KisDataSource_CapKeyedObject *> KVmap;
     typedef pair<string, KisDataSource_CapKeyedObject *> KVpair;
@@ -242,9 +276,24 @@ protected:
     int num_reports_id;
     TrackerElement *num_reports;
 
+    // Decoded on a capture thread
+    int source_threaded_id;
+    TrackerElement *source_threaded;
+
+    // CPUs the capture thread is pinned to
+    int source_affinity_id;
+    TrackerElement *source_affinity;
+
+    // Packets dropped because the packetchain was full
+    int queue_drops_id;
+    TrackerElement *queue_drops;
+
     IPCRemoteV2 *source_ipc;
     RingbufferHandler *ipchandler;
 
+    // The capture binary sends CRC32C frames, so we send it CRC32C frames too
+    bool ipc_crc32c;
+
     // Commands waiting to be sent
     vector<KisDataSource_QueuedCommand *> pending_commands;
 
@@ -255,16 +304,65 @@ protected:
     // IPC protocol assembly & send to driver
     virtual bool write_ipc_packet(string in_type, KVmap *in_kvpairs);
 
+    // Scratch space for reassembling a frame which wraps around the end of
+    // the ring buffer; every other frame is decoded in place
+    vector<uint8_t> frame_scratch;
+
+    // Capture thread state, protected by capture_lock.  The capture thread
+    // takes source_lock, so it must never be stopped while holding it.
+    pthread_mutex_t capture_lock;
+    pthread_cond_t capture_cond;
+    pthread_t capture_tid;
+    bool capture_running;
+    bool capture_shutdown;
+    bool capture_pending;
+    vector<int> capture_cpus;
+    unsigned int capture_queue_wait;
+
+    // Frames the capture thread left for the main thread
+    deque<vector<uint8_t> > deferred_frames;
+    // IPC error found by the capture thread, for the main thread to fail the
+    // source with
+    string deferred_error;
+
+    // Read the threading options from a source definition
+    virtual void parse_capture_options(string in_definition);
+
+    virtual void start_capture_thread();
+    virtual void stop_capture_thread();
+
+    // Decode every complete frame in the IPC read buffer
+    virtual void drain_read_buffer(bool in_capture_thread);
+
+    // Validate and dispatch a single complete frame.  The kv pairs borrow
+    // their data from the frame, which must remain valid until this returns.
+    // Returns false if the frame is corrupt.
+    virtual bool handle_frame(uint8_t *in_frame, size_t in_frame_sz);
+
+    // Check the checksum of a frame, zeroing it in place
+    virtual bool check_frame(uint8_t *in_frame, size_t in_frame_sz);
+
+    // Split a checked frame into kv pairs and handle it.  On the capture
+    // thread only packet frames are handled; anything else returns -1 and
+    // must be handed to the main thread.  Returns 0 if the frame is corrupt.
+    virtual int dispatch_frame(uint8_t *in_frame, size_t in_frame_sz, 
+            bool in_capture_thread);
+
+    // Hand a decoded packet to the packetchain, from whichever thread we're
+    // decoding on
+    virtual void inject_packet(kis_packet *in_pack);
+
     // Top-level packet handler
-    virtual void handle_packet(string in_type, KVmap in_kvmap);
+    virtual void handle_packet(string in_type, KVmap &in_kvmap);
 
     // Standard packet types
-    virtual void handle_packet_status(KVmap in_kvpairs);
-    virtual void handle_packet_probe_resp(KVmap in_kvpairs);
-    virtual void handle_packet_open_resp(KVmap in_kvpairs);
-    virtual void handle_packet_error(KVmap in_kvpairs);
-    virtual void handle_packet_message(KVmap in_kvpairs);
-    virtual void handle_packet_data(KVmap in_kvpairs);
+    virtual void handle_packet_status(KVmap &in_kvpairs);
+    virtual void handle_packet_probe_resp(KVmap &in_kvpairs);
+    virtual void handle_packet_open_resp(KVmap &in_kvpairs);
+    virtual void handle_packet_error(KVmap &in_kvpairs);
+    virtual void handle_packet_message(KVmap &in_kvpairs);
+    virtual void handle_packet_data(KVmap &in_kvpairs);
+    virtual void handle_packet_packets(KVmap &in_kvpairs);
 
     // Common message kv pair
     virtual bool handle_kv_success(KisDataSource_CapKeyedObject *in_obj);
@@ -274,6 +372,11 @@ protected:
     virtual kis_layer1_packinfo *handle_kv_signal(KisDataSource_CapKeyedObject *in_obj);
     virtual kis_packet *handle_kv_packet(KisDataSource_CapKeyedObject *in_obj);
 
+    // Decode a batch of fixed-header packet records and inject them into the
+    // packet chain; returns the number of packets handled
+    virtual unsigned int handle_kv_packets(KisDataSource_CapKeyedObject *in_obj,
+            kis_gps_packinfo *in_gps);
+
     // Spawn an IPC process, using the source_ipc_bin.  If the IPC system is running
     // already, issue a kill
     virtual bool spawn_ipc();
@@ -292,6 +395,8 @@ public:
 
 class KisDataSource_CapKeyedObject {
 public:
+    // Borrow the object from a received kv pair; the frame it lives in must
+    // outlast this object
     KisDataSource_CapKeyedObject(simple_cap_proto_kv *in_kp);
     KisDataSource_CapKeyedObject(string in_key, const char *in_object, ssize_t in_len);
     ~KisDataSource_CapKeyedObject();
@@ -299,6 +404,9 @@ public:
     string key;
     size_t size;
     char *object;
+
+    // Object points into a received frame instead of our own copy
+    bool borrowed;
 };
 
 #endif
@@ -72,10 +72,8 @@ int Kis_DLT_PPI::HandlePacket(kis_packet *in_pack) {
 	kis_ref_capsource *capsrc =
 		(kis_ref_capsource *) in_pack->fetch(pack_comp_capsrc);
 
-	if (capsrc == NULL) {
-		// printf("debug - no capsrc?\n");
-		return 1;
-	}
+	// Frames injected without a capture source (offline replay) are
+	// decoded with no FCS configured and without checking the CRC
 
 	ppi_packet_header *ppi_ph;
 	ppi_field_header *ppi_fh;
@@ -294,7 +292,8 @@ int Kis_DLT_PPI::HandlePacket(kis_packet *in_pack) {
 	}
 
 	// If we're validating the FCS
-	if (capsrc->ref_source->FetchValidateCRC() && fcschunk != NULL) {
+	if (capsrc != NULL && capsrc->ref_source->FetchValidateCRC() &&
+			fcschunk != NULL) {
 		// Compare it and flag the packet
 		uint32_t calc_crc =
 			crc32_le_80211(globalreg->crc32_table, decapchunk->data, 
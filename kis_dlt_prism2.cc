@@ -115,10 +115,8 @@ int Kis_DLT_Prism2::HandlePacket(kis_packet *in_pack) {
 	kis_ref_capsource *capsrc =
 		(kis_ref_capsource *) in_pack->fetch(pack_comp_capsrc);
 
-	if (capsrc == NULL) {
-		// printf("debug - no capsrc?\n");
-		return 1;
-	}
+	// Frames injected without a capture source (offline replay) are
+	// decoded with no FCS configured and without checking the CRC
 
     int callback_offset = 0;
     char errstr[STATUS_MAX] = "";
@@ -126,7 +124,10 @@ int Kis_DLT_Prism2::HandlePacket(kis_packet *in_pack) {
 	// Make a datachunk for the reformatted frame
 	kis_layer1_packinfo *radioheader = NULL;
 
-	int fcsbytes = capsrc->ref_source->FetchFCSBytes();
+	int fcsbytes = 0;
+
+	if (capsrc != NULL)
+		fcsbytes = capsrc->ref_source->FetchFCSBytes();
 
     // See if we have an AVS wlan header...
     avs_80211_1_header *v1hdr = (avs_80211_1_header *) linkchunk->data;
@@ -238,8 +239,7 @@ int Kis_DLT_Prism2::HandlePacket(kis_packet *in_pack) {
         return 0;
     }
 
-	decapchunk->data = new uint8_t[decapchunk->length];
-    memcpy(decapchunk->data, linkchunk->data + callback_offset, decapchunk->length);
+	decapchunk->copy_data(linkchunk->data + callback_offset, decapchunk->length);
 
 	in_pack->insert(pack_comp_radiodata, radioheader);
 	in_pack->insert(pack_comp_decap, decapchunk);
@@ -256,7 +256,8 @@ int Kis_DLT_Prism2::HandlePacket(kis_packet *in_pack) {
 	}
 
 	// If we're validating the FCS
-	if (capsrc->ref_source->FetchValidateCRC() && fcschunk != NULL) {
+	if (capsrc != NULL && capsrc->ref_source->FetchValidateCRC() &&
+			fcschunk != NULL) {
 		// Compare it and flag the packet
 		uint32_t calc_crc =
 			crc32_le_80211(globalreg->crc32_table, decapchunk->data, 
@@ -0,0 +1,129 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KIS_FLAT_MAP_H__
+#define __KIS_FLAT_MAP_H__
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+// Sorted map stored as a contiguous vector of key/value pairs, used for the
+// children of tracked element maps.  Most tracked maps hold a handful to a
+// few dozen entries and are read far more often than they're changed, so a
+// flat array beats a tree on both lookup time and memory.  Small maps are
+// searched linearly; larger maps are binary searched.
+//
+// Implements the subset of the std::map API the tracker uses, with one
+// important difference:  inserting or erasing invalidates iterators.
+template<class K, class V>
+class kis_flat_map {
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<K, V> value_type;
+    typedef typename std::vector<value_type>::iterator iterator;
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+    // Below this size a linear scan is faster than a binary search
+    static const size_t linear_max = 16;
+
+    iterator begin() { return data.begin(); }
+    iterator end() { return data.end(); }
+    const_iterator begin() const { return data.begin(); }
+    const_iterator end() const { return data.end(); }
+
+    size_t size() const { return data.size(); }
+    bool empty() const { return data.empty(); }
+
+    void clear() { data.clear(); }
+
+    iterator find(const K& in_key) {
+        iterator i = lower_bound(data.begin(), data.end(), in_key);
+
+        if (i != data.end() && !(in_key < i->first))
+            return i;
+
+        return data.end();
+    }
+
+    const_iterator find(const K& in_key) const {
+        const_iterator i = lower_bound(data.begin(), data.end(), in_key);
+
+        if (i != data.end() && !(in_key < i->first))
+            return i;
+
+        return data.end();
+    }
+
+    std::pair<iterator, bool> insert(const value_type& in_value) {
+        iterator i = lower_bound(data.begin(), data.end(), in_value.first);
+
+        if (i != data.end() && !(in_value.first < i->first))
+            return std::make_pair(i, false);
+
+        i = data.insert(i, in_value);
+
+        return std::make_pair(i, true);
+    }
+
+    V& operator[](const K& in_key) {
+        return insert(value_type(in_key, V())).first->second;
+    }
+
+    void erase(iterator i) {
+        data.erase(i);
+    }
+
+    size_t erase(const K& in_key) {
+        iterator i = find(in_key);
+
+        if (i == data.end())
+            return 0;
+
+        data.erase(i);
+        return 1;
+    }
+
+protected:
+    static bool key_less(const value_type& a, const K& b) {
+        return a.first < b;
+    }
+
+    template<class I>
+    static I lower_bound(I in_begin, I in_end, const K& in_key) {
+        if ((size_t) (in_end - in_begin) <= linear_max) {
+            I i = in_begin;
+
+            while (i != in_end && i->first < in_key)
+                ++i;
+
+            return i;
+        }
+
+        return std::lower_bound(in_begin, in_end, in_key, key_less);
+    }
+
+    std::vector<value_type> data;
+};
+
+#endif
+
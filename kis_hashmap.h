@@ -0,0 +1,182 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KIS_HASHMAP_H__
+#define __KIS_HASHMAP_H__
+
+#include "config.h"
+
+#include <stdint.h>
+#include <vector>
+
+// Open-addressing hash table keyed on a 64bit int, used for indexing device
+// keys and mac addresses.  Linear probing with backward-shift deletion keeps
+// the table free of tombstones, so lookups stay short no matter how much
+// churn the device list sees.
+//
+// Values are expected to be cheap to copy (pointers).  Not thread safe;
+// callers provide their own locking.
+template<class V>
+class kis_hashmap {
+public:
+    kis_hashmap() {
+        num_entries = 0;
+        resize_table(16);
+    }
+
+    // Find a value; returns the default (NULL for pointers) if not found
+    V find(uint64_t in_key) const {
+        size_t pos = hash(in_key) & mask;
+
+        while (slots[pos].used) {
+            if (slots[pos].key == in_key)
+                return slots[pos].value;
+
+            pos = (pos + 1) & mask;
+        }
+
+        return V();
+    }
+
+    bool contains(uint64_t in_key) const {
+        size_t pos = hash(in_key) & mask;
+
+        while (slots[pos].used) {
+            if (slots[pos].key == in_key)
+                return true;
+
+            pos = (pos + 1) & mask;
+        }
+
+        return false;
+    }
+
+    // Insert or replace a value
+    void insert(uint64_t in_key, V in_value) {
+        // Keep the load under 50% so probe runs stay short
+        if ((num_entries + 1) * 2 > slots.size())
+            resize_table(slots.size() * 2);
+
+        size_t pos = hash(in_key) & mask;
+
+        while (slots[pos].used) {
+            if (slots[pos].key == in_key) {
+                slots[pos].value = in_value;
+                return;
+            }
+
+            pos = (pos + 1) & mask;
+        }
+
+        slots[pos].used = true;
+        slots[pos].key = in_key;
+        slots[pos].value = in_value;
+        num_entries++;
+    }
+
+    // Remove a key; returns false if it wasn't present
+    bool erase(uint64_t in_key) {
+        size_t pos = hash(in_key) & mask;
+
+        while (slots[pos].used) {
+            if (slots[pos].key == in_key)
+                break;
+
+            pos = (pos + 1) & mask;
+        }
+
+        if (!slots[pos].used)
+            return false;
+
+        // Shift back any following entries which would no longer be
+        // reachable across the hole we're leaving
+        size_t hole = pos;
+        size_t next = (pos + 1) & mask;
+
+        while (slots[next].used) {
+            size_t ideal = hash(slots[next].key) & mask;
+
+            // Move the entry if its ideal slot isn't cyclically in (hole, next]
+            if (((next - ideal) & mask) >= ((next - hole) & mask)) {
+                slots[hole] = slots[next];
+                hole = next;
+            }
+
+            next = (next + 1) & mask;
+        }
+
+        slots[hole].used = false;
+        slots[hole].value = V();
+        num_entries--;
+
+        return true;
+    }
+
+    void clear() {
+        num_entries = 0;
+        resize_table(16);
+    }
+
+    size_t size() const {
+        return num_entries;
+    }
+
+protected:
+    typedef struct {
+        uint64_t key;
+        V value;
+        bool used;
+    } hash_slot;
+
+    // 64bit finalizer from murmurhash3; device keys and macs differ mostly in
+    // the low bits and share OUI prefixes, so they need a real mix
+    static size_t hash(uint64_t k) {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return (size_t) k;
+    }
+
+    void resize_table(size_t in_size) {
+        std::vector<hash_slot> old_slots;
+        old_slots.swap(slots);
+
+        hash_slot empty;
+        empty.key = 0;
+        empty.value = V();
+        empty.used = false;
+
+        slots.assign(in_size, empty);
+        mask = in_size - 1;
+        num_entries = 0;
+
+        for (size_t x = 0; x < old_slots.size(); x++) {
+            if (old_slots[x].used)
+                insert(old_slots[x].key, old_slots[x].value);
+        }
+    }
+
+    std::vector<hash_slot> slots;
+    size_t mask;
+    size_t num_entries;
+};
+
+#endif
+
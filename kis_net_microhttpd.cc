@@ -35,6 +35,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <signal.h>
 
 #include "globalregistry.h"
 #include "messagebus.h"
@@ -55,6 +56,9 @@ Kis_Net_Httpd::Kis_Net_Httpd(GlobalRegistry *in_globalreg) {
 
     pthread_mutex_init(&controller_mutex, NULL);
 
+    pthread_mutex_init(&chunked_mutex, NULL);
+    chunked_shutdown = false;
+
     if (globalreg->kismet_config == NULL) {
         fprintf(stderr, "FATAL OOPS: Kis_Net_Httpd called without kismet_config\n");
         exit(1);
@@ -183,6 +187,8 @@ Kis_Net_Httpd::~Kis_Net_Httpd() {
         if (running)
             StopHttpd();
 
+        StopChunkedGenerators(NULL);
+
         globalreg->RemoveGlobal("HTTPD_SERVER");
 
         if (session_db) {
@@ -196,6 +202,7 @@ Kis_Net_Httpd::~Kis_Net_Httpd() {
     }
 
     pthread_mutex_destroy(&controller_mutex);
+    pthread_mutex_destroy(&chunked_mutex);
 }
 
 char *Kis_Net_Httpd::read_ssl_file(string in_fname) {
@@ -262,6 +269,10 @@ void Kis_Net_Httpd::RemoveHandler(Kis_Net_Httpd_Handler *in_handler) {
     }
 
     pthread_mutex_unlock(&controller_mutex);
+
+    // Anything still streaming from the handler has to finish before the
+    // handler is torn down
+    StopChunkedGenerators(in_handler);
 }
 
 int Kis_Net_Httpd::StartHttpd() {
@@ -327,6 +338,10 @@ int Kis_Net_Httpd::StartHttpd() {
 }
 
 int Kis_Net_Httpd::StopHttpd() {
+    // Cancelling the generators also wakes any microhttpd thread waiting on
+    // them, so the daemon can stop
+    StopChunkedGenerators(NULL);
+
     if (microhttpd != NULL) {
         MHD_stop_daemon(microhttpd);
         return 1;
@@ -649,6 +664,17 @@ int Kis_Net_Httpd::SendHttpResponse(Kis_Net_Httpd *httpd,
         MHD_create_response_from_buffer(responsestr.length(),
                 (void *) responsestr.c_str(), MHD_RESPMEM_MUST_COPY);
 
+    AppendStandardHeaders(httpd, response, url);
+
+    int ret = MHD_queue_response(connection, httpcode, response);
+
+    MHD_destroy_response(response);
+
+    return ret;
+}
+
+void Kis_Net_Httpd::AppendStandardHeaders(Kis_Net_Httpd *httpd,
+        struct MHD_Response *response, const char *url) {
     char lastmod[31];
     struct tm tmstruct;
     time_t now;
@@ -667,12 +693,6 @@ int Kis_Net_Httpd::SendHttpResponse(Kis_Net_Httpd *httpd,
             MHD_add_response_header(response, "Content-Type", mime.c_str());
         }
     }
-
-    int ret = MHD_queue_response(connection, httpcode, response);
-
-    MHD_destroy_response(response);
-
-    return ret;
 }
 
 Kis_Net_Httpd_Handler::Kis_Net_Httpd_Handler(GlobalRegistry *in_globalreg) {
@@ -694,6 +714,353 @@ void Kis_Net_Httpd_Handler::Bind_Httpd_Server(GlobalRegistry *in_globalreg) {
     }
 }
 
+typedef struct {
+    Kis_Net_Httpd *httpd;
+    Kis_Net_Httpd_Stream_Handler *handler;
+    Kis_Net_Httpd_Chunked_Buffer *buffer;
+    bool *finished;
+    string url;
+    string method;
+    std::map<string, string> args;
+} kis_net_httpd_chunked_aux;
+
+void *Kis_Net_Httpd::chunked_generator_thread(void *arg) {
+    kis_net_httpd_chunked_aux *aux = (kis_net_httpd_chunked_aux *) arg;
+
+    // Leave signal handling to the main thread
+    sigset_t sset;
+    sigfillset(&sset);
+    pthread_sigmask(SIG_BLOCK, &sset, NULL);
+
+    {
+        std::ostream stream(aux->buffer);
+
+        aux->handler->Httpd_CreateChunkedResponse(aux->httpd, aux->url.c_str(),
+                aux->method.c_str(), aux->args, stream);
+    }
+
+    aux->buffer->complete();
+    aux->buffer->release();
+
+    {
+        local_locker lock(&(aux->httpd->chunked_mutex));
+        *(aux->finished) = true;
+    }
+
+    delete(aux);
+
+    return NULL;
+}
+
+void Kis_Net_Httpd::ReapChunkedGenerators() {
+    vector<chunked_generator *> finished;
+
+    {
+        local_locker lock(&chunked_mutex);
+
+        std::list<chunked_generator *>::iterator i = chunked_generators.begin();
+        while (i != chunked_generators.end()) {
+            if ((*i)->finished) {
+                finished.push_back(*i);
+                i = chunked_generators.erase(i);
+            } else {
+                ++i;
+            }
+        }
+    }
+
+    for (unsigned int x = 0; x < finished.size(); x++) {
+        pthread_join(finished[x]->thread, NULL);
+        finished[x]->buffer->release();
+        delete(finished[x]);
+    }
+}
+
+void Kis_Net_Httpd::StopChunkedGenerators(Kis_Net_Httpd_Handler *in_handler) {
+    vector<chunked_generator *> stopping;
+
+    {
+        local_locker lock(&chunked_mutex);
+
+        if (in_handler == NULL)
+            chunked_shutdown = true;
+
+        std::list<chunked_generator *>::iterator i = chunked_generators.begin();
+        while (i != chunked_generators.end()) {
+            if (in_handler == NULL || (*i)->handler == in_handler) {
+                // Writes are discarded from now on, so the generator only
+                // has to finish walking whatever it's serializing
+                (*i)->buffer->cancel();
+                stopping.push_back(*i);
+                i = chunked_generators.erase(i);
+            } else {
+                ++i;
+            }
+        }
+    }
+
+    for (unsigned int x = 0; x < stopping.size(); x++) {
+        pthread_join(stopping[x]->thread, NULL);
+        stopping[x]->buffer->release();
+        delete(stopping[x]);
+    }
+}
+
+static ssize_t chunked_reader(void *cls, uint64_t pos __attribute__((unused)),
+        char *buf, size_t max) {
+    Kis_Net_Httpd_Chunked_Buffer *buffer = (Kis_Net_Httpd_Chunked_Buffer *) cls;
+
+    return buffer->read(buf, max);
+}
+
+static int chunked_collect_args(void *cls, 
+        enum MHD_ValueKind kind __attribute__((unused)),
+        const char *key, const char *value) {
+    std::map<string, string> *args = (std::map<string, string> *) cls;
+
+    if (key != NULL)
+        (*args)[key] = (value == NULL) ? "" : value;
+
+    return MHD_YES;
+}
+
+static void chunked_free(void *cls) {
+    Kis_Net_Httpd_Chunked_Buffer *buffer = (Kis_Net_Httpd_Chunked_Buffer *) cls;
+
+    // If the client went away mid-stream, let the generator bail out
+    buffer->cancel();
+    buffer->release();
+}
+
+int Kis_Net_Httpd::SendChunkedResponse(Kis_Net_Httpd *httpd,
+        Kis_Net_Httpd_Stream_Handler *handler, struct MHD_Connection *connection,
+        const char *url, const char *method) {
+
+    GlobalRegistry *globalreg = httpd->globalreg;
+
+    httpd->ReapChunkedGenerators();
+
+    Kis_Net_Httpd_Chunked_Buffer *buffer =
+        new Kis_Net_Httpd_Chunked_Buffer(KIS_HTTPD_CHUNKBUFFERSZ, 
+                KIS_HTTPD_CHUNKSTALL);
+
+    struct MHD_Response *response =
+        MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 32 * 1024,
+                &chunked_reader, buffer, &chunked_free);
+
+    if (response == NULL) {
+        delete(buffer);
+        return MHD_NO;
+    }
+
+    Kis_Net_Httpd::AppendStandardHeaders(httpd, response, url);
+
+    kis_net_httpd_chunked_aux *aux = new kis_net_httpd_chunked_aux;
+    aux->httpd = httpd;
+    aux->handler = handler;
+    aux->buffer = buffer;
+    aux->url = string(url);
+    aux->method = string(method);
+
+    MHD_get_connection_values(connection, MHD_GET_ARGUMENT_KIND, 
+            &chunked_collect_args, &(aux->args));
+
+    chunked_generator *gen = new chunked_generator;
+    gen->handler = handler;
+    gen->buffer = buffer;
+    gen->finished = false;
+
+    aux->finished = &(gen->finished);
+
+    {
+        // Held until the generator is on the list, so it can't mark itself
+        // finished before it's there
+        local_locker lock(&(httpd->chunked_mutex));
+
+        int err = 0;
+
+        if (httpd->chunked_shutdown ||
+                (err = pthread_create(&(gen->thread), NULL, 
+                                      chunked_generator_thread, aux)) != 0) {
+            if (err != 0)
+                _MSG("Kismet HTTPD failed to launch a thread for a streamed "
+                        "response: " + string(strerror(err)), MSGFLAG_ERROR);
+
+            // Send an empty response rather than leaving the client hanging
+            delete(aux);
+            delete(gen);
+            buffer->complete();
+            buffer->release();
+        } else {
+            buffer->retain();
+            httpd->chunked_generators.push_back(gen);
+        }
+    }
+
+    int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+
+    MHD_destroy_response(response);
+
+    return ret;
+}
+
+Kis_Net_Httpd_Chunked_Buffer::Kis_Net_Httpd_Chunked_Buffer(size_t in_max,
+        time_t in_stall_timeout) {
+    pthread_mutex_init(&buffer_mutex, NULL);
+    pthread_cond_init(&buffer_cond, NULL);
+
+    ring.resize(in_max);
+    ring_start = 0;
+    ring_len = 0;
+
+    stall_timeout = in_stall_timeout;
+
+    done = false;
+    cancelled = false;
+
+    // One reference for the generator and one for microhttpd
+    refcount = 2;
+
+    setp(staging, staging + sizeof(staging));
+}
+
+Kis_Net_Httpd_Chunked_Buffer::~Kis_Net_Httpd_Chunked_Buffer() {
+    pthread_mutex_destroy(&buffer_mutex);
+    pthread_cond_destroy(&buffer_cond);
+}
+
+Kis_Net_Httpd_Chunked_Buffer::int_type 
+    Kis_Net_Httpd_Chunked_Buffer::overflow(int_type ch) {
+
+    if (!flush_staging())
+        return traits_type::eof();
+
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+
+    return traits_type::not_eof(ch);
+}
+
+int Kis_Net_Httpd_Chunked_Buffer::sync() {
+    return flush_staging() ? 0 : -1;
+}
+
+bool Kis_Net_Httpd_Chunked_Buffer::flush_staging() {
+    const char *data = pbase();
+    size_t len = pptr() - pbase();
+
+    pthread_mutex_lock(&buffer_mutex);
+
+    while (len > 0 && !cancelled) {
+        if (ring_len == ring.size()) {
+            struct timespec ts;
+            ts.tv_sec = time(0) + stall_timeout;
+            ts.tv_nsec = 0;
+
+            if (pthread_cond_timedwait(&buffer_cond, &buffer_mutex, &ts) == ETIMEDOUT &&
+                    ring_len == ring.size()) {
+                // Client stopped reading; give up so we don't hold whatever
+                // the generator has locked forever
+                cancelled = true;
+                pthread_cond_broadcast(&buffer_cond);
+            }
+
+            continue;
+        }
+
+        size_t end = (ring_start + ring_len) % ring.size();
+        size_t chunk = min(len, ring.size() - ring_len);
+        chunk = min(chunk, ring.size() - end);
+
+        memcpy(&(ring[end]), data, chunk);
+
+        ring_len += chunk;
+        data += chunk;
+        len -= chunk;
+
+        pthread_cond_broadcast(&buffer_cond);
+    }
+
+    bool ret = !cancelled;
+
+    pthread_mutex_unlock(&buffer_mutex);
+
+    setp(staging, staging + sizeof(staging));
+
+    return ret;
+}
+
+void Kis_Net_Httpd_Chunked_Buffer::complete() {
+    flush_staging();
+
+    local_locker lock(&buffer_mutex);
+    done = true;
+    pthread_cond_broadcast(&buffer_cond);
+}
+
+ssize_t Kis_Net_Httpd_Chunked_Buffer::read(char *buf, size_t max) {
+    pthread_mutex_lock(&buffer_mutex);
+
+    while (ring_len == 0 && !done && !cancelled)
+        pthread_cond_wait(&buffer_cond, &buffer_mutex);
+
+    if (ring_len == 0 || cancelled) {
+        ssize_t end = MHD_CONTENT_READER_END_OF_STREAM;
+
+        if (cancelled)
+            end = MHD_CONTENT_READER_END_WITH_ERROR;
+
+        pthread_mutex_unlock(&buffer_mutex);
+
+        return end;
+    }
+
+    size_t copied = 0;
+
+    while (copied < max && ring_len > 0) {
+        size_t chunk = min(max - copied, ring_len);
+        chunk = min(chunk, ring.size() - ring_start);
+
+        memcpy(buf + copied, &(ring[ring_start]), chunk);
+
+        ring_start = (ring_start + chunk) % ring.size();
+        ring_len -= chunk;
+        copied += chunk;
+    }
+
+    pthread_cond_broadcast(&buffer_cond);
+
+    pthread_mutex_unlock(&buffer_mutex);
+
+    return (ssize_t) copied;
+}
+
+void Kis_Net_Httpd_Chunked_Buffer::cancel() {
+    local_locker lock(&buffer_mutex);
+
+    cancelled = true;
+    pthread_cond_broadcast(&buffer_cond);
+}
+
+void Kis_Net_Httpd_Chunked_Buffer::retain() {
+    local_locker lock(&buffer_mutex);
+    refcount++;
+}
+
+void Kis_Net_Httpd_Chunked_Buffer::release() {
+    int remaining;
+
+    {
+        local_locker lock(&buffer_mutex);
+        remaining = --refcount;
+    }
+
+    if (remaining == 0)
+        delete this;
+}
+
 int Kis_Net_Httpd_Stream_Handler::Httpd_HandleRequest(Kis_Net_Httpd *httpd, 
         struct MHD_Connection *connection,
         const char *url, const char *method, const char *upload_data,
@@ -702,6 +1069,10 @@ int Kis_Net_Httpd_Stream_Handler::Httpd_HandleRequest(Kis_Net_Httpd *httpd,
     std::stringstream stream;
     int ret;
 
+    if (Httpd_UseChunkedStream(url, method)) {
+        return httpd->SendChunkedResponse(httpd, this, connection, url, method);
+    }
+
     Httpd_CreateStreamResponse(httpd, connection, url, method, upload_data,
             upload_data_size, stream);
 
@@ -26,6 +26,7 @@
 #include <algorithm>
 #include <string>
 #include <sstream>
+#include <streambuf>
 #include <pthread.h>
 #include <microhttpd.h>
 
@@ -38,6 +39,7 @@
 class Kis_Net_Httpd;
 class Kis_Net_Httpd_Session;
 class Kis_Net_Httpd_Connection;
+class Kis_Net_Httpd_Stream_Handler;
 
 // Basic request handler from MHD
 class Kis_Net_Httpd_Handler {
@@ -100,12 +102,83 @@ public:
             const char *url, const char *method, const char *upload_data,
             size_t *upload_data_size, std::stringstream &stream) = 0;
 
+    // Handlers which can generate very large responses (such as the full
+    // device list) can stream them instead of building the whole response
+    // in memory first.  If this returns true for a path,
+    // Httpd_CreateChunkedResponse is called from a generator thread and
+    // writes into a bounded buffer which drains as the client reads.
+    virtual bool Httpd_UseChunkedStream(const char *path __attribute__((unused)),
+            const char *method __attribute__((unused))) {
+        return false;
+    }
+
+    // Chunked responses don't get the connection; it belongs to the
+    // microhttpd thread while the response is being sent.  The GET
+    // arguments of the request are copied into args instead.
+    virtual void Httpd_CreateChunkedResponse(
+            Kis_Net_Httpd *httpd __attribute__((unused)),
+            const char *url __attribute__((unused)), 
+            const char *method __attribute__((unused)),
+            const std::map<string, string> &args __attribute__((unused)),
+            std::ostream &stream __attribute__((unused))) { }
+
     virtual int Httpd_HandleRequest(Kis_Net_Httpd *httpd, 
             struct MHD_Connection *connection,
             const char *url, const char *method, const char *upload_data,
             size_t *upload_data_size);
 };
 
+// Bounded buffer backing a chunked response.  The generator thread writes
+// to an ostream over this buffer and blocks when it is full; microhttpd
+// drains it from the content reader callback.  If the client stops reading
+// for longer than the stall timeout, or disconnects, the buffer is cancelled
+// and further writes are discarded so the generator can finish quickly and
+// release any locks it holds.
+//
+// Shared by the generator, microhttpd, and the server's record of the
+// generator; each calls release() when it is done and the last one out
+// deletes the buffer.
+class Kis_Net_Httpd_Chunked_Buffer : public std::streambuf {
+public:
+    Kis_Net_Httpd_Chunked_Buffer(size_t in_max, time_t in_stall_timeout);
+    virtual ~Kis_Net_Httpd_Chunked_Buffer();
+
+    // Generator side:  flush and mark the response complete
+    void complete();
+
+    // Reader side:  copy up to max bytes, blocking until data is available;
+    // returns a MHD_CONTENT_READER_ code at the end of the stream
+    ssize_t read(char *buf, size_t max);
+
+    // Abort the stream, waking up anyone who is blocked
+    void cancel();
+
+    void retain();
+    void release();
+
+protected:
+    virtual int_type overflow(int_type ch);
+    virtual int sync();
+
+    // Push the staging area into the ring; blocks while the ring is full
+    bool flush_staging();
+
+    pthread_mutex_t buffer_mutex;
+    pthread_cond_t buffer_cond;
+
+    std::vector<char> ring;
+    size_t ring_start, ring_len;
+
+    // Local put area so that small writes from the serializers don't take
+    // the lock every time
+    char staging[4096];
+
+    time_t stall_timeout;
+
+    bool done, cancelled;
+    int refcount;
+};
+
 // Fallback handler to report that we can't serve static files
 class Kis_Net_Httpd_No_Files_Handler : public Kis_Net_Httpd_Stream_Handler {
 public:
@@ -119,6 +192,8 @@ public:
 
 #define KIS_SESSION_COOKIE      "KISMET"
 #define KIS_HTTPD_POSTBUFFERSZ  (1024 * 32)
+#define KIS_HTTPD_CHUNKBUFFERSZ (1024 * 64)
+#define KIS_HTTPD_CHUNKSTALL    30
 
 // Connection data, used for processing POST requests
 class Kis_Net_Httpd_Connection {
@@ -192,6 +267,16 @@ public:
             struct MHD_Connection *connection, 
             const char *url, int httpcode, string responsestr);
 
+    // Stream a response from a handler generator thread as the client reads it
+    static int SendChunkedResponse(Kis_Net_Httpd *httpd,
+            Kis_Net_Httpd_Stream_Handler *handler,
+            struct MHD_Connection *connection,
+            const char *url, const char *method);
+
+    // Add the standard headers (last modified, content type by extension)
+    static void AppendStandardHeaders(Kis_Net_Httpd *httpd,
+            struct MHD_Response *response, const char *url);
+
 protected:
     GlobalRegistry *globalreg;
 
@@ -213,6 +298,29 @@ protected:
 
     pthread_mutex_t controller_mutex;
 
+    // Generator threads of chunked responses.  They run handler code, so
+    // they're cancelled and joined before a handler or the server goes away;
+    // finished ones are joined as new ones start
+    typedef struct {
+        pthread_t thread;
+        Kis_Net_Httpd_Handler *handler;
+        Kis_Net_Httpd_Chunked_Buffer *buffer;
+        bool finished;
+    } chunked_generator;
+
+    pthread_mutex_t chunked_mutex;
+    std::list<chunked_generator *> chunked_generators;
+    bool chunked_shutdown;
+
+    static void *chunked_generator_thread(void *arg);
+
+    // Join the generators which have finished
+    void ReapChunkedGenerators();
+
+    // Cancel and join the generators of a handler, or of every handler if
+    // in_handler is NULL; no new ones are started after that
+    void StopChunkedGenerators(Kis_Net_Httpd_Handler *in_handler);
+
     // Handle the requests and dispatch to controllers
     static int http_request_handler(void *cls, struct MHD_Connection *connection,
             const char *url, const char *method, const char *version,
@@ -0,0 +1,506 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+#include "kis_reactor.h"
+
+#ifdef HAVE_KIS_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
+
+#include "util.h"
+#include "messagebus.h"
+#include "pollable.h"
+#include "timetracker.h"
+
+KisReactor::KisReactor(GlobalRegistry *in_globalreg) {
+    globalreg = in_globalreg;
+
+    pthread_mutex_init(&reactor_locker, NULL);
+
+    wakeup_fd = -1;
+    wakeup_wfd = -1;
+    timer_fd = -1;
+    epoll_fd = -1;
+
+#ifdef HAVE_KIS_EPOLL
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        _MSG("Failed to create epoll descriptor for the main loop: " +
+                string(strerror(errno)), MSGFLAG_FATAL);
+        globalreg->fatal_condition = 1;
+        return;
+    }
+
+    if ((wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) >= 0) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(struct epoll_event));
+        ev.events = EPOLLIN;
+        ev.data.fd = wakeup_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &ev);
+    }
+
+    wakeup_wfd = wakeup_fd;
+
+    // Armed for the next timer due; timers are scheduled by wall clock time
+    if ((timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC)) >= 0) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(struct epoll_event));
+        ev.events = EPOLLIN;
+        ev.data.fd = timer_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+
+        // Pick up anything scheduled before we existed
+        TimersChanged();
+    }
+#else
+    int wakeup_pipe[2];
+
+    if (pipe(wakeup_pipe) >= 0) {
+        fcntl(wakeup_pipe[0], F_SETFL, fcntl(wakeup_pipe[0], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(wakeup_pipe[1], F_SETFL, fcntl(wakeup_pipe[1], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(wakeup_pipe[0], F_SETFD, FD_CLOEXEC);
+        fcntl(wakeup_pipe[1], F_SETFD, FD_CLOEXEC);
+
+        wakeup_fd = wakeup_pipe[0];
+        wakeup_wfd = wakeup_pipe[1];
+    }
+#endif
+
+    if (wakeup_fd < 0) {
+        _MSG("Failed to create wakeup descriptor for the main loop: " +
+                string(strerror(errno)), MSGFLAG_FATAL);
+        globalreg->fatal_condition = 1;
+    }
+}
+
+KisReactor::~KisReactor() {
+    {
+        local_locker lock(&reactor_locker);
+
+        if (timer_fd >= 0)
+            close(timer_fd);
+
+        if (wakeup_wfd >= 0 && wakeup_wfd != wakeup_fd)
+            close(wakeup_wfd);
+
+        if (wakeup_fd >= 0)
+            close(wakeup_fd);
+
+        if (epoll_fd >= 0)
+            close(epoll_fd);
+    }
+
+    if (globalreg->reactor == this)
+        globalreg->reactor = NULL;
+
+    pthread_mutex_destroy(&reactor_locker);
+}
+
+#ifdef HAVE_KIS_EPOLL
+static uint32_t reactor_to_epoll(unsigned int in_events) {
+    uint32_t ev = EPOLLET;
+
+    if (in_events & REACTOR_READ)
+        ev |= EPOLLIN | EPOLLRDHUP;
+
+    if (in_events & REACTOR_WRITE)
+        ev |= EPOLLOUT;
+
+    return ev;
+}
+#endif
+
+int KisReactor::AddFd(int in_fd, unsigned int in_events, 
+        ReactorEventHandler *in_handler) {
+    local_locker lock(&reactor_locker);
+
+    if (in_fd < 0 || fd_map.find(in_fd) != fd_map.end())
+        return -1;
+
+#ifdef HAVE_KIS_EPOLL
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.events = reactor_to_epoll(in_events);
+    ev.data.fd = in_fd;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, in_fd, &ev) < 0)
+        return -1;
+#else
+    if (in_fd >= FD_SETSIZE)
+        return -1;
+#endif
+
+    reactor_fd rfd;
+    rfd.fd = in_fd;
+    rfd.events = in_events;
+    rfd.handler = in_handler;
+
+    fd_map[in_fd] = rfd;
+
+#ifndef HAVE_KIS_EPOLL
+    // Make sure select() picks up the new descriptor
+    Wakeup();
+#endif
+
+    return 1;
+}
+
+int KisReactor::ModifyFd(int in_fd, unsigned int in_events) {
+    local_locker lock(&reactor_locker);
+
+    map<int, reactor_fd>::iterator i = fd_map.find(in_fd);
+
+    if (i == fd_map.end())
+        return -1;
+
+    i->second.events = in_events;
+
+#ifdef HAVE_KIS_EPOLL
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.events = reactor_to_epoll(in_events);
+    ev.data.fd = in_fd;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, in_fd, &ev) < 0)
+        return -1;
+#else
+    Wakeup();
+#endif
+
+    return 1;
+}
+
+int KisReactor::RemoveFd(int in_fd) {
+    local_locker lock(&reactor_locker);
+
+    map<int, reactor_fd>::iterator i = fd_map.find(in_fd);
+
+    if (i == fd_map.end())
+        return -1;
+
+    fd_map.erase(i);
+
+#ifdef HAVE_KIS_EPOLL
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, in_fd, NULL);
+#endif
+
+    return 1;
+}
+
+void KisReactor::AddWakeupHandler(ReactorEventHandler *in_handler) {
+    local_locker lock(&reactor_locker);
+    wakeup_vec.push_back(in_handler);
+}
+
+void KisReactor::RemoveWakeupHandler(ReactorEventHandler *in_handler) {
+    local_locker lock(&reactor_locker);
+
+    vector<ReactorEventHandler *>::iterator i =
+        find(wakeup_vec.begin(), wakeup_vec.end(), in_handler);
+
+    if (i != wakeup_vec.end())
+        wakeup_vec.erase(i);
+}
+
+void KisReactor::Wakeup() {
+    if (wakeup_wfd < 0)
+        return;
+
+#ifdef HAVE_KIS_EPOLL
+    uint64_t one = 1;
+    if (write(wakeup_wfd, &one, sizeof(uint64_t)) < 0) {
+        // A full counter already has a wakeup pending
+    }
+#else
+    char c = 0;
+    if (write(wakeup_wfd, &c, 1) < 0) {
+        // A full pipe already has a wakeup pending
+    }
+#endif
+}
+
+void KisReactor::DrainWakeup() {
+    char buf[256];
+
+    while (read(wakeup_fd, buf, 256) > 0)
+        ;
+
+    vector<ReactorEventHandler *> handlers;
+
+    {
+        local_locker lock(&reactor_locker);
+        handlers = wakeup_vec;
+    }
+
+    for (unsigned int x = 0; x < handlers.size(); x++)
+        handlers[x]->ReactorEvent(-1, REACTOR_WAKEUP);
+}
+
+void KisReactor::TimersChanged() {
+#ifdef HAVE_KIS_EPOLL
+    if (timer_fd < 0)
+        return;
+
+    struct itimerspec its;
+    struct timeval next;
+
+    memset(&its, 0, sizeof(struct itimerspec));
+
+    if (globalreg->timetracker != NULL && 
+            globalreg->timetracker->FetchNextTrigger(&next)) {
+        its.it_value.tv_sec = next.tv_sec;
+        its.it_value.tv_nsec = next.tv_usec * 1000;
+
+        // A zero time disarms the timer, and anything in the past fires
+        // immediately
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+            its.it_value.tv_nsec = 1;
+    }
+
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+#endif
+}
+
+int KisReactor::TimerWait(int in_max_ms) {
+    struct timeval next, now;
+
+    if (globalreg->timetracker == NULL || 
+            !globalreg->timetracker->FetchNextTrigger(&next))
+        return in_max_ms;
+
+    gettimeofday(&now, NULL);
+
+    long wait_ms = (next.tv_sec - now.tv_sec) * 1000L +
+        (next.tv_usec - now.tv_usec + 999) / 1000;
+
+    if (wait_ms < 0)
+        wait_ms = 0;
+
+    if (in_max_ms >= 0 && wait_ms > in_max_ms)
+        return in_max_ms;
+
+    return (int) wait_ms;
+}
+
+void KisReactor::DrainTimer() {
+    uint64_t expirations;
+
+    if (timer_fd >= 0 && read(timer_fd, &expirations, sizeof(uint64_t)) < 0) {
+        // Nothing pending
+    }
+}
+
+void KisReactor::RunTimers() {
+    DrainTimer();
+
+    // Tick re-arms us for the next timer
+    if (globalreg->timetracker != NULL)
+        globalreg->timetracker->Tick();
+}
+
+void KisReactor::Dispatch(int in_fd, unsigned int in_events) {
+    ReactorEventHandler *handler;
+
+    {
+        local_locker lock(&reactor_locker);
+
+        map<int, reactor_fd>::iterator i = fd_map.find(in_fd);
+
+        // Removed by an earlier handler in this pass
+        if (i == fd_map.end())
+            return;
+
+        handler = i->second.handler;
+    }
+
+    handler->ReactorEvent(in_fd, in_events);
+}
+
+int KisReactor::Iterate(int in_timeout_ms, bool in_timers) {
+    fd_set rset, wset;
+    int max_fd = 0;
+    struct timeval tm;
+
+    FD_ZERO(&rset);
+    FD_ZERO(&wset);
+
+    // Collect the descriptors of the pollables which haven't moved to the
+    // reactor yet
+    for (unsigned int x = 0; x < globalreg->subsys_pollable_vec.size(); x++) 
+        max_fd = globalreg->subsys_pollable_vec[x]->MergeSet(max_fd, &rset, &wset);
+
+#ifdef HAVE_KIS_EPOLL
+    struct epoll_event events[64];
+    int nev = 0;
+
+    // A negative timeout sleeps until the next timer or event; an explicit
+    // one, including 0 for a pass which mustn't block, is always honoured
+    if (in_timers)
+        in_timeout_ms = TimerWait(in_timeout_ms);
+
+    if (max_fd > 0) {
+        tm.tv_sec = in_timeout_ms / 1000;
+        tm.tv_usec = (in_timeout_ms % 1000) * 1000;
+
+        // The epoll descriptor is readable whenever anything registered
+        // with it is ready, so it can wait alongside the old pollables
+        FD_SET(epoll_fd, &rset);
+
+        if (select(max(max_fd, epoll_fd) + 1, &rset, &wset, NULL, 
+                    in_timeout_ms < 0 ? NULL : &tm) < 0) {
+            if (errno != EINTR && errno != EAGAIN)
+                return -1;
+
+            FD_ZERO(&rset);
+            FD_ZERO(&wset);
+        }
+
+        if (FD_ISSET(epoll_fd, &rset))
+            nev = epoll_wait(epoll_fd, events, 64, 0);
+    } else {
+        nev = epoll_wait(epoll_fd, events, 64, in_timeout_ms);
+    }
+
+    if (nev < 0) {
+        if (errno != EINTR && errno != EAGAIN)
+            return -1;
+
+        nev = 0;
+    }
+
+    // Timestamps everything handled in this pass
+    if (!globalreg->packet_clock)
+        gettimeofday(&(globalreg->timestamp), NULL);
+
+    for (int e = 0; e < nev; e++) {
+        int fd = events[e].data.fd;
+
+        // The timerfd is one-shot; whatever is overdue is run below, or on
+        // the next pass which runs timers, and Tick re-arms it
+        if (fd == timer_fd) {
+            DrainTimer();
+            continue;
+        }
+
+        if (fd == wakeup_fd) {
+            DrainWakeup();
+            continue;
+        }
+
+        unsigned int rev = 0;
+
+        if (events[e].events & (EPOLLIN | EPOLLPRI | EPOLLRDHUP))
+            rev |= REACTOR_READ;
+
+        if (events[e].events & EPOLLOUT)
+            rev |= REACTOR_WRITE;
+
+        // Errors and hangups are reported as readable too, so handlers find
+        // out the normal way
+        if (events[e].events & (EPOLLERR | EPOLLHUP))
+            rev |= REACTOR_ERROR | REACTOR_READ;
+
+        Dispatch(fd, rev);
+    }
+
+    // Run timers whenever the next one is due, not only when the timerfd
+    // fired in this pass; an expiry drained by a pass which doesn't run 
+    // timers would otherwise leave the timerfd disarmed for good
+    if (in_timers && (timer_fd < 0 || TimerWait(-1) == 0))
+        RunTimers();
+#else
+    vector<reactor_fd> watched;
+
+    {
+        local_locker lock(&reactor_locker);
+
+        for (map<int, reactor_fd>::iterator i = fd_map.begin(); 
+                i != fd_map.end(); ++i) {
+            if (i->second.events & REACTOR_READ)
+                FD_SET(i->first, &rset);
+            if (i->second.events & REACTOR_WRITE)
+                FD_SET(i->first, &wset);
+            if (i->first > max_fd)
+                max_fd = i->first;
+
+            watched.push_back(i->second);
+        }
+    }
+
+    if (wakeup_fd >= 0) {
+        FD_SET(wakeup_fd, &rset);
+        if (wakeup_fd > max_fd)
+            max_fd = wakeup_fd;
+    }
+
+    if (in_timers)
+        in_timeout_ms = TimerWait(in_timeout_ms);
+
+    tm.tv_sec = in_timeout_ms / 1000;
+    tm.tv_usec = (in_timeout_ms % 1000) * 1000;
+
+    if (select(max_fd + 1, &rset, &wset, NULL, 
+                in_timeout_ms < 0 ? NULL : &tm) < 0) {
+        if (errno != EINTR && errno != EAGAIN)
+            return -1;
+
+        FD_ZERO(&rset);
+        FD_ZERO(&wset);
+    }
+
+    if (!globalreg->packet_clock)
+        gettimeofday(&(globalreg->timestamp), NULL);
+
+    if (wakeup_fd >= 0 && FD_ISSET(wakeup_fd, &rset))
+        DrainWakeup();
+
+    for (unsigned int x = 0; x < watched.size(); x++) {
+        unsigned int rev = 0;
+
+        if (FD_ISSET(watched[x].fd, &rset))
+            rev |= REACTOR_READ;
+        if (FD_ISSET(watched[x].fd, &wset))
+            rev |= REACTOR_WRITE;
+
+        if (rev != 0)
+            Dispatch(watched[x].fd, rev);
+    }
+
+    if (in_timers)
+        RunTimers();
+#endif
+
+    // Old pollables are polled every pass, like they always were
+    for (unsigned int x = 0; x < globalreg->subsys_pollable_vec.size(); x++) {
+        if (globalreg->subsys_pollable_vec[x]->Poll(rset, wset) < 0 &&
+                globalreg->fatal_condition)
+            break;
+    }
+
+    return 1;
+}
+
@@ -0,0 +1,138 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KIS_REACTOR_H__
+#define __KIS_REACTOR_H__
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <map>
+#include <vector>
+
+#include "globalregistry.h"
+
+#ifdef SYS_LINUX
+#define HAVE_KIS_EPOLL 1
+#endif
+
+#define REACTOR_READ        1
+#define REACTOR_WRITE       2
+#define REACTOR_ERROR       4
+#define REACTOR_WAKEUP      8
+
+// Anything which registers descriptors with the reactor
+class ReactorEventHandler {
+public:
+    virtual ~ReactorEventHandler() { }
+
+    // Called in the main thread when a registered descriptor is ready.  in_events
+    // is a mask of REACTOR_READ, REACTOR_WRITE and REACTOR_ERROR.
+    //
+    // Readiness is edge triggered:  a handler must read (or write) until it
+    // gets EAGAIN, or it won't hear about the descriptor again until more data
+    // arrives.
+    //
+    // Wakeup handlers are called with an fd of -1 and REACTOR_WAKEUP.
+    virtual void ReactorEvent(int in_fd, unsigned int in_events) = 0;
+};
+
+// Main loop event reactor
+//
+// Descriptors are registered once, with the events they're interested in,
+// and their handlers are only called when they're ready; on Linux this is
+// built on epoll and scales to any number of descriptors.  Timetracker is
+// driven by a timerfd armed for the next timer due, so the loop sleeps until
+// there's something to do, and other threads can wake the main loop through
+// an eventfd.  On other platforms the same interface is implemented with
+// select().
+//
+// Older Pollable subsystems in the globalreg pollable vector are still
+// merged and polled every pass, exactly as the old main loop did, until they
+// are moved to the reactor.  While any of them have descriptors the reactor
+// waits in select() with the epoll descriptor in the read set.
+class KisReactor {
+public:
+    KisReactor(GlobalRegistry *in_globalreg);
+    ~KisReactor();
+
+    // Register a descriptor with a mask of REACTOR_READ and REACTOR_WRITE.
+    // Descriptors should be non-blocking.  Returns negative on failure.
+    int AddFd(int in_fd, unsigned int in_events, ReactorEventHandler *in_handler);
+
+    // Change the events we're interested in.  Safe to call from any thread;
+    // re-arming a descriptor which is already ready delivers an event for it.
+    int ModifyFd(int in_fd, unsigned int in_events);
+
+    // Stop watching a descriptor; must be called before it is closed
+    int RemoveFd(int in_fd);
+
+    // Handlers called (in the main thread) whenever something calls Wakeup()
+    void AddWakeupHandler(ReactorEventHandler *in_handler);
+    void RemoveWakeupHandler(ReactorEventHandler *in_handler);
+
+    // Wake up the main loop from another thread
+    void Wakeup();
+
+    // Called by Timetracker when the next timer due may have changed
+    void TimersChanged();
+
+    // Run one pass of the main loop, waiting at most in_timeout_ms for 
+    // something to happen, or with a negative timeout until something does.
+    // Timers are only run when in_timers is set; then the wait is also cut
+    // short for the next timer due.  Returns negative if waiting failed.
+    int Iterate(int in_timeout_ms, bool in_timers);
+
+protected:
+    GlobalRegistry *globalreg;
+
+    pthread_mutex_t reactor_locker;
+
+    struct reactor_fd {
+        int fd;
+        unsigned int events;
+        ReactorEventHandler *handler;
+    };
+
+    map<int, reactor_fd> fd_map;
+    vector<ReactorEventHandler *> wakeup_vec;
+
+    // Wakeup descriptor; an eventfd, or the read side of a pipe
+    int wakeup_fd;
+    int wakeup_wfd;
+
+    // Timer descriptor armed for the next Timetracker deadline, -1 if we
+    // shorten our waits instead
+    int timer_fd;
+
+    int epoll_fd;
+
+    void DrainWakeup();
+    void DrainTimer();
+    void RunTimers();
+    void Dispatch(int in_fd, unsigned int in_events);
+
+    // Milliseconds until the next timer is due, capped at in_max_ms; -1 for
+    // in_max_ms means no cap
+    int TimerWait(int in_max_ms);
+};
+
+#endif
+
@@ -0,0 +1,370 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __KIS_SHM_RING_H__
+#define __KIS_SHM_RING_H__
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef SYS_LINUX
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#ifdef SYS_memfd_create
+#define HAVE_KIS_SHM_RING 1
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#endif
+#endif
+
+/* Shared memory ring
+ *
+ * Single-producer, single-consumer byte ring shared between a capture
+ * helper and the Kismet server.  The server creates the ring in a memfd,
+ * along with an eventfd doorbell, and passes both to the helper when it is
+ * launched (--shm-ring-fd= and --shm-doorbell-fd=).  A helper which
+ * understands the ring attaches to it, writes its simple_cap_proto frames
+ * directly into the shared memory, and rings the doorbell; the server
+ * decodes the frames in place.  A helper which does not simply ignores the
+ * options and keeps using the pipe.  Helpers must attach before they write
+ * anything to the pipe, since the server stops feeding pipe data into the
+ * ring once a helper has taken over as the producer.
+ *
+ * The memfd holds one page of header followed by the data area.  The data
+ * area is mapped twice, back to back, so any span of up to the ring size is
+ * contiguous in memory and frames never have to be reassembled around the
+ * end of the ring.
+ *
+ * head and tail are free-running byte counts; head is only written by the
+ * producer and tail only by the consumer, and they live on their own cache
+ * lines.
+ *
+ * Neither side trusts what the other writes: a head more than the ring
+ * ahead of the tail (or behind it) can only come from a broken producer.  The
+ * ring is then treated as empty (or full, to a producer) and flagged corrupt,
+ * which the owner must handle as a fatal IPC error.
+ *
+ * Shared by the server and the C capture helpers, so everything here is
+ * plain C and static inline.
+ */
+
+#define KIS_SHM_RING_SIG        0x4B53524E
+#define KIS_SHM_RING_VERSION    1
+
+struct kis_shm_ring_h {
+    uint32_t signature;
+    uint32_t version;
+    uint64_t data_sz;
+    /* Set by a producer which has attached and will write to the ring
+     * instead of the pipe */
+    uint32_t producer_attached;
+    uint8_t pad0[44];
+
+    /* Total bytes written, updated by the producer */
+    uint64_t head;
+    uint8_t pad1[56];
+
+    /* Total bytes consumed, updated by the consumer */
+    uint64_t tail;
+    uint8_t pad2[56];
+};
+
+typedef struct {
+    int fd;
+    int doorbell_fd;
+
+    struct kis_shm_ring_h *header;
+    uint8_t *data;
+    size_t data_sz;
+
+    void *map_base;
+    size_t map_sz;
+
+    /* Set once the other side has published an impossible head or tail */
+    int corrupt;
+} kis_shm_ring_t;
+
+static inline size_t kis_shm_ring_pagesz(void) {
+    long pg = sysconf(_SC_PAGESIZE);
+
+    if (pg <= 0)
+        return 4096;
+
+    return (size_t) pg;
+}
+
+/* Map an initialized memfd; the data area must already be sized */
+static inline int kis_shm_ring_map(kis_shm_ring_t *ring) {
+#ifdef HAVE_KIS_SHM_RING
+    size_t pg = kis_shm_ring_pagesz();
+    uint8_t *base;
+
+    ring->map_sz = pg + (ring->data_sz * 2);
+
+    /* Reserve the whole span, then map the file over it twice */
+    base = (uint8_t *) mmap(NULL, ring->map_sz, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (base == MAP_FAILED)
+        return -1;
+
+    if (mmap(base, pg + ring->data_sz, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, ring->fd, 0) == MAP_FAILED) {
+        munmap(base, ring->map_sz);
+        return -1;
+    }
+
+    if (mmap(base + pg + ring->data_sz, ring->data_sz, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, ring->fd, pg) == MAP_FAILED) {
+        munmap(base, ring->map_sz);
+        return -1;
+    }
+
+    ring->map_base = base;
+    ring->header = (struct kis_shm_ring_h *) base;
+    ring->data = base + pg;
+
+    return 1;
+#else
+    (void) ring;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* Create a new ring with a data area of at least in_sz bytes, rounded up to
+ * the page size.  The memfd and doorbell are close-on-exec; whoever launches
+ * the helper clears that on the copies it hands over.  Returns negative on
+ * failure. */
+static inline int kis_shm_ring_create(kis_shm_ring_t *ring, size_t in_sz) {
+    memset(ring, 0, sizeof(kis_shm_ring_t));
+    ring->fd = -1;
+    ring->doorbell_fd = -1;
+
+#ifdef HAVE_KIS_SHM_RING
+    size_t pg = kis_shm_ring_pagesz();
+
+    ring->data_sz = ((in_sz + pg - 1) / pg) * pg;
+
+    if (ring->data_sz == 0)
+        return -1;
+
+    if ((ring->fd = (int) syscall(SYS_memfd_create, "kismet_ring", MFD_CLOEXEC)) < 0)
+        return -1;
+
+    if (ftruncate(ring->fd, pg + ring->data_sz) < 0) {
+        close(ring->fd);
+        ring->fd = -1;
+        return -1;
+    }
+
+    if (kis_shm_ring_map(ring) < 0) {
+        close(ring->fd);
+        ring->fd = -1;
+        return -1;
+    }
+
+    if ((ring->doorbell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        munmap(ring->map_base, ring->map_sz);
+        close(ring->fd);
+        ring->fd = -1;
+        return -1;
+    }
+
+    ring->header->signature = KIS_SHM_RING_SIG;
+    ring->header->version = KIS_SHM_RING_VERSION;
+    ring->header->data_sz = ring->data_sz;
+    ring->header->producer_attached = 0;
+    ring->header->head = 0;
+    ring->header->tail = 0;
+
+    return 1;
+#else
+    (void) in_sz;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* Attach to a ring passed to us by the server.  Returns negative if the
+ * ring can't be mapped or isn't a ring we understand; the caller should
+ * fall back to the pipe. */
+static inline int kis_shm_ring_attach(kis_shm_ring_t *ring, int in_fd,
+        int in_doorbell_fd) {
+#ifdef HAVE_KIS_SHM_RING
+    struct kis_shm_ring_h hdr;
+
+    memset(ring, 0, sizeof(kis_shm_ring_t));
+    ring->fd = in_fd;
+    ring->doorbell_fd = in_doorbell_fd;
+
+    if (pread(in_fd, &hdr, sizeof(struct kis_shm_ring_h), 0) !=
+            sizeof(struct kis_shm_ring_h))
+        return -1;
+
+    if (hdr.signature != KIS_SHM_RING_SIG || hdr.version != KIS_SHM_RING_VERSION)
+        return -1;
+
+    if (hdr.data_sz == 0 || (hdr.data_sz % kis_shm_ring_pagesz()) != 0)
+        return -1;
+
+    ring->data_sz = hdr.data_sz;
+
+    if (kis_shm_ring_map(ring) < 0)
+        return -1;
+
+    __atomic_store_n(&(ring->header->producer_attached), 1, __ATOMIC_RELEASE);
+
+    return 1;
+#else
+    (void) ring;
+    (void) in_fd;
+    (void) in_doorbell_fd;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* Unmap and close a ring */
+static inline void kis_shm_ring_close(kis_shm_ring_t *ring) {
+#ifdef HAVE_KIS_SHM_RING
+    if (ring->map_base != NULL)
+        munmap(ring->map_base, ring->map_sz);
+#endif
+
+    if (ring->fd >= 0)
+        close(ring->fd);
+
+    if (ring->doorbell_fd >= 0)
+        close(ring->doorbell_fd);
+
+    ring->map_base = NULL;
+    ring->header = NULL;
+    ring->data = NULL;
+    ring->fd = -1;
+    ring->doorbell_fd = -1;
+}
+
+static inline int kis_shm_ring_producer_attached(kis_shm_ring_t *ring) {
+    return __atomic_load_n(&(ring->header->producer_attached), __ATOMIC_ACQUIRE);
+}
+
+static inline int kis_shm_ring_corrupt(kis_shm_ring_t *ring) {
+    return ring->corrupt;
+}
+
+/* Bytes between tail and head, or 0 and the ring flagged corrupt if they
+ * can't be from a working peer */
+static inline size_t kis_shm_ring_span(kis_shm_ring_t *ring, uint64_t head,
+        uint64_t tail) {
+    if (head - tail > ring->data_sz) {
+        ring->corrupt = 1;
+        return 0;
+    }
+
+    return (size_t) (head - tail);
+}
+
+static inline size_t kis_shm_ring_used(kis_shm_ring_t *ring) {
+    uint64_t head = __atomic_load_n(&(ring->header->head), __ATOMIC_ACQUIRE);
+    uint64_t tail = __atomic_load_n(&(ring->header->tail), __ATOMIC_ACQUIRE);
+
+    return kis_shm_ring_span(ring, head, tail);
+}
+
+static inline size_t kis_shm_ring_available(kis_shm_ring_t *ring) {
+    size_t used = kis_shm_ring_used(ring);
+
+    if (ring->corrupt)
+        return 0;
+
+    return ring->data_sz - used;
+}
+
+/* Producer: reserve in_sz contiguous bytes to build a frame in place.
+ * Returns NULL if there isn't room; nothing is visible to the consumer
+ * until kis_shm_ring_commit */
+static inline uint8_t *kis_shm_ring_reserve(kis_shm_ring_t *ring, size_t in_sz) {
+    uint64_t head = ring->header->head;
+    uint64_t tail = __atomic_load_n(&(ring->header->tail), __ATOMIC_ACQUIRE);
+    size_t used = kis_shm_ring_span(ring, head, tail);
+
+    if (ring->corrupt || in_sz > ring->data_sz - used)
+        return NULL;
+
+    return ring->data + (head % ring->data_sz);
+}
+
+/* Producer: publish in_sz bytes previously reserved */
+static inline void kis_shm_ring_commit(kis_shm_ring_t *ring, size_t in_sz) {
+    __atomic_store_n(&(ring->header->head), ring->header->head + in_sz,
+            __ATOMIC_RELEASE);
+}
+
+/* Producer: copy a complete block into the ring.  Returns in_sz, or 0 if
+ * there isn't room for all of it */
+static inline size_t kis_shm_ring_write(kis_shm_ring_t *ring, const void *in_data,
+        size_t in_sz) {
+    uint8_t *ptr;
+
+    if ((ptr = kis_shm_ring_reserve(ring, in_sz)) == NULL)
+        return 0;
+
+    memcpy(ptr, in_data, in_sz);
+    kis_shm_ring_commit(ring, in_sz);
+
+    return in_sz;
+}
+
+/* Producer: wake the consumer.  Helpers can commit several frames and ring
+ * once. */
+static inline void kis_shm_ring_doorbell(kis_shm_ring_t *ring) {
+    uint64_t one = 1;
+
+    if (write(ring->doorbell_fd, &one, sizeof(uint64_t)) < 0) {
+        /* A full counter means the consumer already has a wakeup pending */
+    }
+}
+
+/* Consumer: get a pointer to the readable data, which is always contiguous.
+ * Returns the number of bytes readable, never more than the ring, so the span
+ * stays inside the double mapping */
+static inline size_t kis_shm_ring_peek(kis_shm_ring_t *ring, uint8_t **ret_data) {
+    uint64_t tail = ring->header->tail;
+    uint64_t head = __atomic_load_n(&(ring->header->head), __ATOMIC_ACQUIRE);
+
+    *ret_data = ring->data + (tail % ring->data_sz);
+
+    return kis_shm_ring_span(ring, head, tail);
+}
+
+/* Consumer: release in_sz bytes back to the producer */
+static inline void kis_shm_ring_consume(kis_shm_ring_t *ring, size_t in_sz) {
+    __atomic_store_n(&(ring->header->tail), ring->header->tail + in_sz,
+            __ATOMIC_RELEASE);
+}
+
+#endif
+
@@ -72,6 +72,7 @@
 #include "datasourcetracker.h"
 
 #include "timetracker.h"
+#include "kis_reactor.h"
 #include "alertracker.h"
 
 #include "netframework.h"
@@ -107,6 +108,8 @@
 
 #include "entrytracker.h"
 
+#include "pcap_replay.h"
+
 #ifndef exec_name
 char *exec_name;
 #endif
@@ -239,20 +242,20 @@ void CatchShutdown(int sig) {
 		globalregistry->sourcetracker->StopSource(0);
 	}
 
+    // Shut down the data sources and their capture threads while the
+    // packetchain is still around for them to feed
+    Datasourcetracker *datasourcetracker =
+        (Datasourcetracker *) globalregistry->FetchGlobal("DATA_SOURCE_TRACKER");
+    if (datasourcetracker != NULL)
+        datasourcetracker->close_datasources();
+
 	globalregistry->spindown = 1;
 
 	// Start a short shutdown cycle for 2 seconds
 	if (daemonize == 0)
 		fprintf(stderr, "\n*** KISMET IS SHUTTING DOWN ***\n");
 	time_t shutdown_target = time(0) + 2;
-	int max_fd = 0;
-	fd_set rset, wset;
-	struct timeval tm;
 	while (1) {
-		FD_ZERO(&rset);
-		FD_ZERO(&wset);
-		max_fd = 0;
-
 		if (globalregistry->fatal_condition) {
 			break;
 		}
@@ -261,29 +264,13 @@ void CatchShutdown(int sig) {
 			break;
 		}
 
-		// Collect all the pollable descriptors
-		for (unsigned int x = 0; x < globalregistry->subsys_pollable_vec.size(); x++) 
-			max_fd = 
-				globalregistry->subsys_pollable_vec[x]->MergeSet(max_fd, &rset, 
-																 &wset);
-
-		tm.tv_sec = 0;
-		tm.tv_usec = 100000;
-
-		if (select(max_fd + 1, &rset, &wset, NULL, &tm) < 0) {
-			if (errno != EINTR && errno != EAGAIN) {
-				break;
-			}
+		if (globalregistry->reactor == NULL) {
+			break;
 		}
 
-		for (unsigned int x = 0; x < globalregistry->subsys_pollable_vec.size(); 
-			 x++) {
-			if (globalregistry->subsys_pollable_vec[x]->Poll(rset, wset) < 0 &&
-				globalregistry->fatal_condition) {
-				break;
-			}
+		if (globalregistry->reactor->Iterate(100, false) < 0) {
+			break;
 		}
-
 	}
 
 	if (globalregistry->rootipc != NULL) {
@@ -333,6 +320,9 @@ void CatchShutdown(int sig) {
     fprintf(stderr, "debug - freeing lifetime globals\n");
     globalregistry->DeleteLifetimeGlobals();
 
+    if (globalregistry->reactor != NULL)
+        delete globalregistry->reactor;
+
     exit(0);
 }
 
@@ -659,13 +649,10 @@ int main(int argc, char *argv[], char *envp[]) {
 
     // Set up usage functions
     globalregistry->RegisterUsageFunc(Devicetracker::usage);
+    globalregistry->RegisterUsageFunc(PcapReplay::usage);
 
 	int startup_ipc_id = -1;
 
-	int max_fd = 0;
-	fd_set rset, wset;
-	struct timeval tm;
-
 	const int nlwc = globalregistry->getopt_long_num++;
 	const int dwc = globalregistry->getopt_long_num++;
 	const int npwc = globalregistry->getopt_long_num++;
@@ -737,6 +724,11 @@ int main(int argc, char *argv[], char *envp[]) {
 	// Register the smart msg printer for everything
 	globalregistry->messagebus->RegisterClient(smartmsgcli, MSGFLAG_ALL);
 
+    // Make the main loop reactor; the root IPC startup below already spins
+    // it.  It outlives the lifetime globals, which remove their descriptors
+    // from it as they shut down
+    globalregistry->reactor = new KisReactor(globalregistry);
+
 #ifndef SYS_CYGWIN
 	// Generate the root ipc packet capture and spawn it immediately, then register
 	// and sync the packet protocol stuff
@@ -759,37 +751,17 @@ int main(int argc, char *argv[], char *envp[]) {
 		time_t ipc_spin_start = time(0);
 
 		while (1) {
-			FD_ZERO(&rset);
-			FD_ZERO(&wset);
-			max_fd = 0;
-
 			if (globalregistry->fatal_condition)
 				CatchShutdown(-1);
 
-			// Collect all the pollable descriptors
-			for (unsigned int x = 0; x < globalregistry->subsys_pollable_vec.size(); x++) 
-				max_fd = 
-					globalregistry->subsys_pollable_vec[x]->MergeSet(max_fd, &rset, 
-																	 &wset);
-			tm.tv_sec = 0;
-			tm.tv_usec = 100000;
-
-			if (select(max_fd + 1, &rset, &wset, NULL, &tm) < 0) {
-				if (errno != EINTR && errno != EAGAIN) {
-					snprintf(errstr, STATUS_MAX, "Main select loop failed: %s",
-							 strerror(errno));
-					CatchShutdown(-1);
-				}
+			if (globalregistry->reactor->Iterate(100, false) < 0) {
+				snprintf(errstr, STATUS_MAX, "Main select loop failed: %s",
+						 strerror(errno));
+				CatchShutdown(-1);
 			}
 
-			for (unsigned int x = 0; 
-				 x < globalregistry->subsys_pollable_vec.size(); x++) {
-
-				if (globalregistry->subsys_pollable_vec[x]->Poll(rset, wset) < 0 &&
-					globalregistry->fatal_condition) {
-					CatchShutdown(-1);
-				}
-			}
+			if (globalregistry->fatal_condition)
+				CatchShutdown(-1);
 
 			if (globalregistry->rootipc->FetchRootIPCSynced() > 0) {
 				// printf("debug - kismet server startup got root sync\n");
@@ -1142,45 +1114,51 @@ int main(int argc, char *argv[], char *envp[]) {
 			 string(SYSCONF_LOC) + "/" + config_base + ")", MSGFLAG_INFO);
 	}
 	
+	// Offline replay, if one was asked for on the command line
+	PcapReplay *replay = new PcapReplay(globalregistry);
+	globalregistry->RegisterLifetimeGlobal(replay);
+
+	if (globalregistry->fatal_condition)
+		CatchShutdown(-1);
+
 	// Set the global silence now that we're set up
 	glob_silent = local_silent;
 
 	// Core loop
 	while (1) {
 		// printf("debug - %d - main loop tick\n", getpid());
-
-		FD_ZERO(&rset);
-		FD_ZERO(&wset);
-		max_fd = 0;
+		int loop_timeout = 100;
 
 		if (globalregistry->fatal_condition)
 			CatchShutdown(-1);
 
-		// Collect all the pollable descriptors
-		for (unsigned int x = 0; x < globalregistry->subsys_pollable_vec.size(); x++) 
-			max_fd = 
-				globalregistry->subsys_pollable_vec[x]->MergeSet(max_fd, &rset, 
-																 &wset);
+		// Feed the replay a batch at a time, and don't block in the loop
+		// while there's more to replay; once the file is read, a normal
+		// blocking pass lets the reactor wake us as the threaded chain hands
+		// back the last packets
+		if (replay->Replaying()) {
+			replay->ReplayBatch();
 
-		tm.tv_sec = 0;
-		tm.tv_usec = 100000;
-
-		if (select(max_fd + 1, &rset, &wset, NULL, &tm) < 0) {
-			if (errno != EINTR && errno != EAGAIN) {
-				snprintf(errstr, STATUS_MAX, "Main select loop failed: %s",
-						 strerror(errno));
-				CatchShutdown(-1);
-			}
+			if (replay->Replaying() && !replay->Draining())
+				loop_timeout = 0;
 		}
 
-		globalregistry->timetracker->Tick();
+		// Only exit once the last replayed packet is through the chain and
+		// the replay has reported and handed back the clock
+		if (!replay->Replaying() && replay->Finished() && 
+			replay->ExitOnFinish())
+			CatchShutdown(-1);
 
-		for (unsigned int x = 0; x < globalregistry->subsys_pollable_vec.size(); x++) {
-			if (globalregistry->subsys_pollable_vec[x]->Poll(rset, wset) < 0 &&
-				globalregistry->fatal_condition) {
-				CatchShutdown(-1);
-			}
+		// Dispatches ready descriptors, polls the remaining old-style 
+		// pollables, and runs timers
+		if (globalregistry->reactor->Iterate(loop_timeout, true) < 0) {
+			snprintf(errstr, STATUS_MAX, "Main loop failed: %s",
+					 strerror(errno));
+			CatchShutdown(-1);
 		}
+
+		if (globalregistry->fatal_condition)
+			CatchShutdown(-1);
 	}
 
 	CatchShutdown(-1);
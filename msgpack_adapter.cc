@@ -19,6 +19,7 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <list>
 #include <map>
@@ -35,8 +36,64 @@
 #include "devicetracker_component.h"
 #include "msgpack_adapter.h"
 
+typedef void (*msgpack_packer_func)(GlobalRegistry *, TrackerElement *,
+        msgpack::packer<std::ostream> &, SerializeCacheTags *);
+
+// Pack a tagged record through the serialization cache, holding the component
+// it was built from locked; returns false if the element isn't tagged
+static bool PackCached(GlobalRegistry *globalreg, TrackerElement *v,
+        msgpack::packer<std::ostream> &o, SerializeCacheTags *tags,
+        int in_format, msgpack_packer_func in_packer) {
+    const SerializeCacheTags::cache_tag *tag = tags->Match(v);
+
+    if (tag == NULL)
+        return false;
+
+    if (tags->cache == NULL) {
+        // Only here for the lock
+        if (tag->lock != NULL)
+            tag->lock->mutex_lock();
+
+        (*in_packer)(globalreg, v, o, NULL);
+
+        if (tag->lock != NULL)
+            tag->lock->mutex_unlock();
+
+        return true;
+    }
+
+    if (!tags->cache->Fetch(tag->object, tag->generation, tag->view,
+                in_format, tags->now, &(tags->scratch))) {
+        // Records don't nest, so nothing under this one is looked up
+        msgpack::packer<std::ostream> rpacker(&(tags->scratch_stream));
+
+        tags->scratch.clear();
+
+        if (tag->lock != NULL)
+            tag->lock->mutex_lock();
+
+        (*in_packer)(globalreg, v, rpacker, NULL);
+
+        if (tag->lock != NULL)
+            tag->lock->mutex_unlock();
+
+        tags->cache->Store(tag->object, tag->generation, tag->view,
+                in_format, tags->now, tags->scratch.data(), 
+                tags->scratch.length());
+    }
+
+    // The packer has no raw write, but a bin body goes out untouched
+    o.pack_bin_body(tags->scratch.data(), tags->scratch.length());
+
+    return true;
+}
+
 void MsgpackAdapter::Packer(GlobalRegistry *globalreg, TrackerElement *v,
-        msgpack::packer<std::stringstream> &o) {
+        msgpack::packer<std::ostream> &o, SerializeCacheTags *tags) {
+
+    if (tags != NULL && PackCached(globalreg, v, o, tags, 
+                SerializeCache::format_msgpack, &MsgpackAdapter::Packer))
+        return;
 
     v->pre_serialize();
 
@@ -109,7 +166,7 @@ void MsgpackAdapter::Packer(GlobalRegistry *globalreg, TrackerElement *v,
 
             o.pack_array(v->size());
             for (x = 0; x < tvec->size(); x++) {
-                Packer(globalreg, (*tvec)[x], o);
+                Packer(globalreg, (*tvec)[x], o, tags);
             }
 
             break;
@@ -119,7 +176,7 @@ void MsgpackAdapter::Packer(GlobalRegistry *globalreg, TrackerElement *v,
             for (map_iter = tmap->begin(); map_iter != tmap->end(); 
                     ++map_iter) {
                 o.pack(globalreg->entrytracker->GetFieldName(map_iter->first));
-                Packer(globalreg, map_iter->second, o);
+                Packer(globalreg, map_iter->second, o, tags);
                 // o.pack(map_iter->second);
             }
             break;
@@ -129,7 +186,7 @@ void MsgpackAdapter::Packer(GlobalRegistry *globalreg, TrackerElement *v,
             for (map_iter = tmap->begin(); map_iter != tmap->end(); 
                     ++map_iter) {
                 o.pack(map_iter->first);
-                Packer(globalreg, map_iter->second, o);
+                Packer(globalreg, map_iter->second, o, tags);
                 //o.pack(map_iter->second);
             }
             break;
@@ -143,7 +200,7 @@ void MsgpackAdapter::Packer(GlobalRegistry *globalreg, TrackerElement *v,
                 // not a vector of mac+mask
                 o.pack(mac_map_iter->first.MacFull2String());
                 // o.pack(mac_map_iter->second);
-                Packer(globalreg, mac_map_iter->second, o);
+                Packer(globalreg, mac_map_iter->second, o, tags);
             }
             break;
         case TrackerStringMap:
@@ -154,7 +211,7 @@ void MsgpackAdapter::Packer(GlobalRegistry *globalreg, TrackerElement *v,
                     ++string_map_iter) {
                 o.pack(string_map_iter->first);
                 // o.pack(string_map_iter->second);
-                Packer(globalreg, string_map_iter->second, o);
+                Packer(globalreg, string_map_iter->second, o, tags);
             }
             break;
         case TrackerDoubleMap:
@@ -165,7 +222,7 @@ void MsgpackAdapter::Packer(GlobalRegistry *globalreg, TrackerElement *v,
                     ++double_map_iter) {
                 o.pack(double_map_iter->first);
                 // o.pack(double_map_iter->second);
-                Packer(globalreg, double_map_iter->second, o);
+                Packer(globalreg, double_map_iter->second, o, tags);
             }
             break;
 
@@ -175,26 +232,214 @@ void MsgpackAdapter::Packer(GlobalRegistry *globalreg, TrackerElement *v,
 
 }
 
-void MsgpackAdapter::Pack(GlobalRegistry *globalreg, std::stringstream &stream,
+void MsgpackAdapter::Pack(GlobalRegistry *globalreg, std::ostream &stream,
         tracker_component *c) {
     /*
     msgpack::adaptor::entrytracker = globalreg->entrytracker; 
     msgpack::pack(stream, (TrackerElement *) c);
     */
 
-    msgpack::packer<std::stringstream> packer(&stream);
+    msgpack::packer<std::ostream> packer(&stream);
     Packer(globalreg, (TrackerElement *) c, packer);
 }
 
-void MsgpackAdapter::Pack(GlobalRegistry *globalreg, std::stringstream &stream,
-        TrackerElement *e) {
+void MsgpackAdapter::Pack(GlobalRegistry *globalreg, std::ostream &stream,
+        TrackerElement *e, SerializeCacheTags *tags) {
     /*
     msgpack::adaptor::entrytracker = globalreg->entrytracker; 
     msgpack::pack(stream, e);
     */
 
-    msgpack::packer<std::stringstream> packer(&stream);
-    Packer(globalreg, e, packer);
+    msgpack::packer<std::ostream> packer(&stream);
+    Packer(globalreg, e, packer, tags);
+}
+
+// Pack a mac as raw bytes in network order, with the mask following it only
+// when it isn't a full mac
+static void CompactPackMac(const mac_addr &mac, 
+        msgpack::packer<std::ostream> &o) {
+    uint8_t bytes[MAC_LEN_MAX * 2];
+    unsigned int len = MAC_LEN_MAX;
+
+    for (unsigned int x = 0; x < MAC_LEN_MAX; x++)
+        bytes[x] = (uint8_t) (mac.longmac >> ((MAC_LEN_MAX - x - 1) * 8));
+
+    if ((mac.longmask & 0xFFFFFFFFFFFFULL) != 0xFFFFFFFFFFFFULL) {
+        for (unsigned int x = 0; x < MAC_LEN_MAX; x++)
+            bytes[MAC_LEN_MAX + x] = 
+                (uint8_t) (mac.longmask >> ((MAC_LEN_MAX - x - 1) * 8));
+        len = MAC_LEN_MAX * 2;
+    }
+
+    o.pack_bin(len);
+    o.pack_bin_body((const char *) bytes, len);
+}
+
+// uuid keeps its fields in host order; send the standard byte order so it
+// reads the same as the string form
+static void CompactPackUuid(const uuid &u, msgpack::packer<std::ostream> &o) {
+    uint8_t bytes[16];
+
+    uint32_t tl = *(u.time_low);
+    bytes[0] = (uint8_t) (tl >> 24);
+    bytes[1] = (uint8_t) (tl >> 16);
+    bytes[2] = (uint8_t) (tl >> 8);
+    bytes[3] = (uint8_t) tl;
+    bytes[4] = (uint8_t) (*(u.time_mid) >> 8);
+    bytes[5] = (uint8_t) *(u.time_mid);
+    bytes[6] = (uint8_t) (*(u.time_hi) >> 8);
+    bytes[7] = (uint8_t) *(u.time_hi);
+    bytes[8] = (uint8_t) (*(u.clock_seq) >> 8);
+    bytes[9] = (uint8_t) *(u.clock_seq);
+    memcpy(bytes + 10, u.node, 6);
+
+    o.pack_bin(16);
+    o.pack_bin_body((const char *) bytes, 16);
+}
+
+void MsgpackAdapter::CompactPacker(GlobalRegistry *globalreg, TrackerElement *v,
+        msgpack::packer<std::ostream> &o, SerializeCacheTags *tags) {
+
+    if (tags != NULL && PackCached(globalreg, v, o, tags, 
+                SerializeCache::format_msgpack_compact, 
+                &MsgpackAdapter::CompactPacker))
+        return;
+
+    v->pre_serialize();
+
+    vector<TrackerElement *> *tvec;
+    unsigned int x;
+
+    TrackerElement::tracked_map *tmap;
+    TrackerElement::map_iterator map_iter;
+
+    TrackerElement::tracked_mac_map *tmacmap;
+    TrackerElement::mac_map_iterator mac_map_iter;
+
+    TrackerElement::tracked_string_map *tstringmap;
+    TrackerElement::string_map_iterator string_map_iter;
+
+    TrackerElement::tracked_double_map *tdoublemap;
+    TrackerElement::double_map_iterator double_map_iter;
+
+    const string *lname;
+
+    switch (v->get_type()) {
+        case TrackerString:
+            o.pack(GetTrackerValue<string>(v));
+            break;
+        case TrackerInt8:
+            o.pack(GetTrackerValue<int8_t>(v));
+            break;
+        case TrackerUInt8:
+            o.pack(GetTrackerValue<uint8_t>(v));
+            break;
+        case TrackerInt16:
+            o.pack(GetTrackerValue<int16_t>(v));
+            break;
+        case TrackerUInt16:
+            o.pack(GetTrackerValue<uint16_t>(v));
+            break;
+        case TrackerInt32:
+            o.pack(GetTrackerValue<int32_t>(v));
+            break;
+        case TrackerUInt32:
+            o.pack(GetTrackerValue<uint32_t>(v));
+            break;
+        case TrackerInt64:
+            o.pack(GetTrackerValue<int64_t>(v));
+            break;
+        case TrackerUInt64:
+            o.pack(GetTrackerValue<uint64_t>(v));
+            break;
+        case TrackerFloat:
+            o.pack(GetTrackerValue<float>(v));
+            break;
+        case TrackerDouble:
+            o.pack(GetTrackerValue<double>(v));
+            break;
+        case TrackerMac:
+            CompactPackMac(GetTrackerValue<mac_addr>(v), o);
+            break;
+        case TrackerUuid:
+            CompactPackUuid(GetTrackerValue<uuid>(v), o);
+            break;
+        case TrackerVector:
+            tvec = v->get_vector();
+
+            o.pack_array(tvec->size());
+            for (x = 0; x < tvec->size(); x++) {
+                CompactPacker(globalreg, (*tvec)[x], o, tags);
+            }
+
+            break;
+        case TrackerMap:
+            tmap = v->get_map();
+            o.pack_map(tmap->size());
+            for (map_iter = tmap->begin(); map_iter != tmap->end(); 
+                    ++map_iter) {
+                lname = map_iter->second->get_local_name_ptr();
+
+                if (lname != NULL && lname->length() != 0)
+                    o.pack(*lname);
+                else
+                    o.pack(map_iter->first);
+
+                CompactPacker(globalreg, map_iter->second, o, tags);
+            }
+            break;
+        case TrackerIntMap:
+            tmap = v->get_intmap();
+            o.pack_map(tmap->size());
+            for (map_iter = tmap->begin(); map_iter != tmap->end(); 
+                    ++map_iter) {
+                o.pack(map_iter->first);
+                CompactPacker(globalreg, map_iter->second, o, tags);
+            }
+            break;
+        case TrackerMacMap:
+            tmacmap = v->get_macmap();
+            o.pack_map(tmacmap->size());
+            for (mac_map_iter = tmacmap->begin(); 
+                    mac_map_iter != tmacmap->end();
+                    ++mac_map_iter) {
+                CompactPackMac(mac_map_iter->first, o);
+                CompactPacker(globalreg, mac_map_iter->second, o, tags);
+            }
+            break;
+        case TrackerStringMap:
+            tstringmap = v->get_stringmap();
+            o.pack_map(tstringmap->size());
+            for (string_map_iter = tstringmap->begin();
+                    string_map_iter != tstringmap->end();
+                    ++string_map_iter) {
+                o.pack(string_map_iter->first);
+                CompactPacker(globalreg, string_map_iter->second, o, tags);
+            }
+            break;
+        case TrackerDoubleMap:
+            tdoublemap = v->get_doublemap();
+            o.pack_map(tdoublemap->size());
+            for (double_map_iter = tdoublemap->begin();
+                    double_map_iter != tdoublemap->end();
+                    ++double_map_iter) {
+                o.pack(double_map_iter->first);
+                CompactPacker(globalreg, double_map_iter->second, o, tags);
+            }
+            break;
+
+        default:
+            // Keep the container counts right even for a type we can't send
+            o.pack_nil();
+            break;
+    }
+
+}
+
+void MsgpackAdapter::CompactPack(GlobalRegistry *globalreg, 
+        std::ostream &stream, TrackerElement *e, SerializeCacheTags *tags) {
+    msgpack::packer<std::ostream> packer(&stream);
+    CompactPacker(globalreg, e, packer, tags);
 }
 
 void MsgpackAdapter::AsStringVector(msgpack::object &obj, 
@@ -206,4 +451,33 @@ void MsgpackAdapter::AsStringVector(msgpack::object &obj,
         vec.push_back(obj.via.array.ptr[i].as<string>());
 }
 
+msgpack::object *MsgpackAdapter::FindStrKey(msgpack::object &obj, 
+        const char *key) {
+    if (obj.type != msgpack::type::MAP)
+        return NULL;
+
+    size_t keylen = strlen(key);
+
+    for (unsigned int i = 0; i < obj.via.map.size; i++) {
+        msgpack::object_kv *kv = &(obj.via.map.ptr[i]);
+
+        if (kv->key.type != msgpack::type::STR)
+            continue;
+
+        if (kv->key.via.str.size != keylen)
+            continue;
+
+        if (memcmp(kv->key.via.str.ptr, key, keylen) == 0)
+            return &(kv->val);
+    }
+
+    return NULL;
+}
+
+bool MsgpackAdapter::UnpackReferenceRaw(
+        msgpack::type::object_type type __attribute__((unused)), 
+        std::size_t len __attribute__((unused)), 
+        void *user_data __attribute__((unused))) {
+    return true;
+}
 
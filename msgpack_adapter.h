@@ -32,32 +32,72 @@
 
 #include "globalregistry.h"
 #include "trackedelement.h"
+#include "serialize_cache.h"
 
 namespace MsgpackAdapter {
 
 typedef map<string, msgpack::object> MsgpackStrMap;
 
+// Records tagged in the cache tags are copied from the serialization cache
+// when they haven't changed
 void Packer(GlobalRegistry *globalreg, TrackerElement *v, 
-        msgpack::packer<std::stringstream> &packer);
+        msgpack::packer<std::ostream> &packer, 
+        SerializeCacheTags *tags = NULL);
 
-void Pack(GlobalRegistry *globalreg, std::stringstream &stream, 
+void Pack(GlobalRegistry *globalreg, std::ostream &stream, 
         tracker_component *c);
-void Pack(GlobalRegistry *globalreg, std::stringstream &stream, 
-        TrackerElement *e);
+void Pack(GlobalRegistry *globalreg, std::ostream &stream, 
+        TrackerElement *e, SerializeCacheTags *tags = NULL);
 
 class Serializer : public TrackerElementSerializer {
 public:
-    Serializer(GlobalRegistry *in_globalreg, std::stringstream &in_stream) : 
+    Serializer(GlobalRegistry *in_globalreg, std::ostream &in_stream) : 
         TrackerElementSerializer(in_globalreg, in_stream) { }
 
     virtual void serialize(TrackerElement *in_elem) {
-        Pack(globalreg, stream, in_elem);
+        Pack(globalreg, stream, in_elem, cache_tags);
+    }
+};
+
+// Compact dialect
+//
+// Values are packed bare instead of as [type, value] pairs, map keys are the
+// integer field ids (fields given a local name, like wrapper keys, keep their
+// name as a string key), MACs are a 6-byte bin (12 bytes, mac then mask, when
+// the mask isn't a full mac), and UUIDs are a 16-byte bin in RFC 4122 byte
+// order.  The field ids and types needed to decode it come from
+// /system/tracked_fields.msgpack, which only has to be fetched once per server
+// run.
+void CompactPacker(GlobalRegistry *globalreg, TrackerElement *v,
+        msgpack::packer<std::ostream> &packer,
+        SerializeCacheTags *tags = NULL);
+
+void CompactPack(GlobalRegistry *globalreg, std::ostream &stream,
+        TrackerElement *e, SerializeCacheTags *tags = NULL);
+
+class CompactSerializer : public TrackerElementSerializer {
+public:
+    CompactSerializer(GlobalRegistry *in_globalreg, std::ostream &in_stream) :
+        TrackerElementSerializer(in_globalreg, in_stream) { }
+
+    virtual void serialize(TrackerElement *in_elem) {
+        CompactPack(globalreg, stream, in_elem, cache_tags);
     }
 };
 
 // Convert to std::vector<std::string>.  MAY THROW EXCEPTIONS.
 void AsStringVector(msgpack::object &obj, std::vector<std::string> &vec);
 
+// Find a string-keyed value in a map object without converting the map to a
+// MsgpackStrMap.  Returns NULL if the object isn't a map or has no such key.
+msgpack::object *FindStrKey(msgpack::object &obj, const char *key);
+
+// Unpack reference function which leaves str and bin objects pointing into
+// the source buffer instead of copying them into the unpack zone.  The source
+// buffer must outlive the unpacked objects.
+bool UnpackReferenceRaw(msgpack::type::object_type type, std::size_t len,
+        void *user_data);
+
 }
 
 #endif
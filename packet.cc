@@ -42,14 +42,15 @@ kis_packet::kis_packet(GlobalRegistry *in_globalreg) {
 	filtered = 0;
 
 	// Stock and init the content vector
-	content_vec.resize(MAX_PACKET_COMPONENTS, NULL);
-	/*
-	   for (unsigned int y = 0; y < MAX_PACKET_COMPONENTS; y++)
-	   content_vec[y] = NULL;
-	   */
+	for (unsigned int y = 0; y < MAX_PACKET_COMPONENTS; y++)
+		content_vec[y] = NULL;
 }
 
 kis_packet::~kis_packet() {
+	reset();
+}
+
+void kis_packet::reset() {
 	// Delete everything we contain when we die.  I hope whomever put
 	// it there expected this.
 	for (unsigned int y = 0; y < MAX_PACKET_COMPONENTS; y++) {
@@ -65,6 +66,11 @@ kis_packet::~kis_packet() {
 
 		content_vec[y] = NULL;
 	}
+
+	error = 0;
+	filtered = 0;
+	ts.tv_sec = 0;
+	ts.tv_usec = 0;
 }
    
 void kis_packet::insert(const unsigned int index, packet_component *data) {
@@ -33,6 +33,8 @@
 #include <vector>
 #include <map>
 
+#include <pthread.h>
+
 #include "globalregistry.h"
 #include "macaddr.h"
 #include "packet_ieee80211.h"
@@ -45,6 +47,13 @@
 // Maximum length of a frame
 #define MAX_PACKET_LEN			8192
 
+// Data up to this size is held inside the kis_datachunk itself instead of in a
+// separate allocation; this covers any normal frame plus capture headers
+#define KIS_DATACHUNK_INLINE_LEN	2048
+
+// Maximum number of freed objects each packet pool holds onto
+#define KIS_PACKET_POOL_MAX		1024
+
 // Same as defined in libpcap/system, but we need to know the basic dot11 DLT
 // even when we don't have pcap
 #define KDLT_IEEE802_11			105
@@ -57,6 +66,75 @@ public:
 	int self_destruct;
 };
 
+// Free-list allocator for frequently created packet components.  Classes 
+// derive from kis_pooled<self>, and the normal new/delete of that class 
+// then recycles memory instead of going to malloc for every packet.  
+// Subclasses which are a different size fall through to the heap.
+template<class T>
+class kis_pooled {
+public:
+    static void *operator new(size_t sz) {
+        if (sz != sizeof(T))
+            return ::operator new(sz);
+
+        pthread_mutex_lock(&pool_mutex);
+
+        if (pool_head != NULL) {
+            pool_node *n = pool_head;
+            pool_head = n->next;
+            pool_free--;
+            pthread_mutex_unlock(&pool_mutex);
+            return (void *) n;
+        }
+
+        pthread_mutex_unlock(&pool_mutex);
+
+        return ::operator new(sz);
+    }
+
+    static void operator delete(void *p, size_t sz) {
+        if (p == NULL)
+            return;
+
+        if (sz != sizeof(T)) {
+            ::operator delete(p);
+            return;
+        }
+
+        pthread_mutex_lock(&pool_mutex);
+
+        if (pool_free < KIS_PACKET_POOL_MAX) {
+            pool_node *n = (pool_node *) p;
+            n->next = pool_head;
+            pool_head = n;
+            pool_free++;
+            pthread_mutex_unlock(&pool_mutex);
+            return;
+        }
+
+        pthread_mutex_unlock(&pool_mutex);
+
+        ::operator delete(p);
+    }
+
+protected:
+    // Freed objects are chained through their own storage
+    struct pool_node {
+        pool_node *next;
+    };
+
+    static pthread_mutex_t pool_mutex;
+    static pool_node *pool_head;
+    static unsigned int pool_free;
+};
+
+template<class T> 
+pthread_mutex_t kis_pooled<T>::pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+template<class T> 
+typename kis_pooled<T>::pool_node *kis_pooled<T>::pool_head = NULL;
+template<class T>
+unsigned int kis_pooled<T>::pool_free = 0;
+
 // Overall packet container that holds packet information
 class kis_packet {
 public:
@@ -71,7 +149,7 @@ public:
 	int filtered;
 
 	// Actual vector of bits in the packet
-	vector<packet_component *> content_vec;
+	packet_component *content_vec[MAX_PACKET_COMPONENTS];
    
     // Init stuff
     kis_packet() {
@@ -80,6 +158,10 @@ public:
 
 	kis_packet(GlobalRegistry *in_globalreg);
     ~kis_packet();
+
+    // Destroy all components and return to a freshly created state so that
+    // the packetchain can recycle us
+    void reset();
    
     void insert(const unsigned int index, packet_component *data);
     void *fetch(const unsigned int index) const;
@@ -97,7 +179,7 @@ protected:
 };
 
 // Arbitrary data chunk, decapsulated from the link headers
-class kis_datachunk : public packet_component {
+class kis_datachunk : public packet_component, public kis_pooled<kis_datachunk> {
 public:
     uint8_t *data;
     unsigned int length;
@@ -114,40 +196,54 @@ public:
     }
 
     virtual ~kis_datachunk() {
-		if (data != NULL && self_data) {
-			delete[] data;
-		}
+        free_data();
         length = 0;
     }
 
 	// Default to copy=true; it's always safe to copy, it's not always safe not to
 	virtual void set_data(uint8_t *in_data, unsigned int in_length, bool copy = true) {
-		if (data != NULL && self_data)
-			delete[] data;
-
 		if (copy) {
-			data = new uint8_t[in_length];
-			memcpy(data, in_data, in_length);
-			self_data = true;
-		} else {
-			data = in_data;
-			self_data = false;
-		}
+            copy_data(in_data, in_length);
+            return;
+		} 
+        
+        free_data();
+
+        data = in_data;
+        self_data = false;
 
 		length = in_length;
 	}
 
     virtual void copy_data(const uint8_t *in_data, unsigned int in_length) {
-		if (data != NULL && self_data)
-			delete[] data;
+        free_data();
+
+        // Small frames live in our own inline buffer
+        if (in_length <= KIS_DATACHUNK_INLINE_LEN)
+            data = inline_data;
+        else
+            data = new uint8_t[in_length];
 
-        data = new uint8_t[in_length];
         memcpy(data, in_data, in_length);
         self_data = true;
 
 		length = in_length;
+    }
+
+protected:
+    void free_data() {
+		if (data != NULL && self_data && data != inline_data)
+			delete[] data;
 
+        data = NULL;
     }
+
+    uint8_t inline_data[KIS_DATACHUNK_INLINE_LEN];
+
+private:
+    // Data may point into our own inline buffer, so we can't be copied
+    kis_datachunk(const kis_datachunk&);
+    kis_datachunk& operator=(const kis_datachunk&);
 };
 
 class kis_packet_checksum : public kis_datachunk {
@@ -175,7 +271,7 @@ enum kis_packet_basictype {
 // Common info
 // Extracted by phy-specific dissectors, used by the common classifier
 // to build phy-neutral devices and tracking records.
-class kis_common_info : public packet_component {
+class kis_common_info : public packet_component, public kis_pooled<kis_common_info> {
 public:
 	kis_common_info() {
 		self_destruct = 1;
@@ -244,7 +340,7 @@ enum kis_protocol_info_type {
 	proto_eap
 };
 
-class kis_data_packinfo : public packet_component {
+class kis_data_packinfo : public packet_component, public kis_pooled<kis_data_packinfo> {
 public:
 	kis_data_packinfo() {
 		self_destruct = 1; // Safe to delete us
@@ -297,7 +393,7 @@ enum kis_layer1_packinfo_signal_type {
     kis_l1_signal_type_rssi
 };
 
-class kis_layer1_packinfo : public packet_component {
+class kis_layer1_packinfo : public packet_component, public kis_pooled<kis_layer1_packinfo> {
 public:
 	kis_layer1_packinfo() {
 		self_destruct = 1;  // Safe to delete us
@@ -25,6 +25,12 @@
 #include <inttypes.h>
 #endif
 
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
 #include "globalregistry.h"
 #include "messagebus.h"
 #include "configfile.h"
@@ -40,6 +46,20 @@ public:
     }
 };
 
+// Dissector thread entry point
+void *packetchain_dissect_thread(void *arg) {
+    Packetchain *packetchain = (Packetchain *) arg;
+
+    // Leave signal handling to the main thread
+    sigset_t sset;
+    sigfillset(&sset);
+    pthread_sigmask(SIG_BLOCK, &sset, NULL);
+
+    packetchain->DissectThread();
+
+    return NULL;
+}
+
 Packetchain::Packetchain() {
     fprintf(stderr, "Packetchain() called with no globalregistry\n");
 	exit(-1);
@@ -51,13 +71,115 @@ Packetchain::Packetchain(GlobalRegistry *in_globalreg) {
 	next_handlerid = 1;
 
 	pthread_mutex_init(&packetchain_mutex, NULL);
+    pthread_rwlock_init(&handler_rwlock, NULL);
+    pthread_mutex_init(&packet_pool_mutex, NULL);
+
+    pthread_mutex_init(&pipeline_mutex, NULL);
+    pthread_cond_init(&pipeline_cond, NULL);
+    pthread_cond_init(&space_cond, NULL);
+    pipeline_shutdown = false;
+
+    next_seqno = 0;
+    next_tracker_seqno = 0;
+    in_flight = 0;
+    dissect_drops = 0;
+    tracker_drops = 0;
+    processed = 0;
+
+    // The capture helper builds a chain without a config, and always runs
+    // it inline
+    dissect_threads = 0;
+    queue_max = 2048;
+
+    if (globalreg->kismet_config != NULL) {
+        dissect_threads = 
+            globalreg->kismet_config->FetchOptUInt("packet_threads", 0);
+        queue_max =
+            globalreg->kismet_config->FetchOptUInt("packet_queue_max", 2048);
+    }
+
+    if (queue_max == 0)
+        queue_max = 1;
 
     globalreg->InsertGlobal("PACKETCHAIN", this);
+
+    // Dissected packets and packets from capture threads come back to the 
+    // main thread through the reactor
+    if (globalreg->reactor == NULL) {
+        if (dissect_threads != 0)
+            _MSG("Packetchain has no main loop reactor to hand packets back to, "
+                    "packets will be processed in the main thread", MSGFLAG_ERROR);
+        dissect_threads = 0;
+        return;
+    }
+
+    globalreg->reactor->AddWakeupHandler(this);
+
+    if (dissect_threads == 0)
+        return;
+
+    for (unsigned int x = 0; x < dissect_threads; x++) {
+        pthread_t t;
+
+        if (pthread_create(&t, NULL, packetchain_dissect_thread, this) != 0) {
+            _MSG("Packetchain failed to launch packet thread: " +
+                    string(strerror(errno)), MSGFLAG_ERROR);
+            break;
+        }
+
+        dissect_thread_vec.push_back(t);
+    }
+
+    if (dissect_thread_vec.size() == 0) {
+        dissect_threads = 0;
+        return;
+    }
+
+    dissect_threads = dissect_thread_vec.size();
+
+    _MSG("Processing packets with " + UIntToString(dissect_threads) + 
+            " dissector threads, queueing up to " + UIntToString(queue_max) +
+            " packets", MSGFLAG_INFO);
 }
 
 Packetchain::~Packetchain() {
     globalreg->RemoveGlobal("PACKETCHAIN");
 
+    if (globalreg->reactor != NULL)
+        globalreg->reactor->RemoveWakeupHandler(this);
+
+    {
+        local_locker lock(&pipeline_mutex);
+        pipeline_shutdown = true;
+        pthread_cond_broadcast(&pipeline_cond);
+        pthread_cond_broadcast(&space_cond);
+
+        for (deque<kis_packet *>::iterator i = inject_queue.begin();
+                i != inject_queue.end(); ++i) {
+            delete *i;
+        }
+        inject_queue.clear();
+    }
+
+    if (dissect_thread_vec.size() != 0) {
+        for (unsigned int x = 0; x < dissect_thread_vec.size(); x++) 
+            pthread_join(dissect_thread_vec[x], NULL);
+
+        // Anything still in the pipeline is thrown away without running the
+        // rest of the chain; we're shutting down
+        for (deque<pc_queued>::iterator i = dissect_queue.begin();
+                i != dissect_queue.end(); ++i) {
+            delete i->packet;
+        }
+        dissect_queue.clear();
+
+        for (map<uint64_t, kis_packet *>::iterator i = tracker_queue.begin();
+                i != tracker_queue.end(); ++i) {
+            delete i->second;
+        }
+        tracker_queue.clear();
+    }
+
     {
         local_locker lock(&packetchain_mutex);
 
@@ -100,7 +222,20 @@ Packetchain::~Packetchain() {
         }
     }
 
+    {
+        local_locker lock(&packet_pool_mutex);
+
+        for (unsigned int x = 0; x < packet_pool.size(); x++)
+            delete packet_pool[x];
+        packet_pool.clear();
+    }
+
     pthread_mutex_destroy(&packetchain_mutex);
+    pthread_rwlock_destroy(&handler_rwlock);
+    pthread_mutex_destroy(&packet_pool_mutex);
+    pthread_mutex_destroy(&pipeline_mutex);
+    pthread_cond_destroy(&pipeline_cond);
+    pthread_cond_destroy(&space_cond);
 }
 
 int Packetchain::RegisterPacketComponent(string in_component) {
@@ -154,9 +289,19 @@ string Packetchain::FetchPacketComponentName(int in_id) {
 }
 
 kis_packet *Packetchain::GeneratePacket() {
-    kis_packet *newpack = new kis_packet(globalreg);
+    kis_packet *newpack = NULL;
     pc_link *pcl;
 
+    pthread_mutex_lock(&packet_pool_mutex);
+    if (packet_pool.size() != 0) {
+        newpack = packet_pool.back();
+        packet_pool.pop_back();
+    }
+    pthread_mutex_unlock(&packet_pool_mutex);
+
+    if (newpack == NULL)
+        newpack = new kis_packet(globalreg);
+
     // Run the frame through the genesis chain incase anything
     // needs to add something at the beginning
 	pthread_mutex_lock(&packetchain_mutex);
@@ -176,7 +321,111 @@ kis_packet *Packetchain::GeneratePacket() {
 }
 
 int Packetchain::ProcessPacket(kis_packet *in_pack) {
-	pthread_mutex_lock(&packetchain_mutex);
+    if (dissect_threads == 0) {
+        pthread_mutex_lock(&packetchain_mutex);
+        ProcessDissect(in_pack);
+        ProcessTracker(in_pack);
+        processed++;
+        pthread_mutex_unlock(&packetchain_mutex);
+
+        DestroyPacket(in_pack);
+
+        return 1;
+    }
+
+    {
+        local_locker lock(&pipeline_mutex);
+
+        // The in-flight count covers everything between here and the end of
+        // the tracker stages, so a slow tracker backs up into the dissectors
+        // and we shed load here instead of growing without bound
+        if (in_flight >= queue_max) {
+            CountDrop();
+        } else {
+            pc_queued q;
+            q.seqno = next_seqno++;
+            q.packet = in_pack;
+
+            dissect_queue.push_back(q);
+            in_flight++;
+
+            pthread_cond_signal(&pipeline_cond);
+
+            return 1;
+        }
+    }
+
+    DestroyPacket(in_pack);
+
+    return 0;
+}
+
+int Packetchain::QueuePacket(kis_packet *in_pack, unsigned int in_wait_ms) {
+    // Without a reactor there's no way back to the main thread
+    if (globalreg->reactor == NULL) {
+        local_locker lock(&pipeline_mutex);
+        dissect_drops++;
+    } else {
+        bool queued = false, wake = false;
+
+        {
+            local_locker lock(&pipeline_mutex);
+
+            if (in_flight >= queue_max && in_wait_ms != 0) {
+                struct timespec ts;
+
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec += in_wait_ms / 1000;
+                ts.tv_nsec += (in_wait_ms % 1000) * 1000000L;
+
+                if (ts.tv_nsec >= 1000000000L) {
+                    ts.tv_sec++;
+                    ts.tv_nsec -= 1000000000L;
+                }
+
+                while (in_flight >= queue_max && !pipeline_shutdown) {
+                    if (pthread_cond_timedwait(&space_cond, &pipeline_mutex, 
+                                &ts) == ETIMEDOUT)
+                        break;
+                }
+            }
+
+            if (in_flight >= queue_max || pipeline_shutdown) {
+                CountDrop();
+            } else if (dissect_threads != 0) {
+                pc_queued q;
+                q.seqno = next_seqno++;
+                q.packet = in_pack;
+
+                dissect_queue.push_back(q);
+                in_flight++;
+
+                pthread_cond_signal(&pipeline_cond);
+
+                return 1;
+            } else {
+                inject_queue.push_back(in_pack);
+                in_flight++;
+                queued = true;
+
+                // Anything already queued has a wakeup pending
+                wake = (inject_queue.size() == 1);
+            }
+        }
+
+        if (wake)
+            globalreg->reactor->Wakeup();
+
+        if (queued)
+            return 1;
+    }
+
+    DestroyPacket(in_pack);
+
+    return 0;
+}
+
+void Packetchain::ProcessDissect(kis_packet *in_pack) {
     // Run it through every chain vector, ignoring error codes
     pc_link *pcl;
 
@@ -195,6 +444,10 @@ int Packetchain::ProcessPacket(kis_packet *in_pack) {
     for (unsigned int x = 0; x < datadissect_chain.size() && 
 		 (pcl = datadissect_chain[x]); x++)
         (*(pcl->callback))(globalreg, pcl->auxdata, in_pack);
+}
+
+void Packetchain::ProcessTracker(kis_packet *in_pack) {
+    pc_link *pcl;
 
     for (unsigned int x = 0; x < classifier_chain.size() && 
 		 (pcl = classifier_chain[x]); x++)
@@ -207,11 +460,139 @@ int Packetchain::ProcessPacket(kis_packet *in_pack) {
     for (unsigned int x = 0; x < logging_chain.size() && 
 		 (pcl = logging_chain[x]); x++)
         (*(pcl->callback))(globalreg, pcl->auxdata, in_pack);
-	pthread_mutex_unlock(&packetchain_mutex);
+}
 
-    DestroyPacket(in_pack);
+void Packetchain::DissectThread() {
+    pc_queued q;
 
-    return 1;
+    while (1) {
+        pthread_mutex_lock(&pipeline_mutex);
+
+        while (!pipeline_shutdown && dissect_queue.size() == 0)
+            pthread_cond_wait(&pipeline_cond, &pipeline_mutex);
+
+        if (pipeline_shutdown) {
+            pthread_mutex_unlock(&pipeline_mutex);
+            return;
+        }
+
+        q = dissect_queue.front();
+        dissect_queue.pop_front();
+
+        pthread_mutex_unlock(&pipeline_mutex);
+
+        // The stateless stages only need the handler lists to hold still
+        pthread_rwlock_rdlock(&handler_rwlock);
+        ProcessDissect(q.packet);
+        pthread_rwlock_unlock(&handler_rwlock);
+
+        bool wake = false;
+
+        {
+            local_locker lock(&pipeline_mutex);
+
+            tracker_queue[q.seqno] = q.packet;
+
+            // Only kick the main loop when the packet it's waiting on is
+            // ready; anything later in the sequence will be drained with it
+            if (q.seqno == next_tracker_seqno)
+                wake = true;
+        }
+
+        if (wake)
+            globalreg->reactor->Wakeup();
+    }
+}
+
+void Packetchain::DrainTrackerQueue() {
+    kis_packet *pack;
+
+    while (1) {
+        {
+            local_locker lock(&pipeline_mutex);
+
+            map<uint64_t, kis_packet *>::iterator i = 
+                tracker_queue.find(next_tracker_seqno);
+
+            if (i == tracker_queue.end())
+                return;
+
+            pack = i->second;
+            tracker_queue.erase(i);
+            next_tracker_seqno++;
+        }
+
+        pthread_mutex_lock(&packetchain_mutex);
+        ProcessTracker(pack);
+        pthread_mutex_unlock(&packetchain_mutex);
+
+        DestroyPacket(pack);
+
+        {
+            local_locker lock(&pipeline_mutex);
+            in_flight--;
+            processed++;
+            pthread_cond_signal(&space_cond);
+        }
+    }
+}
+
+void Packetchain::DrainInjectQueue() {
+    deque<kis_packet *> packets;
+
+    {
+        local_locker lock(&pipeline_mutex);
+        packets.swap(inject_queue);
+    }
+
+    for (deque<kis_packet *>::iterator i = packets.begin(); 
+            i != packets.end(); ++i) {
+        pthread_mutex_lock(&packetchain_mutex);
+        ProcessDissect(*i);
+        ProcessTracker(*i);
+        pthread_mutex_unlock(&packetchain_mutex);
+
+        DestroyPacket(*i);
+
+        {
+            local_locker lock(&pipeline_mutex);
+            in_flight--;
+            processed++;
+            pthread_cond_signal(&space_cond);
+        }
+    }
+}
+
+void Packetchain::CountDrop() {
+    unsigned int waiting = dissect_queue.size() + inject_queue.size();
+
+    // Everything else in flight has been handed to a dissector thread or is
+    // waiting for the main thread; the threads hold at most one each
+    if (in_flight - waiting > waiting + dissect_threads)
+        tracker_drops++;
+    else
+        dissect_drops++;
+}
+
+void Packetchain::ReactorEvent(int in_fd __attribute__((unused)), 
+        unsigned int in_events __attribute__((unused))) {
+    if (dissect_threads != 0)
+        DrainTrackerQueue();
+    else
+        DrainInjectQueue();
+}
+
+void Packetchain::FetchStats(pc_stats *out_stats) {
+    local_locker lock(&pipeline_mutex);
+
+    out_stats->dissect_threads = dissect_threads;
+    out_stats->queue_max = queue_max;
+    // Packets queued for the inline chain haven't been dissected yet either
+    out_stats->dissect_queue = dissect_queue.size() + inject_queue.size();
+    out_stats->tracker_queue = in_flight - out_stats->dissect_queue;
+    out_stats->dissect_drops = dissect_drops;
+    out_stats->tracker_drops = tracker_drops;
+    out_stats->processed = processed;
 }
 
 void Packetchain::DestroyPacket(kis_packet *in_pack) {
@@ -227,7 +608,19 @@ void Packetchain::DestroyPacket(kis_packet *in_pack) {
     }
 	pthread_mutex_unlock(&packetchain_mutex);
 
-	delete in_pack;
+    // Clear out the components (returning them to their own pools) and 
+    // keep the packet for reuse
+    in_pack->reset();
+
+    pthread_mutex_lock(&packet_pool_mutex);
+    if (packet_pool.size() < KIS_PACKET_POOL_MAX) {
+        packet_pool.push_back(in_pack);
+        in_pack = NULL;
+    }
+    pthread_mutex_unlock(&packet_pool_mutex);
+
+    if (in_pack != NULL)
+        delete in_pack;
 }
 
 int Packetchain::RegisterHandler(pc_callback in_cb, void *in_aux, 
@@ -241,6 +634,7 @@ int Packetchain::RegisterHandler(pc_callback in_cb, void *in_aux,
     }
 
 	pthread_mutex_lock(&packetchain_mutex);
+	pthread_rwlock_wrlock(&handler_rwlock);
 
     // Generate packet, we'll nuke it if it's invalid later
     link = new pc_link;
@@ -305,12 +699,14 @@ int Packetchain::RegisterHandler(pc_callback in_cb, void *in_aux,
             break;
 
         default:
+			pthread_rwlock_unlock(&handler_rwlock);
 			pthread_mutex_unlock(&packetchain_mutex);
             delete link;
             _MSG("Packetchain::RegisterHandler requested unknown chain", 
 				 MSGFLAG_ERROR);
             return -1;
     }
+	pthread_rwlock_unlock(&handler_rwlock);
 	pthread_mutex_unlock(&packetchain_mutex);
 
     return link->id;
@@ -320,6 +716,7 @@ int Packetchain::RemoveHandler(int in_id, int in_chain) {
 	unsigned int x;
 
 	pthread_mutex_lock(&packetchain_mutex);
+	pthread_rwlock_wrlock(&handler_rwlock);
     switch (in_chain) {
         case CHAINPOS_GENESIS:
 			for (x = 0; x < genesis_chain.size(); x++) {
@@ -394,12 +791,15 @@ int Packetchain::RemoveHandler(int in_id, int in_chain) {
             break;
 
         default:
+			pthread_rwlock_unlock(&handler_rwlock);
 			pthread_mutex_unlock(&packetchain_mutex);
             _MSG("Packetchain::RemoveHandler requested unknown chain", 
 				 MSGFLAG_ERROR);
             return -1;
     }
 
+	pthread_rwlock_unlock(&handler_rwlock);
+
 	pthread_mutex_unlock(&packetchain_mutex);
     return 1;
 }
@@ -408,6 +808,7 @@ int Packetchain::RemoveHandler(pc_callback in_cb, int in_chain) {
 	unsigned int x;
 
 	pthread_mutex_lock(&packetchain_mutex);
+	pthread_rwlock_wrlock(&handler_rwlock);
     switch (in_chain) {
         case CHAINPOS_GENESIS:
 			for (x = 0; x < genesis_chain.size(); x++) {
@@ -482,12 +883,15 @@ int Packetchain::RemoveHandler(pc_callback in_cb, int in_chain) {
             break;
 
         default:
+			pthread_rwlock_unlock(&handler_rwlock);
 			pthread_mutex_unlock(&packetchain_mutex);
             _MSG("Packetchain::RemoveHandler requested unknown chain", 
 				 MSGFLAG_ERROR);
             return -1;
     }
 
+	pthread_rwlock_unlock(&handler_rwlock);
+
 	pthread_mutex_unlock(&packetchain_mutex);
     return 1;
 
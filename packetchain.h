@@ -32,10 +32,12 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <deque>
 
 #include <pthread.h>
 
 #include "globalregistry.h"
+#include "kis_reactor.h"
 #include "packet.h"
 
 // Packet chain progression
@@ -60,6 +62,18 @@
 //
 // DESTROY
 //   --> destroy_chain
+//
+// When packet_threads is set in the config, the chain is split in two:
+// POST-CAPTURE through DATA-DISSECT only look at the packet itself and are
+// run by a pool of dissector threads, while CLASSIFIER, TRACKER and LOGGING
+// touch shared state and are run on the main thread, in the original order
+// the packets were injected, as the dissected packets are handed back by
+// waking up the main loop reactor.
+//
+// Data sources with their own capture threads inject packets with
+// QueuePacket, which waits for room in the pipeline instead of dropping
+// immediately; when the chain runs inline, those packets are handed to the
+// main thread to be processed.
 
 #define CHAINPOS_GENESIS        1
 #define CHAINPOS_POSTCAP        2
@@ -77,7 +91,7 @@
 
 class kis_packet;
 
-class Packetchain : public LifetimeGlobal {
+class Packetchain : public LifetimeGlobal, public ReactorEventHandler {
 public:
     Packetchain();
     Packetchain(GlobalRegistry *in_globalreg);
@@ -88,10 +102,17 @@ public:
     int RemovePacketComponent(int in_id);
 	string FetchPacketComponentName(int in_id);
 
-    // Generate a packet and hand it back
+    // Generate a packet and hand it back; packets are recycled from a pool
+    // of previously destroyed packets when possible
     kis_packet *GeneratePacket();
-    // Inject a packet into the chain
+    // Inject a packet into the chain.  When running threaded, the packet
+    // is queued and the chain completes asynchronously; if the queue is full
+    // the packet is dropped and destroyed.
     int ProcessPacket(kis_packet *in_pack);
+    // Inject a packet from a capture thread.  Waits up to in_wait_ms for room
+    // in the pipeline; if there still isn't any the packet is dropped and
+    // destroyed and 0 is returned.
+    int QueuePacket(kis_packet *in_pack, unsigned int in_wait_ms);
     // Destroy a packet at the end of its life
     void DestroyPacket(kis_packet *in_pack);
  
@@ -109,7 +130,50 @@ public:
     int RemoveHandler(pc_callback in_cb, int in_chain);
 	int RemoveHandler(int in_id, int in_chain);
 
+    // Reactor wakeup, used to return dissected packets to the main thread
+    // for the stateful stages of the chain
+    virtual void ReactorEvent(int in_fd, unsigned int in_events);
+
+    // Pipeline stats
+    typedef struct {
+        // Number of dissector threads, 0 if the chain runs inline
+        unsigned int dissect_threads;
+        // Maximum number of packets in flight in the pipeline
+        unsigned int queue_max;
+        // Packets waiting for a dissector thread
+        unsigned int dissect_queue;
+        // Packets dissected and waiting for the tracker stages
+        unsigned int tracker_queue;
+        // Packets dropped because the pipeline was full, charged to the 
+        // stage holding most of the backlog at the time: waiting for (or in)
+        // the dissector threads, or waiting for the tracker stages on the 
+        // main thread
+        uint64_t dissect_drops;
+        uint64_t tracker_drops;
+        // Packets which have completed the entire chain
+        uint64_t processed;
+    } pc_stats;
+
+    void FetchStats(pc_stats *out_stats);
+
+    // Dissector thread main loop
+    void DissectThread();
+
 protected:
+    // Run the stateless and stateful halves of the chain
+    void ProcessDissect(kis_packet *in_pack);
+    void ProcessTracker(kis_packet *in_pack);
+
+    // Hand completed packets to the stateful stages, in order
+    void DrainTrackerQueue();
+
+    // Run packets queued by capture threads through the inline chain
+    void DrainInjectQueue();
+
+    // Count a dropped packet against the backed up stage; called with the
+    // pipeline locked
+    void CountDrop();
+
     GlobalRegistry *globalreg;
 
     int next_componentid, next_handlerid;
@@ -132,6 +196,48 @@ protected:
     vector<Packetchain::pc_link *> logging_chain;
 
 	pthread_mutex_t packetchain_mutex;
+
+    // Handlers are walked concurrently by the dissector threads, so changes
+    // to the chain vectors take this for writing
+    pthread_rwlock_t handler_rwlock;
+
+    // Pipeline state, protected by pipeline_mutex
+    typedef struct {
+        uint64_t seqno;
+        kis_packet *packet;
+    } pc_queued;
+
+    unsigned int dissect_threads;
+    unsigned int queue_max;
+    vector<pthread_t> dissect_thread_vec;
+
+    pthread_mutex_t pipeline_mutex;
+    pthread_cond_t pipeline_cond;
+    bool pipeline_shutdown;
+
+    // Signalled when packets leave the pipeline, for capture threads waiting
+    // for room
+    pthread_cond_t space_cond;
+
+    // Packets waiting for a dissector thread
+    deque<pc_queued> dissect_queue;
+    // Dissected packets, keyed by injection order
+    map<uint64_t, kis_packet *> tracker_queue;
+    // Packets from capture threads waiting for the main thread, when the
+    // chain runs inline
+    deque<kis_packet *> inject_queue;
+
+    uint64_t next_seqno;
+    uint64_t next_tracker_seqno;
+    unsigned int in_flight;
+
+    uint64_t dissect_drops;
+    uint64_t tracker_drops;
+    uint64_t processed;
+
+    // Destroyed packets kept for reuse by GeneratePacket
+    vector<kis_packet *> packet_pool;
+    pthread_mutex_t packet_pool_mutex;
 };
 
 #endif
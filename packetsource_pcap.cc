@@ -92,19 +92,69 @@ extern "C" {
 #include "packetsource_pcap.h"
 #include "tcpdump-extract.h"
 
+#ifdef HAVE_KIS_TPACKET_V3
+#include <sys/mman.h>
+#include <net/if_arp.h>
+#include <linux/if_ether.h>
+#endif
+
 #ifdef HAVE_LIBPCAP
 
 // This is such a bad thing to do...
 // #include <pcap-int.h>
 
-// Pcap global callback structs, these get filled in by the pcap callback.
-// NON-THREAD-SAFE, if we ever use threads.
-pcap_pkthdr callback_header;
-u_char callback_data[MAX_PACKET_LEN];
+void PacketSource_Pcap::ParsePcapOptions(vector<opt_pair> *in_opts) {
+	if (FetchOpt("tpacket", in_opts) != "") {
+		use_tpacket = FetchOptBoolean("tpacket", in_opts, 0);
+
+#ifndef HAVE_KIS_TPACKET_V3
+		if (use_tpacket) {
+			_MSG("Source '" + interface + "' requested tpacket=true, but Kismet "
+				 "was not built with AF_PACKET TPACKET_V3 support.  Falling back "
+				 "to libpcap.", MSGFLAG_ERROR);
+			use_tpacket = false;
+		}
+#endif
+	}
+
+	if (FetchOpt("tpacket_blocks", in_opts) != "") {
+		unsigned int b;
+
+		if (sscanf(FetchOpt("tpacket_blocks", in_opts).c_str(), "%u", &b) != 1 ||
+			b == 0) {
+			_MSG("Invalid tpacket_blocks= on source '" + interface + "', "
+				 "expected a number of ring blocks.", MSGFLAG_ERROR);
+		} else {
+			tpacket_blocks = b;
+		}
+	}
+}
+
+void PacketSource_Pcap::CheckCopyFrames() {
+	copy_frames = true;
+
+	if (globalreg->packetchain == NULL)
+		return;
+
+	Packetchain::pc_stats stats;
+	globalreg->packetchain->FetchStats(&stats);
+
+	// An inline chain is completely done with the packet by the time 
+	// ProcessPacket returns, so the frame can stay in the capture buffer
+	copy_frames = (stats.dissect_threads != 0);
+}
 
 int PacketSource_Pcap::OpenSource() {
 	char errstr[STATUS_MAX] = "";
 	last_channel = 0;
+
+	CheckCopyFrames();
+
+#ifdef HAVE_KIS_TPACKET_V3
+	if (use_tpacket)
+		return OpenTpacket();
+#endif
+
 	char *unconst = strdup(interface.c_str());
 
 	pd = pcap_open_live(unconst, MAX_PACKET_LEN, 1, 1000, errstr);
@@ -170,6 +220,10 @@ int PacketSource_Pcap::OpenSource() {
 }
 
 int PacketSource_Pcap::CloseSource() {
+#ifdef HAVE_KIS_TPACKET_V3
+	CloseTpacket();
+#endif
+
 	if (pd != NULL)
 		pcap_close(pd);
 	pd = NULL;
@@ -179,6 +233,16 @@ int PacketSource_Pcap::CloseSource() {
 int PacketSource_Pcap::DatalinkType() {
     char errstr[STATUS_MAX] = "";
 
+#ifdef HAVE_KIS_TPACKET_V3
+	// The ring socket resolves the link type from the interface when it
+	// opens
+	if (tpacket_sock >= 0) {
+		if (datalink_type == DLT_EN10MB && override_dlt >= 0)
+			datalink_type = override_dlt;
+		return 1;
+	}
+#endif
+
 	if (pd == NULL)
 		return -1;
 
@@ -221,11 +285,16 @@ int PacketSource_Pcap::DatalinkType() {
 }
 
 int PacketSource_Pcap::FetchDescriptor() {
-	if (pd == NULL) {
+	if (error) {
 		return -1;
 	}
 
-	if (error) {
+#ifdef HAVE_KIS_TPACKET_V3
+	if (tpacket_sock >= 0)
+		return tpacket_sock;
+#endif
+
+	if (pd == NULL) {
 		return -1;
 	}
 
@@ -238,17 +307,66 @@ int PacketSource_Pcap::FetchDescriptor() {
 
 void PacketSource_Pcap::Pcap_Callback(u_char *bp, const struct pcap_pkthdr *header,
 									  const u_char *in_data) {
-	// Copy into the globals
-	memcpy(&callback_header, header, sizeof(pcap_pkthdr));
-	memcpy(callback_data, in_data, kismin(header->len, MAX_PACKET_LEN));
+	PacketSource_Pcap *source = (PacketSource_Pcap *) bp;
+
+	source->ProcessFrame(&(header->ts), in_data, header->caplen, 
+						 source->copy_frames);
+}
+
+int PacketSource_Pcap::ProcessFrame(const struct timeval *in_ts, 
+									const uint8_t *in_data, 
+									unsigned int in_caplen, bool in_copy) {
+	if (paused)
+		return 0;
+
+	// Genesis a new packet, fill it in with the radio layer info if we have it,
+	// and inject it into the system
+	kis_packet *newpack = globalreg->packetchain->GeneratePacket();
+
+	newpack->ts.tv_sec = in_ts->tv_sec;
+	newpack->ts.tv_usec = in_ts->tv_usec;
+
+	// Add the link-layer raw data to the packet, for the pristine copy
+	kis_datachunk *linkchunk = new kis_datachunk;
+	linkchunk->dlt = datalink_type;
+	linkchunk->source_id = source_id;
+
+	linkchunk->set_data((uint8_t *) in_data, 
+						kismin(in_caplen, (unsigned int) MAX_PACKET_LEN), in_copy);
+
+	newpack->insert(_PCM(PACK_COMP_LINKFRAME), linkchunk);
+
+	// Only decode the DLT if we're asked to
+	if (dlt_mangle && ManglePacket(newpack, linkchunk) < 0) {
+		globalreg->packetchain->DestroyPacket(newpack);
+		return 0;
+	}
+
+	num_packets++;
+
+	// Flag the header
+	kis_ref_capsource *csrc_ref = new kis_ref_capsource;
+	csrc_ref->ref_source = this;
+	newpack->insert(_PCM(PACK_COMP_KISCAPSRC), csrc_ref);
+
+	// Inject it into the packetchain; the chain destroys the packet at the
+	// end of processing, so we're done with it here
+	return globalreg->packetchain->ProcessPacket(newpack);
 }
 
 int PacketSource_Pcap::Poll() {
 	int ret;
 	char errstr[STATUS_MAX] = "";
 
-	// Get data from the pcap callbacks
-	if ((ret = pcap_dispatch(pd, 1, PacketSource_Pcap::Pcap_Callback, NULL)) < 0) {
+#ifdef HAVE_KIS_TPACKET_V3
+	if (tpacket_sock >= 0)
+		return PollTpacket();
+#endif
+
+	// Drain up to a batch of frames per wakeup; each one goes through the
+	// callback and into the packetchain
+	if ((ret = pcap_dispatch(pd, dispatch_max, PacketSource_Pcap::Pcap_Callback, 
+							 (u_char *) this)) < 0) {
 		// If we failed to dispatch a packet collection, find out if the interface
 		// got downed and give a smarter error message
 #ifdef SYS_LINUX
@@ -274,56 +392,199 @@ int PacketSource_Pcap::Poll() {
 		return 0;
 	}
 
-	if (ret == 0)
+	if (paused)
 		return 0;
 
-	if (paused)
+	return ret;
+}
+
+#ifdef HAVE_KIS_TPACKET_V3
+int PacketSource_Pcap::OpenTpacket() {
+	struct ifreq ifr;
+	struct sockaddr_ll sll;
+	int version = TPACKET_V3;
+	long pagesz = sysconf(_SC_PAGESIZE);
+
+	if (pagesz <= 0)
+		pagesz = 4096;
+
+	if ((tpacket_sock = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) < 0) {
+		_MSG("Failed to open AF_PACKET socket for source '" + interface + "': " +
+			 string(strerror(errno)), MSGFLAG_ERROR);
 		return 0;
+	}
 
-	// Genesis a new packet, fill it in with the radio layer info if we have it,
-	// and inject it into the system
-	kis_packet *newpack = globalreg->packetchain->GeneratePacket();
+	memset(&ifr, 0, sizeof(struct ifreq));
+	strncpy(ifr.ifr_name, interface.c_str(), sizeof(ifr.ifr_name) - 1);
+
+	if (ioctl(tpacket_sock, SIOCGIFINDEX, &ifr) < 0) {
+		_MSG("Failed to find interface index for source '" + interface + "': " +
+			 string(strerror(errno)), MSGFLAG_ERROR);
+		CloseTpacket();
+		return 0;
+	}
 
-	// Get the timestamp from the pcap callback
-	newpack->ts.tv_sec = callback_header.ts.tv_sec;
-	newpack->ts.tv_usec = callback_header.ts.tv_usec;
+	memset(&sll, 0, sizeof(struct sockaddr_ll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = ifr.ifr_ifindex;
 
-	// Add the link-layer raw data to the packet, for the pristine copy
-	kis_datachunk *linkchunk = new kis_datachunk;
-	linkchunk->dlt = datalink_type;
-	linkchunk->source_id = source_id;
+	// Map the hardware type to a DLT the way libpcap would
+	if (ioctl(tpacket_sock, SIOCGIFHWADDR, &ifr) < 0) {
+		_MSG("Failed to get link type for source '" + interface + "': " +
+			 string(strerror(errno)), MSGFLAG_ERROR);
+		CloseTpacket();
+		return 0;
+	}
 
-	linkchunk->set_data(callback_data, kismin(callback_header.caplen, 
-											  (uint32_t) MAX_PACKET_LEN), true);
-#if 0
-	linkchunk->data = 
-		new uint8_t[kismin(callback_header.caplen, (uint32_t) MAX_PACKET_LEN)];
-	linkchunk->length = kismin(callback_header.caplen, (uint32_t) MAX_PACKET_LEN);
-	memcpy(linkchunk->data, callback_data, linkchunk->length);
-#endif
+	switch (ifr.ifr_hwaddr.sa_family) {
+		case ARPHRD_IEEE80211_RADIOTAP:
+			datalink_type = DLT_IEEE802_11_RADIO;
+			break;
+		case ARPHRD_IEEE80211_PRISM:
+			datalink_type = DLT_PRISM_HEADER;
+			break;
+		case ARPHRD_IEEE80211:
+			datalink_type = DLT_IEEE802_11;
+			break;
+		case ARPHRD_ETHER:
+			datalink_type = DLT_EN10MB;
+			break;
+		default:
+			_MSG("Source '" + interface + "' has link type " + 
+				 IntToString(ifr.ifr_hwaddr.sa_family) + " which Kismet can't "
+				 "capture from an AF_PACKET ring, use the libpcap capture "
+				 "instead.", MSGFLAG_ERROR);
+			CloseTpacket();
+			return 0;
+	}
 
-	newpack->insert(_PCM(PACK_COMP_LINKFRAME), linkchunk);
+	if (setsockopt(tpacket_sock, SOL_PACKET, PACKET_VERSION, &version, 
+				   sizeof(int)) < 0) {
+		_MSG("Failed to enable TPACKET_V3 on source '" + interface + "': " +
+			 string(strerror(errno)), MSGFLAG_ERROR);
+		CloseTpacket();
+		return 0;
+	}
 
-	// Only decode the DLT if we're asked to
-	if (dlt_mangle)
-		ManglePacket(newpack, linkchunk);
+	// Blocks are retired to us when they fill or when the timeout expires,
+	// whichever comes first, so a quiet channel still delivers promptly
+	memset(&tpacket_req, 0, sizeof(struct tpacket_req3));
+	tpacket_req.tp_block_size = kismax((unsigned int) (1 << 18), 
+									   (unsigned int) pagesz);
+	tpacket_req.tp_frame_size = TPACKET_ALIGN(TPACKET3_HDRLEN + MAX_PACKET_LEN);
+	tpacket_req.tp_block_nr = tpacket_blocks;
+	tpacket_req.tp_frame_nr = (tpacket_req.tp_block_size / tpacket_req.tp_frame_size) *
+		tpacket_req.tp_block_nr;
+	tpacket_req.tp_retire_blk_tov = 50;
+	tpacket_req.tp_feature_req_word = 0;
+
+	if (setsockopt(tpacket_sock, SOL_PACKET, PACKET_RX_RING, &tpacket_req,
+				   sizeof(struct tpacket_req3)) < 0) {
+		_MSG("Failed to create AF_PACKET ring on source '" + interface + "': " +
+			 string(strerror(errno)), MSGFLAG_ERROR);
+		CloseTpacket();
+		return 0;
+	}
 
-	num_packets++;
+	tpacket_map = (uint8_t *) mmap(NULL, 
+								   tpacket_req.tp_block_size * tpacket_req.tp_block_nr,
+								   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED,
+								   tpacket_sock, 0);
+
+	if (tpacket_map == MAP_FAILED) {
+		// Locking the ring isn't worth failing over
+		tpacket_map = (uint8_t *) mmap(NULL, 
+									   tpacket_req.tp_block_size * 
+									   tpacket_req.tp_block_nr,
+									   PROT_READ | PROT_WRITE, MAP_SHARED,
+									   tpacket_sock, 0);
+	}
 
-	// Flag the header
-	kis_ref_capsource *csrc_ref = new kis_ref_capsource;
-	csrc_ref->ref_source = this;
-	newpack->insert(_PCM(PACK_COMP_KISCAPSRC), csrc_ref);
+	if (tpacket_map == MAP_FAILED) {
+		tpacket_map = NULL;
+		_MSG("Failed to map AF_PACKET ring on source '" + interface + "': " +
+			 string(strerror(errno)), MSGFLAG_ERROR);
+		CloseTpacket();
+		return 0;
+	}
 
-	// Inject it into the packetchain
-	globalreg->packetchain->ProcessPacket(newpack);
+	if (bind(tpacket_sock, (struct sockaddr *) &sll, 
+			 sizeof(struct sockaddr_ll)) < 0) {
+		_MSG("Failed to bind AF_PACKET socket to source '" + interface + "': " +
+			 string(strerror(errno)), MSGFLAG_ERROR);
+		CloseTpacket();
+		return 0;
+	}
 
-	// Packetchain destroys the packet at the end of processing, so we're done
-	// with it here
+	tpacket_block = 0;
+
+	error = 0;
+	paused = 0;
+	num_packets = 0;
+
+	_MSG("Capturing from source '" + interface + "' with a " + 
+		 UIntToString(tpacket_req.tp_block_nr) + " block AF_PACKET ring", 
+		 MSGFLAG_INFO);
 
 	return 1;
 }
 
+void PacketSource_Pcap::CloseTpacket() {
+	if (tpacket_map != NULL)
+		munmap(tpacket_map, tpacket_req.tp_block_size * tpacket_req.tp_block_nr);
+	tpacket_map = NULL;
+
+	if (tpacket_sock >= 0)
+		close(tpacket_sock);
+	tpacket_sock = -1;
+}
+
+int PacketSource_Pcap::PollTpacket() {
+	unsigned int nframes = 0;
+
+	// Walk the blocks the kernel has retired to us; a block goes back to 
+	// the kernel as soon as all of its frames have been through the chain.
+	// Stop at a block boundary once we've handled a batch so one busy source
+	// can't hold the main loop indefinitely.
+	while (nframes < dispatch_max) {
+		struct tpacket_block_desc *bd = (struct tpacket_block_desc *)
+			(tpacket_map + (tpacket_block * tpacket_req.tp_block_size));
+
+		if ((__atomic_load_n(&(bd->hdr.bh1.block_status), __ATOMIC_ACQUIRE) &
+			 TP_STATUS_USER) == 0)
+			break;
+
+		struct tpacket3_hdr *th = (struct tpacket3_hdr *)
+			((uint8_t *) bd + bd->hdr.bh1.offset_to_first_pkt);
+
+		for (unsigned int x = 0; x < bd->hdr.bh1.num_pkts; x++) {
+			struct timeval ts;
+
+			ts.tv_sec = th->tp_sec;
+			ts.tv_usec = th->tp_nsec / 1000;
+
+			ProcessFrame(&ts, (uint8_t *) th + th->tp_mac, th->tp_snaplen, 
+						 copy_frames);
+
+			nframes++;
+
+			th = (struct tpacket3_hdr *) ((uint8_t *) th + th->tp_next_offset);
+		}
+
+		__atomic_store_n(&(bd->hdr.bh1.block_status), TP_STATUS_KERNEL,
+						 __ATOMIC_RELEASE);
+
+		tpacket_block = (tpacket_block + 1) % tpacket_req.tp_block_nr;
+	}
+
+	if (paused)
+		return 0;
+
+	return nframes;
+}
+#endif
+
 int PacketSource_Pcap::ManglePacket(kis_packet *packet, kis_datachunk *linkchunk) {
 	int ret = 0;
 
@@ -441,6 +702,8 @@ int PacketSource_Pcapfile::OpenSource() {
 
 	num_packets = 0;
 
+	CheckCopyFrames();
+
 	if (DatalinkType() < 0)
 		return -1;
 
@@ -452,7 +715,8 @@ int PacketSource_Pcapfile::OpenSource() {
 int PacketSource_Pcapfile::Poll() {
 	int ret;
 
-	ret = pcap_dispatch(pd, 1, PacketSource_Pcapfile::Pcap_Callback, NULL);
+	ret = pcap_dispatch(pd, dispatch_max, PacketSource_Pcap::Pcap_Callback, 
+						(u_char *) this);
 
 	if (ret < 0) {
 		globalreg->messagebus->InjectMessage("Pcap failed to get the next packet",
@@ -469,36 +733,7 @@ int PacketSource_Pcapfile::Poll() {
 	if (paused)
 		return 0;
 
-	kis_packet *newpack = globalreg->packetchain->GeneratePacket();
-
-	// Get the timestamp from the pcap callback
-	newpack->ts.tv_sec = callback_header.ts.tv_sec;
-	newpack->ts.tv_usec = callback_header.ts.tv_usec;
-
-	// Add the link-layer raw data to the packet, for the pristine copy
-	kis_datachunk *linkchunk = new kis_datachunk;
-	linkchunk->dlt = datalink_type;
-	linkchunk->source_id = source_id;
-	linkchunk->data = 
-		new uint8_t[kismin(callback_header.caplen, (uint32_t) MAX_PACKET_LEN)];
-	linkchunk->length = kismin(callback_header.caplen, (uint32_t) MAX_PACKET_LEN);
-	memcpy(linkchunk->data, callback_data, linkchunk->length);
-	newpack->insert(_PCM(PACK_COMP_LINKFRAME), linkchunk);
-
-	// Only decode the DLT if we're asked to
-	if (dlt_mangle && ManglePacket(newpack, linkchunk) < 0)
-		return 0;
-
-	num_packets++;
-
-	// Flag the header
-	kis_ref_capsource *csrc_ref = new kis_ref_capsource;
-	csrc_ref->ref_source = this;
-	newpack->insert(_PCM(PACK_COMP_KISCAPSRC), csrc_ref);
-
-	globalreg->packetchain->ProcessPacket(newpack);
-
-	return 1;
+	return ret;
 }
 
 #endif
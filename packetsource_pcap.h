@@ -49,6 +49,15 @@ extern "C" {
 
 #include "kis_ppi.h"
 
+// Native AF_PACKET mmap ring capture, available on kernels new enough to
+// have TPACKET_V3 block rings
+#ifdef SYS_LINUX
+#include <linux/if_packet.h>
+#ifdef TPACKET3_HDRLEN
+#define HAVE_KIS_TPACKET_V3 1
+#endif
+#endif
+
 // Include the various variations of BSD radiotap headers from the system if
 // we can get them, incidentally pull in other stuff but I'm not sure whats
 // needed so we'll leave the extra headers for now
@@ -116,9 +125,34 @@ public:
 		KisPacketSource(in_globalreg, in_interface, in_opts) { 
 			pd = NULL;
 			override_dlt = -1;
+
+			dispatch_max = 64;
+			if (globalreg->kismet_config != NULL)
+				dispatch_max = 
+					globalreg->kismet_config->FetchOptUInt("pcap_dispatch_max", 64);
+			if (dispatch_max == 0)
+				dispatch_max = 1;
+
+			copy_frames = true;
+
+			use_tpacket = false;
+			tpacket_blocks = 16;
+#ifdef HAVE_KIS_TPACKET_V3
+			tpacket_sock = -1;
+			tpacket_map = NULL;
+			tpacket_block = 0;
+#endif
+
+			ParsePcapOptions(in_opts);
 		}
 	virtual ~PacketSource_Pcap() { }
 
+	virtual int ParseOptions(vector<opt_pair> *in_opts) {
+		KisPacketSource::ParseOptions(in_opts);
+		ParsePcapOptions(in_opts);
+		return 1;
+	}
+
 	// No management functions at this level
 	virtual int EnableMonitor() = 0;
 	virtual int DisableMonitor() = 0;
@@ -135,6 +169,7 @@ public:
 
 	virtual int Poll();
 
+	// Called by pcap_dispatch with the source as the user argument
 	static void Pcap_Callback(u_char *bp, const struct pcap_pkthdr *header,
 							  const u_char *in_data);
 
@@ -151,9 +186,44 @@ protected:
 	// If we're just a straight up frame
 	int Eight2KisPack(kis_packet *packet, kis_datachunk *linkchunk);
 
+	// Options common to all pcap-derived sources
+	void ParsePcapOptions(vector<opt_pair> *in_opts);
+
+	// Build a packet around a captured frame and inject it into the chain.
+	// When in_copy is false the link chunk references the capture buffer
+	// directly, which is only safe while the chain processes the packet 
+	// before returning.  Returns 1 if the frame was injected.
+	int ProcessFrame(const struct timeval *in_ts, const uint8_t *in_data,
+					 unsigned int in_caplen, bool in_copy);
+
+	// Work out if frames have to be copied out of the capture buffer; they 
+	// do whenever the packetchain hands packets off to dissector threads
+	void CheckCopyFrames();
+
+	// Native AF_PACKET ring, used instead of pcap_open_live when the 
+	// source is defined with tpacket=true
+	int OpenTpacket();
+	void CloseTpacket();
+	int PollTpacket();
+
 	pcap_t *pd;
 	int datalink_type;
 	int override_dlt;
+
+	// Maximum frames handled per descriptor wakeup
+	unsigned int dispatch_max;
+
+	bool copy_frames;
+
+	bool use_tpacket;
+	unsigned int tpacket_blocks;
+
+#ifdef HAVE_KIS_TPACKET_V3
+	int tpacket_sock;
+	uint8_t *tpacket_map;
+	struct tpacket_req3 tpacket_req;
+	unsigned int tpacket_block;
+#endif
 };	
 
 class PacketSource_Pcapfile : public PacketSource_Pcap {
@@ -645,6 +645,7 @@ Packetsourcetracker::Packetsourcetracker(GlobalRegistry *in_globalreg) :
 											  &pst_sourceprototimer, this);
 
     pthread_mutex_init(&pst_lock, NULL);
+    pthread_mutex_init(&chain_lock, NULL);
 
     /*
     httpd = (Kis_Net_Httpd *) globalreg->FetchGlobal("HTTPD_SERVER");
@@ -1902,9 +1903,7 @@ int Packetsourcetracker::IpcPacket(ipc_source_packet *in_ipc) {
 	kis_datachunk *linkchunk = new kis_datachunk;
 	linkchunk->dlt = in_ipc->dlt;
 	linkchunk->source_id = in_ipc->source_id;
-	linkchunk->data = new uint8_t[in_ipc->pkt_len];
-	linkchunk->length = in_ipc->pkt_len;
-	memcpy(linkchunk->data, in_ipc->data, in_ipc->pkt_len);
+	linkchunk->copy_data(in_ipc->data, in_ipc->pkt_len);
 	newpack->insert(_PCM(PACK_COMP_LINKFRAME), linkchunk);
 
 	kis_ref_capsource *csrc_ref = new kis_ref_capsource;
@@ -2903,6 +2902,8 @@ void Packetsourcetracker::ChainHandler(kis_packet *in_pack) {
 	if (linkchunk == NULL)
 		return;
 
+	local_locker lock(&chain_lock);
+
 	if (running_as_ipc) {
 		// Send it through the IPC system
 		SendIPCPacket(in_pack, linkchunk);
@@ -405,6 +405,10 @@ protected:
     void httpd_pack_all_sources(std::stringstream &stream);
 
     pthread_mutex_t pst_lock;
+
+    // The postcap chain handler can be called from the packet dissector 
+    // threads; the sources' demangling isn't thread safe
+    pthread_mutex_t chain_lock;
 };
 
 #endif
@@ -0,0 +1,575 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "getopt.h"
+#include "util.h"
+#include "endian_magic.h"
+#include "messagebus.h"
+#include "configfile.h"
+#include "packet.h"
+#include "pcap_replay.h"
+
+// pcap file magic, in our byte order
+#define REPLAY_PCAP_MAGIC           0xa1b2c3d4
+#define REPLAY_PCAP_MAGIC_NSEC      0xa1b23c4d
+
+// pcapng block types
+#define REPLAY_PCAPNG_SHB           0x0A0D0D0A
+#define REPLAY_PCAPNG_IDB           0x00000001
+#define REPLAY_PCAPNG_PB            0x00000002
+#define REPLAY_PCAPNG_SPB           0x00000003
+#define REPLAY_PCAPNG_EPB           0x00000006
+#define REPLAY_PCAPNG_BYTEORDER     0x1A2B3C4D
+
+// pcapng interface timestamp resolution option
+#define REPLAY_PCAPNG_OPT_TSRESOL   9
+
+void PcapReplay::usage(const char *name __attribute__((unused))) {
+    printf("\n");
+    printf(" *** Offline Replay Options ***\n");
+    printf("     --replay <file>          Replay a pcap or pcapng file through the\n"
+           "                              packet chain as fast as possible, using\n"
+           "                              the packet timestamps as the server clock\n"
+           "     --replay-exit            Exit once the replay is complete\n"
+          );
+}
+
+PcapReplay::PcapReplay(GlobalRegistry *in_globalreg) {
+    globalreg = in_globalreg;
+
+    replay_active = false;
+    replay_draining = false;
+    replay_done = false;
+    replay_exit = false;
+
+    replay_fd = -1;
+    map = NULL;
+    map_sz = 0;
+    map_pos = 0;
+
+    format = replay_pcap;
+    swapped = false;
+    pcap_dlt = 0;
+    pcap_nsec = false;
+
+    num_packets = 0;
+    num_bytes = 0;
+
+    copy_frames = true;
+    queue_max = 0;
+
+    batch_max =
+        globalreg->kismet_config->FetchOptUInt("replay_batch", 1024);
+    if (batch_max == 0)
+        batch_max = 1;
+
+    const int rfc = globalreg->getopt_long_num++;
+    const int rxc = globalreg->getopt_long_num++;
+
+    static struct option replay_long_options[] = {
+        { "replay", required_argument, 0, rfc },
+        { "replay-exit", no_argument, 0, rxc },
+        { 0, 0, 0, 0 }
+    };
+    int option_idx = 0;
+
+    // Hack the extern getopt index
+    optind = 0;
+
+    while (1) {
+        int r = getopt_long(globalreg->argc, globalreg->argv, "-",
+                replay_long_options, &option_idx);
+
+        if (r < 0)
+            break;
+
+        if (r == rfc) {
+            replay_fname = string(optarg);
+        } else if (r == rxc) {
+            replay_exit = true;
+        }
+    }
+
+    if (replay_fname == "")
+        return;
+
+    if (OpenFile(replay_fname) < 0) {
+        globalreg->fatal_condition = 1;
+        return;
+    }
+
+    Packetchain::pc_stats stats;
+    globalreg->packetchain->FetchStats(&stats);
+
+    // Frames can be referenced in the map as long as the chain is done with
+    // them by the time ProcessPacket returns; with dissector threads they
+    // may outlive the map, and we have to hold back when the chain fills
+    // instead of letting it drop packets
+    copy_frames = (stats.dissect_threads != 0);
+    queue_max = stats.queue_max;
+
+    // Take over the server clock
+    globalreg->packet_clock = 1;
+
+    replay_active = true;
+    gettimeofday(&start_tm, NULL);
+
+    _MSG("Replaying '" + replay_fname + "' (" +
+            ULongToString(map_sz / (1024 * 1024)) + "MB)", MSGFLAG_INFO);
+}
+
+PcapReplay::~PcapReplay() {
+    CloseFile();
+}
+
+int PcapReplay::OpenFile(string in_fname) {
+    struct stat sbuf;
+
+    if ((replay_fd = open(in_fname.c_str(), O_RDONLY)) < 0) {
+        _MSG("Could not open replay file '" + in_fname + "': " +
+                string(strerror(errno)), MSGFLAG_FATAL);
+        return -1;
+    }
+
+    if (fstat(replay_fd, &sbuf) < 0 || !S_ISREG(sbuf.st_mode)) {
+        _MSG("Replay file '" + in_fname + "' is not a regular file", MSGFLAG_FATAL);
+        CloseFile();
+        return -1;
+    }
+
+    map_sz = sbuf.st_size;
+
+    if (map_sz < 24) {
+        _MSG("Replay file '" + in_fname + "' is too short to be a capture file",
+                MSGFLAG_FATAL);
+        CloseFile();
+        return -1;
+    }
+
+    map = (uint8_t *) mmap(NULL, map_sz, PROT_READ, MAP_PRIVATE, replay_fd, 0);
+
+    if (map == MAP_FAILED) {
+        map = NULL;
+        _MSG("Could not map replay file '" + in_fname + "': " +
+                string(strerror(errno)), MSGFLAG_FATAL);
+        CloseFile();
+        return -1;
+    }
+
+    // We only ever walk forward through the file
+    madvise(map, map_sz, MADV_SEQUENTIAL);
+
+    uint32_t magic;
+    memcpy(&magic, map, 4);
+
+    if (magic == REPLAY_PCAPNG_SHB) {
+        // The section header sets the byte order; it's parsed as the first
+        // block
+        format = replay_pcapng;
+        map_pos = 0;
+        return 1;
+    }
+
+    format = replay_pcap;
+
+    if (magic == REPLAY_PCAP_MAGIC || magic == REPLAY_PCAP_MAGIC_NSEC) {
+        swapped = false;
+    } else if (kis_swap32(magic) == REPLAY_PCAP_MAGIC ||
+            kis_swap32(magic) == REPLAY_PCAP_MAGIC_NSEC) {
+        swapped = true;
+        magic = kis_swap32(magic);
+    } else {
+        _MSG("Replay file '" + in_fname + "' is not a pcap or pcapng file",
+                MSGFLAG_FATAL);
+        CloseFile();
+        return -1;
+    }
+
+    pcap_nsec = (magic == REPLAY_PCAP_MAGIC_NSEC);
+    pcap_dlt = Fetch32(map + 20);
+    map_pos = 24;
+
+    return 1;
+}
+
+void PcapReplay::CloseFile() {
+    if (map != NULL)
+        munmap(map, map_sz);
+    map = NULL;
+
+    if (replay_fd >= 0)
+        close(replay_fd);
+    replay_fd = -1;
+}
+
+uint16_t PcapReplay::Fetch16(const uint8_t *in_ptr) {
+    uint16_t r;
+
+    memcpy(&r, in_ptr, 2);
+
+    if (swapped)
+        return kis_swap16(r);
+
+    return r;
+}
+
+uint32_t PcapReplay::Fetch32(const uint8_t *in_ptr) {
+    uint32_t r;
+
+    memcpy(&r, in_ptr, 4);
+
+    if (swapped)
+        return kis_swap32(r);
+
+    return r;
+}
+
+int PcapReplay::NextFrame(replay_frame *ret_frame) {
+    if (format == replay_pcapng)
+        return NextPcapngFrame(ret_frame);
+
+    return NextPcapFrame(ret_frame);
+}
+
+int PcapReplay::NextPcapFrame(replay_frame *ret_frame) {
+    if (map_pos == map_sz)
+        return 0;
+
+    // A short record at the end is a capture that was cut off; treat it as
+    // the end of the file
+    if (map_sz - map_pos < 16)
+        return 0;
+
+    const uint8_t *rec = map + map_pos;
+    uint32_t caplen = Fetch32(rec + 8);
+
+    if (caplen > map_sz - map_pos - 16)
+        return 0;
+
+    ret_frame->ts.tv_sec = Fetch32(rec);
+    ret_frame->ts.tv_usec = Fetch32(rec + 4);
+
+    if (pcap_nsec)
+        ret_frame->ts.tv_usec /= 1000;
+
+    ret_frame->dlt = pcap_dlt;
+    ret_frame->data = rec + 16;
+    ret_frame->caplen = caplen;
+
+    map_pos += 16 + caplen;
+
+    return 1;
+}
+
+int PcapReplay::ParsePcapngSection(const uint8_t *in_block, uint32_t in_len) {
+    uint32_t byteorder;
+
+    if (in_len < 28)
+        return -1;
+
+    memcpy(&byteorder, in_block + 8, 4);
+
+    if (byteorder == REPLAY_PCAPNG_BYTEORDER)
+        swapped = false;
+    else if (kis_swap32(byteorder) == REPLAY_PCAPNG_BYTEORDER)
+        swapped = true;
+    else
+        return -1;
+
+    // Interface ids are per section
+    ng_interfaces.clear();
+
+    return 1;
+}
+
+int PcapReplay::ParsePcapngInterface(const uint8_t *in_block, uint32_t in_len) {
+    replay_ng_interface intf;
+
+    if (in_len < 20)
+        return -1;
+
+    intf.dlt = Fetch16(in_block + 8);
+    intf.ts_units = 1000000;
+
+    // Walk the options looking for the timestamp resolution; everything else
+    // we can ignore
+    uint32_t pos = 16;
+
+    while (pos + 4 <= in_len - 4) {
+        uint16_t code = Fetch16(in_block + pos);
+        uint16_t len = Fetch16(in_block + pos + 2);
+
+        if (code == 0)
+            break;
+
+        if (pos + 4 + len > in_len - 4)
+            return -1;
+
+        if (code == REPLAY_PCAPNG_OPT_TSRESOL && len >= 1) {
+            uint8_t res = in_block[pos + 4];
+
+            // High bit set is a power of 2, otherwise a power of 10
+            if ((res & 0x80) && (res & 0x7F) < 64) {
+                intf.ts_units = 1ULL << (res & 0x7F);
+            } else if ((res & 0x80) == 0 && res <= 19) {
+                intf.ts_units = 1;
+                for (unsigned int x = 0; x < res; x++)
+                    intf.ts_units *= 10;
+            }
+        }
+
+        pos += 4 + ((len + 3) & ~3);
+    }
+
+    ng_interfaces.push_back(intf);
+
+    return 1;
+}
+
+int PcapReplay::NextPcapngFrame(replay_frame *ret_frame) {
+    while (1) {
+        if (map_pos == map_sz)
+            return 0;
+
+        if (map_sz - map_pos < 12)
+            return 0;
+
+        const uint8_t *block = map + map_pos;
+        uint32_t type;
+
+        // The section header is always readable, whatever order the previous
+        // section was in
+        memcpy(&type, block, 4);
+
+        if (type == REPLAY_PCAPNG_SHB && ParsePcapngSection(block,
+                    (uint32_t) kismin(map_sz - map_pos, (size_t) 32)) < 0) {
+            _MSG("Replay file '" + replay_fname + "' has a corrupt pcapng "
+                    "section header", MSGFLAG_ERROR);
+            return -1;
+        }
+
+        // Now in the byte order of the current section
+        type = Fetch32(block);
+        uint32_t block_len = Fetch32(block + 4);
+
+        if (block_len < 12 || (block_len & 3) != 0) {
+            _MSG("Replay file '" + replay_fname + "' has a corrupt pcapng block "
+                    "at offset " + ULongToString(map_pos), MSGFLAG_ERROR);
+            return -1;
+        }
+
+        // Cut-off capture
+        if (block_len > map_sz - map_pos)
+            return 0;
+
+        map_pos += block_len;
+
+        if (type == REPLAY_PCAPNG_IDB) {
+            if (ParsePcapngInterface(block, block_len) < 0) {
+                _MSG("Replay file '" + replay_fname + "' has a corrupt pcapng "
+                        "interface block", MSGFLAG_ERROR);
+                return -1;
+            }
+
+            continue;
+        }
+
+        uint32_t intf_id;
+        uint64_t ts = 0;
+        uint32_t caplen;
+        const uint8_t *data;
+
+        if (type == REPLAY_PCAPNG_EPB) {
+            if (block_len < 32)
+                continue;
+
+            intf_id = Fetch32(block + 8);
+            ts = ((uint64_t) Fetch32(block + 12) << 32) | Fetch32(block + 16);
+            caplen = Fetch32(block + 20);
+            data = block + 28;
+
+            if (caplen > block_len - 32)
+                continue;
+        } else if (type == REPLAY_PCAPNG_SPB) {
+            if (block_len < 16)
+                continue;
+
+            // Simple packets have no timestamp and a captured length implied
+            // by the block size
+            intf_id = 0;
+            caplen = kismin(Fetch32(block + 8), block_len - 16);
+            data = block + 12;
+        } else if (type == REPLAY_PCAPNG_PB) {
+            if (block_len < 32)
+                continue;
+
+            intf_id = Fetch16(block + 8);
+            ts = ((uint64_t) Fetch32(block + 12) << 32) | Fetch32(block + 16);
+            caplen = Fetch32(block + 20);
+            data = block + 28;
+
+            if (caplen > block_len - 32)
+                continue;
+        } else {
+            // Name resolution, statistics, and anything else we don't replay
+            continue;
+        }
+
+        if (intf_id >= ng_interfaces.size())
+            continue;
+
+        replay_ng_interface *intf = &(ng_interfaces[intf_id]);
+
+        if (type == REPLAY_PCAPNG_SPB) {
+            // Carry the clock forward from the last timestamped packet
+            ret_frame->ts = globalreg->timestamp;
+        } else {
+            ret_frame->ts.tv_sec = ts / intf->ts_units;
+            ret_frame->ts.tv_usec =
+                ((ts % intf->ts_units) * 1000000) / intf->ts_units;
+        }
+
+        ret_frame->dlt = intf->dlt;
+        ret_frame->data = data;
+        ret_frame->caplen = caplen;
+
+        return 1;
+    }
+}
+
+void PcapReplay::InjectFrame(replay_frame *in_frame) {
+    // Packet time is server time for the duration of the replay
+    globalreg->timestamp = in_frame->ts;
+
+    kis_packet *newpack = globalreg->packetchain->GeneratePacket();
+
+    newpack->ts = in_frame->ts;
+
+    kis_datachunk *linkchunk = new kis_datachunk;
+    linkchunk->dlt = in_frame->dlt;
+
+    linkchunk->set_data((uint8_t *) in_frame->data,
+            kismin(in_frame->caplen, (unsigned int) MAX_PACKET_LEN), copy_frames);
+
+    newpack->insert(_PCM(PACK_COMP_LINKFRAME), linkchunk);
+
+    num_packets++;
+    num_bytes += in_frame->caplen;
+
+    globalreg->packetchain->ProcessPacket(newpack);
+}
+
+int PcapReplay::ReplayBatch() {
+    replay_frame frame;
+    int r;
+    unsigned int n;
+
+    if (!replay_active)
+        return 0;
+
+    // The rate, the clock, and --replay-exit all wait for the last packets
+    // to clear the dissector threads and tracker stages
+    if (replay_draining) {
+        if (!ChainBusy())
+            ReplayComplete();
+
+        return 0;
+    }
+
+    for (n = 0; n < batch_max; n++) {
+        // Hold off until the tracker stages catch up, they run on this thread
+        if (copy_frames) {
+            Packetchain::pc_stats stats;
+            globalreg->packetchain->FetchStats(&stats);
+
+            if (stats.dissect_queue + stats.tracker_queue >= queue_max)
+                break;
+        }
+
+        if ((r = NextFrame(&frame)) <= 0) {
+            replay_draining = true;
+
+            if (!ChainBusy())
+                ReplayComplete();
+
+            return r;
+        }
+
+        InjectFrame(&frame);
+    }
+
+    return n;
+}
+
+bool PcapReplay::ChainBusy() {
+    // An inline chain is done with a packet when ProcessPacket returns
+    if (!copy_frames)
+        return false;
+
+    Packetchain::pc_stats stats;
+    globalreg->packetchain->FetchStats(&stats);
+
+    return (stats.dissect_queue + stats.tracker_queue) != 0;
+}
+
+void PcapReplay::ReplayComplete() {
+    struct timeval end_tm;
+    double elapsed;
+
+    gettimeofday(&end_tm, NULL);
+
+    elapsed = (end_tm.tv_sec - start_tm.tv_sec) +
+        ((double) end_tm.tv_usec - start_tm.tv_usec) / 1000000;
+
+    if (elapsed <= 0)
+        elapsed = 0.000001;
+
+    char rate[256];
+    snprintf(rate, 256, "%llu packets (%.1fMB) in %.2f seconds, "
+            "%.0f packets/sec, %.1fMB/sec",
+            (unsigned long long) num_packets,
+            (double) num_bytes / (1024 * 1024), elapsed,
+            (double) num_packets / elapsed,
+            ((double) num_bytes / (1024 * 1024)) / elapsed);
+
+    _MSG("Replay of '" + replay_fname + "' complete: " + string(rate),
+            MSGFLAG_INFO);
+
+    replay_active = false;
+    replay_draining = false;
+    replay_done = true;
+
+    // Nothing references the map once we're done; an inline chain has
+    // finished with every frame and a threaded chain got copies
+    CloseFile();
+
+    // Hand the clock back
+    globalreg->packet_clock = 0;
+}
+
@@ -0,0 +1,153 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __PCAP_REPLAY_H__
+#define __PCAP_REPLAY_H__
+
+#include "config.h"
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+
+#include "globalregistry.h"
+#include "packetchain.h"
+
+// Offline pcap replay
+//
+// Started with --replay <file>, this feeds a pcap or pcapng capture into the
+// packetchain as fast as the chain will take it, instead of one frame per
+// pass through the main loop the way the pcapfile source does.  The file is
+// mapped and parsed directly without libpcap, and frames are handed to the
+// chain straight out of the map when the chain runs inline.
+//
+// While a replay is running the server clock (globalreg->timestamp) follows
+// the timestamps of the replayed packets, so device times, RRDs, and timeouts
+// look the way they would have when the capture was made.
+//
+// When the file is done the replay rate is reported, and if --replay-exit was
+// given the server shuts down so the logs are written out.
+class PcapReplay : public LifetimeGlobal {
+public:
+    static void usage(const char *name);
+
+    PcapReplay(GlobalRegistry *in_globalreg);
+    virtual ~PcapReplay();
+
+    // Is there a replay in progress
+    bool Replaying() { return replay_active; }
+
+    // Has the whole file been read, with the replay waiting for the threaded
+    // packetchain to finish the packets still in flight
+    bool Draining() { return replay_draining; }
+
+    // Has a replay run to the end of the file and through the chain
+    bool Finished() { return replay_done; }
+
+    // Should the server exit when the replay finishes
+    bool ExitOnFinish() { return replay_exit; }
+
+    // Replay the next batch of packets.  Returns the number of packets
+    // replayed, 0 if the chain is full or the file is done, and negative on
+    // an error in the file
+    int ReplayBatch();
+
+protected:
+    // File formats
+    enum replay_format {
+        replay_pcap, replay_pcapng
+    };
+
+    // One frame from the file
+    typedef struct {
+        struct timeval ts;
+        int dlt;
+        const uint8_t *data;
+        unsigned int caplen;
+    } replay_frame;
+
+    // pcapng interfaces; each has its own link type and timestamp resolution
+    typedef struct {
+        int dlt;
+        // Timestamp units per second
+        uint64_t ts_units;
+    } replay_ng_interface;
+
+    int OpenFile(std::string in_fname);
+    void CloseFile();
+
+    // Fetch the next frame.  Returns 1 with a frame, 0 at the end of the
+    // file, and negative on a malformed file
+    int NextFrame(replay_frame *ret_frame);
+    int NextPcapFrame(replay_frame *ret_frame);
+    int NextPcapngFrame(replay_frame *ret_frame);
+
+    // Parse a pcapng section header or interface description
+    int ParsePcapngSection(const uint8_t *in_block, uint32_t in_len);
+    int ParsePcapngInterface(const uint8_t *in_block, uint32_t in_len);
+
+    uint16_t Fetch16(const uint8_t *in_ptr);
+    uint32_t Fetch32(const uint8_t *in_ptr);
+
+    void InjectFrame(replay_frame *in_frame);
+
+    // Are there replayed packets still queued in the packetchain
+    bool ChainBusy();
+
+    void ReplayComplete();
+
+    GlobalRegistry *globalreg;
+
+    std::string replay_fname;
+
+    bool replay_active;
+    bool replay_draining;
+    bool replay_done;
+    bool replay_exit;
+
+    // Maximum packets per batch before letting the main loop run
+    unsigned int batch_max;
+
+    // Copy frames out of the map for a threaded packetchain
+    bool copy_frames;
+    unsigned int queue_max;
+
+    int replay_fd;
+    uint8_t *map;
+    size_t map_sz;
+    size_t map_pos;
+
+    replay_format format;
+    // File is in the opposite byte order from us
+    bool swapped;
+
+    // Classic pcap link type and timestamp resolution
+    int pcap_dlt;
+    bool pcap_nsec;
+
+    std::vector<replay_ng_interface> ng_interfaces;
+
+    // Replay statistics
+    uint64_t num_packets;
+    uint64_t num_bytes;
+    struct timeval start_tm;
+};
+
+#endif
+
@@ -71,6 +71,8 @@ Kis_80211_Phy::Kis_80211_Phy(GlobalRegistry *in_globalreg,
 
 	globalreg->InsertGlobal("PHY_80211", this);
 
+	pthread_mutex_init(&wepkey_mutex, NULL);
+
 	// Initialize the crc tables
 	crc32_init_table_80211(globalreg->crc32_table);
 
@@ -269,6 +271,8 @@ Kis_80211_Phy::~Kis_80211_Phy() {
 										  CHAINPOS_TRACKER);
 
     globalreg->timetracker->RemoveTimer(device_idle_timer);
+
+	pthread_mutex_destroy(&wepkey_mutex);
 }
 
 int Kis_80211_Phy::LoadWepkeys() {
@@ -313,7 +317,10 @@ int Kis_80211_Phy::LoadWepkeys() {
         keyinfo->len = len;
         memcpy(keyinfo->key, key, sizeof(unsigned char) * WEPKEY_MAX);
 
-        wepkeys.insert(bssid_mac, keyinfo);
+        {
+            local_locker lock(&wepkey_mutex);
+            wepkeys.insert(bssid_mac, keyinfo);
+        }
 
 		_MSG("Using key '" + rawkey + "' for BSSID " + bssid_mac.Mac2String(),
 			 MSGFLAG_INFO);
@@ -467,6 +474,8 @@ void Kis_80211_Phy::AddWepKey(mac_addr bssid, uint8_t *key, unsigned int len,
 
     memcpy(winfo->key, key, len);
 
+	local_locker lock(&wepkey_mutex);
+
     // Replace exiting ones
 	if (wepkeys.find(winfo->bssid) != wepkeys.end()) {
 		delete wepkeys[winfo->bssid];
@@ -871,6 +880,14 @@ void Kis_80211_Phy::HandleClient(kis_tracked_device_base *basedev,
     if (backdev != NULL) {
         client->set_bssid_key(backdev->get_key());
 
+        // Webserver threads serialize the AP under its own lock, and adding
+        // a client can reallocate its client map.  We already hold the lock
+        // if the device is its own AP.
+        if (backdev != basedev)
+            backdev->mutex_lock();
+
+        bool added_client = false;
+
         dot11_tracked_device *backdot11 = 
             (dot11_tracked_device *) backdev->get_map_value(dot11_device_entry_id);
 
@@ -879,8 +896,19 @@ void Kis_80211_Phy::HandleClient(kis_tracked_device_base *basedev,
                     backdot11->get_associated_client_map()->mac_end()) {
 
                 backdot11->get_associated_client_map()->add_macmap(basedev->get_macaddr(), basedev->get_tracker_key());
+
+                backdev->bump_generation();
+                added_client = true;
             }
         }
+
+        if (backdev != basedev)
+            backdev->mutex_unlock();
+
+        // Get the AP's new client into the change journal and sorted views,
+        // not just the serialize cache
+        if (added_client)
+            devicetracker->MarkDeviceChanged(backdev);
     }
 }
 
@@ -1059,6 +1087,9 @@ int Kis_80211_Phy::TrackerDot11(kis_packet *in_pack) {
         printf("unclassed device as of packet %d\n", packetnum);
     }
 
+    // Done with the device for this packet
+    basedev->bump_generation();
+
 
 #if 0
 
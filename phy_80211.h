@@ -106,7 +106,7 @@ public:
 // Packet info decoded by the dot11 phy decoder
 // 
 // Injected into the packet chain and processed later into the device records
-class dot11_packinfo : public packet_component {
+class dot11_packinfo : public packet_component, public kis_pooled<dot11_packinfo> {
 public:
     dot11_packinfo() {
 		self_destruct = 1; // Our delete() handles this
@@ -1236,8 +1236,10 @@ protected:
 
 	// Are we allowed to send wepkeys to the client (server config)
 	int client_wepkey_allowed;
-	// Map of wepkeys to BSSID (or bssid masks)
+	// Map of wepkeys to BSSID (or bssid masks); the decryptor runs on the
+	// packet dissector threads, so the map and key counters are locked
 	macmap<dot11_wep_key *> wepkeys;
+	pthread_mutex_t wepkey_mutex;
 
 	// Generated WEP identity / base
 	unsigned char wep_identity[256];
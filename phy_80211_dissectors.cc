@@ -185,15 +185,10 @@ int Kis_80211_Phy::WPAKeyMgtConv(uint8_t mgt_index) {
 
 // This needs to be optimized and it needs to not use casting to do its magic
 int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
-	static int debugpcknum = 0;
-
 	if (in_pack->error) {
 		return 0;
 	}
 
-	debugpcknum++;
-	// printf("debug - packet %d\n", debugpcknum);
-
     // Extract data, bail if it doesn't exist, make a local copy of what we're
     // inserting into the frame.
     dot11_packinfo *packinfo;
@@ -1646,20 +1641,42 @@ int Kis_80211_Phy::PacketWepDecryptor(kis_packet *in_pack) {
 	if (chunk->dlt != KDLT_IEEE802_11)
 		return 0;
 
-	// Bail if we can't find a key match
-	macmap<dot11_wep_key *>::iterator bwmitr = wepkeys.find(packinfo->bssid_mac);
-	if (bwmitr == wepkeys.end())
-		return 0;
+	// Bail if we can't find a key match; the key is copied out so it can be
+	// replaced while we decrypt
+	unsigned char key[DOT11_WEPKEY_MAX];
+	int keylen;
 
-	manglechunk = DecryptWEP(packinfo, chunk, (*bwmitr->second)->key,
-							 (*bwmitr->second)->len, wep_identity);
+	{
+		local_locker lock(&wepkey_mutex);
 
-	if (manglechunk == NULL) {
-		(*bwmitr->second)->failed++;
-		return 0;
+		macmap<dot11_wep_key *>::iterator bwmitr = 
+			wepkeys.find(packinfo->bssid_mac);
+		if (bwmitr == wepkeys.end())
+			return 0;
+
+		keylen = (*bwmitr->second)->len;
+		memcpy(key, (*bwmitr->second)->key, DOT11_WEPKEY_MAX);
+	}
+
+	manglechunk = DecryptWEP(packinfo, chunk, key, keylen, wep_identity);
+
+	{
+		local_locker lock(&wepkey_mutex);
+
+		macmap<dot11_wep_key *>::iterator bwmitr = 
+			wepkeys.find(packinfo->bssid_mac);
+
+		if (bwmitr != wepkeys.end()) {
+			if (manglechunk == NULL)
+				(*bwmitr->second)->failed++;
+			else
+				(*bwmitr->second)->decrypted++;
+		}
 	}
 
-	(*bwmitr->second)->decrypted++;
+	if (manglechunk == NULL)
+		return 0;
+
 	// printf("debug - flagging packet as decrypted\n");
 	packinfo->decrypted = 1;
 
@@ -32,14 +32,30 @@
 PipeClient::PipeClient(GlobalRegistry *in_globalreg, 
         RingbufferHandler *in_rbhandler) {
     globalreg = in_globalreg;
-    handler = in_rbhandler;
 
     read_fd = -1;
     write_fd = -1;
+
+    write_buf = NULL;
+    write_buf_sz = 0;
+
+    HandleWriteBuffer(in_rbhandler);
 }
 
 PipeClient::~PipeClient() {
     Close();
+
+    delete[] write_buf;
+}
+
+uint8_t *PipeClient::fetch_buf(size_t in_len) {
+    if (write_buf_sz < in_len) {
+        delete[] write_buf;
+        write_buf = new uint8_t[in_len];
+        write_buf_sz = in_len;
+    }
+
+    return write_buf;
 }
 
 int PipeClient::OpenPipes(int rpipe, int wpipe) {
@@ -54,13 +70,16 @@ int PipeClient::OpenPipes(int rpipe, int wpipe) {
 
     if (read_fd > -1) {
         fcntl(read_fd, F_SETFL, fcntl(read_fd, F_GETFL, 0) | O_NONBLOCK);
+        globalreg->reactor->AddFd(read_fd, REACTOR_READ, this);
     }
 
     if (write_fd > -1) {
         fcntl(write_fd, F_SETFL, fcntl(write_fd, F_GETFL, 0) | O_NONBLOCK);
-    }
 
-    globalreg->RegisterPollableSubsys(this);
+        // Only ask for writeability when there's something to write
+        globalreg->reactor->AddFd(write_fd, 
+                handler->GetWriteBufferUsed() ? REACTOR_WRITE : 0, this);
+    }
 
     return 0;
 }
@@ -69,103 +88,137 @@ bool PipeClient::FetchConnected() {
     return read_fd > -1 || write_fd > -1;
 }
 
-int PipeClient::MergeSet(int in_max_fd, fd_set *out_rset, fd_set *out_wset) {
-    int max_fd = in_max_fd;
+void PipeClient::BufferAvailable(size_t in_amt) {
+    if (in_amt == 0 || write_fd < 0 || globalreg->reactor == NULL)
+        return;
 
-    // If we have data waiting to be written, fill it in
-    if (handler->GetWriteBufferUsed() && write_fd > -1) {
-        FD_SET(write_fd, out_wset);
-        if (write_fd > in_max_fd)
-            max_fd = write_fd;
-    }
+    // May be called from any thread; the reactor delivers the write event
+    // in the main loop
+    globalreg->reactor->ModifyFd(write_fd, REACTOR_WRITE);
+}
 
-    // We always want to read data
-    if (read_fd > in_max_fd) {
-        max_fd = read_fd;
-        FD_SET(read_fd, out_rset);
-    }
+void PipeClient::ReadBufferSpaceAvailable() {
+    if (read_fd < 0 || globalreg->reactor == NULL)
+        return;
+
+    // May be called from any thread.  The read descriptor is edge triggered 
+    // and we stopped reading it when the buffer filled, so re-arm it; the
+    // reactor delivers a read event in the main loop if data is waiting
+    globalreg->reactor->ModifyFd(read_fd, REACTOR_READ);
+}
 
-    return max_fd;
+void PipeClient::ReactorEvent(int in_fd, unsigned int in_events) {
+    if (in_fd == read_fd && (in_events & REACTOR_READ))
+        ReadPipe();
+
+    if (in_fd == write_fd && write_fd > -1 && (in_events & REACTOR_WRITE))
+        WritePipe();
 }
 
-int PipeClient::Poll(fd_set& in_rset, fd_set& in_wset) {
+void PipeClient::ReadPipe() {
     stringstream msg;
 
     uint8_t *buf;
     size_t len;
-    ssize_t ret, iret;
+    ssize_t ret;
 
-    if (FD_ISSET(read_fd, &in_rset)) {
-        // Allocate the biggest buffer we can fit in the ring, read as much
-        // as we can at once.
-        
-        len = handler->GetReadBufferFree();
-        buf = new uint8_t[len];
+    while (read_fd > -1) {
+        // Read as much as we can straight into the free space of the ring
+        len = handler->ReserveReadBufferData((void **) &buf, 
+                handler->GetReadBufferFree());
 
+        if (len == 0) {
+            // Nothing to do until the buffer has been drained; the handler
+            // calls ReadBufferSpaceAvailable once there's room
+            return;
+        }
+        
         if ((ret = read(read_fd, buf, len)) < 0) {
-            if (errno != EINTR && errno != EAGAIN) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN) {
                 // Push the error upstream if we failed to read here
                 errstr = strerror_r(errno, strerrbuf, 1024);
                 msg << "Pipe client error reading - " << errstr;
                 handler->BufferError(msg.str());
-                delete[] buf;
                 Close();
-                return 0;
-            }
-        } else {
-            // Insert into buffer
-            iret = handler->PutReadBufferData(buf, ret, true);
-
-            if (iret != ret) {
-                // Die if we couldn't insert all our data, the error is already going
-                // upstream.
-                delete[] buf;
-                Close();
-                return 0;
             }
+
+            return;
         }
 
-        delete[] buf;
+        // Publish what we read
+        handler->CommitReadBufferData(ret);
+
+        // The other end closed the pipe
+        if (ret == 0)
+            return;
     }
+}
+
+void PipeClient::WritePipe() {
+    stringstream msg;
 
-    if (FD_ISSET(write_fd, &in_wset)) {
+    uint8_t *buf;
+    size_t len;
+    ssize_t iret;
+
+    while (write_fd > -1) {
         len = handler->GetWriteBufferUsed();
-        buf = new uint8_t[len];
+
+        if (len == 0) {
+            // Stop asking for writeability, then make sure nothing was queued
+            // while we did
+            globalreg->reactor->ModifyFd(write_fd, 0);
+
+            if (handler->GetWriteBufferUsed() == 0)
+                return;
+
+            globalreg->reactor->ModifyFd(write_fd, REACTOR_WRITE);
+            continue;
+        }
+
+        buf = fetch_buf(len);
 
         // Peek the data into our buffer
-        ret = handler->PeekWriteBufferData(buf, len);
+        len = handler->PeekWriteBufferData(buf, len);
 
         if ((iret = write(write_fd, buf, len)) < 0) {
-            if (errno != EINTR && errno != EAGAIN) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN) {
                 // Push the error upstream
                 errstr = strerror_r(errno, strerrbuf, 1024);
                 msg << "Pipe client error writing - " << errstr;
                 handler->BufferError(msg.str());
-                delete[] buf;
                 Close();
-                return 0;
             }
-        } else {
-            // Consume whatever we managed to write
-            handler->GetWriteBufferData(NULL, iret);
+
+            // Wait for the reactor to tell us the pipe has room
+            return;
         }
 
-        delete[] buf;
+        // Consume whatever we managed to write
+        handler->GetWriteBufferData(NULL, iret);
     }
-
-    return 0;
 }
 
 void PipeClient::Close() {
-    if (read_fd > -1)
+    if (read_fd > -1) {
+        if (globalreg->reactor != NULL)
+            globalreg->reactor->RemoveFd(read_fd);
         close(read_fd);
+    }
 
-    if (write_fd > -1)
+    if (write_fd > -1) {
+        if (globalreg->reactor != NULL)
+            globalreg->reactor->RemoveFd(write_fd);
         close(write_fd);
+    }
 
     read_fd = -1;
     write_fd = -1;
-
-    globalreg->RemovePollableSubsys(this);
 }
 
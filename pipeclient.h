@@ -28,7 +28,7 @@
 #include "messagebus.h"
 #include "globalregistry.h"
 #include "ringbuf_handler.h"
-#include "pollable.h"
+#include "kis_reactor.h"
 
 // Pipe client code for communicating with another process
 //
@@ -37,9 +37,10 @@
 //
 // Populates the read buffer of a rbhandler and drains the write buffer
 //
-// Like other backend clients of a ringbuf handler, does not register as a read
-// or write directly but consumes out of the handler
-class PipeClient : public Pollable {
+// The pipes are registered with the main loop reactor.  We register as the
+// write buffer interface of the handler only to find out when there is data
+// to send, so we can ask the reactor to tell us when the pipe is writeable.
+class PipeClient : public ReactorEventHandler, public RingbufferInterface {
 public:
     PipeClient(GlobalRegistry *in_globalreg, RingbufferHandler *in_rbhandler);
     virtual ~PipeClient();
@@ -48,21 +49,39 @@ public:
     int OpenPipes(int rpipe, int wpipe);
     void Close();
 
-    // Pollable interface
-    virtual int MergeSet(int in_max_fd, fd_set *out_rset, fd_set *out_wset);
-    virtual int Poll(fd_set& in_rset, fd_set& in_wset);
+    // Reactor interface
+    virtual void ReactorEvent(int in_fd, unsigned int in_events);
+
+    // Ringbuffer interface, called when the write buffer gets data
+    virtual void BufferAvailable(size_t in_amt);
+
+    // Ringbuffer interface, called when a reader (such as a capture thread)
+    // makes room in a read buffer we filled up
+    virtual void ReadBufferSpaceAvailable();
 
     bool FetchConnected();
 
 protected:
     GlobalRegistry *globalreg;
-    RingbufferHandler *handler;
 
     int read_fd, write_fd;
 
+    // Scratch buffer for draining the write buffer into the pipe, kept across
+    // polls and only grown as needed.  Reads go straight into the read buffer.
+    uint8_t *write_buf;
+    size_t write_buf_sz;
+
+    uint8_t *fetch_buf(size_t in_len);
+
+    // Read until the pipe is empty or the read buffer is full
+    void ReadPipe();
+    // Write until the write buffer is empty or the pipe is full
+    void WritePipe();
+
     // strerror_r buffers
     char strerrbuf[1024];
     char *errstr;
 };
 
 #endif
+
@@ -33,6 +33,16 @@ RingbufV2::RingbufV2(size_t in_sz) {
     pthread_mutex_init(&buffer_locker, NULL);
 }
 
+RingbufV2::RingbufV2() {
+    buffer = NULL;
+
+    buffer_sz = 0;
+    start_pos = 0;
+    length = 0;
+
+    pthread_mutex_init(&buffer_locker, NULL);
+}
+
 RingbufV2::~RingbufV2() {
     {
         local_locker lock(&buffer_locker);
@@ -87,7 +97,7 @@ size_t RingbufV2::write(void *data, size_t in_sz) {
     copy_start = 
         (start_pos + length) % buffer_sz;
 
-    if (copy_start + in_sz < buffer_sz) {
+    if (copy_start + in_sz <= buffer_sz) {
         memcpy(buffer + copy_start, data, in_sz);
         length += in_sz;
 
@@ -97,7 +107,7 @@ size_t RingbufV2::write(void *data, size_t in_sz) {
         size_t chunk_a = buffer_sz - copy_start;
         size_t chunk_b = in_sz - chunk_a;
 
-        memcpy(buffer + start_pos + length, data, chunk_a);
+        memcpy(buffer + copy_start, data, chunk_a);
         memcpy(buffer, (uint8_t *) data + chunk_a, chunk_b);
 
         /* Increase the length of the buffer */
@@ -181,3 +191,53 @@ size_t RingbufV2::peek(void *ptr, size_t in_sz) {
     return 0;
 }
 
+size_t RingbufV2::peek_span(void **ptr, size_t in_sz) {
+    local_locker lock(&buffer_locker);
+
+    size_t opsize = used_nl();
+
+    if (opsize > in_sz)
+        opsize = in_sz;
+
+    // Only the part up to the end of the buffer is contiguous
+    if (start_pos + opsize > buffer_sz)
+        opsize = buffer_sz - start_pos;
+
+    *ptr = buffer + start_pos;
+
+    return opsize;
+}
+
+size_t RingbufV2::consume(size_t in_sz) {
+    return read(NULL, in_sz);
+}
+
+size_t RingbufV2::reserve(void **ptr, size_t in_sz) {
+    local_locker lock(&buffer_locker);
+
+    size_t opsize = available_nl();
+    size_t copy_start = (start_pos + length) % buffer_sz;
+
+    if (opsize > in_sz)
+        opsize = in_sz;
+
+    // Only the part up to the end of the buffer is contiguous
+    if (copy_start + opsize > buffer_sz)
+        opsize = buffer_sz - copy_start;
+
+    *ptr = buffer + copy_start;
+
+    return opsize;
+}
+
+size_t RingbufV2::commit(size_t in_sz) {
+    local_locker lock(&buffer_locker);
+
+    if (in_sz > available_nl())
+        in_sz = available_nl();
+
+    length += in_sz;
+
+    return in_sz;
+}
+
@@ -27,34 +27,65 @@
 // Kismet as the rewrite continues
 //
 // Automatically thread locks locally to prevent multiple operations overlapping
+//
+// Buffer operations are virtual so other backing stores (such as a ring in
+// shared memory) can stand in for the local buffer.
 class RingbufV2 {
 public:
     RingbufV2(size_t in_sz);
-    ~RingbufV2();
+    virtual ~RingbufV2();
 
     // Reset a buffer
-    void clear();
+    virtual void clear();
 
-    size_t size();
-    size_t available();
-    size_t used();
+    virtual size_t size();
+    virtual size_t available();
+    virtual size_t used();
 
     // Write data into a buffer
     // Return amount of data actually written
-    size_t write(void *in_data, size_t in_sz);
+    virtual size_t write(void *in_data, size_t in_sz);
 
     // Read data from a buffer up to sz
     // Read data is consumed
     // If the in_data pointer is NULL, data is consumed but no copy is performed.
     // Return the amount of data actually read
-    size_t read(void *in_data, size_t in_sz);
+    virtual size_t read(void *in_data, size_t in_sz);
 
     // Peek data from a buffer, up to sz
     // Peeked data is not consumed
     // Return the amount of data actually peeked
-    size_t peek(void *in_data, size_t in_sz);
+    virtual size_t peek(void *in_data, size_t in_sz);
+
+    // Peek data from a buffer without copying it, up to sz.  The pointer
+    // is set to the start of the readable data inside the buffer, and the
+    // amount which can be read contiguously is returned; this may be less
+    // than the amount in the buffer, if the data wraps.
+    //
+    // The data remains valid until it is consumed with read() or consume() -
+    // writers never touch data which hasn't been read - so this is only safe
+    // with a single reader.
+    virtual size_t peek_span(void **in_data, size_t in_sz);
+
+    // Consume data without copying it, typically after peek_span
+    // Return the amount of data actually consumed
+    virtual size_t consume(size_t in_sz);
+
+    // Reserve up to sz bytes of contiguous free space to write into in place,
+    // for writers which can produce data directly into the buffer (such as
+    // a read(2)).  Returns the amount reserved, which may be less than 
+    // requested if the free space wraps.  Nothing is visible to readers until
+    // it is committed.  Only safe with a single writer.
+    virtual size_t reserve(void **in_data, size_t in_sz);
+
+    // Publish sz bytes written into a reservation
+    // Return the amount committed
+    virtual size_t commit(size_t in_sz);
 
 protected:
+    // Subclasses which provide their own storage
+    RingbufV2();
+
     // Mutex for all operations on the buffer
     pthread_mutex_t buffer_locker;
 
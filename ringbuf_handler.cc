@@ -38,6 +38,8 @@ RingbufferHandler::RingbufferHandler(size_t r_buffer_sz, size_t w_buffer_sz) {
     rbuf_notify = NULL;
     wbuf_notify = NULL;
 
+    read_buffer_full = false;
+
     pthread_mutex_init(&handler_locker, NULL);
     pthread_mutex_init(&r_callback_locker, NULL);
     pthread_mutex_init(&w_callback_locker, NULL);
@@ -114,12 +116,18 @@ size_t RingbufferHandler::GetWriteBufferFree() {
 }
 
 size_t RingbufferHandler::GetReadBufferData(void *in_ptr, size_t in_sz) {
-    local_locker lock(&handler_locker);
+    size_t ret = 0;
 
-    if (read_buffer) 
-        return read_buffer->read(in_ptr, in_sz);
+    {
+        local_locker lock(&handler_locker);
 
-    return 0;
+        if (read_buffer) 
+            ret = read_buffer->read(in_ptr, in_sz);
+    }
+
+    NotifyReadSpace(ret);
+
+    return ret;
 }
 
 size_t RingbufferHandler::GetWriteBufferData(void *in_ptr, size_t in_sz) {
@@ -140,6 +148,15 @@ size_t RingbufferHandler::PeekReadBufferData(void *in_ptr, size_t in_sz) {
     return 0;
 }
 
+size_t RingbufferHandler::ZeroCopyPeekReadBufferData(void **in_ptr, size_t in_sz) {
+    local_locker lock(&handler_locker);
+
+    if (read_buffer)
+        return read_buffer->peek_span(in_ptr, in_sz);
+
+    return 0;
+}
+
 size_t RingbufferHandler::PeekWriteBufferData(void *in_ptr, size_t in_sz) {
     local_locker lock(&handler_locker);
 
@@ -149,6 +166,49 @@ size_t RingbufferHandler::PeekWriteBufferData(void *in_ptr, size_t in_sz) {
     return 0;
 }
 
+size_t RingbufferHandler::ConsumeReadBufferData(size_t in_sz) {
+    size_t ret = 0;
+
+    {
+        local_locker lock(&handler_locker);
+
+        if (read_buffer)
+            ret = read_buffer->consume(in_sz);
+    }
+
+    NotifyReadSpace(ret);
+
+    return ret;
+}
+
+void RingbufferHandler::NotifyReadSpace(size_t in_consumed) {
+    if (in_consumed == 0)
+        return;
+
+    {
+        local_locker lock(&handler_locker);
+
+        if (!read_buffer_full)
+            return;
+
+        read_buffer_full = false;
+    }
+
+    local_locker lock(&w_callback_locker);
+
+    if (wbuf_notify)
+        wbuf_notify->ReadBufferSpaceAvailable();
+}
+
+size_t RingbufferHandler::ConsumeWriteBufferData(size_t in_sz) {
+    local_locker lock(&handler_locker);
+
+    if (write_buffer)
+        return write_buffer->consume(in_sz);
+
+    return 0;
+}
+
 size_t RingbufferHandler::PutReadBufferData(void *in_ptr, size_t in_sz, 
         bool in_atomic) {
     size_t ret;
@@ -182,6 +242,43 @@ size_t RingbufferHandler::PutReadBufferData(void *in_ptr, size_t in_sz,
     return ret;
 }
     
+size_t RingbufferHandler::ReserveReadBufferData(void **in_ptr, size_t in_sz) {
+    local_locker lock(&handler_locker);
+
+    if (!read_buffer)
+        return 0;
+
+    size_t ret = read_buffer->reserve(in_ptr, in_sz);
+
+    // Remember that the filler is waiting for a reader to make room
+    if (ret == 0)
+        read_buffer_full = true;
+
+    return ret;
+}
+
+size_t RingbufferHandler::CommitReadBufferData(size_t in_sz) {
+    size_t ret;
+
+    {
+        local_locker lock(&handler_locker);
+
+        if (!read_buffer)
+            return 0;
+
+        ret = read_buffer->commit(in_sz);
+    }
+
+    {
+        local_locker lock(&r_callback_locker);
+
+        if (rbuf_notify)
+            rbuf_notify->BufferAvailable(ret);
+    }
+
+    return ret;
+}
+
 size_t RingbufferHandler::PutWriteBufferData(void *in_ptr, size_t in_sz,
         bool in_atomic) {
     size_t ret;
@@ -215,6 +312,27 @@ size_t RingbufferHandler::PutWriteBufferData(void *in_ptr, size_t in_sz,
     return ret;
 }
 
+void RingbufferHandler::SetReadBuffer(RingbufV2 *in_buffer) {
+    local_locker lock(&handler_locker);
+
+    if (read_buffer)
+        delete read_buffer;
+
+    read_buffer = in_buffer;
+}
+
+void RingbufferHandler::ReadBufferAvailable() {
+    size_t used = GetReadBufferUsed();
+
+    if (used == 0)
+        return;
+
+    local_locker lock(&r_callback_locker);
+
+    if (rbuf_notify)
+        rbuf_notify->BufferAvailable(used);
+}
+
 void RingbufferHandler::SetReadBufferInterface(RingbufferInterface *in_interface) {
     local_locker lock(&r_callback_locker);
 
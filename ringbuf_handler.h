@@ -62,6 +62,10 @@ public:
     size_t PeekReadBufferData(void *in_ptr, size_t in_sz);
     size_t PeekWriteBufferData(void *in_ptr, size_t in_sz);
 
+    // Peek read buffer data in place, up to in_sz.  Returns the amount which
+    // can be read contiguously from in_ptr; see RingbufV2::peek_span
+    size_t ZeroCopyPeekReadBufferData(void **in_ptr, size_t in_sz);
+
     // Consume data w/out copying it (used to flag data we previously peeked)
     size_t ConsumeReadBufferData(size_t in_sz);
     size_t ConsumeWriteBufferData(size_t in_sz);
@@ -72,6 +76,23 @@ public:
     size_t PutReadBufferData(void *in_ptr, size_t in_sz, bool in_atomic);
     size_t PutWriteBufferData(void *in_ptr, size_t in_sz, bool in_atomic);
 
+    // Reserve up to in_sz bytes of the read buffer to fill in place, then
+    // commit what was actually filled; see RingbufV2::reserve.  Commit
+    // triggers callbacks like PutReadBufferData.  Only one client may fill
+    // the read buffer this way.
+    size_t ReserveReadBufferData(void **in_ptr, size_t in_sz);
+    size_t CommitReadBufferData(size_t in_sz);
+
+    // Replace the read buffer with another implementation (such as a shared
+    // memory ring); the handler takes ownership.  Anything in the old buffer
+    // is discarded.
+    void SetReadBuffer(RingbufV2 *in_buffer);
+
+    // Notify the read interface of data which was placed in the read buffer
+    // directly instead of through PutReadBufferData (by another process
+    // sharing the buffer)
+    void ReadBufferAvailable();
+
     // Set interface callbacks to be called when we have data in the buffers
     void SetReadBufferInterface(RingbufferInterface *in_interface);
     void SetWriteBufferInterface(RingbufferInterface *in_interface);
@@ -96,6 +117,14 @@ protected:
     pthread_mutex_t handler_locker;
     pthread_mutex_t r_callback_locker;
     pthread_mutex_t w_callback_locker;
+
+    // A reservation found the read buffer full, and whoever is filling it is
+    // waiting for room
+    bool read_buffer_full;
+
+    // Tell the write interface there's room in the read buffer again, if it
+    // was waiting for it
+    void NotifyReadSpace(size_t in_consumed);
 };
 
 // Ringbuffer interface, interacts with a ringbuffer handler 
@@ -111,6 +140,12 @@ public:
     // Called when a buffer grows
     virtual void BufferAvailable(size_t in_amt) = 0;
 
+    // Called on the write buffer interface when data is consumed from a read
+    // buffer which was found full while reserving space in it.  Clients
+    // filling the read buffer from an edge-triggered descriptor use this to 
+    // start reading again once a reader in another thread has made room.
+    virtual void ReadBufferSpaceAvailable() { }
+
     // Called when a buffer encounters an error
     virtual void BufferError(string in_error __attribute__((unused))) { }
 
@@ -0,0 +1,246 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "ringbuf_shm.h"
+
+RingbufShm::RingbufShm(size_t in_sz) : RingbufV2() {
+    ring_valid = (kis_shm_ring_create(&ring, in_sz) >= 0);
+}
+
+RingbufShm::~RingbufShm() {
+    local_locker lock(&buffer_locker);
+
+    if (ring_valid)
+        kis_shm_ring_close(&ring);
+
+    ring_valid = false;
+}
+
+bool RingbufShm::valid() {
+    return ring_valid;
+}
+
+bool RingbufShm::producer_attached() {
+    if (!ring_valid)
+        return false;
+
+    return kis_shm_ring_producer_attached(&ring);
+}
+
+bool RingbufShm::corrupt() {
+    local_locker lock(&buffer_locker);
+
+    if (!ring_valid)
+        return false;
+
+    // Catch a bad head even if nothing has looked at the ring yet
+    kis_shm_ring_used(&ring);
+
+    return kis_shm_ring_corrupt(&ring);
+}
+
+void RingbufShm::clear() {
+    local_locker lock(&buffer_locker);
+
+    if (!ring_valid)
+        return;
+
+    uint8_t *data;
+    kis_shm_ring_consume(&ring, kis_shm_ring_peek(&ring, &data));
+}
+
+size_t RingbufShm::size() {
+    if (!ring_valid)
+        return 0;
+
+    return ring.data_sz;
+}
+
+size_t RingbufShm::available() {
+    if (!ring_valid)
+        return 0;
+
+    return kis_shm_ring_available(&ring);
+}
+
+size_t RingbufShm::used() {
+    if (!ring_valid)
+        return 0;
+
+    return kis_shm_ring_used(&ring);
+}
+
+size_t RingbufShm::write(void *in_data, size_t in_sz) {
+    local_locker lock(&buffer_locker);
+
+    // Once the helper owns the producer side we can't write without
+    // racing it
+    if (!ring_valid || kis_shm_ring_producer_attached(&ring))
+        return 0;
+
+    return kis_shm_ring_write(&ring, in_data, in_sz);
+}
+
+size_t RingbufShm::read(void *in_data, size_t in_sz) {
+    local_locker lock(&buffer_locker);
+
+    if (!ring_valid)
+        return 0;
+
+    uint8_t *data;
+    size_t len = kis_shm_ring_peek(&ring, &data);
+
+    if (len > in_sz)
+        len = in_sz;
+
+    if (in_data != NULL)
+        memcpy(in_data, data, len);
+
+    kis_shm_ring_consume(&ring, len);
+
+    return len;
+}
+
+size_t RingbufShm::peek(void *in_data, size_t in_sz) {
+    local_locker lock(&buffer_locker);
+
+    if (!ring_valid)
+        return 0;
+
+    uint8_t *data;
+    size_t len = kis_shm_ring_peek(&ring, &data);
+
+    if (len > in_sz)
+        len = in_sz;
+
+    memcpy(in_data, data, len);
+
+    return len;
+}
+
+size_t RingbufShm::peek_span(void **in_data, size_t in_sz) {
+    local_locker lock(&buffer_locker);
+
+    if (!ring_valid)
+        return 0;
+
+    uint8_t *data;
+    size_t len = kis_shm_ring_peek(&ring, &data);
+
+    if (len > in_sz)
+        len = in_sz;
+
+    *in_data = data;
+
+    return len;
+}
+
+size_t RingbufShm::consume(size_t in_sz) {
+    return read(NULL, in_sz);
+}
+
+size_t RingbufShm::reserve(void **in_data, size_t in_sz) {
+    local_locker lock(&buffer_locker);
+
+    if (!ring_valid || kis_shm_ring_producer_attached(&ring))
+        return 0;
+
+    size_t len = kis_shm_ring_available(&ring);
+
+    if (len > in_sz)
+        len = in_sz;
+
+    *in_data = kis_shm_ring_reserve(&ring, len);
+
+    return len;
+}
+
+size_t RingbufShm::commit(size_t in_sz) {
+    local_locker lock(&buffer_locker);
+
+    if (!ring_valid || kis_shm_ring_producer_attached(&ring))
+        return 0;
+
+    if (in_sz > kis_shm_ring_available(&ring))
+        in_sz = kis_shm_ring_available(&ring);
+
+    kis_shm_ring_commit(&ring, in_sz);
+
+    return in_sz;
+}
+
+ShmRingClient::ShmRingClient(GlobalRegistry *in_globalreg, 
+        RingbufferHandler *in_rbhandler, RingbufShm *in_ring) {
+    globalreg = in_globalreg;
+    handler = in_rbhandler;
+    ring = in_ring;
+
+    doorbell_fd = dup(ring->get_doorbell_fd());
+
+    if (doorbell_fd > -1) {
+        fcntl(doorbell_fd, F_SETFL, fcntl(doorbell_fd, F_GETFL, 0) | O_NONBLOCK);
+        fcntl(doorbell_fd, F_SETFD, fcntl(doorbell_fd, F_GETFD, 0) | FD_CLOEXEC);
+        globalreg->reactor->AddFd(doorbell_fd, REACTOR_READ, this);
+    }
+}
+
+ShmRingClient::~ShmRingClient() {
+    Close();
+}
+
+void ShmRingClient::Close() {
+    if (doorbell_fd > -1) {
+        if (globalreg->reactor != NULL)
+            globalreg->reactor->RemoveFd(doorbell_fd);
+        close(doorbell_fd);
+    }
+
+    doorbell_fd = -1;
+}
+
+void ShmRingClient::ReactorEvent(int in_fd, 
+        unsigned int in_events __attribute__((unused))) {
+    uint64_t count;
+
+    if (in_fd != doorbell_fd)
+        return;
+
+    // Reading the eventfd resets the counter; one wakeup covers every
+    // frame the helper published since the last one
+    if (::read(doorbell_fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
+        return;
+
+    if (ring->corrupt()) {
+        // Stop listening; the error kills the helper, and nothing left in
+        // the ring can be trusted
+        Close();
+        handler->BufferError("IPC helper corrupted the shared memory ring "
+                "(head outside the ring); closing the connection");
+        return;
+    }
+
+    handler->ReadBufferAvailable();
+}
+
@@ -0,0 +1,106 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __RINGBUF_SHM_H__
+#define __RINGBUF_SHM_H__
+
+#include "config.h"
+
+#include "globalregistry.h"
+#include "ringbuf2.h"
+#include "ringbuf_handler.h"
+#include "kis_reactor.h"
+#include "kis_shm_ring.h"
+
+// Ringbuffer backed by a shared memory ring (see kis_shm_ring.h), used as
+// the read buffer of an IPC handler so frames written by a capture helper
+// are decoded in place.
+//
+// The helper is the producer once it attaches.  Until then (or forever, for
+// helpers which don't know about the ring) data arriving over the pipe is
+// written into the ring by the server instead, so the consumer never has to
+// know which path the data took.
+//
+// The ring is single-producer, single-consumer; the RingbufV2 mutex still
+// serializes the server side.
+class RingbufShm : public RingbufV2 {
+public:
+    RingbufShm(size_t in_sz);
+    virtual ~RingbufShm();
+
+    // Did we get a ring from the kernel?
+    bool valid();
+
+    int get_ring_fd() { return ring.fd; }
+    int get_doorbell_fd() { return ring.doorbell_fd; }
+
+    // Has the helper taken over as the producer?
+    bool producer_attached();
+
+    // Has the helper published a head we can't trust?  Nothing more is read
+    // from the ring once it has
+    bool corrupt();
+
+    virtual void clear();
+
+    virtual size_t size();
+    virtual size_t available();
+    virtual size_t used();
+
+    virtual size_t write(void *in_data, size_t in_sz);
+    virtual size_t read(void *in_data, size_t in_sz);
+    virtual size_t peek(void *in_data, size_t in_sz);
+
+    // The ring is mapped twice back to back, so spans are never cut short
+    // by the end of the ring
+    virtual size_t peek_span(void **in_data, size_t in_sz);
+    virtual size_t consume(size_t in_sz);
+
+    virtual size_t reserve(void **in_data, size_t in_sz);
+    virtual size_t commit(size_t in_sz);
+
+protected:
+    kis_shm_ring_t ring;
+    bool ring_valid;
+};
+
+// Reactor client watching the doorbell of a shared memory ring; wakes up the
+// read interface of the handler when the helper has published frames, or
+// errors the handler if the helper has corrupted the ring.  Holds its own
+// copy of the doorbell fd; the ring must be the read buffer of the handler.
+class ShmRingClient : public ReactorEventHandler {
+public:
+    ShmRingClient(GlobalRegistry *in_globalreg, RingbufferHandler *in_rbhandler,
+            RingbufShm *in_ring);
+    virtual ~ShmRingClient();
+
+    void Close();
+
+    // Reactor interface
+    virtual void ReactorEvent(int in_fd, unsigned int in_events);
+
+protected:
+    GlobalRegistry *globalreg;
+    RingbufferHandler *handler;
+    RingbufShm *ring;
+
+    int doorbell_fd;
+};
+
+#endif
+
@@ -0,0 +1,252 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef SYS_LINUX
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#endif
+
+#include "ringbuf_spsc.h"
+
+RingbufSPSC::RingbufSPSC(size_t in_sz) : RingbufV2() {
+    long pg = sysconf(_SC_PAGESIZE);
+
+    if (pg <= 0)
+        pg = 4096;
+
+    // A power of two of at least a page, so we can mask positions and map
+    // the buffer twice
+    buffer_sz = (size_t) pg;
+
+    while (buffer_sz < in_sz)
+        buffer_sz <<= 1;
+
+    mask = buffer_sz - 1;
+
+    head.store(0);
+    tail.store(0);
+
+    is_mirrored = map_mirror();
+
+    if (!is_mirrored)
+        buffer = new uint8_t[buffer_sz];
+}
+
+RingbufSPSC::~RingbufSPSC() {
+#ifdef SYS_LINUX
+    if (is_mirrored) {
+        munmap(buffer, buffer_sz * 2);
+
+        // Don't let the base class free the mapping
+        buffer = NULL;
+    }
+#endif
+}
+
+bool RingbufSPSC::map_mirror() {
+#if defined(SYS_LINUX) && defined(SYS_memfd_create)
+    int fd;
+    uint8_t *base;
+
+    if ((fd = (int) syscall(SYS_memfd_create, "kismet_ringbuf", 0)) < 0)
+        return false;
+
+    if (ftruncate(fd, buffer_sz) < 0) {
+        close(fd);
+        return false;
+    }
+
+    // Reserve the span, then map the same pages into both halves
+    base = (uint8_t *) mmap(NULL, buffer_sz * 2, PROT_NONE, 
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (base == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    if (mmap(base, buffer_sz, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+            mmap(base + buffer_sz, buffer_sz, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, buffer_sz * 2);
+        close(fd);
+        return false;
+    }
+
+    // The mappings hold the memory
+    close(fd);
+
+    buffer = base;
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void RingbufSPSC::copy_in(size_t in_pos, void *in_data, size_t in_sz) {
+    size_t off = in_pos & mask;
+
+    if (is_mirrored || off + in_sz <= buffer_sz) {
+        memcpy(buffer + off, in_data, in_sz);
+        return;
+    }
+
+    size_t chunk_a = buffer_sz - off;
+
+    memcpy(buffer + off, in_data, chunk_a);
+    memcpy(buffer, (uint8_t *) in_data + chunk_a, in_sz - chunk_a);
+}
+
+void RingbufSPSC::copy_out(size_t in_pos, void *in_data, size_t in_sz) {
+    size_t off = in_pos & mask;
+
+    if (is_mirrored || off + in_sz <= buffer_sz) {
+        memcpy(in_data, buffer + off, in_sz);
+        return;
+    }
+
+    size_t chunk_a = buffer_sz - off;
+
+    memcpy(in_data, buffer + off, chunk_a);
+    memcpy((uint8_t *) in_data + chunk_a, buffer, in_sz - chunk_a);
+}
+
+void RingbufSPSC::clear() {
+    tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+size_t RingbufSPSC::size() {
+    return buffer_sz;
+}
+
+size_t RingbufSPSC::used() {
+    size_t t = tail.load(std::memory_order_acquire);
+    size_t h = head.load(std::memory_order_acquire);
+
+    return h - t;
+}
+
+size_t RingbufSPSC::available() {
+    return buffer_sz - used();
+}
+
+size_t RingbufSPSC::write(void *in_data, size_t in_sz) {
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t t = tail.load(std::memory_order_acquire);
+
+    if (buffer_sz - (h - t) < in_sz)
+        return 0;
+
+    copy_in(h, in_data, in_sz);
+
+    head.store(h + in_sz, std::memory_order_release);
+
+    return in_sz;
+}
+
+size_t RingbufSPSC::read(void *in_data, size_t in_sz) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    size_t opsize = h - t;
+
+    if (opsize > in_sz)
+        opsize = in_sz;
+
+    if (opsize == 0)
+        return 0;
+
+    if (in_data != NULL)
+        copy_out(t, in_data, opsize);
+
+    tail.store(t + opsize, std::memory_order_release);
+
+    return opsize;
+}
+
+size_t RingbufSPSC::peek(void *in_data, size_t in_sz) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    size_t opsize = h - t;
+
+    if (opsize > in_sz)
+        opsize = in_sz;
+
+    if (opsize != 0)
+        copy_out(t, in_data, opsize);
+
+    return opsize;
+}
+
+size_t RingbufSPSC::peek_span(void **in_data, size_t in_sz) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    size_t off = t & mask;
+    size_t opsize = h - t;
+
+    if (opsize > in_sz)
+        opsize = in_sz;
+
+    if (!is_mirrored && off + opsize > buffer_sz)
+        opsize = buffer_sz - off;
+
+    *in_data = buffer + off;
+
+    return opsize;
+}
+
+size_t RingbufSPSC::consume(size_t in_sz) {
+    return read(NULL, in_sz);
+}
+
+size_t RingbufSPSC::reserve(void **in_data, size_t in_sz) {
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t t = tail.load(std::memory_order_acquire);
+    size_t off = h & mask;
+    size_t opsize = buffer_sz - (h - t);
+
+    if (opsize > in_sz)
+        opsize = in_sz;
+
+    if (!is_mirrored && off + opsize > buffer_sz)
+        opsize = buffer_sz - off;
+
+    *in_data = buffer + off;
+
+    return opsize;
+}
+
+size_t RingbufSPSC::commit(size_t in_sz) {
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t t = tail.load(std::memory_order_acquire);
+
+    if (in_sz > buffer_sz - (h - t))
+        in_sz = buffer_sz - (h - t);
+
+    head.store(h + in_sz, std::memory_order_release);
+
+    return in_sz;
+}
+
@@ -0,0 +1,87 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __RINGBUF_SPSC_H__
+#define __RINGBUF_SPSC_H__
+
+#include "config.h"
+
+#include <atomic>
+
+#include "ringbuf2.h"
+
+// Lock-free single-producer, single-consumer ringbuffer
+//
+// Drop-in for RingbufV2 where exactly one thread writes (or reserves and
+// commits) and exactly one thread reads (or peeks and consumes), such as the
+// read buffer of an IPC or network client.  No mutex is taken; the read and
+// write positions are free-running counters published with release stores
+// and picked up with acquire loads.
+//
+// The size is rounded up to a power of two so positions wrap with a mask.
+// Where the platform allows it (Linux memfd), the buffer is mapped twice
+// back to back, so reserve() and peek_span() always return the full free or
+// used span instead of stopping at the end of the buffer.
+//
+// clear() belongs to the consumer.
+class RingbufSPSC : public RingbufV2 {
+public:
+    RingbufSPSC(size_t in_sz);
+    virtual ~RingbufSPSC();
+
+    // Is the buffer mapped twice, so every span is contiguous?
+    bool mirrored() { return is_mirrored; }
+
+    virtual void clear();
+
+    virtual size_t size();
+    virtual size_t available();
+    virtual size_t used();
+
+    virtual size_t write(void *in_data, size_t in_sz);
+    virtual size_t read(void *in_data, size_t in_sz);
+    virtual size_t peek(void *in_data, size_t in_sz);
+
+    virtual size_t peek_span(void **in_data, size_t in_sz);
+    virtual size_t consume(size_t in_sz);
+
+    virtual size_t reserve(void **in_data, size_t in_sz);
+    virtual size_t commit(size_t in_sz);
+
+protected:
+    bool map_mirror();
+
+    // Copy in or out of the ring at a position, handling the wrap when we
+    // aren't mirrored
+    void copy_in(size_t in_pos, void *in_data, size_t in_sz);
+    void copy_out(size_t in_pos, void *in_data, size_t in_sz);
+
+    size_t mask;
+    bool is_mirrored;
+
+    // Total bytes written, only stored by the producer
+    std::atomic<size_t> head;
+    uint8_t pad0[64 - sizeof(std::atomic<size_t>)];
+
+    // Total bytes consumed, only stored by the consumer
+    std::atomic<size_t> tail;
+    uint8_t pad1[64 - sizeof(std::atomic<size_t>)];
+};
+
+#endif
+
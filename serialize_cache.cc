@@ -0,0 +1,188 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <string.h>
+
+#include "util.h"
+#include "serialize_cache.h"
+
+SerializeCache::SerializeCache(size_t in_max_bytes, time_t in_max_age) {
+    max_bytes = in_max_bytes;
+    max_age = in_max_age;
+
+    lru_head = NULL;
+    lru_tail = NULL;
+
+    memset(&stats, 0, sizeof(cache_stats));
+    stats.max_bytes = max_bytes;
+
+    pthread_mutex_init(&cache_mutex, NULL);
+}
+
+SerializeCache::~SerializeCache() {
+    {
+        local_locker lock(&cache_mutex);
+
+        while (lru_head != NULL)
+            Remove_nl(lru_head);
+    }
+
+    pthread_mutex_destroy(&cache_mutex);
+}
+
+uint64_t SerializeCache::IndexKey(uint64_t in_object, uint64_t in_view,
+        int in_format) {
+    // The hashmap mixes the result, this just has to fold the parts together
+    uint64_t k = in_object;
+
+    k ^= in_view * 0x9E3779B97F4A7C15ULL;
+    k ^= (uint64_t) in_format << 56;
+
+    return k;
+}
+
+SerializeCache::cache_entry *SerializeCache::Find_nl(uint64_t in_object, 
+        uint64_t in_view, int in_format) {
+    cache_entry *e = index.find(IndexKey(in_object, in_view, in_format));
+
+    if (e == NULL)
+        return NULL;
+
+    if (e->object != in_object || e->view != in_view || e->format != in_format)
+        return NULL;
+
+    return e;
+}
+
+void SerializeCache::Unlink_nl(cache_entry *in_entry) {
+    if (in_entry->prev != NULL)
+        in_entry->prev->next = in_entry->next;
+    else
+        lru_head = in_entry->next;
+
+    if (in_entry->next != NULL)
+        in_entry->next->prev = in_entry->prev;
+    else
+        lru_tail = in_entry->prev;
+
+    in_entry->prev = NULL;
+    in_entry->next = NULL;
+}
+
+void SerializeCache::PushFront_nl(cache_entry *in_entry) {
+    in_entry->prev = NULL;
+    in_entry->next = lru_head;
+
+    if (lru_head != NULL)
+        lru_head->prev = in_entry;
+    else
+        lru_tail = in_entry;
+
+    lru_head = in_entry;
+}
+
+void SerializeCache::Remove_nl(cache_entry *in_entry) {
+    stats.bytes -= in_entry->data.length() + entry_overhead;
+    stats.entries--;
+
+    index.erase(IndexKey(in_entry->object, in_entry->view, in_entry->format));
+    Unlink_nl(in_entry);
+
+    delete in_entry;
+}
+
+bool SerializeCache::Fetch(uint64_t in_object, uint64_t in_generation,
+        uint64_t in_view, int in_format, time_t in_now,
+        std::string *ret_data) {
+    local_locker lock(&cache_mutex);
+
+    cache_entry *e = Find_nl(in_object, in_view, in_format);
+
+    if (e == NULL || e->generation != in_generation || 
+            in_now - e->stored >= max_age) {
+        // Anything stale is replaced when the record is stored again
+        stats.misses++;
+        return false;
+    }
+
+    ret_data->assign(e->data);
+
+    if (e != lru_head) {
+        Unlink_nl(e);
+        PushFront_nl(e);
+    }
+
+    stats.hits++;
+
+    return true;
+}
+
+void SerializeCache::Store(uint64_t in_object, uint64_t in_generation,
+        uint64_t in_view, int in_format, time_t in_now,
+        const char *in_data, size_t in_len) {
+    // Don't let one huge record flush everything else out
+    if (in_len + entry_overhead > max_bytes / 4)
+        return;
+
+    local_locker lock(&cache_mutex);
+
+    // Drop whatever is in our slot, an older generation of the record or
+    // something colliding with it
+    cache_entry *e = 
+        index.find(IndexKey(in_object, in_view, in_format));
+
+    if (e != NULL) {
+        // Someone else already stored this generation
+        if (e->object == in_object && e->view == in_view && 
+                e->format == in_format && e->generation == in_generation &&
+                e->stored == in_now)
+            return;
+
+        Remove_nl(e);
+    }
+
+    while (lru_tail != NULL && 
+            stats.bytes + in_len + entry_overhead > max_bytes) {
+        Remove_nl(lru_tail);
+        stats.evictions++;
+    }
+
+    e = new cache_entry;
+
+    e->object = in_object;
+    e->view = in_view;
+    e->format = in_format;
+    e->generation = in_generation;
+    e->stored = in_now;
+    e->data.assign(in_data, in_len);
+
+    PushFront_nl(e);
+    index.insert(IndexKey(in_object, in_view, in_format), e);
+
+    stats.bytes += in_len + entry_overhead;
+    stats.entries++;
+}
+
+void SerializeCache::FetchStats(cache_stats *ret_stats) {
+    local_locker lock(&cache_mutex);
+
+    *ret_stats = stats;
+}
+
@@ -0,0 +1,217 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __SERIALIZE_CACHE_H__
+#define __SERIALIZE_CACHE_H__
+
+#include "config.h"
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <streambuf>
+
+#include "kis_hashmap.h"
+
+class TrackerElement;
+class tracker_component;
+
+// Serialization cache
+//
+// Keeps the encoded form of records (devices, mostly) so a record which
+// hasn't changed since the last request can be copied into the output instead
+// of being serialized again.  Records are identified by an object id and a
+// view (whole record, summary, or a field projection), and an encoding is only
+// good for the generation of the record it was made from.  The owner of the
+// record bumps the generation whenever it changes the record.
+//
+// Serializing also rolls time-based data (RRDs) forward even when the record
+// itself hasn't changed, so encodings are also dropped once they're older
+// than the maximum age.
+//
+// Least recently used encodings are thrown out once the cache is full.
+class SerializeCache {
+public:
+    // Encodings are kept per output format
+    enum cache_format {
+        format_json = 0,
+        format_msgpack = 1,
+        format_msgpack_compact = 2
+    };
+
+    typedef struct {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint64_t entries;
+        // Memory used by the cache, including bookkeeping
+        uint64_t bytes;
+        uint64_t max_bytes;
+    } cache_stats;
+
+    SerializeCache(size_t in_max_bytes, time_t in_max_age);
+    ~SerializeCache();
+
+    // Copy out the encoding of a record.  Returns false if there isn't one
+    // for this generation of the record, or it has gotten too old
+    bool Fetch(uint64_t in_object, uint64_t in_generation, uint64_t in_view,
+            int in_format, time_t in_now, std::string *ret_data);
+
+    // Store the encoding of a record, replacing any older generation
+    void Store(uint64_t in_object, uint64_t in_generation, uint64_t in_view,
+            int in_format, time_t in_now, const char *in_data, size_t in_len);
+
+    void FetchStats(cache_stats *ret_stats);
+
+protected:
+    struct cache_entry {
+        uint64_t object;
+        uint64_t view;
+        int format;
+
+        uint64_t generation;
+        time_t stored;
+        std::string data;
+
+        // LRU list
+        cache_entry *prev;
+        cache_entry *next;
+    };
+
+    // Rough per-entry bookkeeping cost, counted against the size limit
+    static const size_t entry_overhead = sizeof(cache_entry) + 64;
+
+    // Entries are indexed by a hash of object, view, and format; a colliding
+    // entry is simply treated as a different record
+    static uint64_t IndexKey(uint64_t in_object, uint64_t in_view, 
+            int in_format);
+
+    cache_entry *Find_nl(uint64_t in_object, uint64_t in_view, int in_format);
+    void Remove_nl(cache_entry *in_entry);
+    void Unlink_nl(cache_entry *in_entry);
+    void PushFront_nl(cache_entry *in_entry);
+
+    pthread_mutex_t cache_mutex;
+
+    size_t max_bytes;
+    time_t max_age;
+
+    kis_hashmap<cache_entry *> index;
+
+    // Most recently used at the head
+    cache_entry *lru_head;
+    cache_entry *lru_tail;
+
+    cache_stats stats;
+};
+
+// Records in one tree being serialized which should go through the cache,
+// filled in by whoever builds the tree and handed to the serializer with
+// TrackerElementSerializer::SetCacheTags.
+//
+// Tags are matched in the order the serializer reaches the tagged elements,
+// which is the order they were added to their vector, so they have to be
+// tagged in that order.  An element which doesn't match the next tag is
+// simply serialized normally.
+//
+// A tag may also name the component the record was built from, which is held
+// locked while the record is serialized.  Tags can be used for locking alone
+// with no cache.
+class SerializeCacheTags {
+public:
+    SerializeCacheTags(SerializeCache *in_cache, time_t in_now) :
+        scratch_buf(&scratch), scratch_stream(&scratch_buf) {
+        cache = in_cache;
+        now = in_now;
+        next_tag = 0;
+    }
+
+    typedef struct {
+        TrackerElement *element;
+        uint64_t object;
+        uint64_t generation;
+        uint64_t view;
+        tracker_component *lock;
+    } cache_tag;
+
+    void Tag(TrackerElement *in_element, uint64_t in_object,
+            uint64_t in_generation, uint64_t in_view, 
+            tracker_component *in_lock = NULL) {
+        cache_tag t;
+
+        t.element = in_element;
+        t.object = in_object;
+        t.generation = in_generation;
+        t.view = in_view;
+        t.lock = in_lock;
+
+        tags.push_back(t);
+    }
+
+    // Match the next tag; returns NULL if this element isn't it
+    inline const cache_tag *Match(TrackerElement *in_element) {
+        if (next_tag >= tags.size() || tags[next_tag].element != in_element)
+            return NULL;
+
+        return &(tags[next_tag++]);
+    }
+
+    // NULL when the tags are only for locking
+    SerializeCache *cache;
+    time_t now;
+
+    // Scratch space for copying out cached encodings, and a stream which
+    // appends to it for serializers which build records through a stream
+    std::string scratch;
+
+protected:
+    class scratch_streambuf : public std::streambuf {
+    public:
+        scratch_streambuf(std::string *in_str) : str(in_str) { }
+
+    protected:
+        virtual std::streamsize xsputn(const char *in_data, 
+                std::streamsize in_sz) {
+            str->append(in_data, in_sz);
+            return in_sz;
+        }
+
+        virtual int overflow(int in_c) {
+            if (in_c != traits_type::eof())
+                str->push_back((char) in_c);
+            return in_c;
+        }
+
+        std::string *str;
+    };
+
+    scratch_streambuf scratch_buf;
+
+public:
+    std::ostream scratch_stream;
+
+protected:
+    std::vector<cache_tag> tags;
+    unsigned int next_tag;
+};
+
+#endif
+
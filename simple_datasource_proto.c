@@ -33,7 +33,7 @@ simple_cap_proto_kv_t *encode_simple_cap_proto_kv(char *in_key, uint8_t *in_obj,
     if (kv == NULL)
         return NULL;
 
-    snprintf(kv->header.key, 16, "%16s", in_key);
+    snprintf(kv->header.key, 16, "%s", in_key);
     kv->header.obj_sz = kis_hton32(in_obj_len);
 
     memcpy(kv->object, in_obj, in_obj_len);
@@ -43,6 +43,13 @@ simple_cap_proto_kv_t *encode_simple_cap_proto_kv(char *in_key, uint8_t *in_obj,
 
 simple_cap_proto_t *encode_simple_cap_proto(char *in_type,
         simple_cap_proto_kv_t **in_kv_list, unsigned int in_kv_len) {
+    return encode_simple_cap_proto_checksum(in_type, in_kv_list, in_kv_len,
+            SIMPLE_CAP_CHECKSUM_ADLER32);
+}
+
+simple_cap_proto_t *encode_simple_cap_proto_checksum(char *in_type,
+        simple_cap_proto_kv_t **in_kv_list, unsigned int in_kv_len,
+        int in_checksum) {
     simple_cap_proto_t *cp;
     simple_cap_proto_kv_t *kv;
     unsigned int x;
@@ -52,7 +59,7 @@ simple_cap_proto_t *encode_simple_cap_proto(char *in_type,
 
     for (x = 0; x < in_kv_len; x++) {
         kv = in_kv_list[x];
-        sz += sizeof(simple_cap_proto_t) + kv->header.obj_sz;
+        sz += sizeof(simple_cap_proto_kv_t) + kis_ntoh32(kv->header.obj_sz);
     }
 
     cp = (simple_cap_proto_t *) malloc(sz);
@@ -60,24 +67,159 @@ simple_cap_proto_t *encode_simple_cap_proto(char *in_type,
     if (cp == NULL)
         return NULL;
 
-    cp->signature = kis_hton32(KIS_CAP_SIMPLE_PROTO_SIG);
+    if (in_checksum == SIMPLE_CAP_CHECKSUM_CRC32C)
+        cp->signature = kis_hton32(KIS_CAP_SIMPLE_PROTO_SIG_CRC32C);
+    else
+        cp->signature = kis_hton32(KIS_CAP_SIMPLE_PROTO_SIG);
     cp->checksum = 0;
-    snprintf(cp->type, 16, "%16s", in_type);
+    snprintf(cp->type, 16, "%s", in_type);
     cp->packet_sz = kis_hton32((uint32_t) sz);
     cp->num_kv_pairs = kis_hton32(in_kv_len);
 
     for (x = 0; x < in_kv_len; x++) {
         kv = in_kv_list[x];
-        memcpy(cp->data + offt, kv, sizeof(simple_cap_proto_kv_t) + kv->header.obj_sz);
-        offt += sizeof(simple_cap_proto_kv_t) + kv->header.obj_sz;
+        memcpy(cp->data + offt, kv, 
+                sizeof(simple_cap_proto_kv_t) + kis_ntoh32(kv->header.obj_sz));
+        offt += sizeof(simple_cap_proto_kv_t) + kis_ntoh32(kv->header.obj_sz);
     }
 
-    csum = Adler32Checksum((const char *) cp, sz);
+    if (in_checksum == SIMPLE_CAP_CHECKSUM_CRC32C)
+        csum = Crc32cChecksum((const char *) cp, sz);
+    else
+        csum = Adler32Checksum((const char *) cp, sz);
     cp->checksum = kis_hton32(csum);
 
     return cp;
 }
 
+int simple_cap_proto_check(simple_cap_proto_t *in_frame, size_t in_sz) {
+    uint32_t signature, frame_checksum, calc_checksum;
+
+    if (in_sz < sizeof(simple_cap_proto_t))
+        return 0;
+
+    signature = kis_ntoh32(in_frame->signature);
+    frame_checksum = kis_ntoh32(in_frame->checksum);
+
+    in_frame->checksum = 0;
+
+    if (signature == KIS_CAP_SIMPLE_PROTO_SIG_CRC32C)
+        calc_checksum = Crc32cChecksum((const char *) in_frame, in_sz);
+    else if (signature == KIS_CAP_SIMPLE_PROTO_SIG)
+        calc_checksum = Adler32Checksum((const char *) in_frame, in_sz);
+    else
+        return 0;
+
+    return calc_checksum == frame_checksum;
+}
+
+int simple_cap_proto_batch_init(simple_cap_proto_batch_t *in_batch, 
+        size_t in_max_len, unsigned int in_max_packets, 
+        unsigned int in_max_latency_usec) {
+    in_batch->buf = (uint8_t *) malloc(in_max_len);
+
+    if (in_batch->buf == NULL)
+        return -1;
+
+    in_batch->len = 0;
+    in_batch->max_len = in_max_len;
+    in_batch->num_packets = 0;
+    in_batch->max_packets = in_max_packets;
+    in_batch->max_latency_usec = in_max_latency_usec;
+    in_batch->first_ts.tv_sec = 0;
+    in_batch->first_ts.tv_usec = 0;
+    in_batch->checksum = SIMPLE_CAP_CHECKSUM_ADLER32;
+
+    return 1;
+}
+
+void simple_cap_proto_batch_free(simple_cap_proto_batch_t *in_batch) {
+    if (in_batch->buf != NULL)
+        free(in_batch->buf);
+
+    in_batch->buf = NULL;
+    in_batch->len = 0;
+    in_batch->num_packets = 0;
+}
+
+int simple_cap_proto_batch_add(simple_cap_proto_batch_t *in_batch,
+        struct timeval *in_ts, uint32_t in_dlt, uint32_t in_flags,
+        int16_t in_signal, int16_t in_noise, uint32_t in_freq_khz,
+        uint32_t in_caplen, const uint8_t *in_data) {
+    simple_cap_proto_packet_h_t *ph;
+    size_t rec_len = sizeof(simple_cap_proto_packet_h_t) + in_caplen;
+
+    /* Sending the batch won't make room for this one */
+    if (rec_len > in_batch->max_len)
+        return -2;
+
+    if (in_batch->num_packets >= in_batch->max_packets ||
+            in_batch->len + rec_len > in_batch->max_len)
+        return -1;
+
+    if (in_batch->num_packets == 0)
+        gettimeofday(&(in_batch->first_ts), NULL);
+
+    ph = (simple_cap_proto_packet_h_t *) (in_batch->buf + in_batch->len);
+
+    ph->tv_sec = kis_hton64((uint64_t) in_ts->tv_sec);
+    ph->tv_usec = kis_hton32((uint32_t) in_ts->tv_usec);
+    ph->dlt = kis_hton32(in_dlt);
+    ph->flags = kis_hton32(in_flags);
+    ph->signal = (int16_t) kis_hton16((uint16_t) in_signal);
+    ph->noise = (int16_t) kis_hton16((uint16_t) in_noise);
+    ph->freq_khz = kis_hton32(in_freq_khz);
+    ph->caplen = kis_hton32(in_caplen);
+
+    memcpy(ph->data, in_data, in_caplen);
+
+    in_batch->len += rec_len;
+    in_batch->num_packets++;
+
+    return 1;
+}
+
+int simple_cap_proto_batch_due(simple_cap_proto_batch_t *in_batch,
+        struct timeval *in_now) {
+    long waited_usec;
+
+    if (in_batch->num_packets == 0)
+        return 0;
+
+    if (in_batch->num_packets >= in_batch->max_packets)
+        return 1;
+
+    waited_usec = (in_now->tv_sec - in_batch->first_ts.tv_sec) * 1000000L +
+        (in_now->tv_usec - in_batch->first_ts.tv_usec);
+
+    if (waited_usec >= (long) in_batch->max_latency_usec)
+        return 1;
+
+    return 0;
+}
+
+simple_cap_proto_t *simple_cap_proto_batch_encode(simple_cap_proto_batch_t *in_batch) {
+    simple_cap_proto_kv_t *kv;
+    simple_cap_proto_t *frame;
+
+    if (in_batch->num_packets == 0)
+        return NULL;
+
+    kv = encode_simple_cap_proto_kv("PACKETS", in_batch->buf, in_batch->len);
+
+    if (kv == NULL)
+        return NULL;
+
+    frame = encode_simple_cap_proto_checksum("PACKETS", &kv, 1, in_batch->checksum);
+
+    free(kv);
+
+    in_batch->len = 0;
+    in_batch->num_packets = 0;
+
+    return frame;
+}
+
 #if 0
 // Doesn't work with ubuntu msgpack 0.57 b/c it lacks strings, floats, etc.
 // Left for reference
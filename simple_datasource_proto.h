@@ -22,7 +22,9 @@
 #include "config.h"
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <time.h>
+#include <sys/time.h>
 
 /*
  * Simple capture protocol
@@ -45,6 +47,26 @@
  */
 
 #define KIS_CAP_SIMPLE_PROTO_SIG    0xDECAFBAD
+/* Same frame, checksummed with CRC32C instead of the original sum */
+#define KIS_CAP_SIMPLE_PROTO_SIG_CRC32C 0xDECAFBAC
+
+/* Checksums
+ *
+ * Every frame is checksummed with the checksum field set to zero.  The
+ * signature says which checksum a frame uses:  KIS_CAP_SIMPLE_PROTO_SIG
+ * frames use the original Adler-style sum (Adler32Checksum), which has to be
+ * computed a byte at a time, and KIS_CAP_SIMPLE_PROTO_SIG_CRC32C frames use
+ * CRC32C, which most CPUs compute in hardware.
+ *
+ * When the server can compute CRC32C in hardware it offers it in a CHECKSUM
+ * kv in the OPENDEVICE command, a msgpack array of the checksum names it
+ * accepts ("crc32c", "adler32").  A capture binary which supports it may then
+ * send CRC32C frames, and once the server has received one it checksums its
+ * own commands with CRC32C too.  Capture binaries which don't know about the
+ * CHECKSUM kv ignore it, and both sides keep using the original sum.
+ */
+#define SIMPLE_CAP_CHECKSUM_ADLER32     0
+#define SIMPLE_CAP_CHECKSUM_CRC32C      1
 
 /* Multiple key-value pairs can be nested inside a kismet proto packet. */
 
@@ -59,8 +81,8 @@ typedef struct simple_cap_proto_kv_h simple_cap_proto_kv_h_t;
 
 struct simple_cap_proto_kv {
     simple_cap_proto_kv_h_t header;
-    /* Packed binary representation of value */
-    uint8_t *object;
+    /* Packed binary representation of value, obj_sz bytes long */
+    uint8_t object[0];
 } __attribute__((packed));
 typedef struct simple_cap_proto_kv simple_cap_proto_kv_t;
 
@@ -68,7 +90,8 @@ typedef struct simple_cap_proto_kv simple_cap_proto_kv_t;
 struct simple_cap_proto {
     /* Fixed Start-of-packet signature */
     uint32_t signature;
-    /* Basic crc32 checksum of packet data, calculated with checksum set to zero */
+    /* Checksum of packet data, calculated with checksum set to zero; the
+     * signature selects the checksum */
     uint32_t checksum;
     /* Total size of packet including signature and checksum */
     uint32_t packet_sz;
@@ -76,18 +99,115 @@ struct simple_cap_proto {
     char type[16];
     /* Number of KV pairs */
     uint32_t num_kv_pairs;
-    /* List of kv pairs */
-    uint8_t *data;
+    /* List of kv pairs, packed back to back */
+    uint8_t data[0];
 } __attribute__((packed));
 typedef struct simple_cap_proto simple_cap_proto_t;
 
+/* Batched packets
+ *
+ * A PACKETS frame carries many captured packets at once, to save the framing,
+ * checksum, and msgpack overhead of a DATA frame per packet on busy channels.
+ * The frame holds a PACKETS kv whose object is a series of packet records
+ * packed back to back, each a fixed header followed by caplen bytes of packet
+ * data.  All header fields are network endian.  An optional GPS kv, identical
+ * to the one in a DATA frame, applies to every packet in the frame.
+ *
+ * The server passes a BATCH kv in the OPENDEVICE command, a msgpack dictionary
+ * with 'latency_ms', the longest a capture binary should hold a packet before
+ * sending the batch, 'max_packets', the most packets to put in one batch, and
+ * 'max_bytes', the most bytes of packet records to put in one batch.  The
+ * server can't read a frame larger than its IPC buffer, so max_bytes must be
+ * honored.  Capture binaries which don't support batching ignore it and send
+ * DATA frames.
+ */
+
+/* Packet record header has valid signal and noise in dBm */
+#define SIMPLE_CAP_PACKET_SIGNAL_DBM    (1 << 0)
+/* Packet record header has valid signal and noise in RSSI */
+#define SIMPLE_CAP_PACKET_SIGNAL_RSSI   (1 << 1)
+/* Packet record header has a valid frequency */
+#define SIMPLE_CAP_PACKET_FREQ          (1 << 2)
+
+struct simple_cap_proto_packet_h {
+    uint64_t tv_sec;
+    uint32_t tv_usec;
+    /* Link type of packet */
+    uint32_t dlt;
+    /* SIMPLE_CAP_PACKET_ flags */
+    uint32_t flags;
+    int16_t signal;
+    int16_t noise;
+    uint32_t freq_khz;
+    /* Length of packet data following the header */
+    uint32_t caplen;
+    uint8_t data[0];
+} __attribute__((packed));
+typedef struct simple_cap_proto_packet_h simple_cap_proto_packet_h_t;
+
+/* Batch of packets being assembled by a capture binary */
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t max_len;
+
+    unsigned int num_packets;
+    unsigned int max_packets;
+
+    /* When the first packet went into the batch */
+    struct timeval first_ts;
+    unsigned int max_latency_usec;
+
+    /* SIMPLE_CAP_CHECKSUM_ type to encode the batch with */
+    int checksum;
+} simple_cap_proto_batch_t;
+
 /* Encode a KV list */
 simple_cap_proto_t *encode_simple_cap_proto(char *in_type, 
         simple_cap_proto_kv_t **in_kv_list, unsigned int in_kv_len);
 
+/* Encode a KV list, checksummed with in_checksum (SIMPLE_CAP_CHECKSUM_) */
+simple_cap_proto_t *encode_simple_cap_proto_checksum(char *in_type, 
+        simple_cap_proto_kv_t **in_kv_list, unsigned int in_kv_len,
+        int in_checksum);
+
+/* Check the checksum of a complete received frame of in_sz bytes, whichever
+ * checksum it uses.  The checksum field is zeroed in the process.  Returns 1
+ * if the frame is valid */
+int simple_cap_proto_check(simple_cap_proto_t *in_frame, size_t in_sz);
+
 /* Encode data into a kb pair */
 simple_cap_proto_kv_t *encode_simple_cap_proto_kv(char *in_key, uint8_t *in_obj,
         unsigned int in_obj_len);
 
+/* Set up a packet batch holding up to in_max_len bytes of records and
+ * in_max_packets packets, to be sent at most in_max_latency_usec after the
+ * first packet is added.  Batches use the original checksum until the
+ * checksum field is changed.  Returns -1 on allocation failure */
+int simple_cap_proto_batch_init(simple_cap_proto_batch_t *in_batch, 
+        size_t in_max_len, unsigned int in_max_packets, 
+        unsigned int in_max_latency_usec);
+
+/* Free the buffer of a packet batch */
+void simple_cap_proto_batch_free(simple_cap_proto_batch_t *in_batch);
+
+/* Add a packet to a batch.  Returns -1 if the batch is full, in which case it
+ * should be encoded and sent and the packet added again, and -2 if the packet
+ * is too large for any batch, in which case it should be sent on its own in a
+ * DATA frame */
+int simple_cap_proto_batch_add(simple_cap_proto_batch_t *in_batch,
+        struct timeval *in_ts, uint32_t in_dlt, uint32_t in_flags,
+        int16_t in_signal, int16_t in_noise, uint32_t in_freq_khz,
+        uint32_t in_caplen, const uint8_t *in_data);
+
+/* Is the batch due to be sent, because it is full or the first packet in it
+ * has waited out the latency window?  Returns 1 if it is */
+int simple_cap_proto_batch_due(simple_cap_proto_batch_t *in_batch,
+        struct timeval *in_now);
+
+/* Encode a batch into a PACKETS frame and empty it.  Returns NULL if the
+ * batch is empty or on allocation failure */
+simple_cap_proto_t *simple_cap_proto_batch_encode(simple_cap_proto_batch_t *in_batch);
+
 #endif
 
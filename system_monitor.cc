@@ -19,6 +19,8 @@
 #include "config.h"
 #include "battery.h"
 #include "entrytracker.h"
+#include "packetchain.h"
+#include "devicetracker.h"
 #include "system_monitor.h"
 #include "msgpack_adapter.h"
 #include "json_adapter.h"
@@ -52,6 +54,85 @@ void Systemmonitor::register_fields() {
     battery_remaining_id =
         RegisterField("kismet.system.battery.remaining", TrackerUInt32,
                 "battery remaining in seconds", (void **) &battery_remaining);
+
+    packet_threads_id =
+        RegisterField("kismet.system.packetchain.threads", TrackerUInt32,
+                "packet dissector threads (0 if inline)", 
+                (void **) &packet_threads);
+    packet_queue_max_id =
+        RegisterField("kismet.system.packetchain.queue_max", TrackerUInt32,
+                "maximum packets in flight in the packet chain", 
+                (void **) &packet_queue_max);
+    packet_dissect_queue_id =
+        RegisterField("kismet.system.packetchain.dissect_queue", TrackerUInt32,
+                "packets waiting for a dissector thread", 
+                (void **) &packet_dissect_queue);
+    packet_tracker_queue_id =
+        RegisterField("kismet.system.packetchain.tracker_queue", TrackerUInt32,
+                "packets waiting for the tracker stages", 
+                (void **) &packet_tracker_queue);
+    packet_dissect_drops_id =
+        RegisterField("kismet.system.packetchain.dissect_drops", TrackerUInt64,
+                "packets dropped while the dissector threads were backed up", 
+                (void **) &packet_dissect_drops);
+    packet_tracker_drops_id =
+        RegisterField("kismet.system.packetchain.tracker_drops", TrackerUInt64,
+                "packets dropped while the tracker stages were backed up", 
+                (void **) &packet_tracker_drops);
+    packet_processed_id =
+        RegisterField("kismet.system.packetchain.processed", TrackerUInt64,
+                "packets processed by the packet chain", 
+                (void **) &packet_processed);
+
+    devicelist_snapshots_id =
+        RegisterField("kismet.system.devicelist.snapshots", TrackerUInt64,
+                "device list snapshots built for readers", 
+                (void **) &devicelist_snapshots);
+    devicelist_reader_hold_id =
+        RegisterField("kismet.system.devicelist.reader_hold_usec", TrackerUInt64,
+                "total time readers held the device list lock (usec)", 
+                (void **) &devicelist_reader_hold);
+    devicelist_reader_hold_max_id =
+        RegisterField("kismet.system.devicelist.reader_hold_max_usec", TrackerUInt64,
+                "longest time a reader held the device list lock (usec)", 
+                (void **) &devicelist_reader_hold_max);
+    devicelist_writer_wait_id =
+        RegisterField("kismet.system.devicelist.writer_wait_usec", TrackerUInt64,
+                "total time the packet path waited for the device list lock (usec)", 
+                (void **) &devicelist_writer_wait);
+    devicelist_writer_wait_max_id =
+        RegisterField("kismet.system.devicelist.writer_wait_max_usec", TrackerUInt64,
+                "longest time the packet path waited for the device list lock (usec)", 
+                (void **) &devicelist_writer_wait_max);
+
+    serialcache_hits_id =
+        RegisterField("kismet.system.serialcache.hits", TrackerUInt64,
+                "device records copied from the serialization cache", 
+                (void **) &serialcache_hits);
+    serialcache_misses_id =
+        RegisterField("kismet.system.serialcache.misses", TrackerUInt64,
+                "device records serialized because they weren't cached", 
+                (void **) &serialcache_misses);
+    serialcache_hit_rate_id =
+        RegisterField("kismet.system.serialcache.hit_rate", TrackerDouble,
+                "percentage of device records served from the serialization cache", 
+                (void **) &serialcache_hit_rate);
+    serialcache_evictions_id =
+        RegisterField("kismet.system.serialcache.evictions", TrackerUInt64,
+                "records dropped from the serialization cache to make room", 
+                (void **) &serialcache_evictions);
+    serialcache_entries_id =
+        RegisterField("kismet.system.serialcache.entries", TrackerUInt64,
+                "records in the serialization cache", 
+                (void **) &serialcache_entries);
+    serialcache_bytes_id =
+        RegisterField("kismet.system.serialcache.bytes", TrackerUInt64,
+                "memory used by the serialization cache", 
+                (void **) &serialcache_bytes);
+    serialcache_max_bytes_id =
+        RegisterField("kismet.system.serialcache.max_bytes", TrackerUInt64,
+                "maximum memory for the serialization cache (0 if disabled)", 
+                (void **) &serialcache_max_bytes);
 }
 
 void Systemmonitor::pre_serialize() {
@@ -69,6 +150,41 @@ void Systemmonitor::pre_serialize() {
 
     set_battery_ac(batinfo.ac);
     set_battery_remaining(batinfo.remaining_sec);
+
+    Packetchain::pc_stats pcstats;
+    globalreg->packetchain->FetchStats(&pcstats);
+
+    set_packet_threads(pcstats.dissect_threads);
+    set_packet_queue_max(pcstats.queue_max);
+    set_packet_dissect_queue(pcstats.dissect_queue);
+    set_packet_tracker_queue(pcstats.tracker_queue);
+    set_packet_dissect_drops(pcstats.dissect_drops);
+    set_packet_tracker_drops(pcstats.tracker_drops);
+    set_packet_processed(pcstats.processed);
+
+    Devicetracker::devicelist_lock_stats dlstats;
+    globalreg->devicetracker->FetchLockStats(&dlstats);
+
+    set_devicelist_snapshots(dlstats.snapshots);
+    set_devicelist_reader_hold(dlstats.reader_hold_usec);
+    set_devicelist_reader_hold_max(dlstats.reader_hold_max_usec);
+    set_devicelist_writer_wait(dlstats.writer_wait_usec);
+    set_devicelist_writer_wait_max(dlstats.writer_wait_max_usec);
+
+    SerializeCache::cache_stats scstats;
+    globalreg->devicetracker->FetchSerializeCacheStats(&scstats);
+
+    set_serialcache_hits(scstats.hits);
+    set_serialcache_misses(scstats.misses);
+    if (scstats.hits + scstats.misses > 0)
+        set_serialcache_hit_rate((double) scstats.hits * 100 / 
+                (scstats.hits + scstats.misses));
+    else
+        set_serialcache_hit_rate(0);
+    set_serialcache_evictions(scstats.evictions);
+    set_serialcache_entries(scstats.entries);
+    set_serialcache_bytes(scstats.bytes);
+    set_serialcache_max_bytes(scstats.max_bytes);
 }
 
 bool Systemmonitor::Httpd_VerifyPath(const char *path, const char *method) {
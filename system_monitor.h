@@ -43,6 +43,37 @@ public:
     __Proxy(battery_ac, uint8_t, bool, bool, battery_ac);
     __Proxy(battery_remaining, uint32_t, uint32_t, uint32_t, battery_remaining);
 
+    __Proxy(packet_threads, uint32_t, uint32_t, uint32_t, packet_threads);
+    __Proxy(packet_queue_max, uint32_t, uint32_t, uint32_t, packet_queue_max);
+    __Proxy(packet_dissect_queue, uint32_t, uint32_t, uint32_t, packet_dissect_queue);
+    __Proxy(packet_tracker_queue, uint32_t, uint32_t, uint32_t, packet_tracker_queue);
+    __Proxy(packet_dissect_drops, uint64_t, uint64_t, uint64_t, packet_dissect_drops);
+    __Proxy(packet_tracker_drops, uint64_t, uint64_t, uint64_t, packet_tracker_drops);
+    __Proxy(packet_processed, uint64_t, uint64_t, uint64_t, packet_processed);
+
+    __Proxy(devicelist_snapshots, uint64_t, uint64_t, uint64_t, 
+            devicelist_snapshots);
+    __Proxy(devicelist_reader_hold, uint64_t, uint64_t, uint64_t, 
+            devicelist_reader_hold);
+    __Proxy(devicelist_reader_hold_max, uint64_t, uint64_t, uint64_t, 
+            devicelist_reader_hold_max);
+    __Proxy(devicelist_writer_wait, uint64_t, uint64_t, uint64_t, 
+            devicelist_writer_wait);
+    __Proxy(devicelist_writer_wait_max, uint64_t, uint64_t, uint64_t, 
+            devicelist_writer_wait_max);
+
+    __Proxy(serialcache_hits, uint64_t, uint64_t, uint64_t, serialcache_hits);
+    __Proxy(serialcache_misses, uint64_t, uint64_t, uint64_t, 
+            serialcache_misses);
+    __Proxy(serialcache_hit_rate, double, double, double, serialcache_hit_rate);
+    __Proxy(serialcache_evictions, uint64_t, uint64_t, uint64_t, 
+            serialcache_evictions);
+    __Proxy(serialcache_entries, uint64_t, uint64_t, uint64_t, 
+            serialcache_entries);
+    __Proxy(serialcache_bytes, uint64_t, uint64_t, uint64_t, serialcache_bytes);
+    __Proxy(serialcache_max_bytes, uint64_t, uint64_t, uint64_t, 
+            serialcache_max_bytes);
+
     virtual void pre_serialize();
 
 protected:
@@ -60,6 +91,63 @@ protected:
     int battery_remaining_id;
     TrackerElement *battery_remaining;
 
+    int packet_threads_id;
+    TrackerElement *packet_threads;
+
+    int packet_queue_max_id;
+    TrackerElement *packet_queue_max;
+
+    int packet_dissect_queue_id;
+    TrackerElement *packet_dissect_queue;
+
+    int packet_tracker_queue_id;
+    TrackerElement *packet_tracker_queue;
+
+    int packet_dissect_drops_id;
+    TrackerElement *packet_dissect_drops;
+
+    int packet_tracker_drops_id;
+    TrackerElement *packet_tracker_drops;
+
+    int packet_processed_id;
+    TrackerElement *packet_processed;
+
+    int devicelist_snapshots_id;
+    TrackerElement *devicelist_snapshots;
+
+    int devicelist_reader_hold_id;
+    TrackerElement *devicelist_reader_hold;
+
+    int devicelist_reader_hold_max_id;
+    TrackerElement *devicelist_reader_hold_max;
+
+    int devicelist_writer_wait_id;
+    TrackerElement *devicelist_writer_wait;
+
+    int devicelist_writer_wait_max_id;
+    TrackerElement *devicelist_writer_wait_max;
+
+    int serialcache_hits_id;
+    TrackerElement *serialcache_hits;
+
+    int serialcache_misses_id;
+    TrackerElement *serialcache_misses;
+
+    int serialcache_hit_rate_id;
+    TrackerElement *serialcache_hit_rate;
+
+    int serialcache_evictions_id;
+    TrackerElement *serialcache_evictions;
+
+    int serialcache_entries_id;
+    TrackerElement *serialcache_entries;
+
+    int serialcache_bytes_id;
+    TrackerElement *serialcache_bytes;
+
+    int serialcache_max_bytes_id;
+    TrackerElement *serialcache_max_bytes;
+
 };
 
 #endif
@@ -32,11 +32,12 @@
 TcpClientV2::TcpClientV2(GlobalRegistry *in_globalreg, 
         RingbufferHandler *in_rbhandler) {
     globalreg = in_globalreg;
-    handler = in_rbhandler;
 
     cli_fd = -1;
     connected = false;
     pending_connect = false;
+
+    HandleWriteBuffer(in_rbhandler);
 }
 
 TcpClientV2::~TcpClientV2() {
@@ -129,48 +130,34 @@ int TcpClientV2::Connect(string in_host, unsigned int in_port) {
     host = in_host;
     port = in_port;
 
-    globalreg->RegisterPollableSubsys(this);
+    // A pending connect completes when the socket becomes writeable
+    if (pending_connect)
+        globalreg->reactor->AddFd(cli_fd, REACTOR_WRITE, this);
+    else
+        globalreg->reactor->AddFd(cli_fd, REACTOR_READ | 
+                (handler->GetWriteBufferUsed() ? REACTOR_WRITE : 0), this);
 
     return 0;
 }
 
-int TcpClientV2::MergeSet(int in_max_fd, fd_set *out_rset, fd_set *out_wset) {
-    // All we fill in is the descriptor for writing if we're still trying to
-    // connect
-    if (pending_connect) {
-        FD_SET(cli_fd, out_wset);
-        if (in_max_fd < cli_fd)
-            return cli_fd;
-        return in_max_fd;
-    }
-
-    if (!connected)
-        return in_max_fd;
-
-    // If we have data waiting to be written, fill it in
-    if (handler->GetWriteBufferUsed()) {
-        FD_SET(cli_fd, out_wset);
-    }
-
-    // We always want to read data
-    FD_SET(cli_fd, out_rset);
-
-    if (in_max_fd < cli_fd)
-        return cli_fd;
+void TcpClientV2::BufferAvailable(size_t in_amt) {
+    if (in_amt == 0 || !connected || globalreg->reactor == NULL)
+        return;
 
-    return in_max_fd;
+    // May be called from any thread; the reactor delivers the write event
+    // in the main loop
+    globalreg->reactor->ModifyFd(cli_fd, REACTOR_READ | REACTOR_WRITE);
 }
 
-int TcpClientV2::Poll(fd_set& in_rset, fd_set& in_wset) {
+void TcpClientV2::ReactorEvent(int in_fd, unsigned int in_events) {
     stringstream msg;
 
-    uint8_t *buf;
-    size_t len;
-    ssize_t ret, iret;
+    if (in_fd != cli_fd)
+        return;
 
     if (pending_connect) {
         // See if connect has completed
-        if (FD_ISSET(cli_fd, &in_wset)) {
+        if (in_events & (REACTOR_WRITE | REACTOR_ERROR)) {
             int r, e;
             socklen_t l;
 
@@ -180,105 +167,143 @@ int TcpClientV2::Poll(fd_set& in_rset, fd_set& in_wset) {
             r = getsockopt(cli_fd, SOL_SOCKET, SO_ERROR, &e, &l);
 
             if (r < 0 || e != 0) {
-                errstr = strerror_r(errno, strerrbuf, 1024);
+                errstr = strerror_r(r < 0 ? errno : e, strerrbuf, 1024);
                 msg << "TCP client could not connect to " << host << ":" << port <<
                     " - " << errstr;
                 _MSG(msg.str(), MSGFLAG_ERROR);
 
                 handler->BufferError(msg.str());
 
-                close(cli_fd);
-                connected = false;
-                pending_connect = false;
-                return 0;
-            } else {
-                connected = true;
-                pending_connect = false;
-            }
+                Disconnect();
+                return;
+            } 
 
-            return 0;
+            connected = true;
+            pending_connect = false;
+
+            globalreg->reactor->ModifyFd(cli_fd, REACTOR_READ | REACTOR_WRITE);
         }
 
         // Nothing else to do if we haven't finished connecting
-        return 0;
+        return;
     }
 
     if (!connected)
-        return 0;
+        return;
 
-    if (FD_ISSET(cli_fd, &in_rset)) {
-        // Allocate the biggest buffer we can fit in the ring, read as much
-        // as we can at once.
-        
-        len = handler->GetReadBufferFree();
-        buf = new uint8_t[len];
+    if (in_events & REACTOR_READ)
+        ReadSocket();
+
+    if (connected && (in_events & REACTOR_WRITE))
+        WriteSocket();
+}
+
+void TcpClientV2::ReadSocket() {
+    stringstream msg;
+
+    uint8_t *buf;
+    size_t len;
+    ssize_t ret;
+
+    while (connected) {
+        // Read as much as we can straight into the free space of the ring
+        len = handler->ReserveReadBufferData((void **) &buf, 
+                handler->GetReadBufferFree());
+
+        if (len == 0) {
+            // Nothing to do until the buffer has been drained
+            return;
+        }
 
         if ((ret = read(cli_fd, buf, len)) < 0) {
-            if (errno != EINTR && errno != EAGAIN) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN) {
                 // Push the error upstream if we failed to read here
                 errstr = strerror_r(errno, strerrbuf, 1024);
                 msg << "TCP client error reading from " << host << ":" << port << 
                     " - " << errstr;
                 handler->BufferError(msg.str());
-                delete[] buf;
                 Disconnect();
-                return 0;
             }
-        } else {
-            // Insert into buffer
-            iret = handler->PutReadBufferData(buf, ret, true);
 
-            if (iret != ret) {
-                // Die if we couldn't insert all our data, the error is already going
-                // upstream.
-                delete[] buf;
-                Disconnect();
-                return 0;
-            }
+            return;
         }
 
-        delete[] buf;
+        // Publish what we read
+        handler->CommitReadBufferData(ret);
+
+        // The remote end closed the connection
+        if (ret == 0)
+            return;
     }
+}
 
-    if (FD_ISSET(cli_fd, &in_wset)) {
+void TcpClientV2::WriteSocket() {
+    stringstream msg;
+
+    uint8_t *buf;
+    size_t len;
+    ssize_t iret;
+
+    while (connected) {
         len = handler->GetWriteBufferUsed();
+
+        if (len == 0) {
+            // Stop asking for writeability, then make sure nothing was queued
+            // while we did
+            globalreg->reactor->ModifyFd(cli_fd, REACTOR_READ);
+
+            if (handler->GetWriteBufferUsed() == 0)
+                return;
+
+            globalreg->reactor->ModifyFd(cli_fd, REACTOR_READ | REACTOR_WRITE);
+            continue;
+        }
+
         buf = new uint8_t[len];
 
         // Peek the data into our buffer
-        ret = handler->PeekWriteBufferData(buf, len);
+        len = handler->PeekWriteBufferData(buf, len);
 
         if ((iret = write(cli_fd, buf, len)) < 0) {
-            if (errno != EINTR && errno != EAGAIN) {
+            delete[] buf;
+
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN) {
                 // Push the error upstream
                 errstr = strerror_r(errno, strerrbuf, 1024);
                 msg << "TCP client error writing to " << host << ":" << port << 
                     " - " << errstr;
                 handler->BufferError(msg.str());
-                delete[] buf;
                 Disconnect();
-                return 0;
             }
-        } else {
-            // Consume whatever we managed to write
-            handler->GetWriteBufferData(NULL, iret);
+
+            // Wait for the reactor to tell us the socket has room
+            return;
         }
 
         delete[] buf;
-    }
 
-    return 0;
+        // Consume whatever we managed to write
+        handler->GetWriteBufferData(NULL, iret);
+    }
 }
 
 void TcpClientV2::Disconnect() {
     if (pending_connect || connected) {
+        if (globalreg->reactor != NULL)
+            globalreg->reactor->RemoveFd(cli_fd);
+
         close(cli_fd);
     }
 
     cli_fd = -1;
     pending_connect = false;
     connected = false;
-
-    globalreg->RemovePollableSubsys(this);
 }
 
 bool TcpClientV2::FetchConnected() {
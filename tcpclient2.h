@@ -28,17 +28,17 @@
 #include "messagebus.h"
 #include "globalregistry.h"
 #include "ringbuf_handler.h"
-#include "pollable.h"
+#include "kis_reactor.h"
 
 // New TCP client code.
 //
 // This code replaces tcpclient and clinetframework with a cleaner TCP implementation
 // which interacts with a ringbufferhandler
 //
-// We don't have to implement a ringbuffer interface directly, because we check the
-// write buffer during the poll() sequence.  The consumer will use the ringbuffer
-// interface for reading data coming in from the client.
-class TcpClientV2 : public Pollable {
+// The socket is registered with the main loop reactor.  We register as the write
+// buffer interface only to find out when there is data to send; the consumer will
+// use the ringbuffer interface for reading data coming in from the client.
+class TcpClientV2 : public ReactorEventHandler, public RingbufferInterface {
 public:
     TcpClientV2(GlobalRegistry *in_globalreg, RingbufferHandler *in_rbhandler);
     virtual ~TcpClientV2();
@@ -49,13 +49,19 @@ public:
 
     bool FetchConnected();
 
-    // Pollable interface
-    virtual int MergeSet(int in_max_fd, fd_set *out_rset, fd_set *out_wset);
-    virtual int Poll(fd_set& in_rset, fd_set& in_wset);
+    // Reactor interface
+    virtual void ReactorEvent(int in_fd, unsigned int in_events);
+
+    // Ringbuffer interface, called when the write buffer gets data
+    virtual void BufferAvailable(size_t in_amt);
 
 protected:
     GlobalRegistry *globalreg;
-    RingbufferHandler *handler;
+
+    // Read until the socket is empty or the read buffer is full
+    void ReadSocket();
+    // Write until the write buffer is empty or the socket is full
+    void WriteSocket();
 
     bool pending_connect;
     bool connected;
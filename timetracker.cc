@@ -20,7 +20,9 @@
 
 #include <sys/time.h>
 
+#include "util.h"
 #include "timetracker.h"
+#include "kis_reactor.h"
 
 Timetracker::Timetracker() {
     fprintf(stderr, "Timetracker::Timetracker() called with no globalreg\n");
@@ -30,35 +32,151 @@ Timetracker::Timetracker(GlobalRegistry *in_globalreg) {
     globalreg = in_globalreg;
     next_timer_id = 0;
 
+    firing_evt = NULL;
+    firing_removed = false;
+
+    pthread_mutex_init(&time_mutex, NULL);
+
 	globalreg->start_time = time(0);
 	gettimeofday(&(globalreg->timestamp), NULL);
 }
 
 Timetracker::~Timetracker() {
-    // Free the events
-    for (map<int, timer_event *>::iterator x = timer_map.begin();
-         x != timer_map.end(); ++x)
-        delete x->second;
+    {
+        local_locker lock(&time_mutex);
+
+        // Free the events
+        for (map<int, timer_event *>::iterator x = timer_map.begin();
+             x != timer_map.end(); ++x)
+            delete x->second;
+
+        timer_map.clear();
+        timer_heap.clear();
+    }
+
+    pthread_mutex_destroy(&time_mutex);
+}
+
+void Timetracker::heap_swap(size_t a, size_t b) {
+    timer_event *t = timer_heap[a];
+    timer_heap[a] = timer_heap[b];
+    timer_heap[b] = t;
+
+    timer_heap[a]->heap_pos = a;
+    timer_heap[b]->heap_pos = b;
+}
+
+void Timetracker::heap_sift_up(size_t pos) {
+    while (pos > 0) {
+        size_t parent = (pos - 1) / 2;
+
+        if (!trigger_before(timer_heap[pos], timer_heap[parent]))
+            break;
+
+        heap_swap(pos, parent);
+        pos = parent;
+    }
+}
+
+void Timetracker::heap_sift_down(size_t pos) {
+    size_t sz = timer_heap.size();
+
+    while (1) {
+        size_t l = (pos * 2) + 1;
+        size_t r = l + 1;
+        size_t min = pos;
+
+        if (l < sz && trigger_before(timer_heap[l], timer_heap[min]))
+            min = l;
+
+        if (r < sz && trigger_before(timer_heap[r], timer_heap[min]))
+            min = r;
+
+        if (min == pos)
+            break;
+
+        heap_swap(pos, min);
+        pos = min;
+    }
+}
+
+void Timetracker::heap_push(timer_event *in_evt) {
+    in_evt->heap_pos = timer_heap.size();
+    timer_heap.push_back(in_evt);
+    heap_sift_up(in_evt->heap_pos);
+}
+
+void Timetracker::heap_remove(timer_event *in_evt) {
+    if (in_evt->heap_pos < 0)
+        return;
+
+    size_t pos = in_evt->heap_pos;
+    size_t last = timer_heap.size() - 1;
+
+    if (pos != last) {
+        heap_swap(pos, last);
+        timer_heap.pop_back();
+
+        // The event moved into the hole may belong above or below it
+        timer_event *moved = timer_heap[pos];
+        heap_sift_up(pos);
+        heap_sift_down(moved->heap_pos);
+    } else {
+        timer_heap.pop_back();
+    }
+
+    in_evt->heap_pos = -1;
+}
+
+void Timetracker::Rearm() {
+    if (globalreg->reactor != NULL)
+        globalreg->reactor->TimersChanged();
+}
+
+bool Timetracker::FetchNextTrigger(struct timeval *ret_tm) {
+    local_locker lock(&time_mutex);
+
+    if (timer_heap.size() == 0)
+        return false;
+
+    *ret_tm = timer_heap[0]->trigger_tm;
+
+    return true;
 }
 
 int Timetracker::Tick() {
     // Handle scheduled events
     struct timeval cur_tm;
     gettimeofday(&cur_tm, NULL);
-	globalreg->timestamp.tv_sec = cur_tm.tv_sec;
-	globalreg->timestamp.tv_usec = cur_tm.tv_usec;
+
+    // Timers always run on the wall clock, but an offline replay owns the
+    // server time
+    if (!globalreg->packet_clock) {
+        globalreg->timestamp.tv_sec = cur_tm.tv_sec;
+        globalreg->timestamp.tv_usec = cur_tm.tv_usec;
+    }
     timer_event *evt;
 
-    for (unsigned int x = 0; x < sorted_timers.size(); x++) {
-        evt = sorted_timers[x];
+    pthread_mutex_lock(&time_mutex);
+
+    while (timer_heap.size() > 0) {
+        evt = timer_heap[0];
 
         if ((cur_tm.tv_sec < evt->trigger_tm.tv_sec) ||
             ((cur_tm.tv_sec == evt->trigger_tm.tv_sec) && 
 			 (cur_tm.tv_usec < evt->trigger_tm.tv_usec))) {
-            return 1;
+            break;
 		}
 
-        // Call the function with the given parameters
+        heap_remove(evt);
+
+        firing_evt = evt;
+        firing_removed = false;
+
+        // Call the function with the given parameters; timers may be 
+        // registered or removed from inside the callback
+        pthread_mutex_unlock(&time_mutex);
+
         int ret;
         if (evt->callback != NULL) {
             ret = (*evt->callback)(evt, evt->callback_parm, globalreg);
@@ -66,107 +184,124 @@ int Timetracker::Tick() {
             ret = evt->event->timetracker_event(evt->timer_id);
         }
 
-        if (ret > 0 && evt->timeslices != -1 && evt->recurring) {
+        pthread_mutex_lock(&time_mutex);
+
+        firing_evt = NULL;
+
+        if (!firing_removed && ret > 0 && evt->timeslices != -1 && evt->recurring) {
+            // A recurring timer with no interval would be due again 
+            // immediately and we'd never leave this loop, so it waits at
+            // least one slice
+            int slices = evt->timeslices > 0 ? evt->timeslices : 1;
+
             evt->schedule_tm.tv_sec = cur_tm.tv_sec;
             evt->schedule_tm.tv_usec = cur_tm.tv_usec;
-            evt->trigger_tm.tv_sec = evt->schedule_tm.tv_sec + (evt->timeslices / 10);
+            evt->trigger_tm.tv_sec = evt->schedule_tm.tv_sec + (slices / 10);
             evt->trigger_tm.tv_usec = evt->schedule_tm.tv_usec + 
-				(100000 * (evt->timeslices % 10));
+				(100000 * (slices % 10));
 
             if (evt->trigger_tm.tv_usec > 999999) {
                 evt->trigger_tm.tv_usec = evt->trigger_tm.tv_usec - 1000000;
                 evt->trigger_tm.tv_sec++;
             }
 
-            // Resort the list
-            stable_sort(sorted_timers.begin(), sorted_timers.end(), 
-						SortTimerEventsTrigger());
+            heap_push(evt);
         } else {
-            RemoveTimer(evt->timer_id);
+            timer_map.erase(evt->timer_id);
+            delete evt;
         }
-
     }
 
+    pthread_mutex_unlock(&time_mutex);
+
+    Rearm();
+
     return 1;
 }
 
-int Timetracker::RegisterTimer(int in_timeslices, struct timeval *in_trigger,
-                               int in_recurring, 
-                               int (*in_callback)(TIMEEVENT_PARMS),
-                               void *in_parm) {
-    timer_event *evt = new timer_event;
+int Timetracker::RegisterTimerEvent(timer_event *in_evt, int in_timeslices, 
+        struct timeval *in_trigger) {
+    bool first;
 
-    evt->timer_id = next_timer_id++;
-    gettimeofday(&(evt->schedule_tm), NULL);
+    gettimeofday(&(in_evt->schedule_tm), NULL);
 
     if (in_trigger != NULL) {
-        evt->trigger_tm.tv_sec = in_trigger->tv_sec;
-        evt->trigger_tm.tv_usec = in_trigger->tv_usec;
-        evt->timeslices = -1;
+        in_evt->trigger_tm.tv_sec = in_trigger->tv_sec;
+        in_evt->trigger_tm.tv_usec = in_trigger->tv_usec;
+        in_evt->timeslices = -1;
     } else {
-        evt->trigger_tm.tv_sec = evt->schedule_tm.tv_sec + (in_timeslices / 10);
-        evt->trigger_tm.tv_usec = evt->schedule_tm.tv_usec + (in_timeslices % 10);
-        evt->timeslices = in_timeslices;
+        in_evt->trigger_tm.tv_sec = in_evt->schedule_tm.tv_sec + (in_timeslices / 10);
+        in_evt->trigger_tm.tv_usec = in_evt->schedule_tm.tv_usec + 
+            (100000 * (in_timeslices % 10));
+        in_evt->timeslices = in_timeslices;
+
+        if (in_evt->trigger_tm.tv_usec > 999999) {
+            in_evt->trigger_tm.tv_usec = in_evt->trigger_tm.tv_usec - 1000000;
+            in_evt->trigger_tm.tv_sec++;
+        }
+    }
+
+    {
+        local_locker lock(&time_mutex);
+
+        in_evt->timer_id = next_timer_id++;
+
+        timer_map[in_evt->timer_id] = in_evt;
+        heap_push(in_evt);
+
+        first = (in_evt->heap_pos == 0);
     }
 
+    // Wake the main loop earlier if we're now the next timer due
+    if (first)
+        Rearm();
+
+    return in_evt->timer_id;
+}
+
+int Timetracker::RegisterTimer(int in_timeslices, struct timeval *in_trigger,
+                               int in_recurring, 
+                               int (*in_callback)(TIMEEVENT_PARMS),
+                               void *in_parm) {
+    timer_event *evt = new timer_event;
+
     evt->recurring = in_recurring;
     evt->callback = in_callback;
     evt->callback_parm = in_parm;
     evt->event = NULL;
+    evt->heap_pos = -1;
 
-    timer_map[evt->timer_id] = evt;
-    sorted_timers.push_back(evt);
-
-    // Resort the list
-    stable_sort(sorted_timers.begin(), sorted_timers.end(), SortTimerEventsTrigger());
-
-    return evt->timer_id;
+    return RegisterTimerEvent(evt, in_timeslices, in_trigger);
 }
 
 int Timetracker::RegisterTimer(int in_timeslices, struct timeval *in_trigger,
         int in_recurring, TimetrackerEvent *in_event) {
     timer_event *evt = new timer_event;
 
-    evt->timer_id = next_timer_id++;
-    gettimeofday(&(evt->schedule_tm), NULL);
-
-    if (in_trigger != NULL) {
-        evt->trigger_tm.tv_sec = in_trigger->tv_sec;
-        evt->trigger_tm.tv_usec = in_trigger->tv_usec;
-        evt->timeslices = -1;
-    } else {
-        evt->trigger_tm.tv_sec = evt->schedule_tm.tv_sec + (in_timeslices / 10);
-        evt->trigger_tm.tv_usec = evt->schedule_tm.tv_usec + (in_timeslices % 10);
-        evt->timeslices = in_timeslices;
-    }
-
     evt->recurring = in_recurring;
     evt->callback = NULL;
     evt->callback_parm = NULL;
     evt->event = in_event;
+    evt->heap_pos = -1;
 
-    timer_map[evt->timer_id] = evt;
-    sorted_timers.push_back(evt);
-
-    // Resort the list
-    stable_sort(sorted_timers.begin(), sorted_timers.end(), SortTimerEventsTrigger());
-
-    return evt->timer_id;
+    return RegisterTimerEvent(evt, in_timeslices, in_trigger);
 }
 
 int Timetracker::RemoveTimer(int in_timerid) {
+    local_locker lock(&time_mutex);
+
     map<int, timer_event *>::iterator itr;
 
     itr = timer_map.find(in_timerid);
 
     if (itr != timer_map.end()) {
-        for (unsigned int x = 0; x < sorted_timers.size(); x++) {
-            if (sorted_timers[x]->timer_id == in_timerid)
-                sorted_timers.erase(sorted_timers.begin() + x);
+        // A timer removed from its own callback is cleaned up by Tick
+        if (itr->second == firing_evt) {
+            firing_removed = true;
+            return 1;
         }
 
-        // Resort the list
-        stable_sort(sorted_timers.begin(), sorted_timers.end(), SortTimerEventsTrigger());
+        heap_remove(itr->second);
 
         delete itr->second;
         timer_map.erase(itr);
@@ -28,6 +28,7 @@
 #include <vector>
 #include <algorithm>
 #include <string>
+#include <pthread.h>
 
 #include "globalregistry.h"
 
@@ -60,20 +61,9 @@ public:
         // C function, if we weren't
         int (*callback)(timer_event *, void *, GlobalRegistry *);
         void *callback_parm;
-    };
 
-    // Sort alerts by alert trigger time
-    class SortTimerEventsTrigger {
-    public:
-        inline bool operator() (const Timetracker::timer_event *x, 
-								const Timetracker::timer_event *y) const {
-            if ((x->trigger_tm.tv_sec < y->trigger_tm.tv_sec) ||
-                ((x->trigger_tm.tv_sec == y->trigger_tm.tv_sec) && 
-				 (x->trigger_tm.tv_usec < y->trigger_tm.tv_usec)))
-                return 1;
-
-            return 0;
-        }
+        // Position in the timer heap, -1 when not scheduled
+        int heap_pos;
     };
 
     Timetracker();
@@ -83,6 +73,10 @@ public:
     // Tick and handle timers
     int Tick();
 
+    // Get the trigger time of the next timer; returns false if there are no
+    // timers scheduled.  The main loop sleeps until then.
+    bool FetchNextTrigger(struct timeval *ret_tm);
+
     // Register an optionally recurring timer.  Slices are 1/100th of a second,
     // the smallest linux can slice without getting into weird calls.
     int RegisterTimer(int in_timeslices, struct timeval *in_trigger,
@@ -99,9 +93,39 @@ public:
 protected:
     GlobalRegistry *globalreg;
 
+    // Timers may be registered and removed from any thread; the lock is
+    // released while timer callbacks run
+    pthread_mutex_t time_mutex;
+
     int next_timer_id;
     map<int, timer_event *> timer_map;
-    vector<timer_event *> sorted_timers;
+
+    // Binary min-heap of scheduled timers, ordered by trigger time.  Each
+    // timer knows its own position so it can be removed in O(log n).
+    vector<timer_event *> timer_heap;
+
+    // Timer whose callback is running, and whether it was removed from 
+    // inside the callback
+    timer_event *firing_evt;
+    bool firing_removed;
+
+    int RegisterTimerEvent(timer_event *in_evt, int in_timeslices,
+            struct timeval *in_trigger);
+
+    static bool trigger_before(const timer_event *x, const timer_event *y) {
+        return (x->trigger_tm.tv_sec < y->trigger_tm.tv_sec) ||
+            ((x->trigger_tm.tv_sec == y->trigger_tm.tv_sec) && 
+             (x->trigger_tm.tv_usec < y->trigger_tm.tv_usec));
+    }
+
+    void heap_push(timer_event *in_evt);
+    void heap_remove(timer_event *in_evt);
+    void heap_swap(size_t a, size_t b);
+    void heap_sift_up(size_t pos);
+    void heap_sift_down(size_t pos);
+
+    // Tell the main loop when the next timer is due
+    void Rearm();
 };
 
 class TimetrackerEvent {
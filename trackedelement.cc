@@ -20,6 +20,7 @@
 
 #include <vector>
 #include <stdexcept>
+#include <new>
 
 #include "util.h"
 
@@ -30,6 +31,9 @@
 TrackerElement::TrackerElement(TrackerType type) {
     this->type = TrackerUnassigned;
     reference_count = 0;
+    inline_storage = false;
+    slab_index = 0;
+    local_name = NULL;
 
     set_id(-1);
 
@@ -67,6 +71,9 @@ TrackerElement::TrackerElement(TrackerType type, int id) {
     set_id(id);
 
     reference_count = 0;
+    inline_storage = false;
+    slab_index = 0;
+    local_name = NULL;
 
     dataunion.string_value = NULL;
 
@@ -112,7 +119,7 @@ TrackerElement::~TrackerElement() {
 
         delete(dataunion.subvector_value);
     } else if (type == TrackerMap) {
-        map<int, TrackerElement *>::iterator i;
+        kis_flat_map<int, TrackerElement *>::iterator i;
 
         for (i = dataunion.submap_value->begin(); 
                 i != dataunion.submap_value->end(); ++i) {
@@ -121,7 +128,7 @@ TrackerElement::~TrackerElement() {
 
         delete(dataunion.submap_value);
     } else if (type == TrackerIntMap) {
-        map<int, TrackerElement *>::iterator i;
+        kis_flat_map<int, TrackerElement *>::iterator i;
 
         for (i = dataunion.subintmap_value->begin(); 
                 i != dataunion.subintmap_value->end(); ++i) {
@@ -130,7 +137,7 @@ TrackerElement::~TrackerElement() {
 
         delete(dataunion.subintmap_value);
     } else if (type == TrackerMacMap) {
-        map<mac_addr, TrackerElement *>::iterator i;
+        kis_flat_map<mac_addr, TrackerElement *>::iterator i;
 
         for (i = dataunion.submacmap_value->begin(); 
                 i != dataunion.submacmap_value->end(); ++i) {
@@ -159,6 +166,9 @@ TrackerElement::~TrackerElement() {
     } else if (type == TrackerUuid) {
         delete dataunion.uuid_value;
     }
+
+    if (local_name != NULL)
+        delete(local_name);
 }
 
 void TrackerElement::set_type(TrackerType in_type) {
@@ -174,7 +184,7 @@ void TrackerElement::set_type(TrackerType in_type) {
         delete(dataunion.subvector_value);
         dataunion.subvector_value = NULL;
     } else if (type == TrackerMap && dataunion.submap_value != NULL) {
-        map<int, TrackerElement *>::iterator i;
+        kis_flat_map<int, TrackerElement *>::iterator i;
 
         for (i = dataunion.submap_value->begin(); 
                 i != dataunion.submap_value->end(); ++i) {
@@ -184,7 +194,7 @@ void TrackerElement::set_type(TrackerType in_type) {
         delete(dataunion.submap_value);
         dataunion.submap_value = NULL;
     } else if (type == TrackerIntMap && dataunion.subintmap_value != NULL) {
-        map<int, TrackerElement *>::iterator i;
+        kis_flat_map<int, TrackerElement *>::iterator i;
 
         for (i = dataunion.subintmap_value->begin(); 
                 i != dataunion.subintmap_value->end(); ++i) {
@@ -194,7 +204,7 @@ void TrackerElement::set_type(TrackerType in_type) {
         delete(dataunion.subintmap_value);
         dataunion.subintmap_value = NULL;
     } else if (type == TrackerMacMap && dataunion.submacmap_value != NULL) {
-        map<mac_addr, TrackerElement *>::iterator i;
+        kis_flat_map<mac_addr, TrackerElement *>::iterator i;
 
         for (i = dataunion.submacmap_value->begin(); 
                 i != dataunion.submacmap_value->end(); ++i) {
@@ -236,15 +246,15 @@ void TrackerElement::set_type(TrackerType in_type) {
     if (type == TrackerVector) {
         dataunion.subvector_value = new vector<TrackerElement *>();
     } else if (type == TrackerMap) {
-        dataunion.submap_value = new map<int, TrackerElement *>();
+        dataunion.submap_value = new kis_flat_map<int, TrackerElement *>();
     } else if (type == TrackerIntMap) {
-        dataunion.subintmap_value = new map<int, TrackerElement *>();
+        dataunion.subintmap_value = new kis_flat_map<int, TrackerElement *>();
     } else if (type == TrackerMacMap) {
-        dataunion.submacmap_value = new map<mac_addr, TrackerElement *>();
+        dataunion.submacmap_value = new kis_flat_map<mac_addr, TrackerElement *>();
     } else if (type == TrackerStringMap) {
-        dataunion.substringmap_value = new map<string, TrackerElement *>();
+        dataunion.substringmap_value = new kis_flat_map<string, TrackerElement *>();
     } else if (type == TrackerDoubleMap) {
-        dataunion.subdoublemap_value = new map<double, TrackerElement *>();
+        dataunion.subdoublemap_value = new kis_flat_map<double, TrackerElement *>();
     } else if (type == TrackerMac) {
         dataunion.mac_value = new mac_addr(0);
     } else if (type == TrackerUuid) {
@@ -719,7 +729,7 @@ TrackerElement& TrackerElement::operator^=(uint64_t i) {
 
 TrackerElement *TrackerElement::operator[](int i) {
     string w;
-    map<int, TrackerElement *>::iterator itr;
+    kis_flat_map<int, TrackerElement *>::iterator itr;
 
     switch (type) {
         case TrackerVector:
@@ -795,7 +805,7 @@ TrackerElement::map_iterator TrackerElement::find(int k) {
 TrackerElement *TrackerElement::get_macmap_value(int idx) {
     except_type_mismatch(TrackerMacMap);
 
-    map<mac_addr, TrackerElement *>::iterator i = dataunion.submacmap_value->find(idx);
+    kis_flat_map<mac_addr, TrackerElement *>::iterator i = dataunion.submacmap_value->find(idx);
 
     if (i == dataunion.submacmap_value->end()) {
         return NULL;
@@ -858,8 +868,10 @@ void TrackerElement::del_macmap(mac_addr f) {
 
     mac_map_iterator mi = dataunion.submacmap_value->find(f);
     if (mi != dataunion.submacmap_value->end()) {
+        // Erasing invalidates the iterator, so hold onto the element
+        TrackerElement *e = mi->second;
         dataunion.submacmap_value->erase(mi);
-        mi->second->unlink();
+        e->unlink();
     }
 }
 
@@ -900,7 +912,7 @@ void TrackerElement::insert_macmap(mac_map_pair p) {
 TrackerElement *TrackerElement::get_stringmap_value(string idx) {
     except_type_mismatch(TrackerStringMap);
 
-    map<string, TrackerElement *>::iterator i = dataunion.substringmap_value->find(idx);
+    kis_flat_map<string, TrackerElement *>::iterator i = dataunion.substringmap_value->find(idx);
 
     if (i == dataunion.substringmap_value->end()) {
         return NULL;
@@ -951,8 +963,10 @@ void TrackerElement::del_stringmap(string f) {
 
     string_map_iterator mi = dataunion.substringmap_value->find(f);
     if (mi != dataunion.substringmap_value->end()) {
+        // Erasing invalidates the iterator, so hold onto the element
+        TrackerElement *e = mi->second;
         dataunion.substringmap_value->erase(mi);
-        mi->second->unlink();
+        e->unlink();
     }
 }
 
@@ -994,7 +1008,7 @@ void TrackerElement::insert_stringmap(string_map_pair p) {
 TrackerElement *TrackerElement::get_doublemap_value(double idx) {
     except_type_mismatch(TrackerDoubleMap);
 
-    map<double, TrackerElement *>::iterator i = dataunion.subdoublemap_value->find(idx);
+    kis_flat_map<double, TrackerElement *>::iterator i = dataunion.subdoublemap_value->find(idx);
 
     if (i == dataunion.subdoublemap_value->end()) {
         return NULL;
@@ -1045,8 +1059,10 @@ void TrackerElement::del_doublemap(double f) {
 
     double_map_iterator mi = dataunion.subdoublemap_value->find(f);
     if (mi != dataunion.subdoublemap_value->end()) {
+        // Erasing invalidates the iterator, so hold onto the element
+        TrackerElement *e = mi->second;
         dataunion.subdoublemap_value->erase(mi);
-        mi->second->unlink();
+        e->unlink();
     }
 }
 
@@ -1154,14 +1170,14 @@ void TrackerElement::add_map(TrackerElement *s) {
 
     TrackerElement *old = NULL;
 
-    map_iterator mi = dataunion.submap_value->find(s->get_id());
+    std::pair<map_iterator, bool> ret = 
+        dataunion.submap_value->insert(tracked_pair(s->get_id(), s));
 
-    if (mi != dataunion.submap_value->end()) {
-        old = mi->second;
+    if (!ret.second) {
+        old = ret.first->second;
+        ret.first->second = s;
     }
 
-    (*dataunion.submap_value)[s->get_id()] = s;
-
     s->link();
 
     if (old != NULL)
@@ -1171,10 +1187,12 @@ void TrackerElement::add_map(TrackerElement *s) {
 void TrackerElement::del_map(int f) {
     except_type_mismatch(TrackerMap);
 
-    map<int, TrackerElement *>::iterator i = dataunion.submap_value->find(f);
+    kis_flat_map<int, TrackerElement *>::iterator i = dataunion.submap_value->find(f);
     if (i != dataunion.submap_value->end()) {
+        // Erasing invalidates the iterator, so hold onto the element
+        TrackerElement *e = i->second;
         dataunion.submap_value->erase(i);
-        i->second->unlink();
+        e->unlink();
     }
 }
 
@@ -1218,7 +1236,7 @@ size_t TrackerElement::size_map() {
 TrackerElement *TrackerElement::get_intmap_value(int idx) {
     except_type_mismatch(TrackerIntMap);
 
-    map<int, TrackerElement *>::iterator i = dataunion.subintmap_value->find(idx);
+    kis_flat_map<int, TrackerElement *>::iterator i = dataunion.subintmap_value->find(idx);
 
     if (i == dataunion.submap_value->end()) {
         return NULL;
@@ -1294,10 +1312,12 @@ void TrackerElement::add_intmap(int i, TrackerElement *s) {
 void TrackerElement::del_intmap(int i) {
     except_type_mismatch(TrackerIntMap);
 
-    map<int, TrackerElement *>::iterator itr = dataunion.subintmap_value->find(i);
+    kis_flat_map<int, TrackerElement *>::iterator itr = dataunion.subintmap_value->find(i);
     if (itr != dataunion.subintmap_value->end()) {
-        dataunion.subintmap_value->erase(i);
-        itr->second->unlink();
+        // Erasing invalidates the iterator, so hold onto the element
+        TrackerElement *e = itr->second;
+        dataunion.subintmap_value->erase(itr);
+        e->unlink();
     }
 }
 
@@ -1422,7 +1442,7 @@ template<> mac_addr GetTrackerValue(TrackerElement *e) {
     return e->get_mac();
 }
 
-template<> map<int, TrackerElement *> *GetTrackerValue(TrackerElement *e) {
+template<> kis_flat_map<int, TrackerElement *> *GetTrackerValue(TrackerElement *e) {
     return e->get_map();
 }
 
@@ -1573,6 +1593,54 @@ bool operator>(TrackerElement &te1, double d) {
     return te1.get_double() > d;
 }
 
+// Header in front of a component's field slab.  The count is the component's
+// own hold plus every link to one of the fields, so a field still linked from
+// elsewhere keeps the slab alive after the component is gone.
+typedef struct {
+    int refcount;
+    unsigned int len;
+} tracker_field_slab;
+
+static inline tracker_field_slab *tracker_slab_header(TrackerElement *in_fields) {
+    return ((tracker_field_slab *) in_fields) - 1;
+}
+
+static TrackerElement *tracker_slab_alloc(unsigned int in_len) {
+    char *mem = 
+        new char[sizeof(tracker_field_slab) + (sizeof(TrackerElement) * in_len)];
+
+    tracker_field_slab *slab = (tracker_field_slab *) mem;
+    slab->refcount = 1;
+    slab->len = in_len;
+
+    TrackerElement *fields = (TrackerElement *) (mem + sizeof(tracker_field_slab));
+
+    for (unsigned int i = 0; i < in_len; i++)
+        new (&(fields[i])) TrackerElement();
+
+    return fields;
+}
+
+static void tracker_slab_release(TrackerElement *in_fields) {
+    tracker_field_slab *slab = tracker_slab_header(in_fields);
+
+    if (__sync_sub_and_fetch(&(slab->refcount), 1) != 0)
+        return;
+
+    for (unsigned int i = 0; i < slab->len; i++)
+        in_fields[i].~TrackerElement();
+
+    delete[] (char *) slab;
+}
+
+void TrackerElement::slab_link() {
+    __sync_add_and_fetch(&(tracker_slab_header(this - slab_index)->refcount), 1);
+}
+
+void TrackerElement::slab_unlink() {
+    tracker_slab_release(this - slab_index);
+}
+
 tracker_component::tracker_component(GlobalRegistry *in_globalreg, int in_id) {
     globalreg = in_globalreg;
     tracker = in_globalreg->entrytracker;
@@ -1580,6 +1648,11 @@ tracker_component::tracker_component(GlobalRegistry *in_globalreg, int in_id) {
     set_type(TrackerMap);
     set_id(in_id);
 
+#ifdef TE_COMPACT_FIELDS
+    field_slab = NULL;
+    field_slab_len = 0;
+#endif
+
     pthread_mutex_init(&pthread_lock, NULL);
 }
 
@@ -1592,13 +1665,25 @@ tracker_component::tracker_component(GlobalRegistry *in_globalreg, int in_id,
     set_type(TrackerMap);
     set_id(in_id);
 
+#ifdef TE_COMPACT_FIELDS
+    field_slab = NULL;
+    field_slab_len = 0;
+#endif
+
     pthread_mutex_init(&pthread_lock, NULL);
 }
 
 tracker_component::~tracker_component() { 
-    for (unsigned int i = 0; i < registered_fields.size(); i++) {
-        delete registered_fields[i];
+#ifdef TE_COMPACT_FIELDS
+    if (field_slab != NULL) {
+        // Let go of our children now instead of in the TrackerElement 
+        // destructor, then of our own hold on the slab; it's freed here
+        // unless something outside of us still links one of our fields
+        clear_map();
+
+        tracker_slab_release(field_slab);
     }
+#endif
 
     pthread_mutex_destroy(&pthread_lock);
 }
@@ -1619,9 +1704,16 @@ int tracker_component::RegisterField(string in_name, TrackerType in_type,
         string in_desc, void **in_dest) {
     int id = tracker->RegisterField(in_name, in_type, in_desc);
 
-    registered_field *rf = new registered_field(id, in_dest);
+    registered_fields.push_back(registered_field(id, in_type, in_dest));
+
+    return id;
+}
+
+int tracker_component::RegisterTypedField(string in_name, TrackerType in_type, 
+        string in_desc, void **in_dest) {
+    int id = tracker->RegisterField(in_name, in_type, in_desc);
 
-    registered_fields.push_back(rf);
+    registered_fields.push_back(registered_field(id, in_type, in_dest, true));
 
     return id;
 }
@@ -1637,9 +1729,7 @@ int tracker_component::RegisterField(string in_name, TrackerElement *in_builder,
         string in_desc, void **in_dest) {
     int id = tracker->RegisterField(in_name, in_builder, in_desc);
 
-    registered_field *rf = new registered_field(id, in_dest);
-
-    registered_fields.push_back(rf);
+    registered_fields.push_back(registered_field(id, TrackerUnassigned, in_dest));
 
     return id;
 } 
@@ -1651,13 +1741,62 @@ int tracker_component::RegisterComplexField(string in_name, TrackerElement *in_b
 }
 
 void tracker_component::reserve_fields(TrackerElement *e) {
+#ifdef TE_COMPACT_FIELDS
+    // Plain-typed fields we aren't importing from an existing element all
+    // go in one slab
+    unsigned int num_inline = 0;
+
+    for (unsigned int i = 0; i < registered_fields.size(); i++) {
+        registered_field *rf = &(registered_fields[i]);
+
+        if (rf->assign != NULL && rf->type != TrackerUnassigned &&
+                (e == NULL || e->get_map_value(rf->id) == NULL))
+            num_inline++;
+    }
+
+    unsigned int slab_pos = 0;
+
+    // Fields find their slab by index
+    if (num_inline > 0xFFFF)
+        num_inline = 0xFFFF;
+
+    if (num_inline > 0 && field_slab == NULL) {
+        field_slab = tracker_slab_alloc(num_inline);
+        field_slab_len = num_inline;
+    }
+#endif
+
     for (unsigned int i = 0; i < registered_fields.size(); i++) {
-        registered_field *rf = registered_fields[i];
+        registered_field *rf = &(registered_fields[i]);
 
-        if (rf->assign != NULL) {
-            *(rf->assign) = import_or_new(e, rf->id);
-        } else {
+        if (rf->assign == NULL)
+            continue;
+
+#ifdef TE_COMPACT_FIELDS
+        if (rf->type != TrackerUnassigned && slab_pos < field_slab_len &&
+                (e == NULL || e->get_map_value(rf->id) == NULL)) {
+            TrackerElement *r = &(field_slab[slab_pos]);
+
+            r->inline_storage = true;
+            r->slab_index = (uint16_t) slab_pos++;
+            r->set_id(rf->id);
+            r->set_type(rf->type);
+
+            add_map(r);
+            *(rf->assign) = r;
+
+            continue;
         }
+#endif
+
+        *(rf->assign) = import_or_new(e, rf->id);
+
+        // Typed handles don't check again, so an imported field has to be
+        // what they expect
+        if (rf->typed && (*(rf->assign))->get_type() != rf->type) 
+            throw std::runtime_error("imported field " + get_name(rf->id) + 
+                    " is " + type_to_string((*(rf->assign))->get_type()) + 
+                    ", expected " + type_to_string(rf->type));
     }
 }
 
@@ -1719,4 +1858,24 @@ TrackerElement *tracker_component::get_child_path(std::vector<string> in_path) {
     return cur_elem;
 }
 
+TrackerElement *tracker_component::get_child_path(const std::vector<int> &in_path) {
+    if (in_path.size() < 1)
+        return NULL;
+
+    TrackerElement *cur_elem = (TrackerElement *) this;
+
+    for (unsigned int x = 0; x < in_path.size(); x++) {
+        // Only maps have children we can path into
+        if (cur_elem->get_type() != TrackerMap)
+            return NULL;
+
+        cur_elem = cur_elem->get_map_value(in_path[x]);
+
+        if (cur_elem == NULL)
+            return NULL;
+    }
+
+    return cur_elem;
+}
+
 
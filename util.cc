@@ -716,6 +716,143 @@ uint32_t Adler32Checksum(const char *buf1, int len) {
 	return (s1 & 0xffff) + (s2 << 16);
 }
 
+// Reflected CRC32C polynomial
+#define CRC32C_POLY     0x82F63B78
+
+// Slicing-by-8 tables for CPUs without a crc32 instruction
+class Crc32cTable {
+public:
+    Crc32cTable() {
+        for (unsigned int i = 0; i < 256; i++) {
+            uint32_t crc = i;
+
+            for (unsigned int j = 0; j < 8; j++)
+                crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : (crc >> 1);
+
+            table[0][i] = crc;
+        }
+
+        for (unsigned int i = 0; i < 256; i++) {
+            for (unsigned int s = 1; s < 8; s++) 
+                table[s][i] = (table[s - 1][i] >> 8) ^ table[0][table[s - 1][i] & 0xFF];
+        }
+    }
+
+    uint32_t table[8][256];
+};
+
+static Crc32cTable crc32c_table;
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *buf, size_t len) {
+    const uint32_t (*t)[256] = crc32c_table.table;
+
+    while (len >= 8) {
+        uint32_t lo, hi;
+
+        memcpy(&lo, buf, 4);
+        memcpy(&hi, buf + 4, 4);
+
+#ifdef WORDS_BIGENDIAN
+        lo = __builtin_bswap32(lo);
+        hi = __builtin_bswap32(hi);
+#endif
+
+        lo ^= crc;
+
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^
+            t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+            t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^
+            t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+
+        buf += 8;
+        len -= 8;
+    }
+
+    while (len--)
+        crc = (crc >> 8) ^ t[0][(crc ^ *buf++) & 0xFF];
+
+    return crc;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+// Built for SSE4.2 regardless of the compiler flags, and only called when
+// the CPU supports it
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *buf, size_t len) {
+    uint64_t crc64 = crc;
+
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, buf, 8);
+
+        crc64 = __builtin_ia32_crc32di(crc64, v);
+
+        buf += 8;
+        len -= 8;
+    }
+
+    crc = (uint32_t) crc64;
+
+    while (len--)
+        crc = __builtin_ia32_crc32qi(crc, *buf++);
+
+    return crc;
+}
+
+static bool crc32c_have_hw() {
+    static int have_hw = -1;
+
+    if (have_hw < 0)
+        have_hw = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+
+    return have_hw == 1;
+}
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *buf, size_t len) {
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, buf, 8);
+
+        crc = __builtin_aarch64_crc32cx(crc, v);
+
+        buf += 8;
+        len -= 8;
+    }
+
+    while (len--)
+        crc = __builtin_aarch64_crc32cb(crc, *buf++);
+
+    return crc;
+}
+
+static bool crc32c_have_hw() {
+    return true;
+}
+#else
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *buf, size_t len) {
+    return crc32c_sw(crc, buf, len);
+}
+
+static bool crc32c_have_hw() {
+    return false;
+}
+#endif
+
+bool Crc32cHardware() {
+    return crc32c_have_hw();
+}
+
+uint32_t Crc32cChecksum(const char *buf, size_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+
+    if (crc32c_have_hw())
+        crc = crc32c_hw(crc, (const uint8_t *) buf, len);
+    else
+        crc = crc32c_sw(crc, (const uint8_t *) buf, len);
+
+    return crc ^ 0xFFFFFFFF;
+}
+
 int ChanToFreq(int in_chan) {
 	// 80211 frequencies to channels
 	// Stolen from Linux net/wireless/util.c
@@ -209,6 +209,13 @@ int FetchSysLoadAvg(uint8_t *in_avgmaj, uint8_t *in_avgmin);
 // Adler-32 checksum, derived from rsync, adler-32
 uint32_t Adler32Checksum(const char *buf1, int len);
 
+// CRC32C (Castagnoli) checksum, using the CPU crc32 instructions when
+// available
+uint32_t Crc32cChecksum(const char *buf, size_t len);
+// Is CRC32C computed in hardware on this CPU?  Without it, CRC32C is no
+// faster than Adler32Checksum
+bool Crc32cHardware();
+
 // 802.11 checksum functions, derived from the BBN USRP 802.11 code
 #define IEEE_802_3_CRC32_POLY	0xEDB88320
 unsigned int update_crc32_80211(unsigned int crc, const unsigned char *data,
@@ -38,6 +38,23 @@ XmlserializeAdapter::~XmlserializeAdapter() {
 }
 
 void XmlserializeAdapter::XmlSerialize(TrackerElement *v, std::stringstream &stream) {
+    if (lock_tags != NULL) {
+        const SerializeCacheTags::cache_tag *tag = lock_tags->Match(v);
+
+        if (tag != NULL && tag->lock != NULL) {
+            // Records don't nest, so nothing under this one is matched
+            SerializeCacheTags *saved_tags = lock_tags;
+            lock_tags = NULL;
+
+            tag->lock->mutex_lock();
+            XmlSerialize(v, stream);
+            tag->lock->mutex_unlock();
+
+            lock_tags = saved_tags;
+            return;
+        }
+    }
+
     v->pre_serialize();
 
     TrackerElement::tracked_map *tmap;
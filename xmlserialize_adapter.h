@@ -34,6 +34,7 @@
 #include "trackedelement.h"
 #include "entrytracker.h"
 #include "devicetracker_component.h"
+#include "serialize_cache.h"
 
 /* XML serialization
  *
@@ -60,12 +61,19 @@ class XmlserializeAdapter {
 public:
     XmlserializeAdapter(GlobalRegistry *in_globalreg) {
         globalreg = in_globalreg;
+        lock_tags = NULL;
     }
 
     ~XmlserializeAdapter();
 
     void XmlSerialize(TrackerElement *v, std::stringstream &steam);
 
+    // Components to hold locked while the records tagged with them are
+    // serialized; XML output is never cached.  See serialize_cache.h
+    void SetLockTags(SerializeCacheTags *in_tags) {
+        lock_tags = in_tags;
+    }
+
     void RegisterField(string in_field, string in_entity);
     void RegisterFieldAttr(string in_field, string in_path, string in_attr);
     void RegisterFieldXsitype(string in_field, string in_xsi);
@@ -130,6 +138,8 @@ protected:
     bool StreamSimpleValue(TrackerElement *v, std::stringstream &stream);
 
     map<string, Xmladapter *> field_adapter_map;
+
+    SerializeCacheTags *lock_tags;
 };
 
 #endif